@@ -0,0 +1,147 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+
+// SWAR accumulation kernels (shell/decimator.hpp) against the scalar reference
+//
+//   make && ./accumulate [-v]
+//
+// Exactness: accumulate_packed< Channels, Unroll > must leave acc[] exactly as accumulate_scalar
+// does, for 1 to 8 channels and every unroll factor, on aligned and unaligned data, and for
+// scan counts around the 16 block spill interval and its tails.  Data sets include all 0xfff,
+// where 16 packed adds just fit in a lane and a 17th would carry into the next, and random data
+// with many full scale samples; acc[] starts from random values, as a running sum does.  The
+// run time dispatch (accumulate<>) must pick the same kernel or refuse the channel count.
+//
+// Benchmark: ns per sample of each kernel on this host, for the record; the host compiler
+// vectorizes the scalar loop, so the ratio says nothing about the Cortex-M3, where the shell's
+// "bench accumulate" measures cycles.
+
+#include "decimator.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+using namespace stm32f103;
+
+namespace {
+
+    int failures = 0;
+    long checks = 0;
+
+    template< size_t Channels, size_t Unroll >
+    void
+    check( const uint16_t * data, size_t scans, const uint32_t * seed )
+    {
+        uint32_t ref[ Channels ], acc[ Channels ];
+        std::memcpy( ref, seed, sizeof ref );
+        std::memcpy( acc, seed, sizeof acc );
+        accumulate_scalar< Channels >( data, scans, ref );
+        accumulate_packed< Channels, Unroll >( data, scans, acc );
+        ++checks;
+        if ( std::memcmp( ref, acc, sizeof ref ) && failures++ < 20 )
+            std::printf( "FAIL accumulate_packed< %zu, %zu >: %zu scans, data %% 4 = %zu\n"
+                         , Channels, Unroll, scans, size_t( reinterpret_cast< uintptr_t >( data ) & 3 ) );
+    }
+
+    template< size_t Channels >
+    void
+    check_all( const uint16_t * data, size_t scans, const uint32_t * seed )
+    {
+        check< Channels, 1 >( data, scans, seed );
+        check< Channels, 2 >( data, scans, seed );
+        check< Channels, 4 >( data, scans, seed );
+        check< Channels, 8 >( data, scans, seed );
+        check< Channels, 16 >( data, scans, seed );
+    }
+
+    void
+    check_dispatch( const uint16_t * data, size_t scans, size_t channels, const uint32_t * seed )
+    {
+        uint32_t ref[ 8 ], acc[ 8 ];
+        std::memcpy( ref, seed, sizeof ref );
+        std::memcpy( acc, seed, sizeof acc );
+        const bool supported = channels != 5 && channels != 7;
+        bool ok = accumulate< 4 >( data, scans, channels, acc ) == supported;
+        if ( supported ) {
+            for ( size_t i = 0; i < scans; ++i )
+                for ( size_t ch = 0; ch < channels; ++ch )
+                    ref[ ch ] += data[ i * channels + ch ];
+        }
+        ok = ok && std::memcmp( ref, acc, sizeof ref ) == 0;
+        ++checks;
+        if ( !ok && failures++ < 20 )
+            std::printf( "FAIL accumulate< 4 >: %zu channels, %zu scans\n", channels, scans );
+    }
+
+    template< size_t Channels, typename Kernel >
+    double
+    ns_per_sample( Kernel kernel, const uint16_t * data, size_t scans )
+    {
+        uint32_t acc[ Channels ] = { 0 };
+        const int repeat = 20000;
+        const auto start = std::chrono::steady_clock::now();
+        for ( int i = 0; i < repeat; ++i ) {
+            kernel( data, scans, acc );
+            asm volatile( "" :: "r"( acc ) : "memory" );
+        }
+        const std::chrono::duration< double, std::nano > elapsed = std::chrono::steady_clock::now() - start;
+        return elapsed.count() / repeat / double( scans * Channels );
+    }
+
+    template< size_t Channels >
+    void
+    bench( const uint16_t * data, size_t samples )
+    {
+        const size_t scans = samples / Channels;
+        std::printf( "  %zu ch: scalar %.3f, packed x1 %.3f, x4 %.3f, x8 %.3f ns/sample\n", Channels
+                     , ns_per_sample< Channels >( accumulate_scalar< Channels >, data, scans )
+                     , ns_per_sample< Channels >( accumulate_packed< Channels, 1 >, data, scans )
+                     , ns_per_sample< Channels >( accumulate_packed< Channels, 4 >, data, scans )
+                     , ns_per_sample< Channels >( accumulate_packed< Channels, 8 >, data, scans ) );
+    }
+}
+
+int
+main( int argc, char ** argv )
+{
+    const bool verbose = argc > 1 && std::strcmp( argv[ 1 ], "-v" ) == 0;
+    std::mt19937 rng( 19 );
+    alignas( 4 ) static uint16_t buffer[ 8 * 600 + 2 ];
+    uint32_t seed[ 8 ];
+
+    for ( int trial = 0; trial < 3000; ++trial ) {
+        const int kind = trial % 3;
+        for ( auto& x: buffer )
+            x = kind == 0 ? 0xfff : ( kind == 1 && rng() % 4 ) ? 0xfff - rng() % 4 : rng() & 0xfff;
+        for ( auto& s: seed )
+            s = rng();
+        const size_t scans = trial < 600 ? trial / 2 % 300 : rng() % 600;   // every count to 300, then random
+        const uint16_t * data = buffer + ( trial & 1 );
+        check_all< 1 >( data, scans, seed );
+        check_all< 2 >( data, scans, seed );
+        check_all< 3 >( data, scans, seed );
+        check_all< 4 >( data, scans, seed );
+        check_all< 5 >( data, scans, seed );
+        check_all< 6 >( data, scans, seed );
+        check_all< 7 >( data, scans, seed );
+        check_all< 8 >( data, scans, seed );
+        check_dispatch( data, scans, 1 + trial % 8, seed );
+    }
+    std::printf( "accumulate: %ld comparisons with the scalar reference, %d failed\n", checks, failures );
+
+    if ( verbose || failures == 0 ) {
+        for ( auto& x: buffer )
+            x = rng() & 0xfff;
+        const size_t samples = 960;     // 2 * 16 scans of 30 channels, a typical DMA half
+        std::printf( "host timing, %zu samples a call:\n", samples );
+        bench< 1 >( buffer, samples );
+        bench< 2 >( buffer, samples );
+        bench< 3 >( buffer, samples );
+        bench< 4 >( buffer, samples );
+        bench< 8 >( buffer, samples );
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,112 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+
+// Unpack kernels of the dual ADC modes (shell/adc_pair.hpp) on synthetic DMA buffers
+//
+//   make && ./unpack [-v]
+//
+// A buffer of packed words is made the way ADC1 DR is read in dual mode: ADC2 data in [31:16],
+// ADC1 data in [15:0].  Right aligned 12bit samples, left aligned ones and arbitrary 16bit
+// patterns are all used, so that a lane mixed with its neighbour shows.  Every word count from
+// 0 to 67 and random longer ones are unpacked into outputs at both 2-byte alignments (each
+// output of unpack_simultaneous on its own), which takes the word-at-a-time paths as well as
+// the scalar ones.  The outputs must match a per-sample reference, and the sentinels around
+// them must be untouched.
+
+#include "adc_pair.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+using namespace stm32f103;
+
+namespace {
+
+    constexpr uint16_t sentinel = 0xdead;
+
+    int failures = 0;
+
+    void check( bool ok, const char * what, size_t count, int offset ) {
+        if ( !ok && failures++ < 20 )
+            std::printf( "FAIL %s: %zu words, offset %d\n", what, count, offset );
+    }
+
+    // output with a sentinel before and after; data() is 4-byte aligned plus 'offset' samples
+    struct output {
+        std::vector< uint32_t > storage;
+        uint16_t * begin;
+        size_t size;
+        output( size_t n, int offset ) : storage( n / 2 + 4 ), size( n ) {
+            auto base = reinterpret_cast< uint16_t * >( storage.data() );
+            std::fill( base, base + 2 * storage.size(), sentinel );
+            begin = base + 2 + offset;
+        }
+        uint16_t * data() { return begin; }
+        bool guarded() const { return begin[ -1 ] == sentinel && begin[ size ] == sentinel; }
+    };
+
+    uint16_t
+    sample( std::mt19937& rng, int kind )
+    {
+        switch ( kind ) {
+        case 0: return uint16_t( rng() & 0x0fff );              // ALIGN = 0
+        case 1: return uint16_t( ( rng() & 0x0fff ) << 4 );     // ALIGN = 1
+        default: return uint16_t( rng() );
+        }
+    }
+
+    void
+    run( std::mt19937& rng, size_t count, long& words )
+    {
+        const int kind = rng() % 3;
+        std::vector< uint32_t > packed( count );
+        std::vector< uint16_t > adc1( count ), adc2( count ), series( 2 * count );
+        for ( size_t i = 0; i < count; ++i ) {
+            adc1[ i ] = sample( rng, kind );
+            adc2[ i ] = sample( rng, kind );
+            packed[ i ] = uint32_t( adc2[ i ] ) << 16 | adc1[ i ];
+            series[ 2 * i ] = adc2[ i ];                        // ADC2 converts first
+            series[ 2 * i + 1 ] = adc1[ i ];
+        }
+
+        for ( int offset = 0; offset < 4; ++offset ) {
+            output a( count, offset & 1 ), b( count, offset >> 1 ), s( 2 * count, offset & 1 );
+            unpack_simultaneous( packed.data(), count, a.data(), b.data() );
+            unpack_interleaved( packed.data(), count, s.data() );
+            check( std::equal( adc1.begin(), adc1.end(), a.data() ), "simultaneous ADC1", count, offset );
+            check( std::equal( adc2.begin(), adc2.end(), b.data() ), "simultaneous ADC2", count, offset );
+            check( std::equal( series.begin(), series.end(), s.data() ), "interleaved", count, offset );
+            check( a.guarded() && b.guarded() && s.guarded(), "written outside the output", count, offset );
+            words += long( count );
+        }
+    }
+}
+
+int
+main( int argc, char ** argv )
+{
+    const bool verbose = argc > 1 && std::strcmp( argv[ 1 ], "-v" ) == 0;
+    std::mt19937 rng( 18 );
+    long words = 0;
+    int runs = 0;
+
+    for ( size_t count = 0; count < 68; ++count, ++runs )
+        run( rng, count, words );
+    for ( int i = 0; i < 2000; ++i, ++runs )
+        run( rng, 68 + rng() % 1024, words );
+
+    if ( verbose ) {
+        const uint32_t w[] = { 0x0abc0123, 0x0fff0000 };
+        uint16_t a[ 2 ], b[ 2 ], s[ 4 ];
+        unpack_simultaneous( w, 2, a, b );
+        unpack_interleaved( w, 2, s );
+        std::printf( "  %08x %08x: ADC1 %03x %03x, ADC2 %03x %03x, interleaved %03x %03x %03x %03x\n"
+                     , w[ 0 ], w[ 1 ], a[ 0 ], a[ 1 ], b[ 0 ], b[ 1 ], s[ 0 ], s[ 1 ], s[ 2 ], s[ 3 ] );
+    }
+    std::printf( "adc_pair unpack: %d buffers, %ld words at 4 alignments, %d failed\n", runs, words / 4, failures );
+    return failures ? 1 : 0;
+}
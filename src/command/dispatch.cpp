@@ -0,0 +1,146 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+
+// Host test of the shell command dispatch against the full command table
+//
+//   make && ./dispatch [-v]
+//
+// shell/command_table.hpp is built here against stub commands that record their argv[0].  Every
+// name in the table must resolve to its own entry and reach its command; names next to them
+// (prefixes, extensions, other case, characters sorting before and after the table) must not
+// resolve.  The lookup cost is reported for the binary search and for the linear scan it
+// replaced, over hits and misses.
+
+#include "command_table.hpp"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+    const char * called;
+}
+
+#define STUB( name ) void name( size_t, const char ** argv ) { called = argv[ 0 ]; }
+STUB( can_command ) STUB( i2c_command ) STUB( i2cdetect ) STUB( bmp280_command ) STUB( ad5593_command )
+STUB( rcc_status ) STUB( rcc_enable ) STUB( timer_command ) STUB( gpio_command ) STUB( date_command )
+STUB( hwclock_command ) STUB( uart_command ) STUB( bench_command ) STUB( dlog_command ) STUB( telemetry_command )
+STUB( help ) STUB( rtc_status ) STUB( system_reset ) STUB( bkp_command ) STUB( spi_command ) STUB( alt_test )
+STUB( adc_command ) STUB( dma_command ) STUB( afio_test )
+
+namespace {
+
+    int failures = 0;
+
+    void
+    fail( const std::string& name, const char * what )
+    {
+        ++failures;
+        std::printf( "FAIL '%s': %s\n", name.c_str(), what );
+    }
+
+    // the dispatch before the table was sorted
+    const primitive *
+    linear_find( const char * arg0 )
+    {
+        auto it = std::find_if( command_table, command_table + command_table_size
+                                , [&]( const primitive& cmd ){ return command_detail::compare( cmd.arg0_, arg0 ) == 0; } );
+        return it != command_table + command_table_size ? it : nullptr;
+    }
+
+    // probes of the binary search, as command_detail::find makes them
+    size_t
+    probes( const char * arg0 )
+    {
+        size_t first = 0, last = command_table_size, count = 0;
+        while ( first < last ) {
+            const size_t mid = ( first + last ) / 2;
+            const int r = command_detail::compare( command_table[ mid ].arg0_, arg0 );
+            ++count;
+            if ( r == 0 )
+                break;
+            if ( r < 0 )
+                first = mid + 1;
+            else
+                last = mid;
+        }
+        return count;
+    }
+
+    template< typename F >
+    double
+    ns_per_lookup( F find, const std::vector< std::string >& names, size_t& found )
+    {
+        constexpr size_t rounds = 20000;
+        found = 0;
+        auto t0 = std::chrono::steady_clock::now();
+        for ( size_t i = 0; i < rounds; ++i )
+            for ( const auto& name: names )
+                found += find( name.c_str() ) != nullptr;
+        auto t1 = std::chrono::steady_clock::now();
+        return std::chrono::duration< double, std::nano >( t1 - t0 ).count() / ( rounds * names.size() );
+    }
+}
+
+int
+main( int argc, char ** argv )
+{
+    const bool verbose = argc > 1 && std::strcmp( argv[ 1 ], "-v" ) == 0;
+
+    std::vector< std::string > hits, misses = { "", " ", "!", "zzz", "\x7f", "i2c3", "ad", "uarts", "HELP", "d" };
+    size_t worst = 0;
+    for ( const auto& cmd: command_table ) {
+        const std::string name = cmd.arg0_;
+        hits.push_back( name );
+
+        auto found = command_detail::find( name.c_str() );
+        if ( found != &cmd ) {
+            fail( name, "does not resolve to its entry" );
+            continue;
+        }
+        const char * args[] = { name.c_str(), nullptr };
+        called = nullptr;
+        found->f_( 1, args );
+        if ( called == nullptr || name != called )
+            fail( name, "did not reach its command" );
+        worst = std::max( worst, probes( name.c_str() ) );
+
+        misses.push_back( name + "x" );
+        misses.push_back( name.substr( 0, name.size() - 1 ) );
+        misses.push_back( std::string( 1, char( std::toupper( name[ 0 ] ) ) ) + name.substr( 1 ) );
+    }
+    misses.erase( std::remove_if( misses.begin(), misses.end(), [&]( const std::string& s ){
+                return std::find( hits.begin(), hits.end(), s ) != hits.end(); } ), misses.end() );
+    for ( const auto& name: misses ) {
+        if ( command_detail::find( name.c_str() ) )
+            fail( name, "resolves but is not a command" );
+        if ( linear_find( name.c_str() ) )
+            fail( name, "linear scan resolves it" );
+        worst = std::max( worst, probes( name.c_str() ) );
+    }
+
+    size_t bound = 0;
+    while ( ( size_t( 1 ) << bound ) <= command_table_size )
+        ++bound;
+    if ( worst > bound )
+        fail( "", "binary search takes more probes than log2(n+1)" );
+
+    size_t found;
+    const double binary_hit = ns_per_lookup( command_detail::find, hits, found );
+    const double linear_hit = ns_per_lookup( linear_find, hits, found );
+    const double binary_miss = ns_per_lookup( command_detail::find, misses, found );
+    const double linear_miss = ns_per_lookup( linear_find, misses, found );
+
+    if ( verbose )
+        for ( const auto& name: hits )
+            std::printf( "  %-10s %zu probes\n", name.c_str(), probes( name.c_str() ) );
+
+    std::printf( "dispatch: %zu commands, %zu misses, worst %zu probes; ns/lookup hit %.1f (linear %.1f), miss %.1f (linear %.1f); %d failed\n"
+                 , hits.size(), misses.size(), worst, binary_hit, linear_hit, binary_miss, linear_miss, failures );
+    return failures ? 1 : 0;
+}
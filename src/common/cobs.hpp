@@ -0,0 +1,72 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Consistent Overhead Byte Stuffing and CRC-16/CCITT-FALSE, shared between the device
+// (shell/telemetry.cpp) and the host receiver (telemetry/).
+// The encoded data contains no 0x00, so a zero byte delimits a frame.
+
+namespace cobs {
+
+    // worst case encoded size for n bytes of input
+    constexpr size_t max_encoded_size( size_t n ) { return n + n / 254 + 1; }
+
+    // dst must hold max_encoded_size( n ); returns the encoded size
+    inline size_t encode( const uint8_t * src, size_t n, uint8_t * dst ) {
+        size_t code_pos = 0, out = 1;
+        uint8_t code = 1;
+        for ( size_t i = 0; i < n; ++i ) {
+            if ( src[ i ] ) {
+                dst[ out++ ] = src[ i ];
+                ++code;
+            }
+            if ( src[ i ] == 0 || code == 0xff ) {
+                dst[ code_pos ] = code;
+                code = 1;
+                code_pos = out++;
+                if ( src[ i ] != 0 && i + 1 == n ) // a full block at the end needs no trailing code
+                    return out - 1;
+            }
+        }
+        dst[ code_pos ] = code;
+        return out;
+    }
+
+    // dst must hold n bytes; returns the decoded size, or 0 for malformed input
+    inline size_t decode( const uint8_t * src, size_t n, uint8_t * dst ) {
+        size_t out = 0;
+        for ( size_t i = 0; i < n; ) {
+            uint8_t code = src[ i++ ];
+            if ( code == 0 || i + code - 1 > n )
+                return 0;
+            for ( uint8_t k = 1; k < code; ++k ) {
+                if ( src[ i ] == 0 )
+                    return 0;
+                dst[ out++ ] = src[ i++ ];
+            }
+            if ( code != 0xff && i < n )
+                dst[ out++ ] = 0;
+        }
+        return out;
+    }
+
+    // CRC-16/CCITT-FALSE (poly 0x1021, init 0xffff), nibble table
+    inline uint16_t crc16( const uint8_t * p, size_t n, uint16_t crc = 0xffff ) {
+        static const uint16_t table[ 16 ] = {
+            0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7
+            , 0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef
+        };
+        while ( n-- ) {
+            crc = uint16_t( crc << 4 ) ^ table[ ( crc >> 12 ) ^ ( *p >> 4 ) ];
+            crc = uint16_t( crc << 4 ) ^ table[ ( crc >> 12 ) ^ ( *p++ & 0x0f ) ];
+        }
+        return crc;
+    }
+}
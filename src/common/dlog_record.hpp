@@ -0,0 +1,35 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include <cstdint>
+
+// Deferred log record, shared between the device (shell/dlog.hpp) and the host decoder (dlog/)
+//
+//   byte     sync (0xa5; console text is 7-bit ASCII, so it never appears in text)
+//   uint32   header := words [31:24] | format id [23:0]
+//   uint32   timestamp, DWT cycle counter
+//   uint32   arguments [ words ]
+//
+// All words are little endian.  The format id is the offset of the format string within the
+// '.logfmt' section of the ELF file; that section is not loaded to the device.
+// Argument words: %f takes two words (double), integer conversions with 'll' or 'j' take two
+// words (low word first), anything else takes one; %s is the address of a string in flash.
+
+namespace dlog_record {
+
+    constexpr uint8_t sync = 0xa5;
+    constexpr uint32_t id_mask = 0x00ffffff;
+    constexpr uint32_t words_shift = 24;
+    constexpr uint32_t max_words = 16;
+
+    constexpr uint32_t header( uint32_t id, uint32_t words ) {
+        return ( words << words_shift ) | ( id & id_mask );
+    }
+    constexpr uint32_t id( uint32_t header ) { return header & id_mask; }
+    constexpr uint32_t words( uint32_t header ) { return header >> words_shift; }
+}
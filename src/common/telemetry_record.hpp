@@ -0,0 +1,87 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include "cobs.hpp"
+#include <cstdint>
+
+// Binary telemetry on the console, shared between the device (shell/telemetry.hpp) and the
+// host receiver (telemetry/)
+//
+//   0x00  COBS( type, sequence, record..., crc16 )  0x00
+//
+// A frame is opened and closed by a zero byte, so it can be told apart from console text and
+// from dlog records (dlog_record.hpp).  crc16 (CRC-16/CCITT-FALSE, little endian) covers type,
+// sequence and the record.  The sequence is a uint8_t counter per frame, so the host can count
+// lost frames.  Records are little endian, packed, and start with the DWT cycle counter.
+
+namespace telemetry_record {
+
+    enum type : uint8_t {
+        time = 1        // cycles vs wall clock; sent when streaming starts
+        , adc_block     // averaged ADC1 scan
+        , can_frame     // received CAN message
+        , sensor        // BMP280 sample
+    };
+
+    constexpr uint32_t max_record_size = 64;
+
+#pragma pack( push, 1 )
+    struct time_record {
+        uint32_t cycles;
+        uint32_t clock;         // DWT cycles per second
+        uint32_t seconds;       // system_clock, seconds since 1970-01-01
+    };
+
+    struct adc_record {
+        uint32_t cycles;
+        uint16_t accumulation;  // number of scans averaged
+        uint16_t count;         // valid entries in data
+        uint16_t data[ 8 ];
+    };
+
+    struct can_record {
+        uint32_t cycles;
+        uint32_t id;
+        uint8_t ide;
+        uint8_t rtr;
+        uint8_t dlc;
+        uint8_t fmi;
+        uint8_t data[ 8 ];
+    };
+
+    struct sensor_record {
+        uint32_t cycles;
+        uint32_t pressure;      // Pa
+        int32_t temperature;    // 0.01 degC
+    };
+#pragma pack( pop )
+
+    static_assert( sizeof( time_record ) == 12, "time_record" );
+    static_assert( sizeof( adc_record ) == 24, "adc_record" );
+    static_assert( sizeof( can_record ) == 20, "can_record" );
+    static_assert( sizeof( sensor_record ) == 12, "sensor_record" );
+
+    constexpr size_t max_frame_size = cobs::max_encoded_size( 2 + max_record_size + 2 ) + 2;
+
+    // The frame of a record ( size <= max_record_size ), delimiters included, into 'out', which
+    // must hold max_frame_size bytes; returns the frame size
+    inline size_t frame( uint8_t type, uint8_t sequence, const uint8_t * record, size_t size, uint8_t * out ) {
+        uint8_t payload[ 2 + max_record_size + 2 ];
+        payload[ 0 ] = type;
+        payload[ 1 ] = sequence;
+        for ( size_t i = 0; i < size; ++i )
+            payload[ 2 + i ] = record[ i ];
+        const uint16_t crc = cobs::crc16( payload, 2 + size );
+        payload[ 2 + size ] = crc & 0xff;
+        payload[ 3 + size ] = crc >> 8;
+        const size_t length = cobs::encode( payload, 4 + size, out + 1 );
+        out[ 0 ] = 0;
+        out[ length + 1 ] = 0;
+        return length + 2;
+    }
+}
@@ -0,0 +1,259 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+
+// Host side decoder for the shell's deferred log (shell/dlog.hpp)
+//
+//   stty -F /dev/ttyUSB0 115200 raw; ./dlog ../shell/shell.elf < /dev/ttyUSB0
+//
+// Console text is passed through and telemetry frames are skipped; log records are rendered with the format strings taken
+// from the '.logfmt' section of the ELF file, prefixed by the time in seconds since the first
+// record (DWT cycles / --clock).
+
+#include "dlog_record.hpp"
+#include <elf.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace {
+
+    struct section {
+        uint32_t addr;
+        uint32_t size;
+        const char * data;
+    };
+
+    class image {
+        std::vector< char > file_;
+        section logfmt_;
+        std::vector< section > alloc_;
+    public:
+        image() : logfmt_{ 0, 0, nullptr } {}
+
+        bool load( const char * path ) {
+            std::ifstream in( path, std::ios::binary );
+            if ( ! in )
+                return false;
+            file_.assign( std::istreambuf_iterator< char >( in ), std::istreambuf_iterator< char >() );
+            if ( file_.size() < sizeof( Elf32_Ehdr ) || std::memcmp( file_.data(), ELFMAG, SELFMAG ) != 0 )
+                return false;
+
+            Elf32_Ehdr eh;
+            std::memcpy( &eh, file_.data(), sizeof( eh ) );
+            if ( eh.e_ident[ EI_CLASS ] != ELFCLASS32
+                 || eh.e_shoff + size_t( eh.e_shnum ) * sizeof( Elf32_Shdr ) > file_.size() || eh.e_shstrndx >= eh.e_shnum )
+                return false;
+
+            std::vector< Elf32_Shdr > sh( eh.e_shnum );
+            std::memcpy( sh.data(), file_.data() + eh.e_shoff, sh.size() * sizeof( Elf32_Shdr ) );
+            const char * names = file_.data() + sh[ eh.e_shstrndx ].sh_offset;
+
+            for ( const auto& s: sh ) {
+                if ( s.sh_type != SHT_PROGBITS || s.sh_offset + s.sh_size > file_.size() )
+                    continue;
+                section sec{ s.sh_addr, s.sh_size, file_.data() + s.sh_offset };
+                if ( std::strcmp( names + s.sh_name, ".logfmt" ) == 0 )
+                    logfmt_ = sec;
+                else if ( s.sh_flags & SHF_ALLOC )
+                    alloc_.push_back( sec );
+            }
+            return logfmt_.data != nullptr;
+        }
+
+        // format string by its id (offset in .logfmt)
+        const char * format( uint32_t id ) const {
+            if ( id >= logfmt_.size )
+                return nullptr;
+            return logfmt_.data + id;
+        }
+
+        // string at a device address, for %s
+        std::string string( uint32_t addr ) const {
+            for ( const auto& s: alloc_ ) {
+                if ( s.addr <= addr && addr < s.addr + s.size ) {
+                    const char * p = s.data + ( addr - s.addr );
+                    return std::string( p, strnlen( p, s.addr + s.size - addr ) );
+                }
+            }
+            char buf[ 32 ];
+            snprintf( buf, sizeof( buf ), "(%08x)", addr );
+            return buf;
+        }
+    };
+
+    std::string
+    render( const image& elf, const char * fmt, const uint32_t * args, uint32_t words )
+    {
+        std::string result;
+        uint32_t used = 0;
+        auto take = [&]() -> uint32_t { return used < words ? args[ used++ ] : 0; };
+
+        for ( const char * p = fmt; *p; ++p ) {
+            if ( *p != '%' ) {
+                result += *p;
+                continue;
+            }
+            const char * start = p++;
+            if ( *p == '%' ) {
+                result += '%';
+                continue;
+            }
+            while ( *p && std::strchr( "-+ #0", *p ) )
+                ++p;
+            while ( *p && ( ( '0' <= *p && *p <= '9' ) || *p == '.' ) )
+                ++p;
+            bool wide = false;
+            while ( *p && std::strchr( "hlLjzt", *p ) )
+                wide |= ( *p == 'j' || ( *p == 'l' && p[ 1 ] == 'l' ) ), ++p;
+            if ( *p == '\0' )
+                break;
+
+            // rebuild the spec without length modifiers, then add what the host needs
+            std::string spec;
+            for ( const char * q = start; q < p; ++q )
+                if ( ! std::strchr( "hlLjzt", *q ) )
+                    spec += *q;
+
+            char buf[ 256 ];
+            switch ( *p ) {
+            case 'd': case 'i': case 'u': case 'x': case 'X': case 'o':
+                if ( wide ) {
+                    uint64_t lo = take();
+                    uint64_t v = lo | ( uint64_t( take() ) << 32 );
+                    snprintf( buf, sizeof( buf ), ( spec + "ll" + *p ).c_str(), v );
+                } else {
+                    snprintf( buf, sizeof( buf ), ( spec + *p ).c_str(), take() );
+                }
+                break;
+            case 'c':
+                snprintf( buf, sizeof( buf ), ( spec + 'c' ).c_str(), int( take() & 0xff ) );
+                break;
+            case 'p':
+                snprintf( buf, sizeof( buf ), "0x%08x", take() );
+                break;
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': {
+                uint64_t lo = take();
+                uint64_t bits = lo | ( uint64_t( take() ) << 32 );
+                double d;
+                std::memcpy( &d, &bits, sizeof( d ) );
+                snprintf( buf, sizeof( buf ), ( spec + *p ).c_str(), d );
+                break;
+            }
+            case 's':
+                snprintf( buf, sizeof( buf ), ( spec + 's' ).c_str(), elf.string( take() ).c_str() );
+                break;
+            default:
+                snprintf( buf, sizeof( buf ), "%s%c", spec.c_str(), *p );
+                break;
+            }
+            result += buf;
+        }
+        return result;
+    }
+
+    bool
+    read_word( std::istream& in, uint32_t& w )
+    {
+        unsigned char b[ 4 ];
+        if ( ! in.read( reinterpret_cast< char * >( b ), sizeof( b ) ) )
+            return false;
+        w = b[ 0 ] | ( b[ 1 ] << 8 ) | ( b[ 2 ] << 16 ) | ( uint32_t( b[ 3 ] ) << 24 );
+        return true;
+    }
+}
+
+int
+main( int argc, char ** argv )
+{
+    double clock = 72.0e6;
+    const char * elf_file = nullptr;
+    const char * input_file = nullptr;
+
+    for ( int i = 1; i < argc; ++i ) {
+        if ( std::strcmp( argv[ i ], "--clock" ) == 0 && i + 1 < argc )
+            clock = std::strtod( argv[ ++i ], nullptr );
+        else if ( elf_file == nullptr )
+            elf_file = argv[ i ];
+        else
+            input_file = argv[ i ];
+    }
+
+    if ( elf_file == nullptr || clock <= 0 ) {
+        std::cerr << "usage: " << argv[ 0 ] << " [--clock hz] firmware.elf [capture]" << std::endl;
+        return 1;
+    }
+
+    image elf;
+    if ( ! elf.load( elf_file ) ) {
+        std::cerr << elf_file << ": not an ELF32 file with a .logfmt section" << std::endl;
+        return 1;
+    }
+
+    std::ifstream file;
+    if ( input_file ) {
+        file.open( input_file, std::ios::binary );
+        if ( ! file ) {
+            std::cerr << input_file << ": cannot open" << std::endl;
+            return 1;
+        }
+    }
+    std::istream& in = input_file ? file : std::cin;
+
+    bool first = true;
+    uint32_t last = 0;
+    uint64_t elapsed = 0;  // cycles since the first record; the 32-bit counter wraps every ~60s at 72MHz
+    size_t bad = 0;
+
+    char c;
+    while ( in.get( c ) ) {
+        if ( c == 0 ) {
+            // telemetry frame (telemetry_record.hpp), 0x00 ... 0x00; see src/telemetry
+            size_t size = 0;
+            while ( in.get( c ) && ( c != 0 || size == 0 ) )
+                size += ( c != 0 );
+            continue;
+        }
+        if ( uint8_t( c ) != dlog_record::sync ) {
+            if ( c != '\r' )
+                std::cout << c;
+            continue;
+        }
+        uint32_t header, timestamp, args[ dlog_record::max_words ];
+        if ( ! read_word( in, header ) || ! read_word( in, timestamp ) )
+            break;
+        const uint32_t words = dlog_record::words( header );
+        const char * fmt = elf.format( dlog_record::id( header ) );
+        if ( words > dlog_record::max_words || fmt == nullptr ) {
+            ++bad;  // lost sync, or the ELF file does not match the firmware
+            continue;
+        }
+        bool complete = true;
+        for ( uint32_t i = 0; i < words && complete; ++i )
+            complete = read_word( in, args[ i ] );
+        if ( ! complete )
+            break;
+
+        if ( first ) {
+            first = false;
+            last = timestamp;
+        }
+        elapsed += uint32_t( timestamp - last );
+        last = timestamp;
+
+        char prefix[ 32 ];
+        snprintf( prefix, sizeof( prefix ), "[%12.6f] ", double( elapsed ) / clock );
+        std::cout << prefix << render( elf, fmt, args, words ) << std::flush;
+    }
+
+    if ( bad )
+        std::cerr << bad << " undecodable record(s)" << std::endl;
+    return 0;
+}
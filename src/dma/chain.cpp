@@ -0,0 +1,322 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+
+// ISR replay of the software scatter-gather chains (dma_descriptor, dma_chain_step in shell/dma.hpp)
+//
+//   make && ./chain [-v]
+//
+// A bxDMA channel model moves one byte per step between a 64k SRAM and a USART DR: gather
+// transmit (DIR, memory to DR), scatter receive (DR to memory) and memory to memory copies
+// (MEM2MEM, CPAR the source).  The model raises HTIF, TCIF and TEIF into its ISR bits and stops at
+// TC or on a transfer error, which clears EN as the hardware does.  An interrupt is taken after
+// a random latency, so HT and TC of a link may arrive together, and the handler does what
+// dma::handle_interrupt does with the chain: dma_chain_step, then TC is hidden on inner links.
+//
+// First a fixed sequence checks the register programming of each step.  Then random chains
+// run with random errors: the data moved must be the chain's bytes in link order (up to the
+// failing item), the links must be taken in order, each chain must report exactly one TC, or
+// one TE and no TC, and an aborted chain must not touch the channel registers.
+
+#include "dma.hpp"
+#include "dma_channel.hpp"
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace stm32f103;
+
+namespace {
+
+    constexpr uint32_t GIF = 1, TCIF = 2, HTIF = 4, TEIF = 8;
+    constexpr uint32_t sram_base = 0x20000000, sram_size = 0x10000;
+    constexpr uint32_t usart_dr = 0x40013804;
+
+    int failures = 0;
+
+    void check( bool ok, const char * what ) {
+        if ( !ok && failures++ < 20 )
+            std::printf( "FAIL %s\n", what );
+    }
+
+    struct channel_model {
+        DMAChannel regs;
+        uint32_t isr = 0;
+        uint8_t sram[ sram_size ];
+        std::vector< uint8_t > tx;              // bytes written to DR
+        std::deque< uint8_t > rx;               // bytes DR gives on read
+        uint32_t remaining = 0, count = 0;      // internal copy of CNDTR, and the count it started from
+        long error_at = -1;                     // items to go until a bus error
+        long moved = 0;
+
+        uint8_t& memory( uint32_t addr ) { return sram[ ( addr - sram_base ) % sram_size ]; }
+
+        uint8_t read( uint32_t addr ) {
+            if ( addr != usart_dr )
+                return memory( addr );
+            uint8_t c = rx.empty() ? 0 : rx.front();
+            if ( !rx.empty() )
+                rx.pop_front();
+            return c;
+        }
+
+        void write( uint32_t addr, uint8_t c ) {
+            if ( addr == usart_dr )
+                tx.push_back( c );
+            else
+                memory( addr ) = c;
+        }
+
+        // one item; CNDTR written by software (it differs from the internal count) starts a transfer
+        void step() {
+            if ( !( regs.CCR & EN ) || regs.CNDTR == 0 )
+                return;
+            if ( regs.CNDTR != remaining )
+                remaining = count = regs.CNDTR;
+            if ( error_at >= 0 && error_at-- == 0 ) {
+                regs.CCR &= ~EN;
+                isr |= TEIF | GIF;
+                return;
+            }
+            const uint32_t n = count - remaining;
+            const uint32_t m = regs.CMAR + ( regs.CCR & MINC ? n : 0 );
+            const uint32_t p = regs.CPAR + ( regs.CCR & PINC ? n : 0 );
+            if ( regs.CCR & DIR )
+                write( p, read( m ) );
+            else
+                write( m, read( p ) );
+            ++moved;
+            regs.CNDTR = --remaining;
+            if ( remaining == count / 2 )
+                isr |= HTIF | GIF;
+            if ( remaining == 0 )
+                isr |= TCIF | GIF;
+        }
+
+        bool interrupt_pending() const { return isr & ( regs.CCR & ( TCIE | HTIE | TEIE ) ); }
+    };
+
+    // dma::handle_interrupt for the chain in progress; returns the flags posted to the waiter
+    uint32_t
+    handle_interrupt( channel_model& ch, const dma_descriptor *& chain )
+    {
+        uint32_t x = ch.isr;
+        ch.isr = 0;
+        if ( auto current = chain ) {
+            auto next = dma_chain_step( ch.regs, current, x );
+            if ( next != current ) {
+                chain = next;
+                if ( next ) {
+                    x &= ~TCIF;
+                    if ( ( x & ~GIF ) == 0 )
+                        return 0;
+                }
+            }
+        }
+        return x;
+    }
+
+    // dma::start_chain: load the first link, then enable as dma::enable does
+    void
+    start_chain( channel_model& ch, const dma_descriptor *& chain, const dma_descriptor * first )
+    {
+        chain = first;
+        dma_load_descriptor( ch.regs, *first );
+        ch.regs.CCR |= EN | TCIE | TEIE;
+    }
+
+    void
+    fixed_sequence()
+    {
+        channel_model ch{};
+        volatile DMAChannel& v = ch.regs;
+        dma_descriptor d[ 4 ];
+        d[ 3 ] = { 0x3000, 3, 0, 0, nullptr };
+        d[ 2 ] = { 0x2000, 2, 0x9000, 0x0a80, &d[ 3 ] };
+        d[ 1 ] = { 0x1000, 1, 0, 0, &d[ 2 ] };
+        d[ 0 ] = { 0x0100, 10, 0x8000, 0, &d[ 1 ] };
+
+        ch.regs.CCR = MEM2MEM | PINC | MINC | TEIE | TCIE | EN;
+        dma_load_descriptor( v, d[ 0 ] );
+        check( ( ch.regs.CCR & EN ) == 0, "load leaves EN clear" );
+        ch.regs.CCR |= EN;
+        check( ch.regs.CMAR == 0x100 && ch.regs.CNDTR == 10 && ch.regs.CPAR == 0x8000 && ( ch.regs.CCR & 0x0f ) == 0x0b, "first link" );
+
+        const dma_descriptor * cur = &d[ 0 ];
+        check( dma_chain_step( v, cur, HTIF | GIF ) == cur && ch.regs.CMAR == 0x100, "HT alone keeps the link" );
+        cur = dma_chain_step( v, cur, TCIF | GIF );
+        check( cur == &d[ 1 ] && ch.regs.CMAR == 0x1000 && ch.regs.CNDTR == 1 && ch.regs.CPAR == 0x8000, "TC: CMAR, CNDTR; CPAR 0 kept" );
+        check( ch.regs.CCR == ( MEM2MEM | PINC | MINC | TEIE | TCIE | EN ), "ccr 0 keeps CCR" );
+        cur = dma_chain_step( v, cur, TCIF | GIF );
+        check( cur == &d[ 2 ] && ch.regs.CMAR == 0x2000 && ch.regs.CPAR == 0x9000, "TC: CPAR from the link" );
+        check( ch.regs.CCR == ( 0x0a80 | TEIE | TCIE | EN ), "link ccr, interrupt enables kept" );
+        cur = dma_chain_step( v, cur, HTIF | TCIF | GIF );
+        check( cur == &d[ 3 ] && ch.regs.CMAR == 0x3000 && ch.regs.CCR == ( 0x0a80 | TEIE | TCIE | EN ), "HT and TC together advance once" );
+        check( dma_chain_step( v, cur, TCIF | GIF ) == nullptr, "TC on the last link ends the chain" );
+
+        ch.regs.CMAR = 0x100;
+        ch.regs.CNDTR = 7;
+        ch.regs.CCR = 0x0a;                     // hardware cleared EN
+        check( dma_chain_step( v, &d[ 1 ], TEIF | GIF ) == nullptr, "TE aborts" );
+        check( ch.regs.CMAR == 0x100 && ch.regs.CNDTR == 7 && ch.regs.CCR == 0x0a, "TE reprograms nothing" );
+        check( dma_chain_step( v, &d[ 0 ], TEIF | TCIF | GIF ) == nullptr && ch.regs.CMAR == 0x100, "TE with TC aborts" );
+    }
+
+    struct result {
+        long chains = 0, links = 0, bytes = 0, errors = 0, together = 0;
+    };
+
+    // one random chain of 1..6 links, of one kind; error_at < 0: none
+    void
+    replay( std::mt19937& rng, channel_model& ch, result& r, bool verbose )
+    {
+        enum { gather, scatter, copy } kind = decltype( gather )( rng() % 3 );
+        const size_t nlinks = 1 + rng() % 6;
+        std::vector< dma_descriptor > links( nlinks );
+        std::vector< uint8_t > expected;
+        std::vector< std::pair< uint32_t, uint32_t > > targets;      // scatter/copy destination, count
+
+        uint32_t src = sram_base + 0x100, dst = sram_base + 0x8000;
+        for ( size_t i = 0; i < nlinks; ++i ) {
+            const uint32_t count = 1 + rng() % ( i % 2 ? 300 : 5 );  // short headers and CRCs, long payloads
+            for ( uint32_t k = 0; k < count; ++k )
+                ch.memory( src + k ) = uint8_t( rng() );
+            auto& d = links[ i ];
+            d.count = count;
+            d.ccr = 0;
+            d.next = i + 1 < nlinks ? &links[ i + 1 ] : nullptr;
+            switch ( kind ) {
+            case gather:
+                d.memory = src;
+                d.peripheral = i == 0 ? usart_dr : 0;
+                for ( uint32_t k = 0; k < count; ++k )
+                    expected.push_back( ch.memory( src + k ) );
+                break;
+            case scatter:
+                d.memory = dst;
+                d.peripheral = i == 0 ? usart_dr : 0;
+                for ( uint32_t k = 0; k < count; ++k ) {
+                    expected.push_back( ch.memory( src + k ) );
+                    ch.rx.push_back( ch.memory( src + k ) );
+                }
+                targets.emplace_back( dst, count );
+                break;
+            case copy:
+                d.memory = dst;
+                d.peripheral = src;
+                for ( uint32_t k = 0; k < count; ++k )
+                    expected.push_back( ch.memory( src + k ) );
+                targets.emplace_back( dst, count );
+                break;
+            }
+            if ( i && rng() % 4 == 0 )          // a link with its own priority
+                d.ccr = ( kind == gather ? DIR : kind == copy ? MEM2MEM | PINC : 0 ) | MINC | ( rng() % 4 ) << 12;
+            src += count + rng() % 16;
+            dst += count + rng() % 16;
+        }
+        for ( auto& [ addr, count ]: targets )
+            std::memset( &ch.memory( addr ), 0xee, count );
+
+        const uint32_t ccr = ( kind == gather ? DIR : kind == copy ? MEM2MEM | PINC : 0 ) | MINC | ( rng() % 2 ? HTIE : 0 );
+        ch.regs = DMAChannel{ ccr, 0, 0, 0, 0 };
+        ch.isr = 0;
+        ch.tx.clear();
+        ch.remaining = 0;
+        ch.moved = 0;
+        ch.error_at = rng() % 4 == 0 ? long( rng() % expected.size() ) : -1;
+        const long failing = ch.error_at;
+        const bool error = failing >= 0;
+
+        const dma_descriptor * chain = nullptr;
+        start_chain( ch, chain, &links[ 0 ] );
+
+        const uint32_t latency = 1 + rng() % 40;
+        uint32_t delay = 0, tc = 0, te = 0, posts = 0;
+        size_t link = 0;
+        bool order = true, untouched = true, programmed = true;
+        uint32_t upper = ccr;                   // CCR above the interrupt enables
+        for ( long t = 0; chain && t < 100000; ++t ) {
+            ch.step();
+            if ( !ch.interrupt_pending() ) {
+                delay = 0;
+                continue;
+            }
+            if ( delay == 0 )
+                delay = 1 + rng() % latency;
+            if ( --delay )
+                continue;
+            if ( ( ch.isr & ( HTIF | TCIF ) ) == ( HTIF | TCIF ) )
+                ++r.together;
+            const DMAChannel before = ch.regs;
+            const auto previous = chain;
+            const uint32_t x = handle_interrupt( ch, chain );
+            if ( chain && chain != previous ) {
+                order = order && chain == &links[ ++link ];
+                if ( chain->ccr )
+                    upper = chain->ccr;
+                programmed = programmed && ch.regs.CMAR == chain->memory && ch.regs.CNDTR == chain->count
+                    && ch.regs.CCR == ( ( upper & ~0x0fu ) | ( ccr & HTIE ) | TEIE | TCIE | EN );
+            }
+            if ( x & TEIF )
+                untouched = untouched && std::memcmp( &before, &ch.regs, sizeof before ) == 0;
+            posts += x ? 1 : 0;
+            tc += ( x & TCIF ) ? 1 : 0;
+            te += ( x & TEIF ) ? 1 : 0;
+        }
+
+        // the bytes moved, in link order
+        std::vector< uint8_t > moved = ch.tx;
+        if ( kind != gather )
+            for ( auto& [ addr, count ]: targets )
+                for ( uint32_t k = 0; k < count; ++k )
+                    moved.push_back( ch.memory( addr + k ) );
+        const size_t n = error ? size_t( failing ) : expected.size();
+        bool data = ch.moved == long( n );
+        for ( size_t i = 0; data && i < n; ++i )
+            data = moved[ i ] == expected[ i ];
+        for ( size_t i = n; data && kind != gather && i < moved.size(); ++i )
+            data = moved[ i ] == 0xee;          // nothing written past the failing item
+
+        const bool ended = chain == nullptr;
+        const bool reported = error ? ( te == 1 && tc == 0 ) : ( tc == 1 && te == 0 );
+        check( ended, "chain did not end" );
+        check( order, "links out of order" );
+        check( data, "data moved" );
+        check( reported, error ? "TE not reported once, or TC after TE" : "TC not reported once" );
+        check( untouched, "TE reprogrammed the channel" );
+        check( programmed, "link registers" );
+        check( error || link + 1 == nlinks, "not every link ran" );
+        if ( verbose && r.chains < 10 )
+            std::printf( "  %s, %zu links, %zu bytes, latency %u: %s%s\n", kind == gather ? "gather" : kind == scatter ? "scatter" : "copy"
+                         , nlinks, expected.size(), latency, error ? "TE at " : "TC", error ? std::to_string( failing ).c_str() : "" );
+
+        ++r.chains;
+        r.links += link + 1;
+        r.bytes += ch.moved;
+        r.errors += error ? 1 : 0;
+        ch.rx.clear();
+    }
+}
+
+int
+main( int argc, char ** argv )
+{
+    const bool verbose = argc > 1 && std::strcmp( argv[ 1 ], "-v" ) == 0;
+
+    fixed_sequence();
+    const int fixed = failures;
+
+    static channel_model ch{};
+    std::mt19937 rng( 15 );
+    result r;
+    for ( int i = 0; i < 20000; ++i )
+        replay( rng, ch, r, verbose );
+
+    std::printf( "dma chain: fixed sequence %s; %ld chains, %ld links, %ld bytes, %ld aborted by TE, %ld HT+TC together: %d failed\n"
+                 , fixed ? "FAIL" : "OK", r.chains, r.links, r.bytes, r.errors, r.together, failures );
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,141 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+
+// Stress test of the per-channel DMA completion status (shell/dma_status.hpp)
+//
+//   make && ./status [-v]
+//
+// Threads take the place of the DMA controller, the channel interrupt handlers and thread mode.
+// For each of four channels (ADC, SPI1, I2C1 Tx/Rx), a controller thread raises HTIF|TCIF|GIF in
+// a shared ISR word.  An interrupt thread then does what dma::handle_interrupt does: it reads
+// its own four bits, clears them through IFCR, and posts them.  A waiter thread consumes the
+// completion with take_complete, as dma::transfer_complete does.  On the ADC channel the waiter
+// uses take instead, as the circular stream does.
+//
+// Interrupt threads of other channels run at the same time, so a handler that cleared or
+// overwrote another channel's bits would lose a completion.  Every completion must reach its
+// waiter: a waiter that has seen nothing for a second while its transfer is done is a lost
+// wakeup.  As a control, the same load runs on one shared status word that the handler stores,
+// the way the spinlock code did; it must lose completions.
+
+#include "dma_status.hpp"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+using namespace stm32f103;
+
+namespace {
+
+    constexpr uint32_t GIF = 1, TCIF = 2, HTIF = 4;
+    constexpr uint32_t channels[] = { 0, 1, 5, 6 };  // DMA1 ch1 ADC1, ch2 SPI1_RX, ch6 I2C1_TX, ch7 I2C1_RX
+    constexpr int transfers = 50000;
+
+    std::atomic< uint32_t > isr;                     // DMA_ISR; IFCR is an atomic clear of the written bits
+
+    struct shared_word {                             // the control: one word for all channels, stored by the ISR
+        std::atomic< uint32_t > word;
+        void clear() { word = 0; }
+        void post( uint32_t channel, uint32_t flags ) { word = flags << ( channel * 4 ); }
+        bool take_complete( uint32_t channel ) {
+            return word.fetch_and( ~( TCIF << ( channel * 4 ) ) ) & ( TCIF << ( channel * 4 ) );
+        }
+        uint32_t take( uint32_t channel ) { return ( word.exchange( 0 ) >> ( channel * 4 ) ) & 0x0f; }
+    };
+
+    struct counters {
+        std::atomic< int > started{ 0 }, completed{ 0 }, half{ 0 };
+        std::atomic< bool > lost{ false };
+    };
+
+    template< typename Status >
+    int
+    run( const char * name, Status& status, bool verbose )
+    {
+        status.clear();
+        isr = 0;
+        std::array< counters, 7 > count;
+        std::atomic< int > interrupts{ 0 };
+        std::vector< std::thread > threads;
+
+        for ( auto ch: channels ) {
+            auto& c = count[ ch ];
+
+            // controller: one transfer in flight; the next starts when the waiter has seen the last
+            threads.emplace_back( [&, ch]{
+                    for ( int i = 0; i < transfers && !c.lost; ++i ) {
+                        while ( c.completed.load() != c.started.load() && !c.lost )
+                            std::this_thread::yield();
+                        ++c.started;
+                        isr.fetch_or( ( TCIF | GIF | ( i & 1 ? HTIF : 0 ) ) << ( ch * 4 ) );
+                        // the channel interrupt, as dma::handle_interrupt
+                        uint32_t x = ( isr.load() >> ( ch * 4 ) ) & 0x0f;
+                        isr.fetch_and( ~( x << ( ch * 4 ) ) );
+                        status.post( ch, x );
+                        ++interrupts;
+                    }
+                } );
+
+            // thread mode waiter
+            threads.emplace_back( [&, ch]{
+                    auto seen = std::chrono::steady_clock::now();
+                    while ( c.completed.load() < transfers ) {
+                        bool complete;
+                        if ( ch == 0 ) {
+                            auto x = status.take( ch );
+                            if ( x & HTIF )
+                                ++c.half;
+                            complete = x & TCIF;
+                        } else {
+                            complete = status.take_complete( ch );
+                        }
+                        if ( complete ) {
+                            ++c.completed;
+                            seen = std::chrono::steady_clock::now();
+                        } else if ( std::chrono::steady_clock::now() - seen > std::chrono::seconds( 1 ) ) {
+                            c.lost = true;      // the transfer is done and nobody will post it again
+                            return;
+                        } else {
+                            std::this_thread::yield();
+                        }
+                    }
+                } );
+        }
+        for ( auto& t: threads )
+            t.join();
+
+        int lost = 0;
+        for ( auto ch: channels ) {
+            auto& c = count[ ch ];
+            const bool ok = !c.lost && c.completed == transfers && ( ch != 0 || c.half == transfers / 2 );
+            lost += ok ? 0 : 1;
+            if ( verbose || !ok )
+                std::printf( "  ch%u: started %d, completed %d, half %d%s\n", ch + 1, c.started.load(), c.completed.load()
+                             , c.half.load(), c.lost ? ", lost wakeup" : "" );
+        }
+        std::printf( "%-28s %d interrupts, %d channels lost completions\n", name, interrupts.load(), lost );
+        return lost;
+    }
+}
+
+int
+main( int argc, char ** argv )
+{
+    const bool verbose = argc > 1 && std::strcmp( argv[ 1 ], "-v" ) == 0;
+
+    static dma_status< 7 > status;
+    const int lost = run( "dma_status", status, verbose );
+
+    static shared_word control;
+    const int control_lost = run( "shared word (control)", control, verbose );
+
+    const bool failed = lost != 0 || control_lost == 0;
+    std::printf( "dma status: %s\n", failed ? "FAIL" : "OK" );
+    return failed ? 1 : 0;
+}
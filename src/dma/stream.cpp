@@ -0,0 +1,186 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+
+// CNDTR model of the circular ping-pong stream (shell/dma_stream.hpp)
+//
+//   make && ./stream [-v]
+//
+// The model channel counts CNDTR down from N the way a circular bxDMA channel does: each
+// request writes the next item of a running sequence to buffer[ N - CNDTR ], HTIF is raised
+// when CNDTR reaches N/2, and TCIF when it reaches 0, where it reloads N.  The flags reach
+// handle_interrupt after a random latency, kept under one half time as the stream requires;
+// release() sees the model's CNDTR through watch().  Thread mode acquires a half at random
+// moments and holds it for a random number of requests.
+//
+// Whatever the timing, a half that release() calls intact must have held N/2 consecutive
+// items when it was acquired and must not have changed while it was held; the intact halves
+// must come in order; and every published half is either acquired, counted as an overrun, or
+// still pending.  A half that stayed stable must not be reported late, unless the other half
+// was done and DMA was about to start on it.  A slow consumer must see overruns and late
+// releases, a fast one neither.
+
+#include "dma_stream.hpp"
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+using namespace stm32f103;
+
+namespace {
+
+    constexpr size_t N = 16;
+    constexpr uint32_t HTIF = 4, TCIF = 2;
+
+    struct scenario {
+        const char * name;
+        uint32_t period;        // mean requests between acquire attempts
+        uint32_t hold;          // longest processing time, requests
+        uint32_t latency;       // longest interrupt latency, requests
+        bool expect_loss;
+    };
+
+    int
+    run( const scenario& sc, bool verbose )
+    {
+        static dma_stream< uint32_t, N > stream;
+        stream.reset();
+        std::mt19937 rng( 13 );
+
+        uint32_t * buffer = nullptr;
+        volatile uint32_t cndtr = N;
+        uint32_t value = 0, pending = 0, delay = 0;
+        uint32_t writes[ 2 ] = { 0, 0 };        // per half
+        bool partial[ 2 ] = { false, false };   // DMA has started the half again
+        uint32_t completed[ 2 ] = { 0, 0 };     // first item of the half when it was last completed
+        uint32_t published[ 2 ] = { 0, 0 };     // ... when its interrupt was delivered
+        stream.watch( &cndtr );
+
+        // one DMA request, then the interrupt when its latency is over
+        auto request = [&]{
+            const uint32_t half = ( N - cndtr ) / ( N / 2 );
+            if ( buffer )
+                buffer[ N - cndtr ] = value;
+            ++value;
+            ++writes[ half ];
+            partial[ half ] = true;
+            if ( --cndtr == N / 2 ) {
+                pending |= HTIF;
+                partial[ 0 ] = false;
+                completed[ 0 ] = value - N / 2;
+            }
+            if ( cndtr == 0 ) {
+                pending |= TCIF;
+                partial[ 1 ] = false;
+                completed[ 1 ] = value - N / 2;
+                cndtr = N;
+            }
+            if ( pending && delay == 0 )
+                delay = 1 + ( sc.latency ? rng() % sc.latency : 0 );
+            if ( delay && --delay == 0 ) {
+                if ( pending & HTIF )
+                    published[ 0 ] = completed[ 0 ];
+                if ( pending & TCIF )
+                    published[ 1 ] = completed[ 1 ];
+                stream.handle_interrupt( pending );
+                pending = 0;
+            }
+        };
+
+        // the buffer is private: the first half acquired is its base
+        while ( !buffer ) {
+            request();
+            if ( auto p = stream.acquire() ) {
+                buffer = const_cast< uint32_t * >( p );
+                stream.release();
+            }
+        }
+        for ( size_t i = 0; i < 2 * N; ++i )    // until both halves hold data written by the model
+            request();
+        while ( stream.acquire() )
+            stream.release();
+        const uint32_t before = stream.halves() - stream.pending(), overruns_before = stream.overruns();
+
+        size_t acquired = 0, intact = 0, late = 0, torn = 0, boundary = 0, premature = 0, order = 0, bad = 0, skipped = 0;
+        uint32_t expect = 0;
+        std::vector< uint32_t > copy( N / 2 );
+
+        for ( long step = 0; step < 2000000; ++step ) {
+            request();
+            if ( rng() % sc.period )
+                continue;
+            auto p = stream.acquire();
+            if ( !p )
+                continue;
+            ++acquired;
+            const uint32_t half = ( p - buffer ) / ( N / 2 );
+            const uint32_t written = writes[ half ];
+            const bool complete = !partial[ half ];
+            std::memcpy( copy.data(), p, sizeof( uint32_t ) * N / 2 );
+            const bool current = copy[ 0 ] == published[ half ];  // not a newer round whose interrupt is pending
+            for ( uint32_t d = rng() % ( sc.hold + 1 ); d; --d )
+                request();
+            const bool stable = complete && current && writes[ half ] == written;   // what release() has to tell
+            const bool next = p == buffer + ( N - cndtr );               // DMA is about to start it
+            if ( !stream.release() ) {
+                ++late;
+                if ( stable && next )
+                    ++boundary;         // the other half is done; released just in time
+                else if ( stable )
+                    ++premature;        // DMA was nowhere near this half
+                continue;
+            }
+            ++intact;
+            if ( !stable )
+                ++torn;                 // overwritten before or while held, and release() did not see it
+            bool consecutive = true;
+            for ( size_t i = 1; i < N / 2; ++i )
+                consecutive = consecutive && copy[ i ] == copy[ 0 ] + i;
+            if ( !consecutive )
+                ++bad;
+            if ( intact > 1 && copy[ 0 ] < expect )
+                ++order;
+            if ( intact > 1 && copy[ 0 ] > expect )
+                skipped += ( copy[ 0 ] - expect ) / ( N / 2 );
+            expect = copy[ 0 ] + N / 2;
+        }
+
+        const uint32_t halves = stream.halves() - before, overruns = stream.overruns() - overruns_before;
+        const bool accounted = acquired + overruns + stream.pending() == halves;
+        const bool lost = overruns || late;
+        int failures = 0;
+        if ( torn || bad || order || premature || !accounted || ( sc.expect_loss != lost ) || stream.errors() )
+            ++failures;
+        if ( verbose || failures )
+            std::printf( "  halves %u, acquired %zu, intact %zu, overruns %u, late %zu (%zu at the boundary), skipped %zu\n"
+                         "  torn %zu, not consecutive %zu, out of order %zu, premature %zu, accounted %s\n"
+                         , halves, acquired, intact, overruns, late, boundary, skipped
+                         , torn, bad, order, premature, accounted ? "yes" : "no" );
+        std::printf( "%-44s %s\n", sc.name, failures ? "FAIL" : "OK" );
+        return failures;
+    }
+}
+
+int
+main( int argc, char ** argv )
+{
+    const bool verbose = argc > 1 && std::strcmp( argv[ 1 ], "-v" ) == 0;
+
+    // a half is N/2 = 8 requests
+    const scenario scenarios[] = {
+        { "fast consumer",                            1,  3, 1, false }
+        , { "fast consumer, late interrupts",         1,  3, 4, false }
+        , { "late interrupts, 7/8 of a half",         2,  3, 7, true }
+        , { "slow consumer (overruns)",              12,  3, 1, true }
+        , { "long processing (late releases)",        2, 12, 1, true }
+        , { "everything at random",                   6, 14, 6, true }
+    };
+
+    int failures = 0;
+    for ( const auto& sc: scenarios )
+        failures += run( sc, verbose ) ? 1 : 0;
+    std::printf( "dma_stream: %zu runs, %d failed\n", sizeof( scenarios ) / sizeof( scenarios[ 0 ] ), failures );
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,124 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+
+// shell/to_chars.cpp against the host printf
+//
+//   make && ./dtoa [-v]
+//
+// dtoa must give the digits of "%.*f" for |v| < 2^64 and every precision 0..17: random bit
+// patterns (all exponents, subnormals included), short binary fractions (ties), and the values
+// under 2^-11 whose fraction bits do not fit 64 bits.  qtoa is checked against a long double
+// of the same value, and the integer conversions against "%llu" "%lld" "%llx".
+
+#include "to_chars.hpp"
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+namespace {
+
+    int failures = 0;
+    long count = 0;
+
+    void
+    compare( const char * what, const char * expected, const char * converted, double v = 0, int precision = 0 )
+    {
+        ++count;
+        if ( std::strcmp( expected, converted ) && failures++ < 20 )
+            std::printf( "FAIL %s %.17g .%d: \"%s\" expected \"%s\"\n", what, v, precision, converted, expected );
+    }
+
+    void
+    check_dtoa( double v, int precision )
+    {
+        char converted[ 400 ], expected[ 400 ];
+        *dtoa( v, converted, precision ) = '\0';
+        std::snprintf( expected, sizeof expected, "%.*f", precision, v );
+        compare( "dtoa", expected, converted, v, precision );
+    }
+}
+
+int
+main( int argc, char ** argv )
+{
+    const bool verbose = argc > 1 && std::strcmp( argv[ 1 ], "-v" ) == 0;
+    std::mt19937_64 g( 2 );
+
+    const double special[] = { 0.0, -0.0, 0.5, 1.5, 2.5, 0.125, 0.375, 2.675, 0.05, 0.15, 0.25, 0.35
+                               , 1e-5, 5e-7, 9.9999999, 0.9999995, 123456789.123456789
+                               , 2.0990960435001768e-07           // the 128 bit fraction case
+                               , 5e-18, 5e-17, 4.9999999999999996e-17, 1.5e-17, 0x1p-60, 0x1p-64, 0x1.8p-57
+                               , 18446744073709549568.0, 4.9e-324, 2.2250738585072014e-308, 1e-300 };
+    for ( double v: special )
+        for ( int precision = 0; precision <= 17; ++precision ) {
+            check_dtoa( v, precision );
+            check_dtoa( -v, precision );
+        }
+
+    for ( long i = 0; i < 3000000; ++i ) {
+        double v;
+        const uint64_t bits = g();
+        switch ( i % 4 ) {
+        case 0: std::memcpy( &v, &bits, sizeof v ); break;                             // any exponent
+        case 1: v = std::ldexp( double( bits >> 11 ), int( g() % 140 ) - 110 ); break;  // 2^-110..2^83
+        case 2: v = double( int64_t( g() % 2000001 ) - 1000000 ) / double( 1 << ( g() % 20 ) ); break; // ties
+        default: v = std::ldexp( double( bits >> 11 ), -int( g() % 60 ) - 64 ); break;  // under 2^-11
+        }
+        if ( std::isnan( v ) || !( std::fabs( v ) < 18446744073709551616.0 ) )
+            continue;
+        check_dtoa( v, int( g() % 18 ) );
+    }
+    const long doubles = count;
+
+    for ( long i = 0; i < 1000000; ++i ) {
+        const unsigned q = g() % 40;
+        const int64_t raw = int64_t( g() ) >> ( g() % 40 );
+        const int precision = g() % 18;
+        char converted[ 80 ], expected[ 400 ];
+        *qtoa( raw, q, converted, precision ) = '\0';
+        std::snprintf( expected, sizeof expected, "%.*Lf", precision, std::ldexp( (long double)raw, -int( q ) ) );
+        compare( "qtoa", expected, converted, double( raw ), precision );
+    }
+
+    for ( long i = 0; i < 1000000; ++i ) {
+        uint64_t v = g() >> ( g() % 64 );
+        if ( i < 128 )
+            v = ( i & 1 ) ? UINT64_MAX >> ( i / 2 ) : uint64_t( 1 ) << ( i / 2 );
+        const int64_t s = ( g() & 1 ) ? -int64_t( v ) : int64_t( v );
+        char converted[ 40 ], expected[ 40 ];
+        *u64toa( v, converted ) = '\0';
+        std::snprintf( expected, sizeof expected, "%" PRIu64, v );
+        compare( "u64toa", expected, converted );
+        *i64toa( s, converted ) = '\0';
+        std::snprintf( expected, sizeof expected, "%" PRId64, s );
+        compare( "i64toa", expected, converted );
+        *u32toa( uint32_t( v ), converted ) = '\0';
+        std::snprintf( expected, sizeof expected, "%" PRIu32, uint32_t( v ) );
+        compare( "u32toa", expected, converted );
+        *i32toa( int32_t( s ), converted ) = '\0';
+        std::snprintf( expected, sizeof expected, "%" PRId32, int32_t( s ) );
+        compare( "i32toa", expected, converted );
+        *u64tox( v, converted ) = '\0';
+        std::snprintf( expected, sizeof expected, "%" PRIx64, v );
+        compare( "u64tox", expected, converted );
+    }
+    char converted[ 40 ];
+    *i64toa( INT64_MIN, converted ) = '\0';
+    compare( "i64toa", "-9223372036854775808", converted );
+    *i32toa( INT32_MIN, converted ) = '\0';
+    compare( "i32toa", "-2147483648", converted );
+
+    if ( verbose ) {
+        for ( double v: { 1.5e300, -2e20, 9.9999e20 } ) {
+            *dtoa( v, converted, 3 ) = '\0';
+            std::printf( "%g .3: %s (scientific, not checked)\n", v, converted );
+        }
+    }
+
+    std::printf( "to_chars: %ld doubles, %ld conversions in all, %d failed\n", doubles, count, failures );
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,116 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+
+// shell/format.hpp against the host snprintf
+//
+//   make && ./format [-v]
+//
+// (stream.hpp is for clang++ or arm-none-eabi-g++; a host g++ also wants -U__GNUC__ -D__GNUC__=4)
+//
+// Every conversion, flag, width and precision the shell uses is formatted both ways and the
+// strings must be identical; format_to must also truncate like snprintf does.
+
+#include "format.hpp"
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
+
+void stream::flush() {}
+
+namespace {
+
+    int failures = 0;
+    int count = 0;
+    bool verbose = false;
+
+    void
+    compare( const char * pattern, const char * expected, const char * formatted )
+    {
+        ++count;
+        if ( std::strcmp( expected, formatted ) ) {
+            ++failures;
+            std::printf( "FAIL %-8s \"%s\" expected \"%s\"\n", pattern, formatted, expected );
+        } else if ( verbose ) {
+            std::printf( "     %-8s \"%s\"\n", pattern, formatted );
+        }
+    }
+}
+
+// the pattern goes to both as a literal, so that _fmt checks it while compiling
+#define COMPARE( pattern, ... ) do {                                    \
+        char expected[ 128 ], formatted[ 128 ];                         \
+        std::snprintf( expected, sizeof expected, pattern, __VA_ARGS__ ); \
+        format_to( formatted, sizeof formatted, pattern##_fmt( __VA_ARGS__ ) ); \
+        compare( pattern, expected, formatted );                        \
+    } while ( 0 )
+
+int
+main( int argc, char ** argv )
+{
+    verbose = argc > 1 && std::strcmp( argv[ 1 ], "-v" ) == 0;
+
+    for ( int32_t v: { 0, 1, -1, 42, -42, 123456, -2147483647 - 1, 2147483647 } ) {
+        COMPARE( "%d", v );
+        COMPARE( "%5d|", v );
+        COMPARE( "%-5d|", v );
+        COMPARE( "%05d", v );
+        COMPARE( "%012i", v );
+    }
+    for ( uint32_t v: { 0u, 1u, 0x1fu, 0xabcdu, 0xdeadbeefu, 0xffffffffu } ) {
+        COMPARE( "%u", v );
+        COMPARE( "%x", v );
+        COMPARE( "%X", v );
+        COMPARE( "%08x", v );
+        COMPARE( "%#x", v );
+        COMPARE( "%#X", v );
+        COMPARE( "%#08x", v );
+        COMPARE( "%#012X", v );
+        COMPARE( "%-#10x|", v );
+        COMPARE( "%#10x|", v );
+    }
+    for ( int64_t v: { int64_t( 0 ), int64_t( -9000000000000000000LL ), int64_t( 1234567890123LL ) } ) {
+        COMPARE( "%lld", (long long)v );
+        COMPARE( "%020lld", (long long)v );
+        COMPARE( "%llx", (unsigned long long)v );
+        COMPARE( "%#018llx", (unsigned long long)v );
+    }
+    for ( const char * s: { "", "a", "abc", "abcdef" } ) {
+        COMPARE( "%s|", s );
+        COMPARE( "%5s|", s );
+        COMPARE( "%-5s|", s );
+        COMPARE( "%.3s|", s );
+        COMPARE( "%.0s|", s );
+        COMPARE( "%5.2s|", s );
+        COMPARE( "%-5.2s|", s );
+    }
+    for ( double v: { 0.0, -0.0, 1.5, -1.5, 2.5, 3.14159, -0.000123, 1e10, 123456.789 } ) {
+        COMPARE( "%f", v );
+        COMPARE( "%.0f", v );
+        COMPARE( "%.3f", v );
+        COMPARE( "%10.2f|", v );
+        COMPARE( "%-10.2f|", v );
+        COMPARE( "%010.3f", v );
+    }
+    COMPARE( "%c|%3c|%-3c|", 'a', 'b', 'c' );
+    COMPARE( "100%% %d%%", 5 );
+    COMPARE( "T=%d P=%u", int32_t( -1234 ), uint32_t( 101325 ) );
+
+    // the fixed point argument prints its exact value
+    char formatted[ 64 ];
+    format_to( formatted, sizeof formatted, "%.3f %08.2f"_fmt( fixed< 16 >( 3.25 ), fixed< 8 >( -1.5 ) ) );
+    compare( "fixed<>", "3.250 -0001.50", formatted );
+
+    // truncation: the return value is the stored length, as strlen
+    char small[ 5 ];
+    const size_t n = format_to( small, sizeof small, "%d"_fmt( 123456 ) );
+    compare( "trunc", "1234", small );
+    if ( n != std::strlen( small ) ) {
+        ++failures;
+        std::printf( "FAIL trunc: format_to returned %zu\n", n );
+    }
+
+    std::printf( "format: %d conversions, %d failed\n", count, failures );
+    return failures ? 1 : 0;
+}
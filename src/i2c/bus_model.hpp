@@ -0,0 +1,56 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+
+#pragma once
+
+#include "i2c.hpp"
+#include "i2c_bits.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// Register level helpers shared by the host models of the I2C engines.
+//
+// The engines take a 'volatile I2C&'; on the host that is plain memory, so the side effects of
+// the real peripheral (SR1 then SR2 read clears ADDR, DR read pops the receiver, SR1 read then
+// CR1 write clears STOPF) are applied by the model after each handler call, from what changed.
+
+namespace i2c_model {
+
+    using namespace stm32f103;
+
+    constexpr uint32_t dr_empty = 0x100;   // DR as seen by the handler when nothing was written
+
+    // I2Cx_EV is pending while ITEVTEN and an event flag, or ITBUFEN and TxE/RxNE, are set
+    inline bool event_pending( const I2C& r ) {
+        return ( r.CR2 & ITEVTEN )
+            && ( ( r.SR1 & ( SB | ADDR | ADD10 | BTF | STOPF ) ) || ( ( r.CR2 & ITBUFFN ) && ( r.SR1 & ( TxE | RxNE ) ) ) );
+    }
+
+    inline bool error_pending( const I2C& r ) {
+        return ( r.CR2 & ITERREN ) && ( r.SR1 & error_condition );
+    }
+
+    struct snapshot {
+        uint32_t cr1, cr2, sr1, dr;
+        snapshot( const I2C& r ) : cr1( r.CR1 ), cr2( r.CR2 ), sr1( r.SR1 ), dr( r.DR ) {}
+        bool operator == ( const snapshot& t ) const {
+            return cr1 == t.cr1 && cr2 == t.cr2 && sr1 == t.sr1 && dr == t.dr;
+        }
+    };
+
+    struct checker {
+        std::string name;
+        int failures;
+        checker() : failures( 0 ) {}
+        void operator()( bool condition, const char * what ) {
+            if ( ! condition ) {
+                if ( failures++ < 4 )
+                    std::printf( "FAIL %s: %s\n", name.c_str(), what );
+            }
+        }
+    };
+
+}
@@ -0,0 +1,371 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+
+// Host model of the I2C master peripheral driving shell/i2c_master.hpp through SR1/SR2 sequences
+//
+//   make CXX=g++ && ./master
+//
+// The bus is clocked a byte at a time as RM0008 26.3.3 describes it: START sets SB, the address
+// byte sets ADDR or AF, the transmitter sets TxE and BTF, the receiver holds up to two bytes
+// (DR and the shift register, RxNE then BTF with SCL stretched).  The slave checks what it is
+// given: the last byte of a read must be the only NACKed one, STOP must follow it.  Every
+// interrupt taken must change something; a handler call that leaves registers, buffer and state
+// as they were counts as a spurious interrupt (a storm on the target).  'latency' clocks the bus
+// that many times between interrupts, so TxE and BTF can arrive together.
+
+#include "bus_model.hpp"
+#include "i2c_master.hpp"
+#include <cstring>
+#include <deque>
+#include <vector>
+
+using namespace i2c_model;
+
+namespace {
+
+    constexpr uint8_t sentinel = 0xee;     // unread rx buffer
+
+    struct slave_device {
+        uint8_t address;
+        bool present;
+        size_t nack_at;                    // write data byte to NACK, -1: none
+        bool arlo_at_first_byte;           // lose arbitration on the first data byte
+        std::vector< uint8_t > written;
+        size_t read;                       // bytes sent
+        static uint8_t data( size_t i ) { return uint8_t( 0x40 + i ); }
+    };
+
+    class bus {
+        enum phase_type { idle, address, addressed, transmit, receive, nacked };
+
+        I2C r_;
+        i2c_master master_;
+        slave_device& slave_;
+        checker& check_;
+        i2c_transaction * t_;
+
+        phase_type phase_;
+        bool reading_;
+        bool tx_dr_, tx_shift_;            // transmitter: DR and shift register full
+        uint8_t tx_dr_byte_, tx_shift_byte_;
+        std::deque< uint8_t > held_;       // receiver: DR, then the shift register
+        bool rx_done_;                     // NACKed byte received
+        bool ack_before_;                  // ACK at the previous acknowledge, for POS
+        size_t filled_;                    // rx buffer entries the handler wrote
+
+    public:
+        size_t spurious;
+        size_t events;
+
+        bus( slave_device& s, checker& c ) : r_{}, master_{}, slave_( s ), check_( c ), t_( nullptr )
+                                           , phase_( idle ), spurious( 0 ), events( 0 ) {
+            r_.CR1 = PE | ACK;
+            r_.CR2 = 36;                   // FREQ only, interrupts off while idle
+            r_.DR = dr_empty;
+        }
+
+        const I2C& regs() const { return r_; }
+
+        i2c_transaction * run( i2c_transaction& t, size_t latency ) {
+            t_ = &t;
+            filled_ = 0;
+            reading_ = false;
+            held_.clear();
+            rx_done_ = false;
+            tx_dr_ = tx_shift_ = false;
+            master_.start( r_, &t );
+            i2c_transaction * done = nullptr;
+            for ( size_t clocks = 0; clocks < 10000; ++clocks ) {
+                clock();
+                if ( done ) {
+                    if ( phase_ == idle )
+                        return done;
+                    continue;
+                }
+                if ( ( clocks % latency ) != latency - 1 )
+                    continue;
+                // the handler runs until nothing is pending, as the NVIC would re-enter it
+                for ( int n = 0; n < 64 && !done && ( error_pending( r_ ) || event_pending( r_ ) ); ++n )
+                    done = interrupt();
+            }
+            check_( false, done ? "bus did not return to idle" : "transaction did not complete" );
+            return done;
+        }
+
+    private:
+        i2c_transaction * interrupt() {
+            const bool error = error_pending( r_ );
+            const snapshot before( r_ );
+            const auto state = master_.state();
+            const size_t filled = filled_;
+            const uint32_t sr1 = r_.SR1;
+
+            if ( phase_ != receive || held_.empty() )
+                r_.DR = dr_empty;
+            else
+                r_.DR = held_.front();
+
+            ++events;
+            i2c_transaction * done = error ? master_.error( r_ ) : master_.event( r_ );
+
+            count_reads();
+            if ( ( sr1 & ADDR ) && !error ) {
+                check_( ( master_.state() != i2c_master::read_start && master_.state() != i2c_master::write_start ) || done
+                        , "ADDR handled without leaving the start state" );
+                r_.SR1 &= ~ADDR;           // SR1 then SR2 read
+                addr_cleared();
+            }
+            if ( r_.DR != dr_empty && phase_ != receive )
+                dr_written( uint8_t( r_.DR ) );
+            r_.DR = dr_empty;
+
+            if ( !done && state == master_.state() && snapshot( r_ ) == before && filled == filled_ )
+                ++spurious;
+            return done;
+        }
+
+        // DR reads show up as rx buffer entries; each pops the receiver
+        void count_reads() {
+            if ( t_->rx == nullptr )
+                return;
+            size_t n = filled_;
+            while ( n < t_->rx_size && t_->rx[ n ] != sentinel )
+                ++n;
+            for ( size_t i = filled_; i < n; ++i ) {
+                check_( !held_.empty(), "DR read with RxNE clear" );
+                if ( held_.empty() )
+                    break;
+                t_->rx[ i ] = held_.front();   // a second read in one call sees the byte the shift register moved up
+                held_.pop_front();
+            }
+            filled_ = n;
+            r_.SR1 &= ~( RxNE | BTF );
+            if ( !held_.empty() )
+                r_.SR1 |= RxNE;
+        }
+
+        void addr_cleared() {
+            if ( reading_ ) {
+                phase_ = receive;
+                if ( t_->rx_size == 1 ) {
+                    check_( !( r_.CR1 & ACK ), "N=1: ACK still set when ADDR was cleared" );
+                    check_( r_.CR1 & STOP, "N=1: STOP not set after ADDR" );
+                } else if ( t_->rx_size == 2 ) {
+                    check_( !( r_.CR1 & ACK ) && ( r_.CR1 & POS ), "N=2: POS/ACK not set up at ADDR" );
+                }
+                const bool itbuf = t_->rx_size == 1 || t_->rx_size > 3;  // N = 2, 3 are paced by BTF
+                check_( bool( r_.CR2 & ITBUFFN ) == itbuf, "ITBUFEN wrong for the read length" );
+            } else {
+                phase_ = transmit;
+                r_.SR1 |= TxE;
+            }
+        }
+
+        void dr_written( uint8_t byte ) {
+            if ( phase_ == address ) {
+                check_( r_.SR1 & SB, "address written without SB" );
+                r_.SR1 &= ~SB;
+                tx_dr_byte_ = byte;
+                tx_dr_ = true;
+                return;
+            }
+            check_( phase_ == transmit, "DR written outside of a write phase" );
+            check_( !tx_dr_, "DR written while full" );
+            tx_dr_ = true;
+            tx_dr_byte_ = byte;
+            r_.SR1 &= ~( TxE | BTF );
+        }
+
+        void generate_stop() {
+            r_.CR1 &= ~STOP;
+            r_.SR2 &= ~( MSL | BUSY );
+            if ( phase_ == receive )       // DR keeps what was received until it is read
+                check_( slave_.read == t_->rx_size && rx_done_, "STOP before the last byte of a read" );
+            else
+                r_.SR1 &= ~( TxE | BTF );
+            phase_ = idle;
+        }
+
+        void clock() {
+            if ( ( r_.CR1 & START ) && ( phase_ == idle || phase_ == transmit ) && !tx_shift_ && !tx_dr_ ) {
+                r_.CR1 &= ~START;
+                r_.SR1 = ( r_.SR1 & error_condition ) | SB;
+                r_.SR2 |= MSL | BUSY;
+                phase_ = address;
+                return;
+            }
+            switch ( phase_ ) {
+            case idle:
+            case addressed:
+                break;
+            case address:
+                if ( tx_dr_ ) {
+                    tx_dr_ = false;
+                    reading_ = tx_dr_byte_ & 1;
+                    if ( !reading_ )
+                        slave_.written.clear();
+                    slave_.read = 0;
+                    if ( slave_.present && ( tx_dr_byte_ >> 1 ) == slave_.address ) {
+                        ack_before_ = r_.CR1 & ACK;
+                        r_.SR1 |= ADDR;
+                        if ( reading_ )
+                            r_.SR2 &= ~TRA;
+                        else
+                            r_.SR2 |= TRA;
+                        phase_ = addressed;
+                    } else {
+                        r_.SR1 |= AF;
+                        phase_ = nacked;
+                    }
+                }
+                break;
+            case transmit:
+                if ( tx_shift_ ) {
+                    tx_shift_ = false;
+                    if ( slave_.arlo_at_first_byte ) {
+                        r_.SR1 |= ARLO;
+                        r_.SR2 &= ~( MSL | TRA );
+                        phase_ = nacked;
+                        return;
+                    }
+                    if ( slave_.written.size() == slave_.nack_at ) {
+                        slave_.written.push_back( tx_shift_byte_ );
+                        r_.SR1 |= AF;
+                        phase_ = nacked;
+                        return;
+                    }
+                    slave_.written.push_back( tx_shift_byte_ );
+                    if ( !tx_dr_ )
+                        r_.SR1 |= BTF;
+                }
+                if ( tx_dr_ ) {
+                    tx_shift_byte_ = tx_dr_byte_;
+                    tx_dr_ = false;
+                    tx_shift_ = true;
+                    r_.SR1 |= TxE;
+                } else if ( ( r_.CR1 & STOP ) && !tx_shift_ ) {
+                    generate_stop();
+                }
+                break;
+            case receive:
+                if ( rx_done_ ) {
+                    if ( r_.CR1 & STOP )
+                        generate_stop();
+                    break;
+                }
+                if ( held_.size() < 2 ) {
+                    const bool ack = ( r_.CR1 & POS ) ? ack_before_ : ( r_.CR1 & ACK );
+                    ack_before_ = r_.CR1 & ACK;
+                    const size_t i = slave_.read++;
+                    held_.push_back( slave_device::data( i ) );
+                    r_.SR1 |= RxNE;
+                    if ( held_.size() == 2 )
+                        r_.SR1 |= BTF;
+                    if ( i + 1 == t_->rx_size ) {
+                        check_( !ack, "last byte of a read was ACKed" );
+                        rx_done_ = true;
+                    } else {
+                        check_( ack, "NACK before the last byte of a read" );
+                        rx_done_ = !ack;
+                    }
+                }
+                break;
+            case nacked:
+                if ( r_.CR1 & STOP ) {
+                    check_( !( r_.SR1 & error_condition ), "error flags still set at STOP" );
+                    generate_stop();
+                } else if ( !( r_.SR2 & MSL ) && !( r_.SR1 & error_condition ) ) {
+                    phase_ = idle;         // arbitration lost: the other master owns the bus
+                }
+                break;
+            }
+        }
+    };
+
+    struct scenario {
+        const char * name;
+        size_t tx_size;
+        size_t rx_size;
+        bool present;
+        size_t nack_at;
+        bool arlo;
+        I2C_RESULT_CODE expect;
+    };
+
+    int
+    run( const scenario& s, size_t latency, bool verbose )
+    {
+        checker check;
+        char name[ 80 ];
+        std::snprintf( name, sizeof( name ), "%s tx=%zu rx=%zu latency=%zu", s.name, s.tx_size, s.rx_size, latency );
+        check.name = name;
+
+        slave_device slave{ 0x76, s.present, s.nack_at, s.arlo, {}, 0 };
+        bus b( slave, check );
+
+        std::vector< uint8_t > tx( s.tx_size ), rx( s.rx_size + 1, sentinel );
+        for ( size_t i = 0; i < tx.size(); ++i )
+            tx[ i ] = uint8_t( 0xa0 + i );
+
+        i2c_transaction t{};
+        t.address = slave.address;
+        t.tx = tx.data();
+        t.tx_size = tx.size();
+        t.rx = s.rx_size ? rx.data() : nullptr;
+        t.rx_size = s.rx_size;
+        t.result = I2C_TRANSACTION_PENDING;
+
+        auto done = b.run( t, latency );
+        check( done == &t, "engine returned another transaction" );
+        check( t.result == s.expect, "unexpected result code" );
+        check( b.spurious == 0, "spurious interrupts" );
+        const auto& r = b.regs();
+        check( !( r.CR2 & ( ITBUFFN | ITEVTEN | ITERREN ) ), "interrupt enables not restored" );
+        check( ( r.CR1 & ACK ) && !( r.CR1 & POS ), "ACK/POS not restored" );
+        check( !( r.SR1 & error_condition ), "error flags left set" );
+
+        if ( s.expect == I2C_RESULT_SUCCESS ) {
+            check( slave.written == tx || ( s.tx_size == 0 && slave.written.empty() ), "slave received other bytes" );
+            for ( size_t i = 0; i < s.rx_size; ++i )
+                check( rx[ i ] == slave_device::data( i ), "rx data" );
+            check( rx[ s.rx_size ] == sentinel, "rx buffer overrun" );
+        }
+        if ( verbose || check.failures )
+            std::printf( "%-40s %3zu events %s\n", name, b.events, check.failures ? "FAIL" : "OK" );
+        return check.failures;
+    }
+}
+
+int
+main( int argc, char ** argv )
+{
+    const bool verbose = argc > 1 && std::strcmp( argv[ 1 ], "-v" ) == 0;
+    const size_t none = size_t( -1 );
+    std::vector< scenario > scenarios = {
+        { "probe",               0, 0, true,  none, false, I2C_RESULT_SUCCESS }
+        , { "probe absent",      0, 0, false, none, false, I2C_IRQ_MASTER_ADDRESS_NACK }
+        , { "read absent",       0, 2, false, none, false, I2C_IRQ_MASTER_ADDRESS_NACK }
+        , { "write data nack",   4, 0, true,  1,    false, I2C_IRQ_MASTER_DATA_NACK }
+        , { "write arlo",        3, 0, true,  none, true,  I2C_IRQ_MASTER_BUS_ERROR }
+        , { "write-read nack",   2, 3, true,  0,    false, I2C_IRQ_MASTER_DATA_NACK }
+    };
+    for ( size_t tx = 0; tx <= 3; ++tx ) {
+        for ( size_t rx: { 0, 1, 2, 3, 4, 5, 6, 10 } ) {
+            if ( tx || rx )
+                scenarios.push_back( { tx && rx ? "write-read" : tx ? "write" : "read", tx, rx, true, none, false, I2C_RESULT_SUCCESS } );
+        }
+    }
+
+    int failures = 0;
+    size_t runs = 0;
+    for ( const auto& s: scenarios ) {
+        for ( size_t latency = 1; latency <= 3; ++latency ) {
+            failures += run( s, latency, verbose ) ? 1 : 0;
+            ++runs;
+        }
+    }
+    std::printf( "i2c_master: %zu runs, %d failed\n", runs, failures );
+    return failures ? 1 : 0;
+}
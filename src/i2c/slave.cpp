@@ -0,0 +1,288 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+
+// Host model of the I2C slave peripheral driving shell/i2c_slave.hpp with synthetic SR1/SR2 events
+//
+//   make CXX=g++ && ./slave [-v]
+//
+// A scripted master runs the transactions a Linux i2c-dev master issues against a register
+// file: pointer writes, data writes, reads after a repeated START or after STOP, reads past the
+// end of the file, and bulk reads on the DMA hand-off.  The slave peripheral raises ADDR (with
+// TRA), RxNE, TxE, STOPF and AF the way RM0008 26.3.2 describes; an interrupt is only delivered
+// when its enable bits are set, and every flag must be gone once the handler returns.
+
+#include "bus_model.hpp"
+#include "i2c_slave.hpp"
+#include <cstring>
+#include <initializer_list>
+#include <vector>
+
+using namespace i2c_model;
+
+namespace {
+
+    constexpr size_t file_size = 256;
+    constexpr size_t writable = 16;
+
+    uint8_t registers[ file_size ];
+
+    struct dma_model {
+        const uint8_t * data;
+        size_t size;
+        size_t sent;
+        bool running;
+        size_t starts, stops;
+    } dma;
+
+    bool dma_start( const uint8_t * data, size_t size ) {
+        dma.data = data;
+        dma.size = size;
+        dma.sent = 0;
+        dma.running = true;
+        ++dma.starts;
+        return true;
+    }
+
+    void dma_stop() {
+        dma.running = false;
+        ++dma.stops;
+    }
+
+    struct write_record { uint8_t pointer; size_t count; };
+    std::vector< write_record > writes;
+
+    void on_write( uint8_t pointer, size_t count ) {
+        writes.push_back( { pointer, count } );
+    }
+
+    class bus {
+        I2C r_;
+        i2c_slave& slave_;
+        checker& check_;
+        bool shift_full_;                  // transmitter: DR moved to the shift register
+    public:
+        bus( i2c_slave& s, checker& c ) : r_{}, slave_( s ), check_( c ), shift_full_( false ) {
+            r_.CR1 = PE | ACK;
+            r_.CR2 = ITEVTEN | ITERREN | 36;
+            r_.DR = dr_empty;
+        }
+
+        volatile I2C& regs() { return r_; }
+
+        // S addr+R/W
+        void address( bool read ) {
+            shift_full_ = false;
+            r_.SR1 |= ADDR;
+            r_.SR2 = BUSY | ( read ? TRA : 0 );
+            event( "ADDR" );
+            r_.SR1 &= ~ADDR;               // SR1 then SR2 read
+            check_( bool( r_.CR2 & ITBUFFN ) != bool( r_.CR2 & DMAEN ), "ITBUFEN and DMAEN after ADDR" );
+            if ( read )
+                r_.SR1 |= TxE;
+        }
+
+        // master -> slave byte, ACKed
+        void write( uint8_t byte ) {
+            r_.DR = byte;
+            r_.SR1 |= RxNE;
+            check_( event_pending( r_ ), "RxNE not enabled in a write" );
+            event( "RxNE" );
+            r_.SR1 &= ~RxNE;               // DR read
+        }
+
+        // slave -> master byte; DR moves to the shift register and TxE asks for the next one
+        uint8_t read() {
+            fill();
+            check_( shift_full_, "no byte for the master" );
+            const uint8_t byte = uint8_t( r_.DR );
+            r_.DR = dr_empty;
+            shift_full_ = false;
+            r_.SR1 |= TxE;
+            fill();                        // the slave preloads the next byte while this one goes out
+            return byte;
+        }
+
+        // master NACK after the last byte it reads, then STOP or a repeated START
+        void nack() {
+            r_.SR1 |= AF;
+            check_( error_pending( r_ ), "AF not enabled" );
+            slave_.error( r_ );
+            check_( !( r_.SR1 & error_condition ), "AF left set: error interrupt storm" );
+            r_.SR1 &= ~TxE;
+            shift_full_ = false;
+            r_.DR = dr_empty;
+        }
+
+        void stop() {
+            r_.SR1 |= STOPF;
+            r_.SR2 &= ~BUSY;
+            event( "STOPF" );
+            r_.SR1 &= ~STOPF;              // SR1 read then CR1 write
+        }
+
+        void bus_error() {
+            r_.SR1 |= BERR;
+            slave_.error( r_ );
+            check_( !( r_.SR1 & error_condition ), "BERR left set" );
+        }
+
+        void idle_check() {
+            check_( !( r_.CR2 & ( ITBUFFN | DMAEN ) ), "ITBUFEN/DMAEN left on between transactions" );
+            check_( slave_.state() == i2c_slave::idle, "slave not idle between transactions" );
+            check_( !dma.running, "DMA channel left running" );
+        }
+
+    private:
+        void event( const char * what ) {
+            if ( !event_pending( r_ ) ) {
+                check_( false, what );
+                return;
+            }
+            slave_.event( r_ );
+        }
+
+        // TxE: the handler (or the DMA channel) writes DR
+        void fill() {
+            if ( shift_full_ || !( r_.SR1 & TxE ) )
+                return;
+            if ( r_.CR2 & DMAEN ) {
+                if ( dma.running && dma.sent < dma.size ) {
+                    r_.DR = dma.data[ dma.sent++ ];
+                } else if ( dma.running ) {
+                    dma.running = false;   // TC: the channel callback hands the rest to TxE
+                    slave_.dma_complete( r_ );
+                    return fill();
+                }
+            } else if ( event_pending( r_ ) ) {
+                slave_.event( r_ );
+            }
+            if ( r_.DR != dr_empty ) {
+                shift_full_ = true;
+                r_.SR1 &= ~TxE;
+            }
+        }
+    };
+
+    uint8_t expected( size_t i ) { return i < file_size ? uint8_t( i * 7 + 1 ) : 0xff; }
+
+    int
+    run( const char * name, size_t dma_threshold, bool stopf_after_nack, bool verbose )
+    {
+        checker check;
+        check.name = std::string( name ) + ( stopf_after_nack ? " (STOPF after NACK)" : "" );
+
+        for ( size_t i = 0; i < file_size; ++i )
+            registers[ i ] = expected( i );
+        dma = dma_model{};
+        writes.clear();
+
+        static i2c_slave slave;
+        slave = i2c_slave{};
+        slave.configure( registers, file_size, writable );
+        slave.set_write_callback( on_write );
+        slave.set_dma( dma_threshold, dma_threshold ? dma_start : nullptr, dma_threshold ? dma_stop : nullptr );
+        bus b( slave, check );
+
+        auto read = [&]( size_t n, std::vector< uint8_t >& data ) {
+            data.clear();
+            b.address( true );
+            for ( size_t i = 0; i < n; ++i )
+                data.push_back( b.read() );
+            b.nack();
+            if ( stopf_after_nack )
+                b.stop();
+        };
+        std::vector< uint8_t > data;
+
+        // pointer write, then a read after a repeated START (i2c_smbus_read_i2c_block_data)
+        b.address( false );
+        b.write( 0x20 );
+        read( 8, data );
+        b.idle_check();
+        check( slave.pointer() == 0x20, "pointer" );
+        for ( size_t i = 0; i < data.size(); ++i )
+            check( data[ i ] == expected( 0x20 + i ), "read after repeated START" );
+        check( writes.empty(), "write callback for a pointer-only write" );
+
+        // register write into the writable region, across its end
+        b.address( false );
+        const uint8_t values[] = { 0xa0, 0xa1, 0xa2, 0xa3, 0xa4 };
+        b.write( writable - 3 );
+        for ( auto v: values )
+            b.write( v );
+        b.stop();
+        b.idle_check();
+        check( writes.size() == 1 && writes[ 0 ].pointer == writable - 3 && writes[ 0 ].count == 5, "write callback" );
+        for ( size_t i = 0; i < 3; ++i )
+            check( registers[ writable - 3 + i ] == values[ i ], "writable register" );
+        for ( size_t i = writable; i < writable + 2; ++i )
+            check( registers[ i ] == expected( i ), "read-only register written" );
+
+        // read after STOP starts at the last pointer again, and only the sent bytes are counted
+        const auto before = slave.stats().bytes_read;
+        b.address( false );
+        b.write( 0 );
+        b.stop();
+        read( 4, data );
+        b.idle_check();
+        check( data[ 0 ] == expected( 0 ) && data[ 3 ] == expected( 3 ), "read after STOP" );
+        if ( !dma_threshold )
+            check( slave.stats().bytes_read - before == 4, "bytes_read counts the preloaded byte" );
+
+        // bulk read from near the end of the file: the file, then 0xff
+        b.address( false );
+        b.write( file_size - 200 );
+        read( 220, data );
+        b.idle_check();
+        for ( size_t i = 0; i < data.size(); ++i )
+            check( data[ i ] == expected( file_size - 200 + i ), "bulk read" );
+
+        // short read of a long tail: the master NACKs while the DMA channel is still running
+        b.address( false );
+        b.write( 0x10 );
+        read( 3, data );
+        b.idle_check();
+        check( data[ 2 ] == expected( 0x12 ), "short read" );
+
+        // a bus error in the middle of a write ends it; the next transaction is served
+        b.address( false );
+        b.write( 2 );
+        b.write( 0x55 );
+        b.bus_error();
+        b.idle_check();
+        check( slave.stats().errors == 1, "BERR not counted" );
+        check( registers[ 2 ] == 0x55 && writes.size() == 2 && writes[ 1 ].count == 1, "write ended by BERR" );
+        read( 2, data );
+        check( data[ 0 ] == 0x55 && data[ 1 ] == expected( 3 ), "read after BERR" );
+        b.idle_check();
+
+        const auto& st = slave.stats();
+        if ( dma_threshold ) {
+            check( dma.starts == 5 && st.dma_reads == 5, "DMA reads" );
+            check( dma.stops == 4, "dma_stop on the NACK of a running channel" );  // the bulk read ran out
+        } else {
+            check( dma.starts == 0, "DMA used without a threshold" );
+        }
+        check( st.writes == 6 && st.reads == 5, "transaction counts" );
+
+        if ( verbose || check.failures )
+            std::printf( "%-50s writes %u reads %u dma %u: %s\n", check.name.c_str(), st.writes, st.reads, st.dma_reads
+                         , check.failures ? "FAIL" : "OK" );
+        return check.failures;
+    }
+}
+
+int
+main( int argc, char ** argv )
+{
+    const bool verbose = argc > 1 && std::strcmp( argv[ 1 ], "-v" ) == 0;
+    int failures = 0;
+    for ( bool stopf: { false, true } ) {
+        failures += run( "interrupt", 0, stopf, verbose ) ? 1 : 0;
+        failures += run( "dma threshold 32", 32, stopf, verbose ) ? 1 : 0;
+    }
+    std::printf( "i2c_slave: 4 runs, %d failed\n", failures );
+    return failures ? 1 : 0;
+}
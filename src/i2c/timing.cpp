@@ -0,0 +1,137 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+
+// Sweep of shell/i2c_timing.hpp over PCLK1 2..50MHz and SCL 1k..400kHz in 1kHz steps
+//
+//   make CXX=g++ && ./timing [-v]
+//
+// Each result is checked against the register semantics of RM0008 26.6.8/26.6.9 rather than
+// against the formulas of the calculator: the SCL period rebuilt from CCR, F/S and DUTY must not
+// be shorter than requested, one step less of CCR must be too fast (unless CCR is at its
+// minimum), the I2C specification's minimum SCL low and high times must hold, and TRISE must be
+// the maximum rise time in PCLK1 cycles plus one.
+
+#include "i2c_timing.hpp"
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
+
+using namespace stm32f103;
+
+namespace {
+
+    int failures = 0;
+
+    void
+    fail( uint32_t pclk1, uint32_t speed, const char * what )
+    {
+        if ( failures++ < 10 )
+            std::printf( "FAIL pclk1=%u speed=%u: %s\n", pclk1, speed, what );
+    }
+
+    // SCL period in PCLK1 cycles for a CCR register value; low and high parts
+    void
+    period( uint32_t ccr, uint32_t& low, uint32_t& high )
+    {
+        const uint32_t n = ccr & CCR_CCR;
+        if ( !( ccr & CCR_FS ) ) {
+            low = high = n;
+        } else if ( ccr & CCR_DUTY ) {
+            low = 16 * n;
+            high = 9 * n;
+        } else {
+            low = 2 * n;
+            high = n;
+        }
+    }
+
+    void
+    check( uint32_t pclk1, uint32_t speed, bool verbose )
+    {
+        const auto t = i2c_timing::make( pclk1, speed );
+        const uint32_t mhz = pclk1 / 1000000;
+        const bool fast = speed > i2c_standard_mode;
+
+        if ( fast && mhz < 4 ) {
+            if ( t.valid() )
+                fail( pclk1, speed, "Fm accepted with PCLK1 under 4MHz" );
+            return;
+        }
+        if ( !fast && ( pclk1 + 2 * speed - 1 ) / ( 2 * speed ) > CCR_CCR ) {
+            if ( t.valid() )
+                fail( pclk1, speed, "CCR over 12 bits accepted" );
+            return;
+        }
+        if ( !t.valid() ) {
+            fail( pclk1, speed, "rejected" );
+            return;
+        }
+        if ( t.freq != mhz )
+            fail( pclk1, speed, "FREQ is not PCLK1 in MHz" );
+        if ( t.fast() != fast )
+            fail( pclk1, speed, "F/S does not match the requested mode" );
+        if ( ( t.ccr & CCR_DUTY ) && !fast )
+            fail( pclk1, speed, "DUTY set in Sm" );
+        if ( ( t.ccr & CCR_CCR ) < ( fast ? 1u : 4u ) )
+            fail( pclk1, speed, "CCR under its minimum" );
+
+        uint32_t low, high;
+        period( t.ccr, low, high );
+        const uint64_t cycles = low + high;
+        if ( uint64_t( speed ) * cycles < pclk1 )
+            fail( pclk1, speed, "SCL faster than requested" );
+        if ( t.speed != pclk1 / cycles )
+            fail( pclk1, speed, "reported speed is not the register setting" );
+
+        // one less of CCR in the same duty would exceed the request (the result is the closest)
+        if ( ( t.ccr & CCR_CCR ) > ( fast ? 1u : 4u ) ) {
+            uint32_t l, h;
+            period( t.ccr - 1, l, h );
+            if ( uint64_t( speed ) * ( l + h ) >= pclk1 )
+                fail( pclk1, speed, "CCR is not the smallest for the duty" );
+        }
+
+        // UM10204 table 10: tLOW >= 4.7us / 1.3us, tHIGH >= 4.0us / 0.6us
+        const double ns = 1.0e9 / pclk1;
+        if ( low * ns < ( fast ? 1300 : 4700 ) || high * ns < ( fast ? 600 : 4000 ) )
+            fail( pclk1, speed, "SCL low/high time under the I2C minimum" );
+
+        const uint32_t rise_ns = fast ? 300 : 1000;
+        if ( t.trise != mhz * rise_ns / 1000 + 1 )
+            fail( pclk1, speed, "TRISE" );
+
+        if ( verbose )
+            std::printf( "%2uMHz %6u -> %6u  CCR=0x%04x TRISE=%2u %s\n", mhz, speed, t.speed, t.ccr, t.trise
+                         , !fast ? "Sm" : ( t.ccr & CCR_DUTY ) ? "Fm 16:9" : "Fm 2:1" );
+    }
+}
+
+int
+main( int argc, char ** argv )
+{
+    const bool verbose = argc > 1 && std::strcmp( argv[ 1 ], "-v" ) == 0;
+    size_t count = 0;
+
+    for ( uint32_t mhz = 2; mhz <= 50; ++mhz ) {
+        for ( uint32_t speed = 1000; speed <= i2c_fast_mode; speed += 1000 ) {
+            const bool shown = speed == 10000 || speed == 100000 || speed == 400000;
+            check( mhz * 1000000, speed, verbose && shown && ( mhz % 2 == 0 ) );
+            ++count;
+        }
+    }
+
+    // outside of what the F1 supports
+    for ( auto pclk1: { 0u, 1000000u, 51000000u } )
+        if ( i2c_timing::make( pclk1, 100000 ).valid() )
+            fail( pclk1, 100000, "PCLK1 out of range accepted" );
+    for ( auto speed: { 0u, 401000u, 1000000u } )
+        if ( i2c_timing::make( 36000000, speed ).valid() )
+            fail( 36000000, speed, "speed out of range accepted" );
+    if ( i2c_timing::make( 2000000, 100 ).valid() )
+        fail( 2000000, 100, "CCR over 12 bits accepted" );
+
+    std::printf( "i2c_timing: %zu settings, %d failed\n", count, failures );
+    return failures ? 1 : 0;
+}
@@ -257,29 +257,12 @@ bool
 AD5593::read(  uint8_t addr, uint8_t * data, size_t size ) const
 {
     if ( i2c_ ) {
-        bool success( false );
-
-        if ( i2c_->has_dma( stm32f103::i2c::DMA_Tx ) ) {
-            success = i2c_->dma_transfer( address_, &addr, 1 );
-        } else {
-            success = i2c_->write( address_, &addr, 1 );
-        }
-        
-        if ( success ) {
-            std::array< uint8_t, 2 > buf = { 0 };
-
-            if ( i2c_->has_dma( stm32f103::i2c::DMA_Rx ) ) {
-                // workaround -- AD5593 often cause a read timeout -- retry up to 5 times --
-                if ( condition_wait( 5 )( [&]{ return i2c_->dma_receive( address_, data, size ); } ) )
-                    return true;
-                else
-                    i2c_->print_result( stream(__FILE__,__LINE__) ) << "\tread -- dma_recieve(" << addr << ") error\n";
-            } else {
-                return i2c_->read( address_, data, size );
-            }
-        } else {
-            i2c_->print_result( stream(__FILE__,__LINE__) ) << "\tread -- write(" << addr << ") error\n";
-        }
+        // pointer byte, repeated START, data
+        // workaround -- AD5593 often cause a read timeout -- retry up to 5 times --
+        if ( condition_wait( 5 )( [&]{ return i2c_->transfer( address_, &addr, 1, data, size ); } ) )
+            return true;
+        else
+            i2c_->print_result( stream(__FILE__,__LINE__) ) << "\tread -- transfer(" << addr << ") error\n";
     }
     return false;
 }
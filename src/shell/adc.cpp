@@ -5,16 +5,28 @@
 //
 
 #include "adc.hpp"
+#include "background.hpp"
+#include "decimator.hpp"
 #include "dma.hpp"
 #include "dma_channel.hpp"
+#include "dma_stream.hpp"
+#include "dwt.hpp"
+#include "fixed.hpp"
+#include "ring_buffer.hpp"
 #include "scoped_spinlock.hpp"
 #include "stm32f103.hpp"
 #include "stream.hpp"
+#include "telemetry.hpp"
+#include "timer.hpp"
 #include <algorithm>
 #include <array>
 #include <atomic>
 #include <mutex>
 
+extern std::atomic< uint32_t > atomic_jiffies;
+extern uint32_t __system_clock;
+extern uint32_t __pclk2;
+
 extern "C" {
     void adc1_handler();
     void enable_interrupt( stm32f103::IRQn_type IRQn );
@@ -22,12 +34,251 @@ extern "C" {
 }
 
 namespace stm32f103 {
-    static dma_channel_t< DMA_ADC1 > * __dma_adc1;
-    static uint8_t __adc1_dma[ sizeof( dma_channel_t< DMA_ADC1 > ) ];
-    static std::array< uint16_t, 4 > __adc1_data;
-    static std::array< uint32_t, 4 > __adc1_accumulated_data;
-    static uint32_t __number_of_adc_samples;
-    static constexpr uint32_t __number_of_accumulation = 4096;
+    constexpr size_t __max_sequence = 16;
+    typedef dma_stream< uint16_t, 2 * 16 * __max_sequence > adc1_stream_type;
+    static adc1_stream_type * __adc1_stream;
+    static uint8_t __adc1_stream_storage[ sizeof( adc1_stream_type ) ] __attribute__( ( aligned( 4 ) ) );
+    static size_t __number_of_channels;     // conversions per scan
+    static size_t __scans_per_half;         // one interrupt per half
+    static bool __triggered;
+
+    // Pipeline: the DMA interrupt only publishes a stable half (dma_stream ready bits); the
+    // 'decimate' background task runs the CIC/boxcar decimator over it and queues decimated
+    // scans; the 'sink' background task emits them as text, telemetry frames, or into a RAM log.
+    struct decimated_scan {
+        uint32_t cycles;
+        std::array< uint16_t, __max_sequence > data;
+    };
+    static cic_decimator< __max_sequence > __decimator;
+    static spsc_ring_buffer< decimated_scan, 16 > __decimated;
+    static adc::sink_type __sink;
+    static uint32_t __ratio;                // 0: default, min( rate, 4096 )
+    static uint32_t __order;
+
+    struct pipeline_counters {
+        uint32_t scans;        // decimate: scans in
+        uint32_t outputs;      // decimate: decimated scans out
+        uint32_t dropped;      // decimate -> sink: queue full
+        uint32_t emitted;      // sink
+        uint32_t busy;         // decimate: DWT cycles spent
+        uint32_t halves;       // stream counters at reset
+        uint32_t overruns;
+        uint32_t late;
+        uint32_t start;        // atomic_jiffies at reset
+    };
+    static pipeline_counters __counters;
+
+    constexpr size_t __log_size = 1024;
+    static std::array< uint16_t, __log_size > __log;
+    static uint32_t __log_head;             // entries written, wraps
+
+    typedef timer_t< TIM4_BASE > adc_trigger_timer;  // TIM4 CC4, EXTSEL = 101
+    constexpr uint32_t adc_trigger_channel = 4;
+
+    // timer triggered acquisition; half interrupts are timestamped on the SysTick time base
+    struct acquisition_stats {
+        uint32_t requested;    // scans/s
+        uint32_t ticks;        // timer clocks per scan
+        uint32_t timer_clock;
+        uint32_t nominal;      // SysTick clocks per half
+        uint32_t halves;
+        uint64_t first;
+        uint64_t last;
+        int32_t min;           // interval - nominal
+        int32_t max;
+        uint64_t sum_sq;
+
+        void reset() {
+            halves = 0;
+            first = last = 0;
+            min = max = 0;
+            sum_sq = 0;
+        }
+
+        void mark( uint64_t t ) {
+            if ( halves++ ) {
+                const int32_t d = int32_t( t - last ) - int32_t( nominal );
+                if ( halves == 2 || d < min )
+                    min = d;
+                if ( halves == 2 || d > max )
+                    max = d;
+                sum_sq += uint64_t( int64_t( d ) * d );
+            } else {
+                first = t;
+            }
+            last = t;
+        }
+    };
+    static acquisition_stats __acquisition;
+
+    typedef timer_t< TIM1_BASE > injected_trigger_timer;  // TIM1 TRGO, JEXTSEL = 000
+
+    // trigger (timer update) to interrupt, in trigger timer counts
+    struct latency_stats {
+        uint32_t count;
+        uint32_t min;
+        uint32_t max;
+        uint64_t sum;
+
+        void add( uint32_t ticks ) {
+            if ( count++ == 0 || ticks < min )
+                min = ticks;
+            if ( ticks > max )
+                max = ticks;
+            sum += ticks;
+        }
+    };
+
+    struct injected_state {
+        bool running;
+        uint8_t channel;
+        uint32_t rate;
+        uint32_t prescaler;    // timer clocks per TIM1 count
+        std::atomic< uint16_t > value;
+        latency_stats latency; // TIM1 update -> JEOC handler
+    };
+    static injected_state __injected;
+
+    struct watchdog_state {
+        bool enabled;
+        uint8_t channel;
+        uint16_t low;
+        uint16_t high;
+        void(*callback)();
+        std::atomic< uint32_t > trips;
+        uint32_t last;         // atomic_jiffies at the last trip
+        latency_stats latency; // TIM1 update -> callback, when the guarded channel is the injected one
+    };
+    static watchdog_state __watchdog;
+
+    // SMPx code -> sample time in half ADC clocks (1.5 .. 239.5 cycles)
+    constexpr uint32_t __sample_halfcycles[] = { 3, 15, 27, 57, 83, 111, 143, 479 };
+
+    // HCLK clocks since boot on the SysTick time base (100us jiffies + down counter)
+    static uint64_t
+    systick_clocks()
+    {
+        auto SYSTICK = reinterpret_cast< volatile STK * >( SYSTICK_BASE );
+        auto scb = reinterpret_cast< volatile SCB * >( SCB_BASE );
+        const uint32_t reload = SYSTICK->RVR + 1;
+        uint32_t jiffies, cvr;
+        bool pending;
+        do {
+            jiffies = atomic_jiffies.load();
+            cvr = SYSTICK->CVR;
+            pending = scb->ICSR & ( 1 << 26 );  // PENDSTSET: wrapped, but the handler has not run (we may have preempted it)
+            if ( pending )
+                cvr = SYSTICK->CVR;             // after the wrap for sure
+        } while ( jiffies != atomic_jiffies.load() );
+        return ( uint64_t( jiffies ) + pending ) * reload + ( reload - 1 - cvr );
+    }
+
+    static uint32_t
+    isqrt( uint64_t x )
+    {
+        uint64_t r = 0, bit = uint64_t( 1 ) << 62;
+        while ( bit > x )
+            bit >>= 2;
+        while ( bit ) {
+            if ( x >= r + bit ) {
+                x -= r + bit;
+                r = ( r >> 1 ) + bit;
+            } else {
+                r >>= 1;
+            }
+            bit >>= 2;
+        }
+        return uint32_t( r );
+    }
+
+    // DMA interrupt: HT and TC publish a stable half of __scans_per_half scans; nothing else
+    static void
+    handle_stream( uint32_t flag )
+    {
+        __adc1_stream->handle_interrupt( flag );
+        if ( __triggered && ( flag & 0x06 ) )
+            __acquisition.mark( systick_clocks() );
+    }
+
+    // background: one published half per call
+    static void
+    decimate()
+    {
+        auto data = __adc1_stream ? __adc1_stream->acquire() : nullptr;
+        if ( data == nullptr )
+            return;
+        const auto t0 = dwt::cycles();
+        __decimator.push( data, __scans_per_half, []( const uint16_t * scan ){
+                decimated_scan out;
+                out.cycles = dwt::cycles();
+                std::copy( scan, scan + __number_of_channels, out.data.begin() );
+                ++__counters.outputs;
+                if ( ! __decimated.push( out ) )
+                    ++__counters.dropped;
+            });
+        __counters.scans += __scans_per_half;
+        __adc1_stream->release(); // false (counted as late) if DMA got here first
+        __counters.busy += dwt::cycles() - t0;
+    }
+
+    // background: up to four decimated scans per call
+    static void
+    sink()
+    {
+        decimated_scan scan;
+        for ( size_t n = 0; n < 4 && __decimated.pop( scan ); ++n ) {
+            ++__counters.emitted;
+            const size_t channels = __number_of_channels;
+            if ( __sink == adc::sink_frames || ( __sink == adc::sink_text && telemetry::enabled() ) ) {
+                const size_t count = std::min( channels, size_t( 8 ) );
+                telemetry_record::adc_record rec = { scan.cycles, uint16_t( std::min( __decimator.ratio(), uint32_t( 0xffff ) ) ), uint16_t( count ), { 0 } };
+                std::copy( scan.data.begin(), scan.data.begin() + count, rec.data );
+                telemetry::post( telemetry_record::adc_block, rec );
+            } else if ( __sink == adc::sink_text ) {
+                for ( size_t i = 0; i < channels; ++i )
+                    stream() << "[" << int( i ) << "]:" << int( scan.data[ i ] ) << "\t";
+                stream() << std::endl;
+            } else if ( __sink == adc::sink_log ) {
+                for ( size_t i = 0; i < channels; ++i )
+                    __log[ __log_head++ % __log_size ] = scan.data[ i ];
+            }
+        }
+    }
+
+    static void
+    reset_counters()
+    {
+        __counters = pipeline_counters();
+        if ( __adc1_stream ) {
+            __counters.halves = __adc1_stream->halves();
+            __counters.overruns = __adc1_stream->overruns();
+            __counters.late = __adc1_stream->late();
+        }
+        __counters.start = atomic_jiffies.load();
+    }
+
+    // (re)starts the pipeline behind a new stream; 'rate' is the nominal scan rate for the default ratio
+    static void
+    start_pipeline( uint32_t rate )
+    {
+        const uint32_t ratio = __ratio ? __ratio : std::max( uint32_t( 1 ), std::min( rate, uint32_t( 4096 ) ) );
+        if ( ! __decimator.configure( __number_of_channels, ratio, __order ? __order : 1 ) )
+            __decimator.configure( __number_of_channels, ratio, 1 ); // the default ratio may not fit a higher order
+        __log_head = 0;
+        reset_counters();
+        background::add( decimate );
+        background::add( sink );
+    }
+
+    static void
+    stop_pipeline()
+    {
+        background::remove( decimate );
+        background::remove( sink );
+        decimated_scan scan;
+        while ( __decimated.pop( scan ) )
+            ;
+    }
 };
 
 
@@ -49,8 +300,16 @@ adc::~adc()
 void
 adc::attach( dma& dma )
 {
-    __dma_adc1 = new (&__adc1_dma) dma_channel_t< DMA_ADC1 >( dma, 0, 0 );
-    __dma_adc1->set_receive_buffer( reinterpret_cast< uint8_t * >(__adc1_data.data()), size_t( __adc1_data.size() ) );
+    if ( __triggered )
+        stop_acquisition( dma );
+    if ( ! dma.try_acquire( DMA_ADC1 ) )
+        return;
+    if ( __adc1_stream )
+        __adc1_stream->stop();
+    stop_pipeline();
+    __adc1_stream = new (&__adc1_stream_storage) adc1_stream_type();
+    __number_of_channels = 4;
+    __scans_per_half = adc1_stream_type::capacity() / 2 / __number_of_channels;  // ~5ms per half
 
     adc_->CR1 |= (1 << 8); // SCAN conv mode
     adc_->CR2 |= 0x07 << 17; // SWSTART
@@ -59,7 +318,7 @@ adc::attach( dma& dma )
 
     constexpr uint8_t sample_time = 07; // 239.5 cycles
     uint32_t smpr = 0;
-    for ( size_t i = 0; i < __adc1_data.size(); ++i )
+    for ( size_t i = 0; i < __number_of_channels; ++i )
         smpr |= sample_time << (3*i);
     adc_->SMPR2 |= smpr;
 
@@ -67,30 +326,300 @@ adc::attach( dma& dma )
     adc_->SQR2 = 0;          // p247, Regular channel sequence, 12th down to 7th
     adc_->SQR3 = 0|(1<<5)|(2<<10)|(3<<15);      // p248, Regular channel sequence [0->1->2->3]
 
-    auto callback = +[]( uint32_t flag ){
-        if ( flag & 02 ) { // transfer complete
-            if ( ( __number_of_adc_samples++ % __number_of_accumulation ) == 0 ) {
-                std::copy( __adc1_data.begin(), __adc1_data.end(), __adc1_accumulated_data.begin() );
-            } else {
-                std::transform( __adc1_data.begin(), __adc1_data.end()
-                                , __adc1_accumulated_data.begin(), __adc1_accumulated_data.begin()
-                                , [](const uint16_t& b, const uint32_t& a){ return a + b; } );
-            }
+    start_pipeline( 4096 );
+    __adc1_stream->start( dma, DMA_ADC1, handle_stream, 2 * __scans_per_half * __number_of_channels );
+}
 
-            if ( ( __number_of_adc_samples % __number_of_accumulation ) == ( __number_of_accumulation - 1 ) ) {
-                int i = 0;
-                for ( const auto& a: __adc1_accumulated_data ) {
-                    stream() << "[" << i << "]:" << int( a / __number_of_accumulation ) << "\t";
-                    ++i;
-                }
-                stream() << std::endl;
-            }
-        }
+bool
+adc::start_acquisition( dma& dma, uint32_t rate, const uint8_t * sequence, const uint8_t * sample_time, size_t count )
+{
+    if ( rate == 0 || count == 0 || count > __max_sequence )
+        return false;
+
+    uint32_t scan_halfcycles = 0;
+    for ( size_t i = 0; i < count; ++i ) {
+        if ( sequence[ i ] > 17 || sample_time[ i ] > 7 )
+            return false;
+        scan_halfcycles += __sample_halfcycles[ sample_time[ i ] ] + 25; // + 12.5 cycles conversion
+    }
+
+    // the scan must complete within a trigger period
+    auto RCC = reinterpret_cast< volatile stm32f103::RCC * >( RCC_BASE );
+    const uint32_t adcclk = __pclk2 / ( 2 * ( ( ( RCC->CFGR >> 14 ) & 3 ) + 1 ) );
+    if ( uint64_t( scan_halfcycles ) * rate > uint64_t( adcclk ) * 2 )
+        return false;
+
+    if ( __triggered || __adc1_stream )
+        stop_acquisition( dma );
+    if ( ! dma.try_acquire( DMA_ADC1 ) )
+        return false;
+
+    __number_of_channels = count;
+    // up to 10ms per half, which is the time the decimate stage has to take it
+    __scans_per_half = std::max( size_t( 1 ), std::min( size_t( rate / 100 ), adc1_stream_type::capacity() / 2 / count ) );
+    if ( ( count & 1 ) && __scans_per_half > 1 )
+        __scans_per_half &= ~size_t( 1 );  // word aligned halves for the packed accumulation (decimator.hpp)
+
+    adc_->CR2 &= ~( ( 1 << 1 ) | ( 1 << 8 ) | ( 7 << 17 ) | ( 1 << 20 ) | ( 1 << 23 ) ); // CONT, DMA, EXTSEL, EXTTRIG, TSVREFE
+    adc_->CR1 = ( adc_->CR1 & ~( 1 << 5 ) ) | ( 1 << 8 ); // SCAN; no EOC interrupt, DMA reads DR
+
+    uint32_t sqr[ 3 ] = { ( count - 1 ) << 20, 0, 0 }; // SQR1 (L, SQ13..16), SQR2 (SQ7..12), SQR3 (SQ1..6)
+    bool internal = false;
+    for ( size_t i = 0; i < count; ++i ) {
+        const uint32_t ch = sequence[ i ];
+        volatile uint32_t& smpr = ch < 10 ? adc_->SMPR2 : adc_->SMPR1;
+        smpr = ( smpr & ~( 7 << ( 3 * ( ch % 10 ) ) ) ) | ( sample_time[ i ] << ( 3 * ( ch % 10 ) ) );
+        sqr[ 2 - i / 6 ] |= ch << ( 5 * ( i % 6 ) );
+        internal |= ch >= 16;
+    }
+    adc_->SQR1 = sqr[ 0 ];
+    adc_->SQR2 = sqr[ 1 ];
+    adc_->SQR3 = sqr[ 2 ];
+    if ( internal )
+        adc_->CR2 |= ( 1 << 23 ); // TSVREFE, temperature sensor and Vrefint
+
+    adc_->CR2 |= ( 1 << 8 ) | ( 5 << 17 ) | ( 1 << 20 ); // DMA, EXTSEL = TIM4 CC4, EXTTRIG
+
+    __adc1_stream = new (&__adc1_stream_storage) adc1_stream_type();
+    start_pipeline( rate );
+    __adc1_stream->start( dma, DMA_ADC1, handle_stream, 2 * __scans_per_half * count );
+
+    adc_trigger_timer timer;
+    __acquisition.reset();
+    __acquisition.requested = rate;
+    __acquisition.timer_clock = adc_trigger_timer::clock();
+    __acquisition.ticks = timer.set_trigger( rate, adc_trigger_channel );
+    __acquisition.nominal = uint32_t( uint64_t( __scans_per_half ) * __acquisition.ticks * __system_clock / __acquisition.timer_clock );
+    __triggered = true;
+
+    return true;
+}
+
+void
+adc::stop_acquisition( dma& dma )
+{
+    if ( __triggered )
+        adc_trigger_timer().enable( false );
+    __triggered = false;
+    if ( __adc1_stream )
+        __adc1_stream->stop();
+    stop_pipeline();
+    __adc1_stream = nullptr;
+    adc_->CR2 &= ~( ( 1 << 1 ) | ( 1 << 8 ) | ( 7 << 17 ) ); // CONT, DMA, EXTSEL
+    adc_->CR2 |= ( 7 << 17 );                                // SWSTART as trigger
+    adc_->CR1 |= ( 1 << 5 );                                 // EOC interrupt for data()
+    dma.release( DMA_ADC1 );
+}
+
+bool
+adc::set_decimation( uint32_t ratio, uint32_t order )
+{
+    cic_decimator< __max_sequence > probe;
+    if ( ! probe.configure( 1, ratio ? ratio : 1, order ? order : 1 ) )
+        return false;
+    __ratio = ratio;
+    __order = order;
+    if ( __adc1_stream ) {
+        stop_pipeline();  // the decimator belongs to the decimate stage; pause it while reconfiguring
+        start_pipeline( __acquisition.requested ? __acquisition.requested : 4096 );
+    }
+    return true;
+}
+
+void
+adc::set_sink( sink_type sink )
+{
+    __sink = sink;
+}
+
+void
+adc::print_pipeline() const
+{
+    static constexpr const char * sink_names [] = { "text", "frames", "log", "none" };
+    const auto& c = __counters;
+    const uint32_t ms = ( atomic_jiffies.load() - c.start ) / 10;
+    auto per_sec = [&]( uint32_t n ){ return int( ms ? uint64_t( n ) * 1000 / ms : 0 ); };
+
+    if ( ! __adc1_stream ) {
+        stream() << "adc pipeline: not running; ratio " << int( __ratio ) << " order " << int( __order ? __order : 1 )
+                 << ", sink " << sink_names[ __sink ] << std::endl;
+        return;
+    }
+    stream() << "adc pipeline: " << ( __decimator.order() == 1 ? "boxcar" : "cic" ) << " order " << int( __decimator.order() )
+             << ", ratio " << int( __decimator.ratio() ) << ", sink " << sink_names[ __sink ]
+             << ", " << int( ms ) << "ms" << std::endl;
+    const uint32_t halves = __adc1_stream->halves() - c.halves;
+    stream() << "\tdma isr:  halves " << int( halves ) << " (" << per_sec( halves ) << "/s)"
+             << "\toverruns " << int( __adc1_stream->overruns() - c.overruns )
+             << "\tbacklog " << int( __adc1_stream->pending() ) << " halves" << std::endl;
+    stream() << "\tdecimate: scans " << int( c.scans ) << " (" << per_sec( c.scans ) << "/s)"
+             << "\tlate " << int( __adc1_stream->late() - c.late )
+             << "\tout " << int( c.outputs ) << " (" << per_sec( c.outputs ) << "/s)"
+             << "\tcycles/scan " << int( c.scans ? c.busy / c.scans : 0 ) << std::endl;
+    stream() << "\tsink:     emitted " << int( c.emitted ) << " (" << per_sec( c.emitted ) << "/s)"
+             << "\tdropped " << int( c.dropped )
+             << "\tbacklog " << int( __decimated.size() ) << std::endl;
+}
+
+void
+adc::print_log() const
+{
+    const size_t channels = std::max( __number_of_channels, size_t( 1 ) );
+    const size_t capacity = ( __log_size / channels ) * channels;
+    const size_t stored = std::min( size_t( __log_head ), capacity );
+    stream() << "adc log: " << int( stored / channels ) << " decimated scans" << std::endl;
+    for ( size_t i = __log_head - stored; i < __log_head; ) {
+        for ( size_t ch = 0; ch < channels; ++ch, ++i )
+            stream() << int( __log[ i % __log_size ] ) << ( ch + 1 < channels ? "\t" : "" );
+        stream() << std::endl;
+    }
+}
+
+bool
+adc::start_injected( uint8_t channel, uint8_t sample_time, uint32_t rate )
+{
+    if ( channel > 17 || sample_time > 7 || rate == 0 )
+        return false;
+    auto RCC = reinterpret_cast< volatile stm32f103::RCC * >( RCC_BASE );
+    const uint32_t adcclk = __pclk2 / ( 2 * ( ( ( RCC->CFGR >> 14 ) & 3 ) + 1 ) );
+    if ( uint64_t( __sample_halfcycles[ sample_time ] + 25 ) * rate > uint64_t( adcclk ) * 2 )
+        return false;
+
+    stop_injected();
+
+    volatile uint32_t& smpr = channel < 10 ? adc_->SMPR2 : adc_->SMPR1;
+    smpr = ( smpr & ~( 7 << ( 3 * ( channel % 10 ) ) ) ) | ( sample_time << ( 3 * ( channel % 10 ) ) );
+    adc_->JSQR = uint32_t( channel ) << 15;   // JL = 0: a single conversion, which is JSQ4
+    adc_->CR1 &= ~( 1 << 10 );                // JAUTO off; triggered injection
+    adc_->CR1 |= ( 1 << 7 );                  // JEOCIE
+    if ( channel >= 16 )
+        adc_->CR2 |= ( 1 << 23 );             // TSVREFE
+    adc_->CR2 = ( adc_->CR2 & ~( 7 << 12 ) ) | ( 1 << 15 ); // JEXTSEL = 000 (TIM1 TRGO), JEXTTRIG
+
+    __injected.channel = channel;
+    __injected.rate = rate;
+    __injected.value = 0;
+    __injected.latency = latency_stats();
+    __injected.running = true;
+
+    injected_trigger_timer timer;
+    timer.set_trigger( rate, 0 );
+    __injected.prescaler = injected_trigger_timer::prescaler();
+    return true;
+}
+
+void
+adc::stop_injected()
+{
+    if ( ! __injected.running )
+        return;
+    injected_trigger_timer().enable( false );
+    adc_->CR2 &= ~( 1 << 15 );   // JEXTTRIG
+    adc_->CR1 &= ~( 1 << 7 );    // JEOCIE
+    __injected.running = false;
+}
+
+uint16_t
+adc::injected_value() const
+{
+    return __injected.value.load();
+}
+
+bool
+adc::set_watchdog( uint8_t channel, uint16_t low, uint16_t high, void(*callback)() )
+{
+    if ( channel > 17 || low > high || high > 0x0fff )
+        return false;
+    clear_watchdog();
+
+    __watchdog.channel = channel;
+    __watchdog.low = low;
+    __watchdog.high = high;
+    __watchdog.callback = callback;
+    __watchdog.trips = 0;
+    __watchdog.latency = latency_stats();
+
+    adc_->LTR = low;
+    adc_->HTR = high;
+    adc_->SR = ~uint32_t( 0x01 );  // AWD
+    __watchdog.enabled = true;
+    adc_->CR1 = ( adc_->CR1 & ~0x1f ) | channel | ( 1 << 9 ) | ( 1 << 22 ) | ( 1 << 23 ) | ( 1 << 6 ); // AWDCH, AWDSGL, JAWDEN, AWDEN, AWDIE
+    return true;
+}
+
+void
+adc::clear_watchdog()
+{
+    adc_->CR1 &= ~( ( 1 << 6 ) | ( 1 << 22 ) | ( 1 << 23 ) ); // AWDIE, JAWDEN, AWDEN
+    __watchdog.enabled = false;
+}
+
+void
+adc::print_watchdog() const
+{
+    const uint32_t mhz = injected_trigger_timer::clock() / 1000000;
+    auto ns = [&]( uint64_t ticks ){ return int( ticks * __injected.prescaler * 1000 / mhz ); };
+    auto print_latency = [&]( const latency_stats& l ) {
+        stream() << "min " << ns( l.min ) << "ns\tmax " << ns( l.max ) << "ns\tmean " << ( l.count ? ns( l.sum / l.count ) : 0 )
+                 << "ns (" << int( l.count ) << ")";
     };
 
-    __dma_adc1->set_callback( callback );
+    const auto& w = __watchdog;
+    if ( w.enabled ) {
+        stream() << "adc watchdog: ch " << int( w.channel ) << " [" << int( w.low ) << ", " << int( w.high ) << "]"
+                 << "\ttrips " << int( w.trips.load() );
+        if ( w.trips.load() )
+            stream() << ", last " << int( ( atomic_jiffies.load() - w.last ) / 10 ) << "ms ago";
+        stream() << std::endl;
+        if ( w.latency.count ) {
+            stream() << "\ttrigger -> callback ";
+            print_latency( w.latency );
+            stream() << std::endl;
+        }
+    } else {
+        stream() << "adc watchdog: off" << std::endl;
+    }
 
-    __dma_adc1->enable( true );
+    const auto& j = __injected;
+    if ( j.running ) {
+        stream() << "adc injected: ch " << int( j.channel ) << " at " << int( j.rate ) << "/s, value " << int( j.value.load() ) << std::endl;
+        stream() << "\ttrigger -> JEOC ";
+        print_latency( j.latency );
+        stream() << std::endl;
+    } else {
+        stream() << "adc injected: off" << std::endl;
+    }
+}
+
+void
+adc::print_acquisition() const
+{
+    const auto& a = __acquisition;
+    if ( ! __triggered || a.ticks == 0 ) {
+        stream() << "adc: no timer triggered acquisition; adc rate <scans/s> ch 0,1,.. [smp 0..7,..]" << std::endl;
+        return;
+    }
+    const uint64_t window = a.last - a.first;
+    const uint64_t scans = uint64_t( a.halves > 1 ? a.halves - 1 : 0 ) * __scans_per_half;
+    const uint32_t intervals = a.halves > 1 ? a.halves - 1 : 0;
+    const uint32_t mhz = __system_clock / 1000000;
+    const uint64_t n = scans * __system_clock;
+    const int64_t achieved = window ? ( ( n / window ) << 16 ) + ( ( n % window ) << 16 ) / window : 0; // Q16
+
+    stream() << stream::setprecision( 2 ) << "adc: " << int( __number_of_channels ) << " channels, " << int( __scans_per_half ) << " scans/half"
+             << "\trequested: " << int( a.requested ) << "/s"
+             << "\tprogrammed: " << fixed< 16, int64_t >::from_raw( ( int64_t( a.timer_clock ) << 16 ) / a.ticks ) << "/s"
+             << "\tachieved: " << fixed< 16, int64_t >::from_raw( achieved ) << "/s"
+             << std::endl;
+    stream() << "\thalf interval " << int( a.nominal / mhz ) << "us, jitter vs SysTick (ns) min: "
+             << int( int64_t( a.min ) * 1000 / mhz ) << "\tmax: " << int( int64_t( a.max ) * 1000 / mhz )
+             << "\trms: " << int( intervals ? uint64_t( isqrt( a.sum_sq / intervals ) ) * 1000 / mhz : 0 )
+             << "\thalves: " << int( a.halves )
+             << std::endl;
+    if ( __adc1_stream )
+        stream() << "\tstream overruns: " << int( __adc1_stream->overruns() )
+                 << "\tlate: " << int( __adc1_stream->late() )
+                 << "\terrors: " << int( __adc1_stream->errors() ) << std::endl;
 }
 
 void
@@ -134,8 +663,8 @@ adc::init( PERIPHERAL_BASE base )
 void
 adc::enable( bool onoff )
 {
-    if ( __dma_adc1 )
-        __dma_adc1->enable( onoff );    
+    if ( __adc1_stream )
+        __adc1_stream->enable( onoff );    
 }
 
 uint32_t
@@ -168,10 +697,31 @@ adc::data()
 void
 adc::handle_interrupt()
 {
-    scoped_spinlock<> lock( lock_ );     
+    const uint32_t ticks = __injected.running ? injected_trigger_timer::counter() : 0; // counts since the trigger
+    const uint32_t sr = adc_->SR;
+
+    if ( ( sr & 0x01 ) && __watchdog.enabled ) { // AWD first; it is the one that needs the reaction
+        adc_->SR = ~uint32_t( 0x01 );
+        if ( __watchdog.callback )
+            __watchdog.callback();
+        if ( __injected.running && __injected.channel == __watchdog.channel && ( sr & 0x04 ) )
+            __watchdog.latency.add( ticks );
+        ++__watchdog.trips;
+        __watchdog.last = atomic_jiffies.load();
+    }
+
+    if ( sr & 0x04 ) { // JEOC
+        adc_->SR = ~uint32_t( 0x04 | 0x08 ); // JEOC, JSTRT
+        __injected.value = adc_->JDR1;
+        __injected.latency.add( ticks );
+    }
+
+    if ( ( sr & 0x02 ) && ( adc_->CR1 & ( 1 << 5 ) ) ) { // EOC of a software triggered conversion
+        scoped_spinlock<> lock( lock_ );
 
-    data_ = adc_->DR;
-    flag_ = true;
+        data_ = adc_->DR;
+        flag_ = true;
+    }
 }
 
 void
@@ -26,7 +26,35 @@ namespace stm32f103 {
         ~adc();
         void init( PERIPHERAL_BASE );
     public:
-        void attach( dma& );
+        void attach( dma& );  // free running (continuous) scan of ADC_IN0..3
+
+        // Timer triggered scans at 'rate' per second, converting the ADC_IN channels (0..17) in
+        // 'sequence' in order, each with its SMPx sample time code (0..7 := 1.5..239.5 cycles).
+        // Fails if DMA_ADC1 is leased elsewhere or the scan does not fit in the trigger period.
+        bool start_acquisition( dma&, uint32_t rate, const uint8_t * sequence, const uint8_t * sample_time, size_t count );
+        void stop_acquisition( dma& );
+        void print_acquisition() const;  // requested/programmed/achieved rate and jitter
+
+        // Decimation pipeline behind the DMA stream (both modes): CIC of 'order' (1: boxcar)
+        // decimating by 'ratio' scans (0: the scan rate, at most 4096), then a sink.
+        enum sink_type : uint32_t { sink_text, sink_frames, sink_log, sink_none };
+        bool set_decimation( uint32_t ratio, uint32_t order );
+        void set_sink( sink_type );
+        void print_pipeline() const;     // per-stage throughput, backlog and losses
+        void print_log() const;          // decimated scans kept by sink_log
+
+        // Injected channel: one conversion of 'channel' at 'rate' per second on TIM1 TRGO
+        // (JEXTSEL = 000); it preempts the regular scan, which resumes and keeps streaming.
+        // The JEOC interrupt latches the result and the trigger to interrupt latency.
+        bool start_injected( uint8_t channel, uint8_t sample_time, uint32_t rate );
+        void stop_injected();
+        uint16_t injected_value() const;
+
+        // Analog watchdog on 'channel', regular and injected conversions: 'callback' runs in the
+        // ADC interrupt for every conversion outside [low, high] (12bit codes).
+        bool set_watchdog( uint8_t channel, uint16_t low, uint16_t high, void(*callback)() = nullptr );
+        void clear_watchdog();
+        void print_watchdog() const;     // trips, injected conversions and latencies
         operator bool () const { return adc_; }
 
         bool start_conversion(); // software trigger
@@ -0,0 +1,258 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#include "adc_pair.hpp"
+#include "background.hpp"
+#include "dma.hpp"
+#include "dma_channel.hpp"
+#include "dma_stream.hpp"
+#include "stm32f103.hpp"
+#include "stream.hpp"
+#include "timer.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+
+extern std::atomic< uint32_t > atomic_jiffies;
+extern uint32_t __pclk2;
+
+namespace {
+
+    using namespace stm32f103;
+
+    typedef dma_stream< uint32_t, 256 > pair_stream_type;   // 128 words per half
+    static pair_stream_type * __stream;
+    static uint8_t __stream_storage[ sizeof( pair_stream_type ) ] __attribute__( ( aligned( 4 ) ) );
+
+    typedef stm32f103::timer_t< TIM4_BASE > adc_trigger_timer; // shared with adc::start_acquisition
+    constexpr uint32_t adc_trigger_channel = 4;
+
+    // SMPx code -> sample time in half ADC clocks (1.5 .. 239.5 cycles)
+    constexpr uint32_t __sample_halfcycles[] = { 3, 15, 27, 57, 83, 111, 143, 479 };
+
+    struct channel_stats {
+        uint64_t sum;
+        uint32_t count;
+        uint16_t min;
+        uint16_t max;
+
+        void add( const uint16_t * p, size_t n ) {
+            if ( count == 0 )
+                min = max = p[ 0 ] & 0x0fff;
+            for ( size_t i = 0; i < n; ++i ) {
+                const uint16_t x = p[ i ] & 0x0fff;
+                sum += x;
+                min = std::min( min, x );
+                max = std::max( max, x );
+            }
+            count += n;
+        }
+    };
+
+    struct pair_state {
+        adc_pair::mode_type mode;
+        uint32_t rate;         // pairs/s, 0: continuous
+        uint8_t channels[ 2 ];
+        uint8_t sample_time;
+        uint32_t ticks;        // trigger timer clocks per pair
+        uint32_t start;        // atomic_jiffies
+        uint32_t halves;       // processed by drain()
+        std::array< channel_stats, 2 > stats;  // per ADC; one time series in fast interleaved mode
+    };
+    static pair_state __state;
+
+    alignas( 4 ) static std::array< uint16_t, 2 * pair_stream_type::capacity() / 2 > __unpacked;
+
+    inline volatile ADC * adc1() { return reinterpret_cast< volatile ADC * >( ADC1_BASE ); }
+    inline volatile ADC * adc2() { return reinterpret_cast< volatile ADC * >( ADC2_BASE ); }
+
+    void
+    handle_stream( uint32_t flag )
+    {
+        __stream->handle_interrupt( flag );
+    }
+
+    // background: unpacks one published half per call into running statistics
+    void
+    drain()
+    {
+        auto data = __stream ? __stream->acquire() : nullptr;
+        if ( data == nullptr )
+            return;
+        const size_t n = __stream->half_size();
+        if ( __state.mode == adc_pair::fast_interleaved ) {
+            unpack_interleaved( data, n, __unpacked.data() );
+            __stream->release();
+            __state.stats[ 0 ].add( __unpacked.data(), 2 * n );
+        } else {
+            unpack_simultaneous( data, n, __unpacked.data(), __unpacked.data() + n );
+            __stream->release();
+            __state.stats[ 0 ].add( __unpacked.data(), n );
+            __state.stats[ 1 ].add( __unpacked.data() + n, n );
+        }
+        ++__state.halves;
+    }
+
+    // ADON, reset calibration and calibrate, as adc::init does for ADC1
+    void
+    calibrate( volatile ADC * adc )
+    {
+        adc->CR2 |= ( 1 << 0 );  // ADON
+        size_t count = 1000;
+        adc->CR2 |= ( 1 << 3 );  // RSTCAL
+        while ( count-- && ( adc->CR2 & ( 1 << 3 ) ) )
+            ;
+        count = 1000;
+        adc->CR2 |= ( 1 << 2 );  // CAL
+        while ( count-- && ( adc->CR2 & ( 1 << 2 ) ) )
+            ;
+    }
+
+    void
+    set_sample_time( volatile ADC * adc, uint32_t channel, uint32_t code )
+    {
+        volatile uint32_t& smpr = channel < 10 ? adc->SMPR2 : adc->SMPR1;
+        smpr = ( smpr & ~( 7 << ( 3 * ( channel % 10 ) ) ) ) | ( code << ( 3 * ( channel % 10 ) ) );
+    }
+}
+
+namespace stm32f103 {
+
+    bool
+    adc_pair::start( dma& dma, mode_type mode, uint32_t rate, uint8_t channel1, uint8_t channel2, uint8_t sample_time )
+    {
+        if ( channel1 > 17 || channel2 > 15 || sample_time > 7 )
+            return false;  // ADC2 IN16/IN17 are tied to Vss
+        if ( mode == fast_interleaved && ( channel1 != channel2 || sample_time != 0 || rate ) )
+            return false;  // sampling phases would overlap (RM0008 11.9.5)
+        if ( mode == regular_simultaneous && channel1 == channel2 )
+            return false;  // must not convert the same channel on both ADCs
+
+        auto RCC = reinterpret_cast< volatile stm32f103::RCC * >( RCC_BASE );
+        const uint32_t adcclk = __pclk2 / ( 2 * ( ( ( RCC->CFGR >> 14 ) & 3 ) + 1 ) );
+        if ( uint64_t( __sample_halfcycles[ sample_time ] + 25 ) * rate > uint64_t( adcclk ) * 2 )
+            return false;  // the conversion must complete within a trigger period
+
+        if ( __stream )
+            stop( dma );
+        if ( ! dma.try_acquire( DMA_ADC12 ) )
+            return false;
+
+        __state = pair_state();
+        __state.mode = mode;
+        __state.rate = rate;
+        __state.channels[ 0 ] = channel1;
+        __state.channels[ 1 ] = channel2;
+        __state.sample_time = sample_time;
+
+        calibrate( adc2() );
+
+        auto a1 = adc1();
+        auto a2 = adc2();
+        a1->CR2 &= ~( ( 1 << 1 ) | ( 1 << 8 ) | ( 7 << 17 ) | ( 1 << 20 ) ); // CONT, DMA, EXTSEL, EXTTRIG
+        a2->CR2 &= ~( ( 1 << 1 ) | ( 1 << 8 ) | ( 7 << 17 ) | ( 1 << 20 ) );
+        a1->CR1 = ( a1->CR1 & ~( ( 0x0f << 16 ) | ( 1 << 5 ) | ( 1 << 8 ) ) ) | ( mode << 16 ); // DUALMOD; no EOC interrupt, no SCAN
+        a2->CR1 &= ~( ( 1 << 5 ) | ( 1 << 8 ) );
+
+        a1->SQR1 = a2->SQR1 = 0;   // one conversion each
+        a1->SQR2 = a2->SQR2 = 0;
+        a1->SQR3 = channel1;
+        a2->SQR3 = channel2;
+        set_sample_time( a1, channel1, sample_time );
+        set_sample_time( a2, channel2, sample_time );
+        if ( channel1 >= 16 )
+            a1->CR2 |= ( 1 << 23 );  // TSVREFE; ADC1 only
+
+        // the slave is started by the master; its own trigger is SWSTART so that nothing else starts it
+        a2->CR2 |= ( 7 << 17 ) | ( 1 << 20 ) | ( rate ? 0 : ( 1 << 1 ) );
+
+        __stream = new (&__stream_storage) pair_stream_type();
+        if ( ! __stream->start( dma, DMA_ADC12, handle_stream ) ) {
+            __stream = nullptr;
+            dma.release( DMA_ADC12 );
+            return false;
+        }
+        background::add( drain );
+        __state.start = atomic_jiffies.load();
+
+        if ( rate ) {
+            a1->CR2 |= ( 1 << 8 ) | ( 5 << 17 ) | ( 1 << 20 ); // DMA, EXTSEL = TIM4 CC4, EXTTRIG
+            adc_trigger_timer timer;
+            __state.ticks = timer.set_trigger( rate, adc_trigger_channel );
+        } else {
+            a1->CR2 |= ( 1 << 1 ) | ( 1 << 8 ) | ( 7 << 17 ) | ( 1 << 20 ); // CONT, DMA, SWSTART, EXTTRIG
+            a1->CR2 |= ( 1 << 22 );  // SWSTART
+        }
+        return true;
+    }
+
+    void
+    adc_pair::stop( dma& dma )
+    {
+        if ( ! __stream )
+            return;
+        __stream->stop();
+        if ( __state.rate )
+            adc_trigger_timer().enable( false );
+        auto a1 = adc1();
+        auto a2 = adc2();
+        a1->CR2 &= ~( ( 1 << 1 ) | ( 1 << 8 ) | ( 7 << 17 ) | ( 1 << 23 ) ); // CONT, DMA, EXTSEL, TSVREFE
+        a2->CR2 &= ~( ( 1 << 0 ) | ( 1 << 1 ) );                            // ADON, CONT
+        a1->CR1 &= ~( 0x0f << 16 );                                         // independent mode
+        // back to the state adc::init leaves ADC1 in
+        a1->SQR3 = 0;
+        a1->CR2 |= ( 7 << 17 ) | ( 1 << 20 );                               // SWSTART
+        a1->CR1 |= ( 1 << 5 );                                              // EOC interrupt for adc::data()
+
+        background::remove( drain );
+        __stream = nullptr;
+        dma.release( DMA_ADC12 );
+    }
+
+    bool
+    adc_pair::running()
+    {
+        return __stream != nullptr;
+    }
+
+    void
+    adc_pair::print_status()
+    {
+        const auto& s = __state;
+        if ( ! __stream ) {
+            stream() << "adc pair: stopped; adc pair sim <ch1>,<ch2> [rate NN] [smp n] | fast <ch>" << std::endl;
+            return;
+        }
+        const bool fast = s.mode == fast_interleaved;
+        const uint32_t ms = ( atomic_jiffies.load() - s.start ) / 10;
+        const uint64_t samples = uint64_t( __stream->halves() ) * __stream->half_size() * ( fast ? 2 : 1 );
+
+        stream() << "adc pair: " << ( fast ? "fast interleaved, ch " : "regular simultaneous, ch " ) << int( s.channels[ 0 ] );
+        if ( ! fast )
+            stream() << "," << int( s.channels[ 1 ] );
+        stream() << ", smp " << int( s.sample_time );
+        if ( s.rate )
+            stream() << ", " << int( s.rate ) << " pairs/s (TIM4 " << int( s.ticks ) << " ticks)";
+        else
+            stream() << ", continuous";
+        stream() << std::endl;
+        stream() << "\t" << int( samples ) << ( fast ? " samples" : " pairs" ) << " in " << int( ms ) << "ms, "
+                 << int( ms ? samples * 1000 / ms : 0 ) << "/s"
+                 << "\thalves " << int( __stream->halves() ) << " (drained " << int( s.halves ) << ")"
+                 << "\toverruns " << int( __stream->overruns() )
+                 << "\tlate " << int( __stream->late() )
+                 << "\terrors " << int( __stream->errors() )
+                 << std::endl;
+        for ( size_t i = 0; i < ( fast ? 1 : 2 ); ++i ) {
+            const auto& c = s.stats[ i ];
+            stream() << "\t" << ( fast ? "adc1+2" : i == 0 ? "adc1" : "adc2" ) << " ch " << int( s.channels[ i ] )
+                     << ": mean " << int( c.count ? c.sum / c.count : 0 )
+                     << "\tmin " << int( c.min ) << "\tmax " << int( c.max )
+                     << "\t(" << int( c.count ) << " samples)" << std::endl;
+        }
+    }
+
+}
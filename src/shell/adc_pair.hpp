@@ -0,0 +1,81 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace stm32f103 {
+
+    class dma;
+
+    // ADC1 (master) + ADC2 (slave) dual mode, RM0008 11.9.
+    //
+    // Each ADC1 end of conversion moves one 32-bit word from ADC1 DR (ADC2 data in [31:16], ADC1
+    // data in [15:0]) over DMA1 channel 1, leased as DMA_ADC12; the single ADC modes (adc::attach,
+    // adc::start_acquisition) lease the same channel as DMA_ADC1, so the two exclude each other.
+    //
+    //   regular_simultaneous: ADC1 and ADC2 convert two channels in lock-step, either triggered
+    //                         by TIM4 CC4 at 'rate' pairs/s or continuously (rate 0).
+    //   fast_interleaved:     both convert the same channel continuously, ADC1 starting 7 ADC
+    //                         clocks after ADC2; 2 * 12MHz / 14 = 1.71 Msps with the 1.5 cycle
+    //                         sample time this mode requires (2 Msps at ADCCLK = 14MHz).
+
+    struct adc_pair {
+        enum mode_type : uint32_t { regular_simultaneous = 6, fast_interleaved = 7 };  // ADC1 CR1 DUALMOD
+
+        static bool start( dma&, mode_type, uint32_t rate, uint8_t channel1, uint8_t channel2, uint8_t sample_time );
+        static void stop( dma& );
+        static bool running();
+        static void print_status();
+    };
+
+    // Unpack kernels for the packed words; 'count' is the number of words.
+
+    // regular simultaneous: word i := ADC2 << 16 | ADC1, sampled at the same instant
+    inline void
+    unpack_simultaneous( const uint32_t * packed, size_t count, uint16_t * adc1, uint16_t * adc2 )
+    {
+        typedef uint32_t __attribute__(( may_alias )) word_type;
+        size_t i = 0;
+        if ( ( ( reinterpret_cast< uintptr_t >( adc1 ) | reinterpret_cast< uintptr_t >( adc2 ) ) & 3 ) == 0 ) {
+            // two words -> one word of ADC1 samples and one of ADC2 samples (little endian)
+            auto a = reinterpret_cast< word_type * >( adc1 );
+            auto b = reinterpret_cast< word_type * >( adc2 );
+            for ( ; i + 2 <= count; i += 2 ) {
+                const uint32_t w0 = packed[ i ], w1 = packed[ i + 1 ];
+                *a++ = ( w0 & 0xffff ) | ( w1 << 16 );
+                *b++ = ( w0 >> 16 ) | ( w1 & 0xffff0000 );
+            }
+        }
+        for ( ; i < count; ++i ) {
+            adc1[ i ] = uint16_t( packed[ i ] );
+            adc2[ i ] = uint16_t( packed[ i ] >> 16 );
+        }
+    }
+
+    // fast interleaved: ADC2 converts first, so word i holds samples 2i (ADC2, [31:16]) and 2i+1
+    // (ADC1, [15:0]) of one time series
+    inline void
+    unpack_interleaved( const uint32_t * packed, size_t count, uint16_t * samples )
+    {
+        typedef uint32_t __attribute__(( may_alias )) word_type;
+        if ( ( reinterpret_cast< uintptr_t >( samples ) & 3 ) == 0 ) {
+            auto out = reinterpret_cast< word_type * >( samples );
+            for ( size_t i = 0; i < count; ++i ) {
+                const uint32_t w = packed[ i ];
+                out[ i ] = ( w >> 16 ) | ( w << 16 );  // a single ROR on Cortex-M3
+            }
+            return;
+        }
+        for ( size_t i = 0; i < count; ++i ) {
+            samples[ 2 * i ] = uint16_t( packed[ i ] >> 16 );
+            samples[ 2 * i + 1 ] = uint16_t( packed[ i ] );
+        }
+    }
+
+}
@@ -0,0 +1,48 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#include "background.hpp"
+#include <array>
+#include <atomic>
+
+namespace {
+    std::array< std::atomic< void(*)() >, 8 > __tasks;
+    std::atomic_flag __running;
+}
+
+using namespace stm32f103;
+
+bool
+background::add( void(*task)() )
+{
+    for ( auto& t: __tasks ) {
+        void (*empty)() = nullptr;
+        if ( t.load() == task || t.compare_exchange_strong( empty, task ) )
+            return true;
+    }
+    return false;
+}
+
+void
+background::remove( void(*task)() )
+{
+    for ( auto& t: __tasks ) {
+        auto expected = task;
+        t.compare_exchange_strong( expected, nullptr );
+    }
+}
+
+void
+background::poll()
+{
+    if ( __running.test_and_set() ) // a task waiting on input must not re-enter the loop
+        return;
+    for ( auto& t: __tasks ) {
+        if ( auto task = t.load() )
+            task();
+    }
+    __running.clear();
+}
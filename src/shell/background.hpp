@@ -0,0 +1,21 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include <cstddef>
+
+namespace stm32f103 {
+
+    // Thread mode tasks polled while the shell waits for input (uart::getc); each call
+    // should do a bounded amount of work and return.
+    struct background {
+        static bool add( void(*)() );
+        static void remove( void(*)() );
+        static void poll();
+    };
+
+}
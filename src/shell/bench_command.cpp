@@ -0,0 +1,295 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#include "command_processor.hpp"
+#include "decimator.hpp"
+#include "dma_memcpy.hpp"
+#include "dwt.hpp"
+#include "fixed.hpp"
+#include "format.hpp"
+#include "stream.hpp"
+#include "to_chars.hpp"
+#include "utility.hpp"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <type_traits>
+
+// On-target micro benchmarks; results are DWT cycles per operation at SYSCLK.
+
+extern "C" {
+    int prf_snprintf( char * buf, unsigned int size, const char * fmt, ... );
+}
+
+namespace {
+
+    struct xorshift32 {
+        uint32_t x;
+        xorshift32( uint32_t seed = 2463534242 ) : x( seed ) {}
+        inline uint32_t operator()() { x ^= x << 13; x ^= x >> 17; x ^= x << 5; return x; }
+    };
+
+    // the former stream_t decimal loop, for reference
+    // (negated in the unsigned type, so that INT_MIN and INT64_MIN are defined)
+    template< typename T >
+    char * legacy_itoa( T d, char * out ) {
+        char buf[ 22 ];
+        char * p = &buf[ 21 ];
+        *p-- = '\0';
+        auto u = std::make_unsigned_t< T >( d );
+        if ( d < 0 ) {
+            *out++ = '-';
+            u = std::make_unsigned_t< T >( 0 ) - u;
+        }
+        do {
+            *p-- = "0123456789"[ u % 10 ];
+            u /= 10;
+        } while ( u );
+        while ( *++p )
+            *out++ = *p;
+        return out;
+    }
+
+    template< typename T, typename F >
+    uint32_t cycles_per_value( const std::array< T, 64 >& values, size_t count, F f ) {
+        char buf[ 24 ];
+        uint32_t sink( 0 );
+        auto t0 = stm32f103::dwt::cycles();
+        for ( size_t i = 0; i < count; ++i )
+            sink += f( values[ i % values.size() ], buf ) - buf;
+        auto elapsed = stm32f103::dwt::cycles() - t0;
+        __asm volatile ( "" :: "r" ( sink ) );
+        return elapsed / count;
+    }
+
+    void
+    bench_itoa( size_t count )
+    {
+        xorshift32 rand;
+        std::array< int32_t, 64 > v32;
+        std::array< int64_t, 64 > v64;
+        for ( size_t i = 0; i < v32.size(); ++i ) {
+            v32[ i ] = int32_t( rand() ) >> ( rand() % 31 );
+            v64[ i ] = int64_t( ( uint64_t( rand() ) << 32 ) | rand() ) >> ( rand() % 63 );
+        }
+        
+        stream() << "itoa: " << int( count ) << " values, cycles/value" << std::endl;
+        stream() << "\tint32 legacy: " << int( cycles_per_value( v32, count, legacy_itoa< int32_t > ) )
+                 << "\ti32toa: " << int( cycles_per_value( v32, count, i32toa ) )
+                 << std::endl;
+        stream() << "\tint64 legacy: " << int( cycles_per_value( v64, count, legacy_itoa< int64_t > ) )
+                 << "\ti64toa: " << int( cycles_per_value( v64, count, i64toa ) )
+                 << std::endl;
+    }
+
+    void
+    bench_dtoa( size_t count )
+    {
+        xorshift32 rand;
+        std::array< double, 64 > vd;
+        std::array< int64_t, 64 > vq;
+        for ( size_t i = 0; i < vd.size(); ++i ) {
+            int32_t r = int32_t( rand() );
+            vq[ i ] = r >> ( rand() % 16 );                 // Q16.16 samples
+            vd[ i ] = double( vq[ i ] ) * ( 1.0 / 65536 ); // same values as double
+        }
+
+        stream() << "dtoa: " << int( count ) << " values, cycles/value" << std::endl;
+        for ( int precision: { 2, 6 } ) {
+            stream() << "	precision " << precision
+                     << "	dtoa: " << int( cycles_per_value( vd, count, [&]( double d, char * p ){ return dtoa( d, p, precision ); } ) )
+                     << "	qtoa(Q16): " << int( cycles_per_value( vq, count, [&]( int64_t q, char * p ){ return qtoa( q, 16, p, precision ); } ) )
+                     << std::endl;
+        }
+        stream() << "	" << vd[ 0 ] << " == " << fixed< 16 >::from_raw( vq[ 0 ] )
+                 << ", " << stream::setprecision( 3 ) << 2.0005 << ", " << -1.0e30 << std::endl;
+    }
+
+    void
+    bench_fmt( size_t count )
+    {
+        xorshift32 rand;
+        std::array< int32_t, 64 > values;
+        for ( auto& v: values )
+            v = int32_t( rand() ) >> ( rand() % 31 );
+
+        char buf[ 64 ];
+        const char * name = "bmp280";
+
+        auto t0 = stm32f103::dwt::cycles();
+        for ( size_t i = 0; i < count; ++i ) {
+            auto v = values[ i % values.size() ];
+            prf_snprintf( buf, sizeof( buf ), "T=%d P=%u X=%08x %s", v, uint32_t( v ), uint32_t( v ), name );
+        }
+        uint32_t prf = ( stm32f103::dwt::cycles() - t0 ) / count;
+        stream() << "\tprf_snprintf: " << buf << std::endl;
+
+        t0 = stm32f103::dwt::cycles();
+        for ( size_t i = 0; i < count; ++i ) {
+            auto v = values[ i % values.size() ];
+            format_to( buf, sizeof( buf ), "T=%d P=%u X=%08x %s"_fmt( v, uint32_t( v ), uint32_t( v ), name ) );
+        }
+        uint32_t fmt = ( stm32f103::dwt::cycles() - t0 ) / count;
+        stream() << "\tformat_to:    " << buf << std::endl;
+
+        stream() << "fmt: " << int( count ) << " calls, cycles/call prf_snprintf: " << int( prf )
+                 << "\tformat_to: " << int( fmt ) << std::endl;
+    }
+
+    // every table entry plus a miss, with the former linear find_if for reference
+    void
+    bench_dispatch( size_t count )
+    {
+        const size_t size = command_processor::size();
+        uint32_t found( 0 );
+
+        auto t0 = stm32f103::dwt::cycles();
+        for ( size_t i = 0; i < count; ++i ) {
+            for ( size_t k = 0; k <= size; ++k )
+                found += command_processor::lookup( k < size ? command_processor::name( k ) : "nosuchcmd" ) != nullptr;
+        }
+        uint32_t bsearch = ( stm32f103::dwt::cycles() - t0 ) / ( count * ( size + 1 ) );
+
+        t0 = stm32f103::dwt::cycles();
+        for ( size_t i = 0; i < count; ++i ) {
+            for ( size_t k = 0; k <= size; ++k ) {
+                const char * key = k < size ? command_processor::name( k ) : "nosuchcmd";
+                size_t j = 0;
+                while ( j < size && strcmp( command_processor::name( j ), key ) != 0 )
+                    ++j;
+                found += j < size;
+            }
+        }
+        uint32_t linear = ( stm32f103::dwt::cycles() - t0 ) / ( count * ( size + 1 ) );
+
+        stream() << "dispatch: " << int( size ) << " commands, " << int( found / 2 / count ) << " found, cycles/lookup binary search: "
+                 << int( bsearch ) << "\tlinear: " << int( linear ) << std::endl;
+    }
+
+    alignas( 4 ) uint8_t __copy_src[ 2048 + 4 ];
+    alignas( 4 ) uint8_t __copy_dst[ 2048 + 4 ];
+
+    // cycles per call, averaged over count
+    template< typename F >
+    uint32_t cycles_per_call( size_t count, F f ) {
+        auto t0 = stm32f103::dwt::cycles();
+        for ( size_t i = 0; i < count; ++i )
+            f();
+        return ( stm32f103::dwt::cycles() - t0 ) / count;
+    }
+
+    inline fixed< 16 > bytes_per_cycle( size_t size, uint32_t cycles ) {
+        return fixed< 16 >::from_raw( cycles ? ( int64_t( size ) << 16 ) / cycles : 0 );
+    }
+
+    // dma_memcpy/dma_memset as seen by a caller that waits for completion, against the CPU loops;
+    // the skewed row (destination + 1) cannot use DMA and shows the fallback
+    void
+    bench_memcpy( size_t count )
+    {
+        using namespace stm32f103;
+
+        for ( size_t i = 0; i < sizeof( __copy_src ); ++i )
+            __copy_src[ i ] = uint8_t( i * 7 + 1 );
+
+        stream() << "memcpy: bytes/cycle, " << int( count ) << " calls (fewer above 64 bytes)" << std::endl
+                 << "\tsize\tcpu\tdma\tskewed\tmemset cpu\tdma" << std::endl;
+
+        size_t errors( 0 );
+        for ( size_t size: { 16, 64, 128, 256, 512, 1024, 2048 } ) {
+            const size_t n = std::max( size_t( 1 ), count * 64 / std::max( size_t( 64 ), size ) );
+            auto cpu = cycles_per_call( n, [&]{ cpu_memcpy( __copy_dst, __copy_src, size ); } );
+            auto dma = cycles_per_call( n, [&]{ errors += ! dma_memcpy( __copy_dst, __copy_src, size ).wait(); } );
+            for ( size_t i = 0; i < size; ++i )
+                errors += __copy_dst[ i ] != __copy_src[ i ];
+            auto skewed = cycles_per_call( n, [&]{ errors += ! dma_memcpy( __copy_dst + 1, __copy_src, size ).wait(); } );
+            auto cpu_set = cycles_per_call( n, [&]{ cpu_memset( __copy_dst, 0x5a, size ); } );
+            auto dma_set = cycles_per_call( n, [&]{ errors += ! dma_memset( __copy_dst, 0xa5, size ).wait(); } );
+            for ( size_t i = 0; i < size; ++i )
+                errors += __copy_dst[ i ] != 0xa5;
+
+            stream() << "\t" << int( size ) << stream::setprecision( 3 )
+                     << "\t" << bytes_per_cycle( size, cpu )
+                     << "\t" << bytes_per_cycle( size, dma )
+                     << "\t" << bytes_per_cycle( size, skewed )
+                     << "\t" << bytes_per_cycle( size, cpu_set )
+                     << "\t\t" << bytes_per_cycle( size, dma_set )
+                     << std::endl;
+        }
+        stream() << "\terrors: " << int( errors )
+                 << "\t(dma above " << int( dma_memcpy_threshold ) << " bytes when a channel is free; see 'dma status')" << std::endl;
+    }
+
+    template< size_t Channels >
+    void
+    bench_accumulate( size_t count, const uint16_t * data, size_t scans, size_t& errors )
+    {
+        using namespace stm32f103;
+        uint32_t ref[ Channels ] = { 0 }, acc1[ Channels ] = { 0 }, acc4[ Channels ] = { 0 }, acc8[ Channels ] = { 0 };
+        auto scalar = cycles_per_call( count, [&]{ accumulate_scalar< Channels >( data, scans, ref ); } );
+        auto packed1 = cycles_per_call( count, [&]{ accumulate_packed< Channels, 1 >( data, scans, acc1 ); } );
+        auto packed4 = cycles_per_call( count, [&]{ accumulate_packed< Channels, 4 >( data, scans, acc4 ); } );
+        auto packed8 = cycles_per_call( count, [&]{ accumulate_packed< Channels, 8 >( data, scans, acc8 ); } );
+        for ( size_t ch = 0; ch < Channels; ++ch )
+            errors += ( acc1[ ch ] != ref[ ch ] ) + ( acc4[ ch ] != ref[ ch ] ) + ( acc8[ ch ] != ref[ ch ] );
+
+        const size_t samples = scans * Channels;
+        auto per_sample = [&]( uint32_t cycles ){ return fixed< 16 >::from_raw( ( int64_t( cycles ) << 16 ) / samples ); };
+        stream() << "\t" << int( Channels ) << stream::setprecision( 2 )
+                 << "\t" << per_sample( scalar )
+                 << "\t" << per_sample( packed1 )
+                 << "\t" << per_sample( packed4 )
+                 << "\t" << per_sample( packed8 ) << std::endl;
+    }
+
+    // ADC oversampling: scalar vs SWAR packed accumulation of full scale 12bit samples
+    void
+    bench_accumulate( size_t count )
+    {
+        auto data = reinterpret_cast< uint16_t * >( __copy_src );
+        constexpr size_t samples = 960;   // a whole number of scans for 1..8 channels
+        xorshift32 rand;
+        for ( size_t i = 0; i < samples; ++i )
+            data[ i ] = ( i % 7 ) == 0 ? 0x0fff : rand() & 0x0fff;
+
+        count = std::max( size_t( 1 ), count / 10 );
+        stream() << "accumulate: cycles/sample over " << int( samples ) << " samples, " << int( count ) << " calls" << std::endl
+                 << "\tch\tscalar\tswar x1\tx4\tx8" << std::endl;
+        size_t errors( 0 );
+        bench_accumulate< 1 >( count, data, samples / 1, errors );
+        bench_accumulate< 2 >( count, data, samples / 2, errors );
+        bench_accumulate< 3 >( count, data, samples / 3, errors );
+        bench_accumulate< 4 >( count, data, samples / 4, errors );
+        bench_accumulate< 8 >( count, data, samples / 8, errors );
+        stream() << "\terrors: " << int( errors ) << std::endl;
+    }
+}
+
+void
+bench_command( size_t argc, const char ** argv )
+{
+    size_t count = 1000;
+    if ( argc > 2 )
+        count = strtod( argv[ 2 ] );
+    if ( count == 0 )
+        count = 1;
+
+    if ( argc > 1 && strcmp( argv[ 1 ], "itoa" ) == 0 ) {
+        bench_itoa( count );
+    } else if ( argc > 1 && strcmp( argv[ 1 ], "dtoa" ) == 0 ) {
+        bench_dtoa( count );
+    } else if ( argc > 1 && strcmp( argv[ 1 ], "fmt" ) == 0 ) {
+        bench_fmt( count );
+    } else if ( argc > 1 && strcmp( argv[ 1 ], "dispatch" ) == 0 ) {
+        bench_dispatch( count );
+    } else if ( argc > 1 && strcmp( argv[ 1 ], "memcpy" ) == 0 ) {
+        bench_memcpy( count );
+    } else if ( argc > 1 && strcmp( argv[ 1 ], "accumulate" ) == 0 ) {
+        bench_accumulate( count );
+    } else {
+        stream() << "bench itoa|dtoa|fmt|dispatch|memcpy|accumulate [count]" << std::endl;
+    }
+}
@@ -29,6 +29,7 @@
 #include "stm32f103.hpp"
 #include "system_clock.hpp"
 #include <atomic>
+#include <cstdlib>
 #if defined __linux
 #include <iostream>
 #include <unistd.h>
@@ -39,7 +40,10 @@
 #include <sys/stat.h>
 #include <errno.h>
 #else
+#include "dwt.hpp"
+#include "format.hpp"
 #include "stream.hpp"
+#include "telemetry.hpp"
 #endif
 #include "debug_print.hpp"
 
@@ -48,6 +52,11 @@ namespace bmp280 {
     BMP280 * BMP280::__instance;
     static uint8_t __bmp280_allocator[ sizeof(BMP280) ];
 
+    // the readout from the TIM2 interrupt; queued on the bus rather than waited for
+    static stm32f103::i2c_transaction __readout;
+    static const uint8_t __readout_register = press_msb;
+    static std::array< uint8_t, 6 > __readout_data;
+
     struct trimming_parameter {
         template< typename T > void operator()( T& d, const uint8_t *& p ) const {
             d = T( uint16_t( p[0] ) | uint16_t( p[1] ) << 8 );
@@ -212,7 +221,7 @@ BMP280::single_measure()
     
     if ( write( std::array< uint8_t, 4 >( { 0xf4, ctrl_meas, 0xf5, config } ) ) ) {
         stm32f103::timer_t< stm32f103::TIM2_BASE >().set_callback( +[]{
-                instance()->readout();
+                instance()->submit_readout();
                 stm32f103::timer_t< stm32f103::TIM2_BASE >::clear_callback( true ); // recursive call
             } );
     }
@@ -250,23 +259,8 @@ BMP280::read(  uint8_t addr, uint8_t * data, size_t size ) const
     bool success( false );
     scoped_spinlock<> lock( __flag );
     if ( i2c_ ) {
-
-        if ( i2c_->has_dma( stm32f103::i2c::DMA_Tx ) ) {
-            success = i2c_->dma_transfer( address_, &addr, 1 );
-        } else {
-            success = i2c_->write( address_, &addr, 1 );
-        }
-        
-        if ( success ) {
-            std::array< uint8_t, 2 > buf = { 0 };
-            
-            if ( i2c_->has_dma( stm32f103::i2c::DMA_Rx ) ) {
-                success = i2c_->dma_receive( address_, data, size );
-            } else {
-                success = i2c_->read( address_, data, size );
-            }
-        }
-
+        // register pointer, repeated START, data
+        success = i2c_->transfer( address_, &addr, 1, data, size );
         if ( !success )
             i2c_->print_result( stream(__FILE__,__LINE__) ) << std::endl;        
     }
@@ -277,25 +271,51 @@ std::pair< uint32_t, uint32_t >
 BMP280::readout()
 {
     std::array< uint8_t, 6 > data;
-    if ( read( 0xf7, data.data(), data.size() ) ) {
-        uint32_t adc_P = uint32_t( data[0] ) << 12 | uint32_t( data[1] ) << 4 | data[2] & 0x0f;
-        uint32_t adc_T  = uint32_t( data[3] ) << 12 | uint32_t( data[4] ) << 4 | data[5] & 0x0f;
-        int32_t t_fine = 0;
-        auto temp = compensate_T( adc_T, t_fine );
-        auto press = compensate_P32( adc_P, t_fine );
-
-        auto minor = temp % 100;
-
-        using stm32f103::system_clock;
-        stream() << int( std::chrono::duration_cast< std::chrono::seconds >( system_clock::now() - system_clock::zero ).count() )
-                 << "\t" << int( press ) << " (Pa)"
-                 << "\t" << int( temp / 100 ) << "." << ( minor < 10 ? "0" : "") << minor << " (degC)";
-        
-        stream() << std::endl;
-        
+    if ( read( press_msb, data.data(), data.size() ) )
+        return report( data.data() );
+    return { -1, -1 };
+}
+
+bool
+BMP280::submit_readout()
+{
+    if ( ! __readout.done() )
+        return false;  // the last one is still on the bus
+    __readout.address = address_;
+    __readout.tx = &__readout_register;
+    __readout.tx_size = 1;
+    __readout.rx = __readout_data.data();
+    __readout.rx_size = __readout_data.size();
+    __readout.context = this;
+    __readout.completion = +[]( stm32f103::i2c_transaction& t ){
+        if ( t.result.load() == stm32f103::I2C_RESULT_SUCCESS )
+            static_cast< const BMP280 * >( t.context )->report( t.rx );
+        else
+            stream(__FILE__,__LINE__) << "bmp280 readout failed: " << int( t.result.load() ) << std::endl;
+    };
+    return i2c_->submit( __readout );
+}
+
+std::pair< uint32_t, uint32_t > 
+BMP280::report( const uint8_t * data ) const
+{
+    uint32_t adc_P = uint32_t( data[0] ) << 12 | uint32_t( data[1] ) << 4 | data[2] & 0x0f;
+    uint32_t adc_T  = uint32_t( data[3] ) << 12 | uint32_t( data[4] ) << 4 | data[5] & 0x0f;
+    int32_t t_fine = 0;
+    auto temp = compensate_T( adc_T, t_fine );
+    auto press = compensate_P32( adc_P, t_fine );
+
+    if ( stm32f103::telemetry::enabled() ) {
+        stm32f103::telemetry::post( telemetry_record::sensor
+                                    , telemetry_record::sensor_record{ stm32f103::dwt::cycles(), press, temp } );
         return { press, temp };
     }
-    return { -1, -1 };
+
+    using stm32f103::system_clock;
+    auto seconds = std::chrono::duration_cast< std::chrono::seconds >( system_clock::now() - system_clock::zero ).count();
+    stream() << "%d\t%u (Pa)\t%s%d.%02d (degC)\n"_fmt( seconds, press, temp < 0 ? "-" : "", std::abs( temp / 100 ), std::abs( temp % 100 ) );
+        
+    return { press, temp };
 }
 
 //static
@@ -303,7 +323,7 @@ void
 BMP280::handle_timer()
 {
     if ( auto p = instance() )
-        auto pair = p->readout();
+        p->submit_readout();
 }
 
 /*!
@@ -90,12 +90,16 @@ namespace bmp280 {
         void measure();
         void stop();
         std::pair< uint32_t, uint32_t> readout();
+        // non-blocking readout for interrupt handlers; reported from the I2C interrupt when the read
+        // completes, false if the bus queue is full or the previous one is still pending
+        bool submit_readout();
         
         inline bool is_active() const { return has_callback_; }
     private:
         uint32_t compensate_P32( uint32_t adc_P, int32_t t_fine ) const;
         uint32_t compensate_P64( uint32_t adc_P, int32_t t_fine ) const;
         int32_t compensate_T( int32_t adc_T, int32_t& t_fine ) const;
+        std::pair< uint32_t, uint32_t > report( const uint8_t * data ) const;  // press_msb..temp_xlsb
         static void handle_timer();
     };
     
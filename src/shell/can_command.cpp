@@ -10,8 +10,10 @@
 #include "can.hpp"
 #include "condition_wait.hpp"
 #include "dma.hpp"
+#include "dwt.hpp"
 #include "stm32f103.hpp"
 #include "stream.hpp"
+#include "telemetry.hpp"
 #include "utility.hpp"
 #include <algorithm>
 #include <bitset>
@@ -93,6 +95,13 @@ candump()
         mdelay( 10 );
 
     while ( auto rx = can->rx_queue_get() ) {
+        if ( stm32f103::telemetry::enabled() ) {
+            telemetry_record::can_record rec = { stm32f103::dwt::cycles(), rx->ID, rx->IDE, rx->RTR, rx->DLC, rx->FMI, { 0 } };
+            std::copy( rx->Data, rx->Data + sizeof( rx->Data ), rec.data );
+            stm32f103::telemetry::post( telemetry_record::can_frame, rec );
+            can->rx_queue_free();
+            continue;
+        }
         // stream() << "\nCAN Recv:\tID: " << rx->ID << ", RTR: " << rx->RTR
         //                                        << ", DLC: " << rx->DLC << ", FMI: " << rx->FMI << "\tdata: \t";
         stream() << "\nCAN Recv:\tID: " << rx->ID << "\tdata:\t";
@@ -5,11 +5,15 @@
 //
 
 #include "command_processor.hpp"
+#include "command_table.hpp"
+#include "../common/cobs.hpp"
 #include "adc.hpp"
+#include "adc_pair.hpp"
 #include "bkp.hpp"
 #include "condition_wait.hpp"
 #include "dma.hpp"
 #include "dma_channel.hpp"
+#include "dwt.hpp"
 #include "gpio.hpp"
 #include "gpio_mode.hpp"
 #include "i2c.hpp"
@@ -19,6 +23,7 @@
 #include "stm32f103.hpp"
 #include "system_clock.hpp"
 #include "timer.hpp"
+#include "tokenizer.hpp"
 #include "utility.hpp"
 #include <atomic>
 #include <algorithm>
@@ -28,21 +33,6 @@
 extern std::atomic< uint32_t > atomic_jiffies;
 extern void mdelay( uint32_t ms );
 
-void can_command( size_t argc, const char ** argv );
-void i2c_command( size_t argc, const char ** argv );
-void i2cdetect( size_t argc, const char ** argv );
-void bmp280_command( size_t argc, const char ** argv );
-void ad5593_command( size_t argc, const char ** argv );
-void rcc_status( size_t argc, const char ** argv );
-void rtc_status( size_t argc, const char ** argv );
-void rcc_enable( size_t argc, const char ** argv );
-void timer_command( size_t argc, const char ** argv );
-void gpio_command( size_t argc, const char ** argv );
-void timer_command( size_t argc, const char ** argv );
-void date_command( size_t argc, const char ** argv );
-void hwclock_command( size_t argc, const char ** argv );
-void help( size_t argc, const char ** argv );
-
 void
 system_reset( size_t argc, const char ** argv )
 {
@@ -259,6 +249,21 @@ alt_test( size_t argc, const char ** argv )
     }
 }
 
+// "0,1,2,3" -> { 0, 1, 2, 3 }; returns the number of values
+static size_t
+parse_list( const char * s, uint8_t * values, size_t size )
+{
+    size_t count = 0;
+    while ( count < size && std::isdigit( *s ) ) {
+        values[ count++ ] = strtod( s );
+        while ( std::isdigit( *s ) )
+            ++s;
+        if ( *s == ',' )
+            ++s;
+    }
+    return count;
+}
+
 void
 adc_command( size_t argc, const char ** argv )
 {
@@ -269,6 +274,14 @@ adc_command( size_t argc, const char ** argv )
         stream() << "adc on NN -- enable ADC; start AD conversion by software cpu cycle, NN replicates.\n";
         stream() << "adc off -- disable ADC.\n";        
         stream() << "adc dma -- auto (hardware) repeat AD conversion in background (continue until cpu reset).\n";
+        stream() << "adc rate NN [ch 0,1,2,3] [smp 0..7[,..]] -- NN scans/s triggered by TIM4 CC4; smp is SMPx per channel (default 4, 41.5 cycles).\n";
+        stream() << "adc rate -- requested vs achieved rate and jitter; adc stop -- stop acquisition, release DMA.\n";
+        stream() << "adc decimate NN [order 1..3] -- CIC (order 1: boxcar) by NN scans, 0 := scan rate up to 4096.\n";
+        stream() << "adc sink text|frames|log|none; adc pipeline -- per-stage counters; adc log -- print the RAM log.\n";
+        stream() << "adc pair sim A,B [rate NN] [smp n] -- ADC1/ADC2 regular simultaneous on channels A and B; continuous if no rate.\n";
+        stream() << "adc pair fast A -- ADC1/ADC2 fast interleaved on channel A (~1.7Msps); adc pair [stop] -- status, stop.\n";
+        stream() << "adc inj CH [rate NN] [smp n] -- injected channel triggered by TIM1 at NN/s (default 1000), preempting the scan; adc inj stop.\n";
+        stream() << "adc awd CH LOW HIGH -- analog watchdog on CH (regular and injected); adc awd off; adc awd -- trips and latency.\n";
         return;
     }
 
@@ -302,6 +315,107 @@ adc_command( size_t argc, const char ** argv )
                          << "\t" << int(d) << "(mV)"
                          << std::endl;
             }
+        } else if ( strcmp( argv[0], "rate" ) == 0 ) {
+            if ( argc > 1 && std::isdigit( *argv[1] ) ) {
+                --argc; ++argv;
+                const uint32_t rate = strtod( argv[0] );
+                uint8_t sequence[ 16 ] = { 0, 1, 2, 3 }, sample_time[ 16 ] = { 4 };
+                size_t channels = 4, times = 1;
+                while ( argc > 2 && ( strcmp( argv[1], "ch" ) == 0 || strcmp( argv[1], "smp" ) == 0 ) ) {
+                    if ( strcmp( argv[1], "ch" ) == 0 )
+                        channels = parse_list( argv[2], sequence, countof( sequence ) );
+                    else
+                        times = parse_list( argv[2], sample_time, countof( sample_time ) );
+                    argc -= 2; argv += 2;
+                }
+                for ( size_t i = times; times && i < countof( sample_time ); ++i )
+                    sample_time[ i ] = sample_time[ times - 1 ];
+                if ( ! __adc.start_acquisition( *stm32f103::dma_t< stm32f103::DMA1_BASE >::instance(), rate, sequence, sample_time, channels ) )
+                    stream() << "adc rate " << int( rate ) << " rejected: DMA_ADC1 in use, bad channel or sample time, or scan longer than the period" << std::endl;
+            }
+            __adc.print_acquisition();
+        } else if ( strcmp( argv[0], "stop" ) == 0 ) {
+            __adc.stop_acquisition( *stm32f103::dma_t< stm32f103::DMA1_BASE >::instance() );
+        } else if ( strcmp( argv[0], "decimate" ) == 0 && argc > 1 && std::isdigit( *argv[1] ) ) {
+            --argc; ++argv;
+            const uint32_t ratio = strtod( argv[0] );
+            uint32_t order = 1;
+            if ( argc > 2 && strcmp( argv[1], "order" ) == 0 ) {
+                order = strtod( argv[2] );
+                argc -= 2; argv += 2;
+            }
+            if ( ! __adc.set_decimation( ratio, order ) )
+                stream() << "adc decimate: order 1..3, 12 + order * log2( ratio ) must fit in 32 bits" << std::endl;
+            __adc.print_pipeline();
+        } else if ( strcmp( argv[0], "sink" ) == 0 && argc > 1 ) {
+            --argc; ++argv;
+            static constexpr const char * sinks [] = { "text", "frames", "log", "none" };
+            for ( size_t i = 0; i < countof( sinks ); ++i ) {
+                if ( strcmp( argv[0], sinks[ i ] ) == 0 )
+                    __adc.set_sink( stm32f103::adc::sink_type( i ) );
+            }
+            __adc.print_pipeline();
+        } else if ( strcmp( argv[0], "pair" ) == 0 ) {
+            using stm32f103::adc_pair;
+            auto& dma = *stm32f103::dma_t< stm32f103::DMA1_BASE >::instance();
+            if ( argc > 2 && ( strcmp( argv[1], "sim" ) == 0 || strcmp( argv[1], "fast" ) == 0 ) ) {
+                const auto mode = strcmp( argv[1], "sim" ) == 0 ? adc_pair::regular_simultaneous : adc_pair::fast_interleaved;
+                uint8_t channels[ 2 ] = { 0, 1 };
+                if ( parse_list( argv[2], channels, countof( channels ) ) == 1 )
+                    channels[ 1 ] = channels[ 0 ];
+                argc -= 2; argv += 2;
+                uint32_t rate = 0;
+                uint8_t sample_time = mode == adc_pair::fast_interleaved ? 0 : 4;
+                while ( argc > 2 && ( strcmp( argv[1], "rate" ) == 0 || strcmp( argv[1], "smp" ) == 0 ) ) {
+                    if ( strcmp( argv[1], "rate" ) == 0 )
+                        rate = strtod( argv[2] );
+                    else
+                        sample_time = strtod( argv[2] );
+                    argc -= 2; argv += 2;
+                }
+                if ( ! adc_pair::start( dma, mode, rate, channels[ 0 ], channels[ 1 ], sample_time ) )
+                    stream() << "adc pair rejected: DMA_ADC1 in use, bad channel or sample time, or conversion longer than the period" << std::endl;
+            } else if ( argc > 1 && strcmp( argv[1], "stop" ) == 0 ) {
+                --argc; ++argv;
+                adc_pair::stop( dma );
+            }
+            adc_pair::print_status();
+        } else if ( strcmp( argv[0], "inj" ) == 0 ) {
+            if ( argc > 1 && std::isdigit( *argv[1] ) ) {
+                --argc; ++argv;
+                const uint8_t channel = strtod( argv[0] );
+                uint32_t rate = 1000;
+                uint8_t sample_time = 4;
+                while ( argc > 2 && ( strcmp( argv[1], "rate" ) == 0 || strcmp( argv[1], "smp" ) == 0 ) ) {
+                    if ( strcmp( argv[1], "rate" ) == 0 )
+                        rate = strtod( argv[2] );
+                    else
+                        sample_time = strtod( argv[2] );
+                    argc -= 2; argv += 2;
+                }
+                if ( ! __adc.start_injected( channel, sample_time, rate ) )
+                    stream() << "adc inj rejected: bad channel or sample time, or conversion longer than the period" << std::endl;
+            } else if ( argc > 1 && strcmp( argv[1], "stop" ) == 0 ) {
+                --argc; ++argv;
+                __adc.stop_injected();
+            }
+            __adc.print_watchdog();
+        } else if ( strcmp( argv[0], "awd" ) == 0 ) {
+            if ( argc > 3 && std::isdigit( *argv[1] ) ) {
+                const uint8_t channel = strtod( argv[1] );
+                const uint16_t low = strtod( argv[2] ), high = strtod( argv[3] );
+                argc -= 3; argv += 3;
+                if ( ! __adc.set_watchdog( channel, low, high ) )
+                    stream() << "adc awd: channel 0..17, 0 <= low <= high <= 4095" << std::endl;
+            } else if ( argc > 1 && strcmp( argv[1], "off" ) == 0 ) {
+                --argc; ++argv;
+                __adc.clear_watchdog();
+            }
+            __adc.print_watchdog();
+        } else if ( strcmp( argv[0], "pipeline" ) == 0 ) {
+            __adc.print_pipeline();
+        } else if ( strcmp( argv[0], "log" ) == 0 ) {
+            __adc.print_log();
         } else if ( std::isdigit( *argv[0] ) ) {
             count = strtod( *argv );
             for ( size_t i = 0; i < count; ++i ) {
@@ -316,9 +430,77 @@ adc_command( size_t argc, const char ** argv )
     }
 }
 
+// header + payload + crc gathered into one frame by a three link memory to memory chain, then
+// scattered back; each chain completes with a single TC
+static void
+dma_chain_test( uint32_t channel )
+{
+    using namespace stm32f103;
+
+    auto& dma = *dma_t< DMA1_BASE >::instance();
+    const auto request = DMA_CHANNEL( DMA_MEM2MEM | channel );
+    if ( channel >= 7 || ! dma.try_acquire( request ) ) {
+        stream() << "dma channel " << int( channel ) << " is in use; see 'dma status'" << std::endl;
+        return;
+    }
+
+    static const uint8_t header[] = { 0xa5, 0x01, 0x00, 0x17 };
+    static const char payload[] = "scatter-gather payload";
+    const uint16_t crc16 = cobs::crc16( reinterpret_cast< const uint8_t * >( payload ), sizeof( payload ) );
+    const uint8_t crc[] = { uint8_t( crc16 ), uint8_t( crc16 >> 8 ) };
+
+    uint8_t frame[ sizeof( header ) + sizeof( payload ) + sizeof( crc ) ] = { 0 };
+    uint8_t h[ sizeof( header ) ] = { 0 }, p[ sizeof( payload ) ] = { 0 }, c[ sizeof( crc ) ] = { 0 };
+
+    auto addr = []( const void * p ){ return reinterpret_cast< uint32_t >( p ); };
+    const dma_descriptor gather[] = {
+        { addr( frame ), sizeof( header ), addr( header ), 0, &gather[ 1 ] }
+        , { addr( frame + sizeof( header ) ), sizeof( payload ), addr( payload ), 0, &gather[ 2 ] }
+        , { addr( frame + sizeof( header ) + sizeof( payload ) ), sizeof( crc ), addr( crc ), 0, nullptr }
+    };
+    const dma_descriptor scatter[] = {
+        { addr( h ), sizeof( h ), addr( frame ), 0, &scatter[ 1 ] }
+        , { addr( p ), sizeof( p ), addr( frame + sizeof( h ) ), 0, &scatter[ 2 ] }
+        , { addr( c ), sizeof( c ), addr( frame + sizeof( h ) + sizeof( p ) ), 0, nullptr }
+    };
+
+    constexpr uint32_t ccr = MEM2MEM | PL_High | 0 << 10 | 0 << 8 | MINC | PINC;  // 8bit, source in CPAR
+    dma.init_channel( DMA_CHANNEL( channel ), 0, nullptr, 0, ccr );
+
+    bool complete = true;
+    for ( auto chain: { gather, scatter } ) {
+        if ( complete && dma.start_chain( channel, chain ) )
+            complete = condition_wait()( [&]{ return ! dma.chain_running( channel ); } ) && dma.transfer_complete( channel );
+    }
+    dma.release( request );
+
+    stream() << "frame:";
+    for ( auto b: frame )
+        stream() << " " << b;
+    stream() << std::endl;
+
+    const bool match = std::equal( h, h + sizeof( h ), header ) && std::equal( p, p + sizeof( p ), payload )
+        && std::equal( c, c + sizeof( c ), crc );
+    stream() << "dma chain " << ( ! complete ? "timeout" : match ? "ok" : "data mismatch" ) << std::endl;
+}
+
 void
 dma_command( size_t argc, const char ** argv )
 {
+    using namespace stm32f103;
+
+    if ( argc > 1 && strcmp( argv[1], "status" ) == 0 ) {
+        dma_t< DMA1_BASE >::instance()->print_leases();
+        if ( argc > 2 && strcmp( argv[2], "reset" ) == 0 )
+            dma_t< DMA1_BASE >::instance()->reset_utilization();
+        return;
+    }
+
+    if ( argc > 1 && strcmp( argv[1], "chain" ) == 0 ) {
+        dma_chain_test( argc > 2 && std::isdigit( argv[2][0] ) ? argv[2][0] - '0' : 1 );
+        return;
+    }
+
     uint32_t channel = 1;
 
     auto it = std::find_if( argv, argv + argc, [](auto a){ return std::isdigit( a[0] ); } );
@@ -329,19 +511,26 @@ dma_command( size_t argc, const char ** argv )
     constexpr static uint32_t src [] = { 0x1a2b3c4d, uint32_t(-2), uint32_t(-3), 4, 5, 6, 7, 8 };
     uint32_t dst [ countof( src ) ] = { 0 };
 
+    const auto request = DMA_CHANNEL( DMA_MEM2MEM | channel );
+    if ( channel >= 7 || ! dma_t< DMA1_BASE >::instance()->try_acquire( request ) ) {
+        stream() << "dma channel " << int( channel ) << " is in use; see 'dma status'" << std::endl;
+        return;
+    }
+
     int i = 0;
     for ( auto& s: src )
         stream() << s << " -> " << dst[ i++ ] << std::endl;
 
-    using namespace stm32f103;
     //constexpr uint32_t ccr = MEM2MEM | PL_High | 2 << 10 | 2 << 8 | MINC | PINC;  // [11:10], [1:0] size {0,1,3} = {8,16,32 bits}
     constexpr uint32_t ccr = MEM2MEM | PL_High | 0 << 10 | 0 << 8 | MINC | PINC;  // [11:10], [1:0] size {0,1,3} = {8,16,32 bits}
 
     dma_t< DMA1_BASE >::instance()->init_channel( DMA_CHANNEL(channel), reinterpret_cast< uint32_t >( src ), reinterpret_cast< uint8_t * >( dst ), 5, ccr );
 
-    stm32f103::scoped_dma_channel_enable<stm32f103::dma> enable_dma_channel( *dma_t< DMA1_BASE >::instance(), channel );
+    dma_t< DMA1_BASE >::instance()->enable( channel, true );
+    bool complete = condition_wait()([&]{ return dma_t< DMA1_BASE >::instance()->transfer_complete( DMA_CHANNEL(channel) ); } );
+    dma_t< DMA1_BASE >::instance()->release( request ); // disables the channel
 
-    if ( ! condition_wait()([&]{ return dma_t< DMA1_BASE >::instance()->transfer_complete( DMA_CHANNEL(channel) ); } ) ) {
+    if ( ! complete ) {
         stream() << "\tdma timeout\n";
         return;
     }
@@ -381,44 +570,6 @@ command_processor::command_processor()
 {
 }
 
-class primitive {
-public:
-    const char * arg0_;
-    void (*f_)(size_t, const char **);
-    const char * help_;
-};
-
-static const primitive command_table [] = {
-    { "ad5593",      ad5593_command,  " ad5593" }
-    , { "adc",       adc_command,     " replicates (1)" }
-    , { "afio",      afio_test,       " AFIO MAPR list" }
-    , { "alt",       alt_test,        " spi [remap]" }
-    , { "bkp",       bkp_command,     " backup registers" }
-    , { "bmp",       bmp280_command,  " start|stop" }
-    , { "can",       can_command,     " can" }
-    , { "candump",   can_command,     " candump" }
-    , { "cansend",   can_command,     " cansend 01a#11223333aabbccdd" }
-    , { "date",      date_command,    " show current date time; date --set 'iso format date'" }
-    , { "disable",   rcc_enable,      " reg1 [reg2...] Disable clock for specified peripheral." }
-    , { "dma",       dma_command,     " ram to ram dma copy teset" }
-    , { "enable",    rcc_enable,      " reg1 [reg2...] Enable clock for specified peripheral." }
-    , { "gpio",      gpio_command,    " pin# (toggle PA# as GPIO, where # is 0..12)" }
-    , { "hwclock",   hwclock_command, "" }
-    , { "i2c",       i2c_command,     " I2C-1 test" }
-    , { "i2c2",      i2c_command,     " I2C-2 test" }
-    , { "i2cdetect", i2cdetect,       " i2cdetect [0|1]" }
-    , { "rcc",       rcc_status,      " RCC clock enable register list" }
-    , { "reset",     system_reset,    "" }
-    , { "rtc",       rtc_status,      " RTC register print" }
-    , { "spi",       spi_command,     " spi [replicates]" }
-    , { "spi2",      spi_command,     " spi2 [replicates]" }
-    , { "timer",     timer_command,   "" }
-    , { "help",      help, "" }
-    , { "?", help, "" }
-};
-
-constexpr size_t command_table_size = sizeof(command_table)/sizeof(command_table[0]);
-
 void
 help( size_t argc, const char ** argv )
 {
@@ -445,12 +596,10 @@ command_processor::operator()( size_t argc, const char ** argv ) const
         bool processed( false );
 
         if ( argc > 0 ) {
-            auto it = std::find_if( command_table, command_table + command_table_size
-                                    , [&](const auto& cmd){ return strcmp(cmd.arg0_, argv[0]) == 0; });
-            if ( it != command_table + command_table_size ) {
+            if ( auto f = lookup( argv[ 0 ] ) ) {
                 processed = true;
                 stream() << std::endl;
-                it->f_( argc, argv );                
+                f( argc, argv );
             }
         }
 
@@ -462,3 +611,70 @@ command_processor::operator()( size_t argc, const char ** argv ) const
 
     return true;
 }
+
+command_processor::command_type
+command_processor::lookup( const char * arg0 )
+{
+    if ( auto cmd = command_detail::find( arg0 ) )
+        return cmd->f_;
+    return nullptr;
+}
+
+size_t
+command_processor::size()
+{
+    return command_table_size;
+}
+
+const char *
+command_processor::name( size_t idx )
+{
+    return idx < command_table_size ? command_table[ idx ].arg0_ : nullptr;
+}
+
+size_t
+command_processor::execute( char * script ) const
+{
+    typedef tokenizer< 32 > tokenizer_type;
+    tokenizer_type::argv_type argv;
+
+    size_t count = 0;
+    for ( char * p = script; *p; ++p ) {
+        if ( *p == ';' || *p == '\n' )
+            ++count;
+    }
+    const bool batch = count > 1;
+
+    size_t executed = 0;
+    uint32_t total = 0;
+    char * p = script;
+    while ( *p ) {
+        char * end = p;
+        while ( *end && *end != ';' && *end != '\n' )
+            ++end;
+        const bool last = *end == '\0';
+        *end = '\0';
+
+        while ( *p == ' ' || *p == '\t' )
+            ++p;
+        if ( *p == '\0' ) { // empty line or ';;'
+            if ( batch == false )
+                (*this)( 0, argv.data() );
+        } else if ( auto argc = tokenizer_type()( p, argv ) ) {
+            const char * arg0 = argv[ 0 ];
+            const uint32_t t0 = stm32f103::dwt::cycles();
+            (*this)( argc, argv.data() );
+            const uint32_t cycles = stm32f103::dwt::cycles() - t0;
+            ++executed;
+            total += cycles;
+            if ( batch )
+                stream() << "[" << arg0 << ": " << int( cycles ) << " cycles]" << std::endl;
+        }
+        if ( last )
+            break;
+        p = end + 1;
+    }
+    if ( batch )
+        stream() << "[batch: " << int( executed ) << " commands, " << int( total ) << " cycles]" << std::endl;
+    return executed;
+}
@@ -18,4 +18,13 @@ public:
     // ~command_processor() {} // dtor causing undefined references: __cxa_end_cleanup, __gxx_personality_v0
     
     bool operator()( size_t argc, const char ** argv ) const;
+
+    // runs ';' or newline separated commands back to back; with more than one command,
+    // the cpu cycles of each (including its console output) are reported
+    size_t execute( char * script ) const;
+
+    typedef void (*command_type)( size_t, const char ** );
+    static command_type lookup( const char * arg0 );  // binary search on the sorted command table
+    static size_t size();
+    static const char * name( size_t );
 };
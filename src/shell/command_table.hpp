@@ -0,0 +1,115 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include <cstddef>
+
+// The shell command table, apart from command_processor.cpp so that the host dispatcher test
+// (src/command) builds the same table against stub commands.
+
+void can_command( size_t argc, const char ** argv );
+void i2c_command( size_t argc, const char ** argv );
+void i2cdetect( size_t argc, const char ** argv );
+void bmp280_command( size_t argc, const char ** argv );
+void ad5593_command( size_t argc, const char ** argv );
+void rcc_status( size_t argc, const char ** argv );
+void rcc_enable( size_t argc, const char ** argv );
+void timer_command( size_t argc, const char ** argv );
+void gpio_command( size_t argc, const char ** argv );
+void date_command( size_t argc, const char ** argv );
+void hwclock_command( size_t argc, const char ** argv );
+void uart_command( size_t argc, const char ** argv );
+void bench_command( size_t argc, const char ** argv );
+void dlog_command( size_t argc, const char ** argv );
+void telemetry_command( size_t argc, const char ** argv );
+
+// defined in command_processor.cpp
+void help( size_t argc, const char ** argv );
+void rtc_status( size_t argc, const char ** argv );
+void system_reset( size_t argc, const char ** argv );
+void bkp_command( size_t argc, const char ** argv );
+void spi_command( size_t argc, const char ** argv );
+void alt_test( size_t argc, const char ** argv );
+void adc_command( size_t argc, const char ** argv );
+void dma_command( size_t argc, const char ** argv );
+void afio_test( size_t argc, const char ** argv );
+
+class primitive {
+public:
+    const char * arg0_;
+    void (*f_)(size_t, const char **);
+    const char * help_;
+};
+
+// Must be kept in strcmp order; lookup is a binary search, and a misplaced entry fails to compile.
+static constexpr primitive command_table [] = {
+    { "?",           help,            "" }
+    , { "ad5593",    ad5593_command,  " ad5593" }
+    , { "adc",       adc_command,     " replicates (1) | dma | rate NN [ch 0,1,..] [smp n,..] | stop | decimate NN [order n] | sink | pipeline | log | pair sim|fast|stop | inj CH | awd CH LOW HIGH" }
+    , { "afio",      afio_test,       " AFIO MAPR list" }
+    , { "alt",       alt_test,        " spi [remap]" }
+    , { "bench",     bench_command,   " itoa|dtoa|fmt|dispatch|memcpy|accumulate [count]" }
+    , { "bkp",       bkp_command,     " backup registers" }
+    , { "bmp",       bmp280_command,  " start|stop" }
+    , { "can",       can_command,     " can" }
+    , { "candump",   can_command,     " candump" }
+    , { "cansend",   can_command,     " cansend 01a#11223333aabbccdd" }
+    , { "date",      date_command,    " show current date time; date --set 'iso format date'" }
+    , { "disable",   rcc_enable,      " reg1 [reg2...] Disable clock for specified peripheral." }
+    , { "dlog",      dlog_command,    " [on|off|status|test] deferred binary log (decode with src/dlog)" }
+    , { "dma",       dma_command,     " [channel#] ram to ram dma copy teset | status [reset] channel leases | chain [channel#] scatter-gather test; see also 'bench memcpy'" }
+    , { "enable",    rcc_enable,      " reg1 [reg2...] Enable clock for specified peripheral." }
+    , { "gpio",      gpio_command,    " pin# (toggle PA# as GPIO, where # is 0..12)" }
+    , { "help",      help,            " commands may be chained with ';', e.g. 'date; uart; rtc'" }
+    , { "hwclock",   hwclock_command, "" }
+    , { "i2c",       i2c_command,     " I2C-1 test" }
+    , { "i2c2",      i2c_command,     " I2C-2 test" }
+    , { "i2cdetect", i2cdetect,       " i2cdetect [0|1]" }
+    , { "rcc",       rcc_status,      " RCC clock enable register list" }
+    , { "reset",     system_reset,    "" }
+    , { "rtc",       rtc_status,      " RTC register print" }
+    , { "spi",       spi_command,     " spi [replicates]" }
+    , { "spi2",      spi_command,     " spi2 [replicates]" }
+    , { "telemetry", telemetry_command, " [on|off] binary frames for adc, candump, bmp (receive with src/telemetry)" }
+    , { "timer",     timer_command,   "" }
+    , { "uart",      uart_command,    " [1|2|3] [status|clear] | open [baud] | send text | recv | policy block|drop|drop-oldest | dma on|off | bench [bytes]" }
+};
+
+constexpr size_t command_table_size = sizeof(command_table)/sizeof(command_table[0]);
+
+namespace command_detail {
+    constexpr int compare( const char * a, const char * b ) {
+        while ( *a && (*a == *b ) )
+            a++, b++;
+        return int( static_cast< unsigned char >( *a ) ) - int( static_cast< unsigned char >( *b ) );
+    }
+
+    constexpr bool is_sorted( const primitive * first, const primitive * last ) {
+        for ( auto it = first; it + 1 < last; ++it ) {
+            if ( compare( it->arg0_, ( it + 1 )->arg0_ ) >= 0 )
+                return false;
+        }
+        return true;
+    }
+    static_assert( is_sorted( command_table, command_table + command_table_size ), "command_table must be sorted by name" );
+
+    // binary search; nullptr if arg0 is not a command
+    inline const primitive * find( const char * arg0 ) {
+        size_t first = 0, last = command_table_size;
+        while ( first < last ) {
+            const size_t mid = ( first + last ) / 2;
+            const int r = compare( command_table[ mid ].arg0_, arg0 );
+            if ( r == 0 )
+                return &command_table[ mid ];
+            if ( r < 0 )
+                first = mid + 1;
+            else
+                last = mid;
+        }
+        return nullptr;
+    }
+}
@@ -44,6 +44,8 @@ extern void __tim7_handler(void);
 extern void __spi1_handler(void);
 extern void __spi2_handler(void);
 extern void __usart1_handler(void);
+extern void __usart2_handler(void);
+extern void __usart3_handler(void);
 extern void __systick_handler(void);
 extern void __dma1_ch1_handler( void );
 extern void __dma1_ch2_handler( void );
@@ -117,12 +119,12 @@ void ( * const vector_table [] )() __attribute__ ((section(".vect"))) = {
 	__i2c1_event_handler,           /* 0x0BC I2C1 event                      */
 	__i2c1_error_handler,           /* 0x0C0 I2C1 error                      */
 	__i2c2_event_handler,           /* 0x0C4 I2C2 event                      */
-	__i2c2_event_handler,           /* 0x0C8 I2C2 error                      */
+	__i2c2_error_handler,           /* 0x0C8 I2C2 error                      */
 	__spi1_handler,                 /* 0x0CC SPI1                            */
 	__spi2_handler,                 /* 0x0D0 SPI2                            */
 	__usart1_handler,               /* 0x0D4 USART1                          */
-	0,                              /* 0x0D8 USART2                          */
-	0,                              /* 0x0DC USART3                          */
+	__usart2_handler,               /* 0x0D8 USART2                          */
+	__usart3_handler,               /* 0x0DC USART3                          */
 	0,                              /* 0x0E0 EXTI Lines 15:10                */
 	0,                              /* 0x0E4 RTC alarm through EXTI line     */
 	0,                              /* 49  USB OTG FS Wakeup through EXTI  */
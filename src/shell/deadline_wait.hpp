@@ -0,0 +1,66 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include "dwt.hpp"
+#include <atomic>
+#include <cstdint>
+
+extern uint32_t __system_clock;
+
+namespace stm32f103 {
+
+    // counts and worst case of a family of waits; zero (.bss) is the cleared state
+    struct wait_statistics {
+        std::atomic< uint32_t > waits;
+        std::atomic< uint32_t > timeouts;
+        std::atomic< uint32_t > worst;    // cycles, longest wait that succeeded
+
+        void add( uint32_t cycles, bool success ) {
+            ++waits;
+            if ( ! success ) {
+                ++timeouts;
+                return;
+            }
+            auto w = worst.load();
+            while ( cycles > w && ! worst.compare_exchange_weak( w, cycles ) )
+                ;
+        }
+
+        void clear() {
+            waits = 0;
+            timeouts = 0;
+            worst = 0;
+        }
+    };
+
+    // Time based counterpart of condition_wait: polls 'condition' until it holds or 'us'
+    // microseconds have passed on the DWT cycle counter, whatever the optimization level and
+    // clock.  With 'sleep' the core waits for an event (WFE) between polls; any interrupt wakes
+    // it, the 100us SysTick at the latest, so it suits conditions made true by an irq handler.
+    struct deadline_wait {
+        uint32_t limit;
+        wait_statistics * stats;
+        bool sleep;
+
+        deadline_wait( uint32_t us, wait_statistics * s = nullptr, bool wfe = false )
+            : limit( us * ( __system_clock / 1000000 ) ), stats( s ), sleep( wfe ) {}
+
+        template< typename functor > inline bool operator()( functor condition ) {
+            const uint32_t t0 = dwt::cycles();
+            bool success;
+            while ( ! ( success = condition() ) && dwt::cycles() - t0 < limit ) {
+                if ( sleep )
+                    __asm volatile ( "wfe" );
+            }
+            if ( stats )
+                stats->add( dwt::cycles() - t0, success );
+            return success;
+        }
+    };
+
+}
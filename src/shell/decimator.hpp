@@ -0,0 +1,185 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace stm32f103 {
+
+    // Oversampling kernels: add 'scans' interleaved scans of Channels 12bit samples into acc[].
+
+    template< size_t Channels >
+    inline void
+    accumulate_scalar( const uint16_t * data, size_t scans, uint32_t * acc )
+    {
+        for ( size_t i = 0; i < scans; ++i, data += Channels ) {
+            for ( size_t ch = 0; ch < Channels; ++ch )
+                acc[ ch ] += data[ ch ];
+        }
+    }
+
+    // SWAR: one 32bit load carries two samples, one 32bit add sums both; 16 adds of 12bit values
+    // (16 * 4095 < 65536) cannot carry from the low lane into the high one, so the packed sums
+    // are spilled to acc[] every 16 blocks.  A block is one scan, or two for odd Channels so that
+    // lanes stay on the same channel.  Samples must be right aligned 12bit (ADC CR2 ALIGN = 0);
+    // an unaligned 'data' takes the scalar path.
+    template< size_t Channels, size_t Unroll = 4 >
+    inline void
+    accumulate_packed( const uint16_t * data, size_t scans, uint32_t * acc )
+    {
+        static_assert( Channels > 0 && Unroll > 0 && 16 % Unroll == 0, "Unroll must divide the 16 block spill interval" );
+        typedef const uint32_t __attribute__(( may_alias )) word_type;
+        constexpr size_t scans_per_block = Channels % 2 ? 2 : 1;
+        constexpr size_t words = Channels * scans_per_block / 2;
+
+        if ( reinterpret_cast< uintptr_t >( data ) & 3 )
+            return accumulate_scalar< Channels >( data, scans, acc );
+
+        auto p = reinterpret_cast< word_type * >( data );
+        const size_t blocks = scans / scans_per_block;
+        for ( size_t done = 0; done < blocks; ) {
+            const size_t n = blocks - done < 16 ? blocks - done : 16;
+            uint32_t sum[ words ] = { 0 };
+            size_t i = 0;
+            for ( ; i + Unroll <= n; i += Unroll ) {
+                for ( size_t u = 0; u < Unroll; ++u, p += words ) {
+                    for ( size_t k = 0; k < words; ++k )
+                        sum[ k ] += p[ k ];
+                }
+            }
+            for ( ; i < n; ++i, p += words ) {
+                for ( size_t k = 0; k < words; ++k )
+                    sum[ k ] += p[ k ];
+            }
+            for ( size_t k = 0; k < words; ++k ) {
+                acc[ ( 2 * k ) % Channels ] += sum[ k ] & 0xffff;
+                acc[ ( 2 * k + 1 ) % Channels ] += sum[ k ] >> 16;
+            }
+            done += n;
+        }
+        const size_t tail = scans - blocks * scans_per_block;
+        accumulate_scalar< Channels >( data + ( scans - tail ) * Channels, tail, acc );
+    }
+
+    // run time channel count -> compile time kernel; false if there is none for 'channels'
+    template< size_t Unroll = 4 >
+    inline bool
+    accumulate( const uint16_t * data, size_t scans, size_t channels, uint32_t * acc )
+    {
+        switch ( channels ) {
+        case 1: accumulate_packed< 1, Unroll >( data, scans, acc ); return true;
+        case 2: accumulate_packed< 2, Unroll >( data, scans, acc ); return true;
+        case 3: accumulate_packed< 3, Unroll >( data, scans, acc ); return true;
+        case 4: accumulate_packed< 4, Unroll >( data, scans, acc ); return true;
+        case 6: accumulate_packed< 6, Unroll >( data, scans, acc ); return true;
+        case 8: accumulate_packed< 8, Unroll >( data, scans, acc ); return true;
+        default: return false;
+        }
+    }
+
+    // CIC decimator over interleaved multi-channel scans of 12bit samples; order 1 is a boxcar
+    // average.  Integrators run at the input rate and combs at the output rate, in modulo 2^32
+    // arithmetic, which is exact as long as 12 + order * log2( ratio ) bits fit in 32 (configure
+    // refuses anything larger).  Outputs are divided by the gain ratio^order; the first order - 1
+    // outputs after reset are start-up transients.
+
+    template< size_t MaxChannels, size_t MaxOrder = 3 >
+    class cic_decimator {
+        std::array< std::array< uint32_t, MaxChannels >, MaxOrder > integrator_;
+        std::array< std::array< uint32_t, MaxChannels >, MaxOrder > comb_;     // previous comb inputs
+        size_t channels_;
+        size_t order_;
+        uint32_t ratio_;
+        uint32_t phase_;
+        uint32_t gain_;
+
+        const uint16_t * comb( uint16_t * out ) {
+            phase_ = 0;
+            for ( size_t ch = 0; ch < channels_; ++ch ) {
+                uint32_t y = integrator_[ order_ - 1 ][ ch ];
+                for ( size_t k = 0; k < order_; ++k ) {
+                    const uint32_t prev = comb_[ k ][ ch ];
+                    comb_[ k ][ ch ] = y;
+                    y -= prev;
+                }
+                out[ ch ] = uint16_t( y / gain_ );
+            }
+            return out;
+        }
+
+    public:
+        cic_decimator() : channels_( 0 ), order_( 1 ), ratio_( 1 ), phase_( 0 ), gain_( 1 ) {}
+
+        static constexpr size_t max_order = MaxOrder;
+
+        bool configure( size_t channels, uint32_t ratio, size_t order ) {
+            if ( channels == 0 || channels > MaxChannels || ratio == 0 || order == 0 || order > MaxOrder )
+                return false;
+            uint32_t bits = 0;
+            while ( ( uint64_t( 1 ) << bits ) < ratio )
+                ++bits;
+            if ( 12 + order * bits > 32 )
+                return false;
+            channels_ = channels;
+            order_ = order;
+            ratio_ = ratio;
+            gain_ = 1;
+            for ( size_t i = 0; i < order; ++i )
+                gain_ *= ratio;
+            reset();
+            return true;
+        }
+
+        void reset() {
+            for ( auto& stage: integrator_ )
+                stage.fill( 0 );
+            for ( auto& stage: comb_ )
+                stage.fill( 0 );
+            phase_ = 0;
+        }
+
+        // one scan in; true when 'out' holds a decimated scan
+        bool push( const uint16_t * scan, uint16_t * out ) {
+            for ( size_t ch = 0; ch < channels_; ++ch ) {
+                uint32_t x = scan[ ch ];
+                for ( size_t k = 0; k < order_; ++k )
+                    x = integrator_[ k ][ ch ] += x;
+            }
+            if ( ++phase_ < ratio_ )
+                return false;
+            comb( out );
+            return true;
+        }
+
+        // 'scans' interleaved scans in; emit( const uint16_t * ) for each decimated scan.  Order 1
+        // (boxcar) adds whole runs up to the next output with accumulate().
+        template< typename F >
+        void push( const uint16_t * data, size_t scans, F emit ) {
+            uint16_t out[ MaxChannels ];
+            while ( scans ) {
+                size_t n = scans < ratio_ - phase_ ? scans : ratio_ - phase_;
+                if ( order_ == 1 && accumulate( data, n, channels_, integrator_[ 0 ].data() ) ) {
+                    if ( ( phase_ += n ) == ratio_ )
+                        emit( comb( out ) );
+                } else {
+                    n = 1;
+                    if ( push( data, out ) )
+                        emit( static_cast< const uint16_t * >( out ) );
+                }
+                data += n * channels_;
+                scans -= n;
+            }
+        }
+
+        inline size_t channels() const { return channels_; }
+        inline size_t order() const { return order_; }
+        inline uint32_t ratio() const { return ratio_; }
+    };
+
+}
@@ -0,0 +1,96 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#include "dlog.hpp"
+#include "background.hpp"
+#include "dwt.hpp"
+#include "ring_buffer.hpp"
+#include "stm32f103.hpp"
+#include "uart.hpp"
+#include <atomic>
+
+namespace {
+    // all zero is a valid empty state, so these are usable from .bss before any constructor
+    stm32f103::ring_buffer< uint32_t, 256 > __dlog_ring;
+    std::atomic< uint32_t > __records;
+    std::atomic< uint32_t > __dropped;
+    std::atomic< bool > __enabled;
+
+    constexpr size_t drain_records_per_poll = 8;
+}
+
+using namespace stm32f103;
+
+uint32_t
+dlog::timestamp()
+{
+    return dwt::cycles();
+}
+
+void
+dlog::push( const uint32_t * record, size_t size )
+{
+    if ( __dlog_ring.push( record, size ) )
+        ++__records;
+    else
+        ++__dropped;
+}
+
+void
+dlog::enable( bool enable )
+{
+    __enabled = enable;
+    if ( enable )
+        background::add( drain );
+    else
+        background::remove( drain );
+}
+
+bool
+dlog::enabled()
+{
+    return __enabled.load();
+}
+
+uint32_t
+dlog::records()
+{
+    return __records.load();
+}
+
+uint32_t
+dlog::dropped()
+{
+    return __dropped.load();
+}
+
+void
+dlog::drain()
+{
+    auto& console = *uart_t< USART1_BASE >::instance();
+
+    for ( size_t n = 0; n < drain_records_per_poll && __enabled; ++n ) {
+        // leave room in the tx buffer for interactive output
+        if ( console.tx_pending() > 128 )
+            return;
+
+        uint32_t header;
+        if ( ! __dlog_ring.pop( header ) )
+            return;
+
+        console.putc( dlog_record::sync );
+        // header, time stamp and arguments; a record is published as a whole, so the rest is there
+        for ( uint32_t i = 0, size = 2 + dlog_record::words( header ); i < size; ++i ) {
+            uint32_t w = header;
+            if ( i > 0 && ! __dlog_ring.pop( w ) )
+                return;
+            console.putc( w & 0xff );
+            console.putc( ( w >> 8 ) & 0xff );
+            console.putc( ( w >> 16 ) & 0xff );
+            console.putc( ( w >> 24 ) & 0xff );
+        }
+    }
+}
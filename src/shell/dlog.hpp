@@ -0,0 +1,112 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include "../common/dlog_record.hpp"
+#include "format.hpp"
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// Deferred log
+//
+//   DLOG( "dma ch%u ISR=%08x\n", channel, flag );
+//
+// The format string goes to the '.logfmt' section, which is kept in the ELF file but not
+// loaded (see stm32.ld); a log site stores only the string offset, a cycle time stamp and the
+// raw arguments into a lock-free RAM ring, which costs a few dozen cycles and is safe from any
+// interrupt priority.  A background task streams the records on the console, and the host tool
+// in src/dlog renders them from the ELF file.  The pattern and the arguments are checked at
+// compile time as "..."_fmt does; 64-bit integers need 'll', and %s takes strings in flash only.
+
+namespace stm32f103 {
+
+    class dlog {
+    public:
+        template< typename T >
+        static constexpr uint32_t words() {
+            typedef typename std::decay< T >::type type;
+            static_assert( ! format_detail::is_fixed< type >::value, "DLOG: fixed<> is not supported, pass raw() with %d" );
+            return ( std::is_floating_point< type >::value || sizeof( type ) == 8 ) ? 2 : 1;
+        }
+
+        // 64-bit integers must be marked 'll' (or 'j') so that the host knows the argument size
+        template< typename T >
+        static constexpr bool next_width_matches( const char * s, size_t& pos ) {
+            typedef typename std::decay< T >::type type;
+            auto sp = format_detail::parse( s, pos );
+            while ( sp.conv == '%' )
+                sp = format_detail::parse( s, sp.next );
+            pos = sp.next;
+            return ! std::is_integral< type >::value || sp.wide == ( sizeof( type ) == 8 );
+        }
+
+        template< typename... Args >
+        static constexpr bool check( const char * s ) {
+            [[maybe_unused]] size_t pos = 0;    // unused for a pattern without arguments
+            bool result = true;
+            ( ( result = result && next_width_matches< Args >( s, pos ) ), ... );
+            return result;
+        }
+
+        // compile time checks of a log site; generates no code
+        template< char... C, typename... Args >
+        static constexpr bool checked( format_detail::format_string< C... > f, const Args&... args ) {
+            static_assert( check< Args... >( format_detail::format_string< C... >::value ), "DLOG: 64-bit integers need 'll' in the format" );
+            (void)f( args... );  // pattern and argument types, as "..."_fmt
+            return true;
+        }
+
+        template< typename... Args >
+        static inline void write( const char * format, const Args&... args ) {
+            constexpr uint32_t size = ( 0 + ... + words< Args >() );
+            static_assert( size <= dlog_record::max_words, "DLOG: too many arguments" );
+            uint32_t record[ 2 + size ];
+            record[ 0 ] = dlog_record::header( uint32_t( reinterpret_cast< uintptr_t >( format ) ), size );
+            record[ 1 ] = timestamp();
+            [[maybe_unused]] uint32_t * p = record + 2;
+            ( ( p = encode( p, args ) ), ... );
+            push( record, 2 + size );
+        }
+
+        static void enable( bool );   // start/stop streaming records to the console
+        static bool enabled();
+        static uint32_t records();
+        static uint32_t dropped();
+        static void drain();          // background task
+
+    private:
+        static uint32_t timestamp();
+        static void push( const uint32_t * record, size_t size );
+
+        template< typename T >
+        static inline uint32_t * encode( uint32_t * p, const T& t ) {
+            if constexpr ( std::is_floating_point< T >::value ) {
+                double d = t;
+                std::memcpy( p, &d, sizeof( d ) );
+                return p + 2;
+            } else if constexpr ( std::is_pointer< T >::value ) {
+                *p = uint32_t( reinterpret_cast< uintptr_t >( t ) );
+                return p + 1;
+            } else if constexpr ( sizeof( T ) == 8 ) {
+                p[ 0 ] = uint32_t( t );
+                p[ 1 ] = uint32_t( uint64_t( t ) >> 32 );
+                return p + 2;
+            } else {
+                *p = uint32_t( t );
+                return p + 1;
+            }
+        }
+    };
+}
+
+#define DLOG( fmt, ... ) do {                                                        \
+        __attribute__(( section( ".logfmt" ), used ))                               \
+            static const char __dlog_format[] = fmt;                                \
+        (void)stm32f103::dlog::checked( fmt ## _fmt, ##__VA_ARGS__ );               \
+        stm32f103::dlog::write( __dlog_format, ##__VA_ARGS__ );                     \
+    } while ( 0 )
@@ -0,0 +1,55 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#include "dlog.hpp"
+#include "dwt.hpp"
+#include "stream.hpp"
+#include "utility.hpp"
+
+namespace {
+    void
+    print_status()
+    {
+        using stm32f103::dlog;
+        stream() << "dlog: " << ( dlog::enabled() ? "on" : "off" )
+                 << "\trecords: " << int( dlog::records() )
+                 << "\tdropped: " << int( dlog::dropped() )
+                 << std::endl;
+    }
+}
+
+void
+dlog_command( size_t argc, const char ** argv )
+{
+    using namespace stm32f103;
+
+    if ( argc == 1 )
+        print_status();
+
+    while ( --argc ) {
+        ++argv;
+        if ( strcmp( argv[0], "on" ) == 0 ) {
+            dlog::enable( true );
+        } else if ( strcmp( argv[0], "off" ) == 0 ) {
+            dlog::enable( false );
+        } else if ( strcmp( argv[0], "status" ) == 0 ) {
+            print_status();
+        } else if ( strcmp( argv[0], "test" ) == 0 ) {
+            auto t0 = dwt::cycles();
+            DLOG( "dlog test: no argument\n" );
+            auto t1 = dwt::cycles();
+            DLOG( "dlog test: %d %u 0x%08x\n", int32_t( -1 ), uint32_t( 2 ), uint32_t( 0xdeadbeef ) );
+            auto t2 = dwt::cycles();
+            DLOG( "dlog test: %lld %.3f %s\n", int64_t( -1234567890123LL ), 3.14159, "flash string" );
+            auto t3 = dwt::cycles();
+            stream() << "dlog cost (cycles): 0 args " << int( t1 - t0 )
+                     << ", 3 words " << int( t2 - t1 )
+                     << ", 5 words " << int( t3 - t2 ) << std::endl;
+        } else {
+            stream() << "dlog [on|off|status|test]" << std::endl;
+        }
+    }
+}
@@ -4,14 +4,19 @@
 // Contact: toshi.hondo@qtplatz.com
 //
 
+#include "dlog.hpp"
 #include "dma.hpp"
 #include "dma_channel.hpp"
+#include "dwt.hpp"
 #include <array>
 #include <atomic>
 #include <mutex>
 #include "stm32f103.hpp"
 #include "stream.hpp"
 
+extern std::atomic< uint32_t > atomic_jiffies;
+extern uint32_t __system_clock;
+
 extern "C" {
     void i2c1_handler();
     void enable_interrupt( stm32f103::IRQn_type IRQn );
@@ -48,8 +53,21 @@ dma::dma() : dma_( 0 )
 void
 dma::init( stm32f103::DMA_BASE addr )
 {
-    lock_.clear();
-    interrupt_status_ = 0;
+    status_.clear();
+    for ( auto& callback: callbacks_ )
+        callback = nullptr;
+    for ( auto& chain: chain_ )
+        chain = nullptr;
+    for ( auto& owner: owner_ )
+        owner = no_owner;
+    for ( auto& waiters: waiters_ )
+        waiters = 0;
+    granted_.fill( nullptr );
+    last_grant_.fill( 0 );
+    grants_.fill( 0 );
+    contended_.fill( 0 );
+    held_.fill( 0 );
+    window_start_ = atomic_jiffies.load();
 
     if ( auto DMA = reinterpret_cast< volatile stm32f103::DMA * >( addr ) ) {
         dma_ = DMA;
@@ -59,10 +77,7 @@ dma::init( stm32f103::DMA_BASE addr )
 void
 dma::clear_callback( uint32_t channel )
 {
-    while ( !lock_.test_and_set( std::memory_order_acquire ) )
-        ;
-    callbacks_[ channel ] = nullptr;
-    lock_.clear();
+    callbacks_.at( channel ) = nullptr;
 }
 
 constexpr static const DMAChannel readOnlyChannel = { 0 }; // allocated on .data (ROM)
@@ -71,8 +86,8 @@ volatile DMAChannel&
 dma::dmaChannel( uint32_t channel )
 {
     auto number_of_channels = dma_number_of_channels< DMA1_BASE >::value;
-    if ( dma_ == reinterpret_cast< volatile stm32f103::DMA * >( DMA1_BASE ) )
-        dma_number_of_channels< stm32f103::DMA2_BASE >::value;
+    if ( dma_ == reinterpret_cast< volatile stm32f103::DMA * >( DMA2_BASE ) )
+        number_of_channels = dma_number_of_channels< DMA2_BASE >::value;
 
     if ( channel < number_of_channels )
         return dma_->channels[ channel ];
@@ -98,23 +113,26 @@ dma::init_channel( DMA_CHANNEL channel_number
     //channel.CCR = ( channel.CCR & 0xffff800f ) | dma_ccr;
     channel.CCR = dma_ccr;
 
+    enable_irq( channel_number );
+
+    return true;
+}
+
+void
+dma::enable_irq( uint32_t channel_number )
+{
     if ( reinterpret_cast< uint32_t >( const_cast< DMA * >( dma_ ) ) == DMA1_BASE ) {
         enable_interrupt( IRQn( DMA1_Channel1_IRQn + channel_number ) );
     } else {
         enable_interrupt( IRQn( DMA2_Channel1_IRQn + channel_number ) );
     }
-
-    return true;
 }
 
 void
 dma::enable( uint32_t channel_number, bool enable )
 {
     if ( enable ) {
-        while ( !lock_.test_and_set( std::memory_order_acquire ) )
-            ;
-        interrupt_status_ &= ~( 0x0f << channel_number );
-        lock_.clear();
+        status_.clear( channel_number );
         dmaChannel( channel_number ).CCR |= EN | TCIE | TEIE; // channel enable, transfer complete interrupt enable, error irq
     } else {
         dmaChannel( channel_number ).CCR &= ~( EN | TCIE );
@@ -154,43 +172,204 @@ dma::set_receive_buffer( uint32_t channel_number, uint8_t * buffer, size_t size
 bool
 dma::transfer_complete( uint32_t channel )
 {
-    uint32_t isr(0);
+    return status_.take_complete( channel );
+}
+
+uint32_t
+dma::take_status( uint32_t channel )
+{
+    return status_.take( channel );
+}
+
+void
+dma::handle_interrupt( uint32_t channel )
+{
+    uint32_t x = ( dma_->ISR >> ( channel * 4 ) ) & 0x0f;
+    dma_->IFCR = x << ( channel * 4 );  // write 1 to clear; other channels' flags are untouched
+
+    if ( auto current = chain_[ channel ].load() ) {
+        auto next = dma_chain_step( dmaChannel( channel ), current, x );
+        if ( next != current ) {
+            chain_[ channel ] = next;
+            if ( next ) {
+                x &= ~uint32_t( TCIF ); // an inner link; the chain completes on the last one
+                if ( ( x & ~uint32_t( GIF ) ) == 0 )
+                    return;
+            }
+        }
+    }
 
-    while ( ! lock_.test_and_set( std::memory_order_acquire ) )
-            ;
-    isr = interrupt_status_.load();
-    interrupt_status_ = dma_->ISR;
-    lock_.clear();
+    status_.post( channel, x );
 
-    return ( ( isr >> (channel * 4) ) & TCIF );
+    if ( auto callback = callbacks_[ channel ].load() )
+        callback( x );
+    else
+        DLOG( "\tDMA: handle_interrupt: %u ISR=%x %s%s%s%s\n", channel, x
+              , ( x & 0x8 ) ? "transfer error, " : ""
+              , ( x & 0x4 ) ? "half transfer, " : ""
+              , ( x & 0x2 ) ? "transfer complete, " : ""
+              , ( x & 0x1 ) ? "global interrupt, " : "" );
 }
 
+bool
+dma::start_chain( uint32_t channel, const dma_descriptor * first )
+{
+    const dma_descriptor * expected = nullptr;
+    if ( first == nullptr || ! chain_.at( channel ).compare_exchange_strong( expected, first ) )
+        return false;
+
+    dma_load_descriptor( dmaChannel( channel ), *first );
+    enable_irq( channel );
+    enable( channel, true );
+    return true;
+}
 
 void
-dma::handle_interrupt( uint32_t channel )
+dma::abort_chain( uint32_t channel )
+{
+    enable( channel, false );
+    chain_.at( channel ) = nullptr;
+}
+
+bool
+dma::try_acquire( DMA_CHANNEL request )
 {
-    while ( !lock_.test_and_set( std::memory_order_acquire ) )
-        ;
-    uint32_t flag = dma_->ISR;
-    interrupt_status_ = flag;
-    lock_.clear();
-
-    dma_->IFCR |= (0x0f << (channel * 4)) & flag;
-
-    auto x = flag >> ( channel * 4 );
-
-    if ( callbacks_.at( channel ) )
-        callbacks_[ channel ]( x );
-    else if ( x & 0x08 )
-        stream() << "\tDMA: handle_interrupt: transfer error at channel# " << channel << " ISR=" << flag << std::endl;
-#if 1
-    if ( callbacks_.at( channel ) == nullptr ) {
-        stream() << "\tDMA: handle_interrupt: " << channel << " ISR=" << flag << " "
-                 << ((x & 0x8) ? "transfer error, " : "")
-                 << ((x & 0x4) ? "half transfer, " : "")
-                 << ((x & 0x2) ? "transfer complete, " : "")
-                 << ((x & 0x1) ? "global interrupt, " : "")
-                 << std::endl;
+    const auto channel = dma_channel_number( request );
+    uint32_t expected = no_owner;
+    if ( ! owner_.at( channel ).compare_exchange_strong( expected, request ) )
+        return expected == request;
+
+    acquired_at_[ channel ] = dwt::cycles();
+    acquired_jiffies_[ channel ] = atomic_jiffies.load();
+    ++grants_[ channel ];
+    const auto idx = dma_request_index( request );
+    if ( idx < dma1_request_count )
+        last_grant_[ channel ] = idx;
+    if ( idx < dma1_request_count && dma1_requests[ idx ].peripheral_address ) {
+        auto& ch = dmaChannel( channel );
+        ch.CCR = 0;
+        ch.CPAR = dma1_requests[ idx ].peripheral_address;
+        ch.CCR = dma1_requests[ idx ].dma_ccr;
+    }
+    return true;
+}
+
+bool
+dma::acquire( DMA_CHANNEL request, void(*granted)( DMA_CHANNEL ) )
+{
+    if ( try_acquire( request ) )
+        return true;
+
+    const auto idx = dma_request_index( request );
+    if ( idx >= dma1_request_count || granted == nullptr )
+        return false;
+
+    const auto channel = dma_channel_number( request );
+    granted_[ idx ] = granted;
+    if ( ( waiters_[ channel ].fetch_or( 1 << idx ) & ( 1 << idx ) ) == 0 )
+        ++contended_[ channel ];
+    grant_next( channel ); // the owner may have released it meanwhile
+    return false;
+}
+
+void
+dma::release( DMA_CHANNEL request )
+{
+    const auto channel = dma_channel_number( request );
+    if ( owner_.at( channel ).load() != request ) {
+        const auto idx = dma_request_index( request );
+        if ( idx < dma1_request_count )
+            waiters_[ channel ].fetch_and( ~( 1 << idx ) ); // queued by acquire; withdrawn
+        return;
+    }
+
+    abort_chain( channel );
+    clear_callback( channel );
+    held_[ channel ] += lease_cycles( channel );
+    owner_[ channel ] = no_owner;
+
+    grant_next( channel );
+}
+
+// DWT cycles for short leases, 100us jiffies once the cycle counter may have wrapped
+uint64_t
+dma::lease_cycles( uint32_t channel ) const
+{
+    const uint32_t jiffies = atomic_jiffies.load() - acquired_jiffies_[ channel ];
+    if ( jiffies >= 10000 )
+        return uint64_t( jiffies ) * ( __system_clock / 10000 );
+    return dwt::cycles() - acquired_at_[ channel ];
+}
+
+// hands a free channel to the next waiter, round robin in dma1_requests order: the scan starts
+// after the last grantee, so a request that keeps coming back cannot starve the others
+void
+dma::grant_next( uint32_t channel )
+{
+    while ( auto waiters = waiters_[ channel ].load() ) {
+        if ( owner_[ channel ].load() != no_owner )
+            return;
+        size_t idx = last_grant_[ channel ];
+        do {
+            idx = ( idx + 1 ) % dma1_request_count;
+        } while ( ( waiters & ( 1 << idx ) ) == 0 );
+        const auto request = dma1_requests[ idx ].request;
+        if ( try_acquire( request ) ) {
+            waiters_[ channel ].fetch_and( ~( 1 << idx ) );
+            if ( auto granted = granted_[ idx ] )
+                granted( request );
+            return;
+        }
+    }
+}
+
+bool
+dma::owns( DMA_CHANNEL request ) const
+{
+    return owner_.at( dma_channel_number( request ) ).load() == request;
+}
+
+bool
+dma::leased( uint32_t channel ) const
+{
+    return channel < owner_.size() && owner_[ channel ].load() != no_owner;
+}
+
+void
+dma::reset_utilization()
+{
+    const auto now = dwt::cycles();
+    const auto jiffies = atomic_jiffies.load();
+    for ( uint32_t channel = 0; channel < held_.size(); ++channel ) {
+        held_[ channel ] = 0;
+        acquired_at_[ channel ] = now;
+        acquired_jiffies_[ channel ] = jiffies;
+    }
+    window_start_ = jiffies;
+}
+
+void
+dma::print_leases() const
+{
+    const uint64_t window = uint64_t( atomic_jiffies.load() - window_start_ ) * ( __system_clock / 10000 ); // 100us jiffies
+
+    for ( uint32_t channel = 0; channel < owner_.size(); ++channel ) {
+        const auto owner = owner_[ channel ].load();
+        const auto idx = owner == no_owner ? dma1_request_count : dma_request_index( owner );
+        uint64_t held = held_[ channel ] + ( owner != no_owner ? lease_cycles( channel ) : 0 );
+
+        stream() << "\tch" << int( channel + 1 ) << ": "
+                 << ( owner == no_owner ? "-" : idx < dma1_request_count ? dma1_requests[ idx ].name : "?" )
+                 << "\tgrants: " << int( grants_[ channel ] )
+                 << "\tcontended: " << int( contended_[ channel ] )
+                 << "\tutilization: " << int( window ? held * 100 / window : 0 ) << "%";
+        if ( auto waiters = waiters_[ channel ].load() ) {
+            stream() << "\twaiting:";
+            for ( size_t i = 0; i < dma1_request_count; ++i ) {
+                if ( waiters & ( 1 << i ) )
+                    stream() << " " << dma1_requests[ i ].name;
+            }
+        }
+        stream() << std::endl;
     }
-#endif
 }
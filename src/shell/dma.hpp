@@ -6,6 +6,7 @@
 
 #pragma once
 
+#include "dma_status.hpp"
 #include <array>
 #include <atomic>
 #include <cstdint>
@@ -34,17 +35,72 @@ namespace stm32f103 {
     enum DMA_CHANNEL : uint32_t;
     enum DMA_DIR : uint32_t;
 
+    // One link of a software scatter-gather chain.  bxDMA has no linked list mode, so the
+    // transfer complete interrupt stops the channel, reloads it from 'next' and restarts it;
+    // the peripheral sees a gap of one interrupt latency between links.
+    struct dma_descriptor {
+        uint32_t memory;                // CMAR
+        uint32_t count;                 // CNDTR, in items of the memory size
+        uint32_t peripheral;            // CPAR, 0: unchanged (memory to memory gather/scatter sets it)
+        uint32_t ccr;                   // CCR without EN/TCIE/HTIE/TEIE, 0: unchanged
+        const dma_descriptor * next;    // nullptr ends the chain
+    };
+
+    // Programs a disabled channel from 'd'; interrupt enables are kept, EN is left clear
+    inline void dma_load_descriptor( volatile DMAChannel& ch, const dma_descriptor& d ) {
+        const uint32_t ccr = ch.CCR & ~1;
+        ch.CCR = ccr;
+        ch.CMAR = d.memory;
+        ch.CNDTR = d.count;
+        if ( d.peripheral )
+            ch.CPAR = d.peripheral;
+        ch.CCR = ( d.ccr ? d.ccr & ~0x0f : ccr & ~0x0f ) | ( ccr & 0x0e );
+    }
+
+    // Chain step for the interrupt flags of the channel running 'current'.  TC moves on to the
+    // next link and restarts the channel; returns the link running afterwards, or nullptr when
+    // the chain has ended (TC on the last link) or was aborted by a transfer error (TE, which
+    // has already disabled the channel).
+    inline const dma_descriptor * dma_chain_step( volatile DMAChannel& ch, const dma_descriptor * current, uint32_t flag ) {
+        if ( flag & 0x08 )
+            return nullptr;
+        if ( ( flag & 0x02 ) == 0 )
+            return current;
+        if ( auto next = current->next ) {
+            dma_load_descriptor( ch, *next );
+            ch.CCR = ch.CCR | 1;
+            return next;
+        }
+        return nullptr;
+    }
+
     class dma {
         volatile DMA * dma_;
 
-        std::atomic_flag lock_;
-        std::atomic< uint32_t  > interrupt_status_;
-        std::array< void(*)( uint32_t ), 7 > callbacks_;
+        dma_status< 7 > status_;
+        std::array< std::atomic< void(*)( uint32_t ) >, 7 > callbacks_;
+        std::array< std::atomic< const dma_descriptor * >, 7 > chain_;   // link in progress
+
+        // channel leases; owner is a DMA_CHANNEL request or no_owner, waiters a bitmask of dma1_requests indices
+        static constexpr uint32_t no_owner = 0xffffffff;
+        std::array< std::atomic< uint32_t >, 7 > owner_;
+        std::array< std::atomic< uint32_t >, 7 > waiters_;
+        std::array< void(*)( DMA_CHANNEL ), 32 > granted_;
+        std::array< uint8_t, 7 > last_grant_;     // dma1_requests index, where the next round robin scan starts after
+        std::array< uint32_t, 7 > grants_;
+        std::array< uint32_t, 7 > contended_;
+        std::array< uint32_t, 7 > acquired_at_;   // DWT cycles
+        std::array< uint32_t, 7 > acquired_jiffies_;
+        std::array< uint64_t, 7 > held_;          // DWT cycles
+        uint32_t window_start_;                   // atomic_jiffies at reset_utilization
+        void grant_next( uint32_t channel );
+        uint64_t lease_cycles( uint32_t channel ) const;
 
         dma();
         dma( const dma& ) = delete;
         dma& operator = ( const dma& ) = delete;
         void init( DMA_BASE );
+        void enable_irq( uint32_t channel );
         template< DMA_BASE > friend struct dma_t;
     public:
 
@@ -73,13 +129,38 @@ namespace stm32f103 {
             set_transfer_buffer( channel, reinterpret_cast< uint8_t * >( buffer ), size );
         }
 
-        bool transfer_complete( uint32_t channel );
+        bool transfer_complete( uint32_t channel );   // consumes TCIF; other flags are left for take_status
+        uint32_t take_status( uint32_t channel );     // returns and clears all flags seen since the last call
 
         void set_callback( uint32_t channel, void(*callback)( uint32_t ) ) {
             callbacks_.at( channel ) = callback;
         }
 
+        inline auto callback( uint32_t channel ) const { return callbacks_.at( channel ).load(); }
+
         void clear_callback( uint32_t channel );
+
+        // Exclusive channel leases for peripherals sharing a request line.  try_acquire grants a
+        // free channel (or one already held by the same request); acquire also queues the request,
+        // and 'granted' is called from the context of the release that hands the channel over,
+        // possibly before acquire returns.  Waiters are served round robin in dma1_requests order,
+        // starting after the last grantee of the channel.  A grant configures CPAR/CCR from
+        // dma1_requests; release disables the channel and drops its interrupt callback, or
+        // withdraws the request if it is still queued.
+        bool try_acquire( DMA_CHANNEL request );
+        bool acquire( DMA_CHANNEL request, void(*granted)( DMA_CHANNEL ) );
+        void release( DMA_CHANNEL request );
+        bool owns( DMA_CHANNEL request ) const;
+        bool leased( uint32_t channel ) const;
+
+        // Scatter-gather: runs the chain from 'first' on a configured (leased) channel; the
+        // channel reports a single TC, or TE if any link failed, when the chain is done.
+        bool start_chain( uint32_t channel, const dma_descriptor * first ); // false if a chain is running
+        void abort_chain( uint32_t channel );
+        inline bool chain_running( uint32_t channel ) const { return chain_.at( channel ).load() != nullptr; }
+
+        void print_leases() const;   // owner, waiters, grants and utilization per channel
+        void reset_utilization();
         
         void handle_interrupt( uint32_t );
     };
@@ -14,7 +14,7 @@
 namespace stm32f103 {
 
     // DMA1
-    // 0 Channel1 := ADC1
+    // 0 Channel1 := ADC1 (16bit, or 32bit ADC1+ADC2 in dual mode)
     // 1 Channel2 := SPI1_RX | USART3_TX
     // 2 Channel3 := SPI1_TX | USART3_RX
     // 3 Channel4 := SPI2_RX | USART1_TX | I2C2_TX
@@ -22,8 +22,13 @@ namespace stm32f103 {
     // 5 Channel6 := USART2_RX | I2C1_TX
     // 6 Channel7 := USART2_TX | I2C1_RX
 
+    // DMA_CHANNEL := request [15:8] | channel number [3:0]; the request field keeps channels
+    // shared by several peripherals distinct so that each can have its own peripheral_address<>.
+    constexpr uint32_t dma_channel_number( uint32_t channel ) { return channel & 0x0f; }
+
     enum DMA_CHANNEL : uint32_t {
         DMA_ADC1 = 0
+        , DMA_ADC12 = 0x0100 | 0 // ADC1+ADC2 dual mode, 32bit words from ADC1 DR (adc_pair)
         , DMA_SPI1_RX = 1
         , DMA_SPI1_TX = 2
         //, DMA_SPI2_RX = 4
@@ -32,6 +37,13 @@ namespace stm32f103 {
         , DMA_I2C2_RX = 4        
         , DMA_I2C1_TX = 5
         , DMA_I2C1_RX = 6
+        , DMA_USART1_TX = 0x0100 | 3
+        , DMA_USART2_TX = 0x0200 | 6
+        , DMA_USART3_TX = 0x0300 | 1
+        , DMA_USART1_RX = 0x0100 | 4
+        , DMA_USART2_RX = 0x0200 | 5
+        , DMA_USART3_RX = 0x0300 | 2
+        , DMA_MEM2MEM = 0x0f00   // | channel number; memory to memory (dma_memcpy), any channel
     };
 
     // p286, bit4
@@ -75,7 +87,12 @@ namespace stm32f103 {
 
     template<> struct peripheral_address< DMA_ADC1 > {
         static constexpr uint32_t value = ADC1_BASE + offsetof( ADC, DR );
-        static constexpr uint32_t dma_ccr = PL_High | DMA_ReadFromPeripheral | MINC | (1 << 10) | (1 << 8) | CIRC; // 16bit,16bit
+        static constexpr uint32_t dma_ccr = PL_High | DMA_ReadFromPeripheral | MINC | (1 << 10) | (1 << 8) | CIRC | HTIE; // 16bit,16bit
+    };
+
+    template<> struct peripheral_address< DMA_ADC12 > {
+        static constexpr uint32_t value = ADC1_BASE + offsetof( ADC, DR );
+        static constexpr uint32_t dma_ccr = PL_VeryHigh | DMA_ReadFromPeripheral | MINC | (2 << 10) | (2 << 8) | CIRC | HTIE; // 32bit,32bit
     };
 
     template<> struct peripheral_address< DMA_I2C1_RX > {
@@ -96,6 +113,96 @@ namespace stm32f103 {
         static constexpr uint32_t dma_ccr = PL_High | DMA_ReadFromMemory | MINC;
     };
 
+    template<> struct peripheral_address< DMA_USART1_TX > {
+        static constexpr uint32_t value = USART1_BASE + offsetof( USART, DR );
+        static constexpr uint32_t dma_ccr = PL_Medium | DMA_ReadFromMemory | MINC;  // 8bit, 8bit
+    };
+    template<> struct peripheral_address< DMA_USART2_TX > {
+        static constexpr uint32_t value = USART2_BASE + offsetof( USART, DR );
+        static constexpr uint32_t dma_ccr = PL_Medium | DMA_ReadFromMemory | MINC;
+    };
+    template<> struct peripheral_address< DMA_USART3_TX > {
+        static constexpr uint32_t value = USART3_BASE + offsetof( USART, DR );
+        static constexpr uint32_t dma_ccr = PL_Medium | DMA_ReadFromMemory | MINC;
+    };
+
+    // receive streams (dma_stream<>); circular, half transfer interrupt
+    template<> struct peripheral_address< DMA_SPI1_RX > {
+        static constexpr uint32_t value = SPI1_BASE + offsetof( SPI, DATA );
+        static constexpr uint32_t dma_ccr = PL_High | DMA_ReadFromPeripheral | MINC | CIRC | HTIE;  // 8bit, 8bit
+    };
+    template<> struct peripheral_address< DMA_USART1_RX > {
+        static constexpr uint32_t value = USART1_BASE + offsetof( USART, DR );
+        static constexpr uint32_t dma_ccr = PL_Medium | DMA_ReadFromPeripheral | MINC | CIRC | HTIE;
+    };
+    template<> struct peripheral_address< DMA_USART2_RX > {
+        static constexpr uint32_t value = USART2_BASE + offsetof( USART, DR );
+        static constexpr uint32_t dma_ccr = PL_Medium | DMA_ReadFromPeripheral | MINC | CIRC | HTIE;
+    };
+    template<> struct peripheral_address< DMA_USART3_RX > {
+        static constexpr uint32_t value = USART3_BASE + offsetof( USART, DR );
+        static constexpr uint32_t dma_ccr = PL_Medium | DMA_ReadFromPeripheral | MINC | CIRC | HTIE;
+    };
+
+    //---------------------------------------
+    // DMA1 request line map (RM0008, Table 78); a channel is leased to one request at a time (dma::try_acquire)
+
+    struct dma_request {
+        DMA_CHANNEL request;
+        const char * name;
+        uint32_t peripheral_address;
+        uint32_t dma_ccr;
+    };
+
+    template< DMA_CHANNEL request >
+    constexpr dma_request make_dma_request( const char * name ) {
+        return { request, name, peripheral_address< request >::value, peripheral_address< request >::dma_ccr };
+    }
+
+    constexpr dma_request dma1_requests [] = {
+        make_dma_request< DMA_ADC1 >( "ADC1" )
+        , make_dma_request< DMA_ADC12 >( "ADC1+2" )
+        , make_dma_request< DMA_SPI1_RX >( "SPI1_RX" )
+        , make_dma_request< DMA_SPI1_TX >( "SPI1_TX" )
+        , make_dma_request< DMA_I2C2_TX >( "I2C2_TX" )
+        , make_dma_request< DMA_I2C2_RX >( "I2C2_RX" )
+        , make_dma_request< DMA_I2C1_TX >( "I2C1_TX" )
+        , make_dma_request< DMA_I2C1_RX >( "I2C1_RX" )
+        , make_dma_request< DMA_USART1_TX >( "USART1_TX" )
+        , make_dma_request< DMA_USART2_TX >( "USART2_TX" )
+        , make_dma_request< DMA_USART3_TX >( "USART3_TX" )
+        , make_dma_request< DMA_USART1_RX >( "USART1_RX" )
+        , make_dma_request< DMA_USART2_RX >( "USART2_RX" )
+        , make_dma_request< DMA_USART3_RX >( "USART3_RX" )
+        , make_dma_request< DMA_CHANNEL( DMA_MEM2MEM | 0 ) >( "MEM2MEM1" )
+        , make_dma_request< DMA_CHANNEL( DMA_MEM2MEM | 1 ) >( "MEM2MEM2" )
+        , make_dma_request< DMA_CHANNEL( DMA_MEM2MEM | 2 ) >( "MEM2MEM3" )
+        , make_dma_request< DMA_CHANNEL( DMA_MEM2MEM | 3 ) >( "MEM2MEM4" )
+        , make_dma_request< DMA_CHANNEL( DMA_MEM2MEM | 4 ) >( "MEM2MEM5" )
+        , make_dma_request< DMA_CHANNEL( DMA_MEM2MEM | 5 ) >( "MEM2MEM6" )
+        , make_dma_request< DMA_CHANNEL( DMA_MEM2MEM | 6 ) >( "MEM2MEM7" )
+    };
+
+    constexpr size_t dma1_request_count = sizeof( dma1_requests ) / sizeof( dma1_requests[ 0 ] );
+
+    // index into dma1_requests, or dma1_request_count if not mapped
+    constexpr size_t dma_request_index( uint32_t request ) {
+        for ( size_t i = 0; i < dma1_request_count; ++i ) {
+            if ( dma1_requests[ i ].request == request )
+                return i;
+        }
+        return dma1_request_count;
+    }
+
+    constexpr bool dma_requests_valid() {
+        for ( size_t i = 0; i < dma1_request_count; ++i ) {
+            if ( dma_channel_number( dma1_requests[ i ].request ) >= 7 || dma_request_index( dma1_requests[ i ].request ) != i )
+                return false;
+        }
+        return dma1_request_count <= 32; // waiters are a bitmask
+    }
+    static_assert( dma_requests_valid(), "dma1_requests: channel out of range or duplicate request" );
+
     //---------------------------------------
 
     template< size_t size, typename T >
@@ -133,38 +240,42 @@ namespace stm32f103 {
         dma& dma_;
     public:
         dma_channel_t( dma& dma, uint8_t * data, uint16_t size ) : dma_( dma ) {
-            dma.init_channel( channel, peripheral_address, data, size, dma_ccr );
+            dma.init_channel( DMA_CHANNEL( channel_number ), peripheral_address, data, size, dma_ccr );
         }
 
         inline void enable( bool enable ) {
-            dma_.enable( channel, enable );
+            dma_.enable( channel_number, enable );
         }
 
         template< typename buffer_type >
         inline void set_transfer_buffer( const buffer_type * buffer, size_t size ) {
-            dma_.set_transfer_buffer( channel, buffer, size );
+            dma_.set_transfer_buffer( channel_number, buffer, size );
         }
 
         template< typename buffer_type >
         inline void set_receive_buffer( buffer_type * buffer, size_t size ) {
-            dma_.set_receive_buffer( channel, buffer, size );
+            dma_.set_receive_buffer( channel_number, buffer, size );
         }        
 
         inline bool transfer_complete() const {
-            return dma_.transfer_complete( channel );
+            return dma_.transfer_complete( channel_number );
         }
 
         inline void set_callback( void(*callback)( uint32_t ) ) {
-            dma_.set_callback( channel, callback );
+            dma_.set_callback( channel_number, callback );
+        }
+
+        inline auto callback() const {
+            return dma_.callback( channel_number );
         }
         
         inline void clear_callback() {
-            dma_.clear_callback( channel );
+            dma_.clear_callback( channel_number );
         }
         
         static constexpr uint32_t dma_ccr = peripheral_address< channel >::dma_ccr;
         static constexpr uint32_t peripheral_address = peripheral_address< channel >::value;
-        static constexpr uint32_t channel_number = channel;
+        static constexpr uint32_t channel_number = dma_channel_number( channel );
     };
 
 
@@ -0,0 +1,285 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#include "dma_memcpy.hpp"
+#include "dma.hpp"
+#include "dma_channel.hpp"
+#include "dwt.hpp"
+#include "stm32f103.hpp"
+#include <array>
+#include <atomic>
+
+extern uint32_t __system_clock;
+
+namespace {
+
+    typedef uint32_t __attribute__(( may_alias )) word_type;
+
+    // Cortex-M3 LDR/STR accept unaligned addresses (CCR.UNALIGN_TRP is clear); LDM/STM do not,
+    // so the packed type keeps the compiler from merging these loads
+    struct __attribute__(( packed, may_alias )) unaligned_word {
+        uint32_t value;
+    };
+
+    constexpr uint32_t max_items = 0xffff; // CNDTR
+
+    // per channel; zero (.bss) is the idle state
+    struct memcpy_slot {
+        std::atomic_flag busy;
+        std::atomic< uint32_t > issued;
+        std::atomic< uint32_t > completed;
+        std::atomic< uint32_t > failed;   // ticket of the last transfer that ended with TEIF
+        uint32_t src;
+        uint32_t dst;
+        uint32_t remaining;               // items not yet handed to the channel
+        uint32_t width;                   // bytes per item
+        bool fill;                        // source address is fixed (memset pattern)
+        uint32_t pattern;
+        void(*completion)( bool );
+    };
+
+    std::array< memcpy_slot, 7 > __slots;
+
+    inline stm32f103::dma& dma1() { return *stm32f103::dma_t< stm32f103::DMA1_BASE >::instance(); }
+
+    inline stm32f103::DMA_CHANNEL request( uint32_t channel ) {
+        return stm32f103::DMA_CHANNEL( stm32f103::DMA_MEM2MEM | channel );
+    }
+
+    // hands the next (up to 65535 items) chunk to the stopped channel
+    void
+    arm( uint32_t channel )
+    {
+        auto& slot = __slots[ channel ];
+        auto& dma = dma1();
+        const uint32_t n = slot.remaining < max_items ? slot.remaining : max_items;
+
+        dma.enable( channel, false );
+        auto& ch = dma.dmaChannel( channel );
+        ch.CPAR = slot.src;
+        ch.CMAR = slot.dst;
+        ch.CNDTR = n;
+
+        slot.remaining -= n;
+        slot.dst += n * slot.width;
+        if ( ! slot.fill )
+            slot.src += n * slot.width;
+
+        dma.enable( channel, true );
+    }
+
+    void
+    complete( uint32_t channel, uint32_t flag )
+    {
+        auto& slot = __slots[ channel ];
+
+        if ( ( flag & 0x08 ) == 0 ) {  // TEIF
+            if ( ( flag & 0x02 ) == 0 )
+                return;
+            if ( slot.remaining ) {
+                arm( channel );
+                return;
+            }
+        } else {
+            slot.failed = slot.issued.load();
+        }
+
+        auto completion = slot.completion;
+        slot.completed = slot.issued.load();
+        dma1().release( request( channel ) );
+        slot.busy.clear();
+
+        if ( completion )
+            completion( ( flag & 0x08 ) == 0 );
+    }
+
+    template< uint32_t channel > void handle_interrupt( uint32_t flag ) { complete( channel, flag ); }
+
+    constexpr void (*__handlers[])( uint32_t ) = {
+        handle_interrupt< 0 >, handle_interrupt< 1 >, handle_interrupt< 2 >, handle_interrupt< 3 >
+        , handle_interrupt< 4 >, handle_interrupt< 5 >, handle_interrupt< 6 >
+    };
+
+    // leases a free channel, highest number first (lowest hardware priority); 'no_channel' if none
+    uint32_t
+    acquire_channel()
+    {
+        auto& dma = dma1();
+        for ( uint32_t channel = __slots.size(); channel-- > 0; ) {
+            auto& slot = __slots[ channel ];
+            if ( slot.busy.test_and_set() )
+                continue;
+            if ( dma.try_acquire( request( channel ) ) )
+                return channel;
+            slot.busy.clear();
+        }
+        return stm32f103::dma_future::no_channel;
+    }
+
+    stm32f103::dma_future
+    start( uint32_t channel, uint32_t src, uint32_t dst, size_t size, uint32_t width, bool fill, void(*completion)( bool ) )
+    {
+        using namespace stm32f103;
+
+        auto& slot = __slots[ channel ];
+        slot.src = src;
+        slot.dst = dst;
+        slot.remaining = size / width;
+        slot.width = width;
+        slot.fill = fill;
+        slot.completion = completion;
+        const uint32_t ticket = slot.issued.fetch_add( 1 ) + 1;
+
+        const uint32_t size_code = width == 4 ? 2 : width == 2 ? 1 : 0;   // [11:10], [9:8] {8,16,32 bits}
+        const uint32_t ccr = MEM2MEM | PL_Low | size_code << 10 | size_code << 8 | MINC | ( fill ? 0 : PINC );
+
+        auto& dma = dma1();
+        dma.init_channel( DMA_CHANNEL( channel ), src, reinterpret_cast< uint8_t * >( dst ), 0, ccr );
+        dma.set_callback( channel, __handlers[ channel ] );
+        arm( channel );
+
+        return dma_future( channel, ticket );
+    }
+}
+
+namespace stm32f103 {
+
+    bool
+    dma_future::ready() const
+    {
+        return channel_ == no_channel || int32_t( __slots[ channel_ ].completed.load() - ticket_ ) >= 0;
+    }
+
+    bool
+    dma_future::ok() const
+    {
+        return channel_ == no_channel || ( ready() && __slots[ channel_ ].failed.load() != ticket_ );
+    }
+
+    bool
+    dma_future::wait() const
+    {
+        const auto t0 = dwt::cycles();
+        while ( ! ready() ) {
+            if ( dwt::cycles() - t0 > __system_clock )
+                return false;
+        }
+        return ok();
+    }
+
+    dma_future
+    dma_memcpy( void * dst, const void * src, size_t size, void(*completion)( bool ) )
+    {
+        auto d = reinterpret_cast< uint8_t * >( dst );
+        auto s = reinterpret_cast< const uint8_t * >( src );
+        const uint32_t skew = reinterpret_cast< uint32_t >( d ) ^ reinterpret_cast< uint32_t >( s );
+        const uint32_t width = ( skew & 3 ) == 0 ? 4 : ( skew & 1 ) == 0 ? 2 : 1;
+
+        if ( size > dma_memcpy_threshold && width > 1 ) {
+            const size_t head = -reinterpret_cast< uint32_t >( d ) & ( width - 1 );
+            const size_t body = ( size - head ) & ~( width - 1 );
+            if ( body > dma_memcpy_threshold ) {
+                const auto channel = acquire_channel();
+                if ( channel != dma_future::no_channel ) {
+                    cpu_memcpy( d, s, head );
+                    cpu_memcpy( d + head + body, s + head + body, size - head - body );
+                    return start( channel, reinterpret_cast< uint32_t >( s + head ), reinterpret_cast< uint32_t >( d + head )
+                                  , body, width, false, completion );
+                }
+            }
+        }
+        cpu_memcpy( dst, src, size );
+        if ( completion )
+            completion( true );
+        return dma_future();
+    }
+
+    dma_future
+    dma_memset( void * dst, uint8_t value, size_t size, void(*completion)( bool ) )
+    {
+        auto d = reinterpret_cast< uint8_t * >( dst );
+        const size_t head = -reinterpret_cast< uint32_t >( d ) & 3;
+        const size_t body = size > head ? ( size - head ) & ~size_t( 3 ) : 0;
+
+        if ( body > dma_memcpy_threshold ) {
+            const auto channel = acquire_channel();
+            if ( channel != dma_future::no_channel ) {
+                cpu_memset( d, value, head );
+                cpu_memset( d + head + body, value, size - head - body );
+                auto& slot = __slots[ channel ];
+                slot.pattern = value * 0x01010101;
+                return start( channel, reinterpret_cast< uint32_t >( &slot.pattern ), reinterpret_cast< uint32_t >( d + head )
+                              , body, 4, true, completion );
+            }
+        }
+        cpu_memset( dst, value, size );
+        if ( completion )
+            completion( true );
+        return dma_future();
+    }
+
+    void *
+    cpu_memcpy( void * dst, const void * src, size_t size )
+    {
+        auto d = reinterpret_cast< uint8_t * >( dst );
+        auto s = reinterpret_cast< const uint8_t * >( src );
+
+        if ( size >= 8 ) {
+            while ( reinterpret_cast< uint32_t >( d ) & 3 ) {
+                *d++ = *s++;
+                --size;
+            }
+            auto dw = reinterpret_cast< word_type * >( d );
+            if ( ( reinterpret_cast< uint32_t >( s ) & 3 ) == 0 ) {
+                auto sw = reinterpret_cast< const word_type * >( s );
+                for ( ; size >= 16; size -= 16, dw += 4, sw += 4 ) {
+                    const uint32_t a = sw[ 0 ], b = sw[ 1 ], c = sw[ 2 ], e = sw[ 3 ];
+                    dw[ 0 ] = a; dw[ 1 ] = b; dw[ 2 ] = c; dw[ 3 ] = e;
+                }
+                for ( ; size >= 4; size -= 4 )
+                    *dw++ = *sw++;
+                s = reinterpret_cast< const uint8_t * >( sw );
+            } else {
+                auto sw = reinterpret_cast< const unaligned_word * >( s );
+                for ( ; size >= 16; size -= 16, dw += 4, sw += 4 ) {
+                    const uint32_t a = sw[ 0 ].value, b = sw[ 1 ].value, c = sw[ 2 ].value, e = sw[ 3 ].value;
+                    dw[ 0 ] = a; dw[ 1 ] = b; dw[ 2 ] = c; dw[ 3 ] = e;
+                }
+                for ( ; size >= 4; size -= 4 )
+                    *dw++ = ( sw++ )->value;
+                s = reinterpret_cast< const uint8_t * >( sw );
+            }
+            d = reinterpret_cast< uint8_t * >( dw );
+        }
+        while ( size-- )
+            *d++ = *s++;
+        return dst;
+    }
+
+    void *
+    cpu_memset( void * dst, uint8_t value, size_t size )
+    {
+        auto d = reinterpret_cast< uint8_t * >( dst );
+
+        if ( size >= 8 ) {
+            while ( reinterpret_cast< uint32_t >( d ) & 3 ) {
+                *d++ = value;
+                --size;
+            }
+            const uint32_t w = value * 0x01010101;
+            auto dw = reinterpret_cast< word_type * >( d );
+            for ( ; size >= 16; size -= 16, dw += 4 ) {
+                dw[ 0 ] = w; dw[ 1 ] = w; dw[ 2 ] = w; dw[ 3 ] = w;
+            }
+            for ( ; size >= 4; size -= 4 )
+                *dw++ = w;
+            d = reinterpret_cast< uint8_t * >( dw );
+        }
+        while ( size-- )
+            *d++ = value;
+        return dst;
+    }
+}
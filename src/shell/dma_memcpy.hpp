@@ -0,0 +1,50 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace stm32f103 {
+
+    // Asynchronous memory copy/fill on a free DMA1 channel.
+    //
+    // A block larger than dma_memcpy_threshold whose source and destination share 4 or 2 byte
+    // alignment is moved by DMA at the widest common size; its unaligned head and tail are done
+    // by the CPU before the channel starts.  Anything else is copied by cpu_memcpy/cpu_memset on
+    // the spot, and the returned handle is already complete.  The channel is leased as
+    // MEM2MEM<n> at low priority (see 'dma status') and released from the transfer complete
+    // interrupt, which then calls 'completion' (in ISR context; on the spot for the CPU path).
+    //
+    //   auto f = dma_memcpy( dst, src, 1024 );
+    //   ...
+    //   if ( ! f.wait() ) // transfer error or timeout
+
+    constexpr size_t dma_memcpy_threshold = 64;
+
+    class dma_future {
+        uint32_t channel_;
+        uint32_t ticket_;
+    public:
+        static constexpr uint32_t no_channel = 0xff;
+
+        dma_future( uint32_t channel = no_channel, uint32_t ticket = 0 ) : channel_( channel ), ticket_( ticket ) {}
+
+        bool ready() const;
+        bool ok() const;    // completed without transfer error
+        bool wait() const;  // ready() and ok(); gives up after ~1s
+
+        inline bool by_dma() const { return channel_ != no_channel; }
+    };
+
+    dma_future dma_memcpy( void * dst, const void * src, size_t size, void(*completion)( bool ok ) = nullptr );
+    dma_future dma_memset( void * dst, uint8_t value, size_t size, void(*completion)( bool ok ) = nullptr );
+
+    // word-unrolled CPU fallback
+    void * cpu_memcpy( void * dst, const void * src, size_t size );
+    void * cpu_memset( void * dst, uint8_t value, size_t size );
+}
@@ -0,0 +1,34 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace stm32f103 {
+
+    // Per-channel ISR flags (TEIF|HTIF|TCIF|GIF); set with fetch_or by the interrupt handler and
+    // consumed by waiters, so channels complete independently and nothing spins in the ISR.
+    template< size_t N >
+    class dma_status {
+        std::array< std::atomic< uint32_t >, N > flags_;
+    public:
+        static constexpr uint32_t tcif = 1 << 1;
+
+        inline void clear() {
+            for ( auto& flags: flags_ )
+                flags = 0;
+        }
+        inline void clear( uint32_t channel ) { flags_.at( channel ) = 0; }
+        inline void post( uint32_t channel, uint32_t flags ) { flags_[ channel ].fetch_or( flags ); }
+        inline bool take_complete( uint32_t channel ) { return flags_.at( channel ).fetch_and( ~tcif ) & tcif; }
+        inline uint32_t take( uint32_t channel ) { return flags_.at( channel ).exchange( 0 ); }
+    };
+
+}
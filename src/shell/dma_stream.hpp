@@ -0,0 +1,169 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include "dma.hpp"
+#include "dma_channel.hpp"
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace stm32f103 {
+
+    // Ping-pong receive stream on a circular DMA channel
+    //
+    // DMA fills buffer_ round and round; the half transfer (HT) and transfer complete (TC)
+    // interrupts each publish the half just written, while DMA moves on to the other one.
+    // A published half stays stable until DMA has finished the other half too, i.e. for one
+    // half-buffer time; release() reports whether the consumer made it (false: the half was
+    // being overwritten while held).  Besides the interrupt count, release() reads CNDTR, so a
+    // half overwritten while the interrupt of the other one is still pending is caught too; this
+    // is exact as long as the interrupt latency stays under one half time.  A half that is
+    // published again before its previous data was acquired counts as an overrun.
+    //
+    //   static dma_stream< uint16_t, 128 > __stream;
+    //   __stream.start( dma, DMA_ADC1, +[]( uint32_t flag ){ __stream.handle_interrupt( flag ); } );
+    //   while ( auto p = __stream.acquire() ) { ...p[ 0 .. half_size() )...; __stream.release(); }
+    //
+    // The channel must be leased (dma::try_acquire).  acquire/release belong to one consumer,
+    // which may be the DMA callback itself.
+
+    template< typename T, size_t N >
+    class dma_stream {
+        static_assert( N >= 2 && ( N % 2 ) == 0, "dma_stream size must be even" );
+
+        dma * dma_;
+        uint32_t channel_;
+        const volatile uint32_t * cndtr_;     // channel CNDTR, or nullptr: interrupt count only
+        size_t half_;                         // items per half; start() may use less than N
+        alignas( 4 ) std::array< T, N > buffer_;
+        std::atomic< uint32_t > ready_;       // bit h: half h published and not yet acquired
+        std::atomic< uint32_t > halves_;      // halves completed by DMA
+        std::array< std::atomic< uint32_t >, 2 > published_; // halves_ when each half was published
+        std::atomic< uint32_t > overruns_;
+        std::atomic< uint32_t > errors_;
+        uint32_t late_;                       // releases after DMA came back to the half
+        int32_t held_;                        // consumer: half being processed, or -1
+        uint32_t taken_;                      // consumer: published_[ held_ ] at acquire
+
+        // DMA has written some of 'half' in this round; CNDTR counts down from 2 * half_ and
+        // reloads on TC, so it never reads 0 here
+        inline bool writing( uint32_t half ) const {
+            if ( cndtr_ == nullptr )
+                return false;
+            const size_t next = 2 * half_ - *cndtr_;   // index DMA writes next
+            return next > half * half_ && next < ( half + 1 ) * half_;
+        }
+
+        inline void publish( uint32_t half ) {
+            published_[ half ] = halves_.fetch_add( 1 ) + 1;
+            if ( ready_.fetch_or( 1 << half ) & ( 1 << half ) )
+                ++overruns_;
+        }
+
+    public:
+        dma_stream() : dma_( nullptr ), channel_( 0 ), cndtr_( nullptr ), half_( N / 2 ), held_( -1 ), taken_( 0 ) {
+            reset();
+        }
+
+        // configures and enables the channel with peripheral_address< request >; ccr gains CIRC|HTIE.
+        // 'count' (even, <= N) items of the buffer are used, e.g. a whole number of ADC scans.
+        bool start( dma& dma, DMA_CHANNEL request, void(*callback)( uint32_t ), size_t count = N ) {
+            const auto idx = dma_request_index( request );
+            if ( idx >= dma1_request_count || ! dma.owns( request ) || count < 2 || count > N || ( count % 2 ) )
+                return false;
+            dma_ = &dma;
+            channel_ = dma_channel_number( request );
+            half_ = count / 2;
+            reset();
+            dma.enable( channel_, false );
+            dma.init_channel( DMA_CHANNEL( channel_ )
+                              , dma1_requests[ idx ].peripheral_address
+                              , reinterpret_cast< uint8_t * >( buffer_.data() )
+                              , count
+                              , dma1_requests[ idx ].dma_ccr | CIRC | HTIE );
+            dma.set_callback( channel_, callback );
+            cndtr_ = &dma.dmaChannel( channel_ ).CNDTR;
+            dma.enable( channel_, true );
+            return true;
+        }
+
+        // the counter release() checks, for a channel set up without start() (e.g. a model of one)
+        void watch( const volatile uint32_t * cndtr, size_t count = N ) {
+            cndtr_ = cndtr;
+            half_ = count / 2;
+        }
+
+        void enable( bool enable ) {
+            if ( dma_ )
+                dma_->enable( channel_, enable );
+        }
+
+        void stop() {
+            enable( false );
+            if ( dma_ )
+                dma_->clear_callback( channel_ );
+        }
+
+        void reset() {
+            ready_ = 0;
+            halves_ = 0;
+            published_[ 0 ] = 0;
+            published_[ 1 ] = 0;
+            overruns_ = 0;
+            errors_ = 0;
+            late_ = 0;
+            held_ = -1;
+        }
+
+        // from the channel's dma callback; HT and TC may arrive together if the irq was late
+        void handle_interrupt( uint32_t flag ) {
+            if ( flag & 0x08 ) // TEIF; the channel has been disabled by hardware
+                ++errors_;
+            if ( flag & 0x04 )
+                publish( 0 );
+            if ( flag & 0x02 )
+                publish( 1 );
+        }
+
+        // oldest published half, or nullptr
+        const T * acquire() {
+            if ( held_ >= 0 )
+                return buffer_.data() + held_ * half_;
+            auto ready = ready_.load();
+            if ( ready == 0 )
+                return nullptr;
+            uint32_t half = ( ready == 3 ) ? ( int32_t( published_[ 1 ].load() - published_[ 0 ].load() ) > 0 ? 0 : 1 ) : ( ready >> 1 );
+            taken_ = published_[ half ].load();
+            ready_.fetch_and( ~( 1 << half ) );
+            held_ = half;
+            return buffer_.data() + half * half_;
+        }
+
+        // false if DMA started writing the held half before it was released
+        bool release() {
+            if ( held_ < 0 )
+                return true;
+            const bool overwritten = writing( held_ );    // before halves_; see the class comment
+            bool intact = ! overwritten && halves_.load() == taken_;
+            if ( ! intact )
+                ++late_;
+            held_ = -1;
+            return intact;
+        }
+
+        inline uint32_t halves() const { return halves_.load(); }
+        inline uint32_t pending() const { auto r = ready_.load(); return ( r & 1 ) + ( r >> 1 ); } // published, not yet acquired
+        inline uint32_t overruns() const { return overruns_.load(); }
+        inline uint32_t errors() const { return errors_.load(); }
+        inline uint32_t late() const { return late_; }
+        inline size_t half_size() const { return half_; }
+        static constexpr size_t capacity() { return N; }
+    };
+
+}
@@ -0,0 +1,28 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include "stm32f103.hpp"
+#include <cstdint>
+
+namespace stm32f103 {
+
+    // free running cpu cycle counter (wraps every 59.6 s at 72MHz)
+    struct dwt {
+        static inline void enable() {
+            reinterpret_cast< volatile CoreDebug * >( COREDEBUG_BASE )->DEMCR |= ( 1 << 24 ); // TRCENA
+            auto DWT = reinterpret_cast< volatile stm32f103::DWT * >( DWT_BASE );
+            DWT->CYCCNT = 0;
+            DWT->CTRL |= 1;  // CYCCNTENA
+        }
+
+        static inline uint32_t cycles() {
+            return reinterpret_cast< volatile stm32f103::DWT * >( DWT_BASE )->CYCCNT;
+        }
+    };
+
+}
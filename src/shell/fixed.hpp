@@ -0,0 +1,50 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+
+// Binary fixed point number, value := raw * 2^-Q
+// stream() << fixed< 16 >( 3.25 ) prints the exact decimal expansion, no floating point involved.
+
+template< unsigned Q, typename T = int32_t >
+class fixed {
+    static_assert( std::is_integral< T >::value && std::is_signed< T >::value, "fixed<> requires a signed integer" );
+    static_assert( Q < sizeof( T ) * 8, "fixed<> fraction bits exceed the storage" );
+
+    typedef typename std::conditional< ( sizeof( T ) < 8 ), int64_t, T >::type wide_type;
+    T raw_;
+
+    struct raw_tag {};
+    constexpr fixed( T raw, raw_tag ) : raw_( raw ) {}
+
+public:
+    static constexpr unsigned fraction_bits = Q;
+    static constexpr T one = T( 1 ) << Q;
+
+    constexpr fixed() : raw_( 0 ) {}
+    constexpr fixed( int v ) : raw_( T( v ) * one ) {}
+    constexpr explicit fixed( double v ) : raw_( T( v * one + ( v < 0 ? -0.5 : 0.5 ) ) ) {}
+
+    static constexpr fixed from_raw( T raw ) { return fixed( raw, raw_tag() ); }
+
+    constexpr T raw() const { return raw_; }
+    constexpr explicit operator double() const { return double( raw_ ) / one; }
+
+    constexpr fixed operator + ( const fixed& t ) const { return from_raw( raw_ + t.raw_ ); }
+    constexpr fixed operator - ( const fixed& t ) const { return from_raw( raw_ - t.raw_ ); }
+    constexpr fixed operator - () const { return from_raw( -raw_ ); }
+    constexpr fixed operator * ( const fixed& t ) const { return from_raw( T( ( wide_type( raw_ ) * t.raw_ ) >> Q ) ); }
+    constexpr fixed operator / ( const fixed& t ) const { return from_raw( T( ( wide_type( raw_ ) << Q ) / t.raw_ ) ); }
+
+    fixed& operator += ( const fixed& t ) { raw_ += t.raw_; return *this; }
+    fixed& operator -= ( const fixed& t ) { raw_ -= t.raw_; return *this; }
+
+    constexpr bool operator < ( const fixed& t ) const { return raw_ < t.raw_; }
+    constexpr bool operator == ( const fixed& t ) const { return raw_ == t.raw_; }
+};
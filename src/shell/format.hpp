@@ -1,12 +1,308 @@
-// Copyright (C) 2018 MS-Cheminformatics LLC
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
 // Licence: CC BY-NC
 // Author: Toshinobu Hondo, Ph.D.
 // Contact: toshi.hondo@qtplatz.com
 //
+
+#pragma once
+
+#include "fixed.hpp"
+#include "stream.hpp"
+#include "to_chars.hpp"
+#include <cstddef>
 #include <cstdint>
+#include <tuple>
+#include <type_traits>
+
+// Compile time checked printf style formatting.
+//
+//   stream() << "T=%d P=%u\n"_fmt( temp, press );
+//   format_to( buf, sizeof( buf ), "%08x"_fmt( addr ) );
+//
+// The pattern is parsed while compiling; the number and the types of the arguments are checked
+// by static_assert, and what remains at run time is a straight sequence of literal writes and
+// value conversions.  Conversions: %d %i (signed) %u (unsigned) %x %X %c %s %f (double or fixed<>)
+// %p and %%, with flags '-' '0' '#', width and precision.  Length modifiers are accepted and
+// ignored; the argument type decides the width.
+
+namespace format_detail {
+
+    struct spec {
+        size_t literal_end;  // literal text := [pos, literal_end)
+        size_t next;         // position following the conversion
+        char conv;           // '\0' := end of pattern
+        bool left;
+        bool zero;
+        bool alt;
+        bool wide;           // 'll' or 'j' length modifier
+        uint8_t width;
+        int8_t precision;    // -1 := default
+    };
+
+    constexpr spec parse( const char * s, size_t pos ) {
+        spec sp{ pos, pos, '\0', false, false, false, false, 0, -1 };
+        while ( s[ pos ] && s[ pos ] != '%' )
+            ++pos;
+        sp.literal_end = sp.next = pos;
+        if ( s[ pos ] == '\0' )
+            return sp;
+        ++pos;
+        for ( ;; ++pos ) {
+            if ( s[ pos ] == '-' )
+                sp.left = true;
+            else if ( s[ pos ] == '0' )
+                sp.zero = true;
+            else if ( s[ pos ] == '#' )
+                sp.alt = true;
+            else
+                break;
+        }
+        while ( s[ pos ] >= '0' && s[ pos ] <= '9' )
+            sp.width = uint8_t( sp.width * 10 + ( s[ pos++ ] - '0' ) );
+        if ( s[ pos ] == '.' ) {
+            sp.precision = 0;
+            ++pos;
+            while ( s[ pos ] >= '0' && s[ pos ] <= '9' )
+                sp.precision = int8_t( sp.precision * 10 + ( s[ pos++ ] - '0' ) );
+        }
+        if ( ( s[ pos ] == 'l' && s[ pos + 1 ] == 'l' ) || s[ pos ] == 'j' )
+            sp.wide = true;
+        while ( s[ pos ] == 'h' || s[ pos ] == 'l' || s[ pos ] == 'z' || s[ pos ] == 'j' || s[ pos ] == 't' || s[ pos ] == 'L' )
+            ++pos;
+        sp.conv = s[ pos ] ? s[ pos ] : '?';  // a pattern ending in '%' is an error
+        sp.next = s[ pos ] ? pos + 1 : pos;
+        return sp;
+    }
+
+    constexpr bool is_conversion( char c ) {
+        return c == 'd' || c == 'i' || c == 'u' || c == 'x' || c == 'X' || c == 'c' || c == 's' || c == 'f' || c == 'p' || c == '%';
+    }
+
+    constexpr size_t count_arguments( const char * s ) {
+        size_t count = 0;
+        for ( spec sp = parse( s, 0 ); sp.conv; sp = parse( s, sp.next ) )
+            if ( sp.conv != '%' )
+                ++count;
+        return count;
+    }
+
+    constexpr bool valid( const char * s ) {
+        for ( spec sp = parse( s, 0 ); sp.conv; sp = parse( s, sp.next ) )
+            if ( ! is_conversion( sp.conv ) )
+                return false;
+        return true;
+    }
+
+    template< typename T > struct is_fixed : std::false_type {};
+    template< unsigned Q, typename T > struct is_fixed< fixed< Q, T > > : std::true_type {};
+
+    template< typename T >
+    constexpr bool accepts( char conv ) {
+        typedef typename std::decay< T >::type type;
+        switch ( conv ) {
+        case 'd': case 'i':
+            return std::is_integral< type >::value && std::is_signed< type >::value && ! std::is_same< type, char >::value;
+        case 'u':
+            return std::is_integral< type >::value && std::is_unsigned< type >::value && ! std::is_same< type, bool >::value;
+        case 'x': case 'X':
+            return std::is_integral< type >::value && ! std::is_same< type, bool >::value;
+        case 'c':
+            return std::is_same< type, char >::value;
+        case 's':
+            return std::is_same< type, const char * >::value || std::is_same< type, char * >::value;
+        case 'f':
+            return std::is_floating_point< type >::value || is_fixed< type >::value;
+        case 'p':
+            return std::is_pointer< type >::value;
+        }
+        return false;
+    }
+
+    // type of the argument consuming the next conversion (skipping "%%"), advancing pos
+    template< typename T >
+    constexpr bool next_accepts( const char * s, size_t& pos ) {
+        spec sp = parse( s, pos );
+        while ( sp.conv == '%' )
+            sp = parse( s, sp.next );
+        pos = sp.next;
+        return sp.conv != '\0' && accepts< T >( sp.conv );
+    }
+
+    template< typename... Args >
+    constexpr bool check_arguments( const char * s ) {
+        [[maybe_unused]] size_t pos = 0;    // unused for a pattern without arguments
+        bool result = true;
+        ( ( result = result && next_accepts< Args >( s, pos ) ), ... );
+        return result;
+    }
+
+    struct buffer_sink {
+        char * p;
+        char * end;
+        inline void put( char c ) { if ( p < end ) *p++ = c; }
+        inline void write( const char * s, size_t size ) { while ( size-- ) put( *s++ ); }
+    };
+
+    struct stream_sink {
+        ::stream& o;
+        inline void put( char c ) { o << c; }
+        inline void write( const char * s, size_t size ) { o.write( s, size ); }
+    };
+
+    template< typename Sink >
+    void put_padded( Sink& sink, const spec& sp, const char * first, const char * last ) {
+        size_t size = last - first;
+        size_t pad = sp.width > size ? sp.width - size : 0;
+        if ( sp.left ) {
+            sink.write( first, size );
+            while ( pad-- )
+                sink.put( ' ' );
+        } else if ( sp.zero ) {
+            // the sign, or the 0x of '#', goes before the zeros
+            size_t prefix = ( first < last && *first == '-' ) ? 1
+                : ( sp.alt && size > 1 && ( first[ 1 ] == 'x' || first[ 1 ] == 'X' ) ) ? 2 : 0;
+            sink.write( first, prefix );
+            first += prefix;
+            size -= prefix;
+            while ( pad-- )
+                sink.put( '0' );
+            sink.write( first, size );
+        } else {
+            while ( pad-- )
+                sink.put( ' ' );
+            sink.write( first, size );
+        }
+    }
+
+    template< typename T >
+    char * convert( char * p, const spec& sp, const T& t ) {
+        if constexpr ( std::is_pointer< T >::value && ! std::is_same< typename std::decay< T >::type, const char * >::value ) {
+            if ( sp.conv == 'p' ) {
+                *p++ = '0'; *p++ = 'x';
+                return u32tox( uint32_t( reinterpret_cast< uintptr_t >( t ) ), p, 8 );
+            }
+        }
+        if constexpr ( std::is_integral< T >::value ) {
+            if ( sp.conv == 'x' || sp.conv == 'X' ) {
+                typedef typename std::make_unsigned< T >::type unsigned_type;
+                if ( sp.alt && t != 0 ) {  // printf: "0x" goes to a nonzero value only
+                    *p++ = '0'; *p++ = sp.conv;
+                }
+                char * q = p;
+                p = sizeof( T ) > 4 ? u64tox( unsigned_type( t ), p ) : u32tox( uint32_t( unsigned_type( t ) ), p );
+                if ( sp.conv == 'X' )
+                    for ( ; q < p; ++q )
+                        if ( *q >= 'a' )
+                            *q -= 'a' - 'A';
+                return p;
+            }
+            if ( sp.conv == 'c' ) {
+                *p++ = char( t );
+                return p;
+            }
+            if constexpr ( std::is_signed< T >::value )
+                return sizeof( T ) > 4 ? i64toa( t, p ) : i32toa( int32_t( t ), p );
+            else
+                return sizeof( T ) > 4 ? u64toa( t, p ) : u32toa( uint32_t( t ), p );
+        }
+        if constexpr ( std::is_floating_point< T >::value )
+            return dtoa( t, p, sp.precision < 0 ? 6 : sp.precision );
+        if constexpr ( is_fixed< T >::value )
+            return qtoa( t.raw(), T::fraction_bits, p, sp.precision < 0 ? 6 : sp.precision );
+        return p;
+    }
+
+    template< typename Sink, typename T >
+    inline void put_argument( Sink& sink, const spec& sp, const T& t ) {
+        typedef typename std::decay< T >::type type;
+        if constexpr ( std::is_same< type, const char * >::value || std::is_same< type, char * >::value ) {
+            const char * last = t;
+            while ( *last && ( sp.precision < 0 || last - t < sp.precision ) )  // %.Ns: at most N chars
+                ++last;
+            put_padded( sink, sp, t, last );
+        } else {
+            char buf[ 48 ];
+            put_padded( sink, sp, buf, convert< type >( buf, sp, t ) );
+        }
+    }
+
+    template< typename F, size_t pos, typename Sink >
+    inline void emit( Sink& sink ) {
+        constexpr spec sp = parse( F::value, pos );
+        static_assert( sp.conv == '\0' || sp.conv == '%', "format: too few arguments" );
+        if constexpr ( sp.literal_end > pos )
+            sink.write( F::value + pos, sp.literal_end - pos );
+        if constexpr ( sp.conv == '%' ) {
+            sink.put( '%' );
+            emit< F, sp.next >( sink );
+        }
+    }
+
+    template< typename F, size_t pos, typename Sink, typename T, typename... Args >
+    inline void emit( Sink& sink, const T& t, const Args&... args ) {
+        constexpr spec sp = parse( F::value, pos );
+        static_assert( sp.conv != '\0', "format: too many arguments" );
+        if constexpr ( sp.literal_end > pos )
+            sink.write( F::value + pos, sp.literal_end - pos );
+        if constexpr ( sp.conv == '%' ) {
+            sink.put( '%' );
+            emit< F, sp.next >( sink, t, args... );
+        } else {
+            static_assert( accepts< T >( sp.conv ), "format: argument type does not match the conversion" );
+            put_argument( sink, sp, t );
+            emit< F, sp.next >( sink, args... );
+        }
+    }
+
+    template< typename F, typename... Args >
+    struct formatted {
+        std::tuple< const Args&... > args;
+
+        template< typename Sink >
+        inline void operator()( Sink& sink ) const {
+            std::apply( [&]( const Args&... a ){ emit< F, 0 >( sink, a... ); }, args );
+        }
+    };
+
+    template< char... C >
+    struct format_string {
+        static constexpr char value[] = { C..., '\0' };
+        static_assert( valid( value ), "format: unknown conversion" );
+
+        template< typename... Args >
+        constexpr formatted< format_string, Args... > operator()( const Args&... args ) const {
+            static_assert( count_arguments( value ) == sizeof...( Args ), "format: argument count does not match the pattern" );
+            static_assert( check_arguments< Args... >( value ), "format: argument type does not match the conversion" );
+            return { std::tuple< const Args&... >( args... ) };
+        }
+    };
+}
+
+template< typename CharT, CharT... C >
+constexpr format_detail::format_string< C... > operator ""_fmt() { return {}; }
+
+template< typename F, typename... Args >
+inline stream& operator << ( stream& o, const format_detail::formatted< F, Args... >& f )
+{
+    format_detail::stream_sink sink{ o };
+    f( sink );
+    return o;
+}
 
-class format {
-public:
-    format();
-};
+template< typename F, typename... Args >
+inline stream& operator << ( stream&& o, const format_detail::formatted< F, Args... >& f )
+{
+    return o << f;
+}
 
+// snprintf equivalent; always '\0' terminated when size > 0, returns the length written
+template< typename F, typename... Args >
+inline size_t format_to( char * buf, size_t size, const format_detail::formatted< F, Args... >& f )
+{
+    if ( size == 0 )
+        return 0;
+    format_detail::buffer_sink sink{ buf, buf + size - 1 };
+    f( sink );
+    *sink.p = '\0';
+    return size_t( sink.p - buf );
+}
@@ -6,87 +6,104 @@
 
 #include "bitset.hpp"
 #include "dma.hpp"
-#include "condition_wait.hpp"
+#include "deadline_wait.hpp"
 #include "dma_channel.hpp"
+#include "dwt.hpp"
+#include "gpio_mode.hpp"
 #include "i2c.hpp"
+#include "i2c_bits.hpp"
+#include "i2c_master.hpp"
+#include "i2c_slave.hpp"
 #include "i2c_string.hpp"
-#include "scoped_spinlock.hpp"
+#include "i2c_timing.hpp"
+#include "ring_buffer.hpp"
 #include "stream.hpp"
 #include "stm32f103.hpp"
 #include <array>
 #include <atomic>
 #include <mutex>
 
-extern uint32_t __pclk1, __pclk2;
+extern uint32_t __pclk1, __pclk2, __system_clock;
 extern void mdelay( uint32_t );
 
 extern "C" {
     void i2c1_handler();
     void enable_interrupt( stm32f103::IRQn_type IRQn );
+    void disable_interrupt( stm32f103::IRQn_type IRQn );
 }
 
-// bits in the status register
 namespace stm32f103 {
 
-    constexpr uint32_t i2c_clock_speed = 100'000; //'; //100kHz
-
-    enum I2C_CR1_MASK {
-        SWRST          = 1 << 15  // Software reset (0 := not under reset, 0 := under reset state
-        , RES0         = 1 << 14  //
-        , ALERT        = 1 << 13  //
-        , PEC          = 1 << 12  //
-        , POS          = 1 << 11  // Acknowledge/PEC Position (for data reception)
-        , ACK          = 1 << 10  //
-        , STOP         = 1 <<  9  //
-        , START        = 1 <<  8  //
-        , NOSTRETCH    = 1 <<  7  //
-        , ENGC         = 1 <<  6  //
-        , ENPEC        = 1 <<  5  //
-        , ENARP        = 1 <<  4  //
-        , SMBTYPE      = 1 <<  3  //
-        , RES1         = 1 <<  2  //
-        , SMBUS        = 1 <<  1  //
-        , PE           = 1 <<  0  // Peripheral enable
-    };
+    constexpr uint32_t i2c_clock_speed = i2c_standard_mode; // default
 
-    enum I2C_CR2_MASK {
-        LAST          = 1 << 12
-        , DMAEN       = 1 << 11    // DMA requests enable
-        , ITBUFFN     = 1 << 10    // Buffer interrupt enable
-        , ITEVTEN     = 1 <<  9    // Event interrupt enable
-        , ITERREN     = 1 <<  8    // Error interrupt enable
-        , FREQ        = 0x3f       // Peirpheral clock frequence ( 0x02(2MHz) .. 0x32(50MHz) )
+    // per bus (I2C1, I2C2); zero (.bss) is the cleared state
+    struct i2c_recovery_counts {
+        std::atomic< uint32_t > attempts;
+        std::atomic< uint32_t > failures;   // SDA or SCL still low afterwards
     };
+    static std::array< i2c_recovery_counts, 2 > __recoveries;
+
+    static wait_statistics __bus_waits;          // register polling in the blocking transfers
+    static wait_statistics __transaction_waits;  // i2c::wait
 
-   // p782
-    enum I2C_STATUS {
-        // SR2, p782
-        ST_PEC          = 0xff << 8  // Packet error checking rigister
-        , DUALF         = 1 << 7     // Dual flag (slave mode)
-        , SMBHOST       = 1 << 6     // SMBus host header (slave mode)
-        , SMBDEFAULT    = 1 << 5     // SMB deault, SMBus device default address (slave mode)
-        , GENCALL       = 1 << 4     // General call address (slave mode)
-        , TRA           = 1 << 2     // Transmitter/receiver (0: data bytes received, 1: data bytes transmitted)
-        , BUSY          = 1 << 1     // Bus busy
-        , MSL           = 1          // Master/slave
-        // SR1, p778
-        , SMB_ALART     = 1 << 15    // SMBus alert
-        , TIME_OUT      = 1 << 14    // Timeout or Tlow error
-        , PEC_ERR       = 1 << 12    // PEC Error in reception
-        , OVR           = 1 << 11    // Overrun/Underrun
-        , AF            = 1 << 10    // Acknowledge failure
-        , ARLO          = 1 << 9     // arbitration lost
-        , BERR          = 1 << 8     // Bus error
-        , TxE           = 1 << 7     // Data register empty (transmitter)
-        , RxNE          = 1 << 6     // Date register not empty (receiver)
-        , STOPF         = 1 << 4     // Stop detection (slave)
-        , ADD10         = 1 << 3     // 10-bit header sent
-        , BTF           = 1 << 2     // Byte transfer finished
-        , ADDR          = 1 << 1     // Address sent (master), matched(slave)
-        , SB            = 1          // Start bit (master mode); 1: start condition generated
+    // A byte takes 90us at 100kHz; the longest wait is a 32 byte DMA transfer (2.9ms).
+    struct i2c_wait : deadline_wait {
+        i2c_wait() : deadline_wait( 10000, &__bus_waits ) {}
     };
 
-    constexpr uint32_t error_condition = SMB_ALART | TIME_OUT | PEC_ERR | OVR | AF | ARLO | BERR;
+    inline uint32_t bus_index( volatile I2C * i2c ) {
+        return reinterpret_cast< uint32_t >( const_cast< I2C * >( i2c ) ) == I2C2_BASE ? 1 : 0;
+    }
+
+    // A slave reset or interrupted in the middle of a read keeps SDA low, waiting for clocks,
+    // and the peripheral sees a busy bus forever (PE=0 or SWRST do not help).  Take SCL and SDA
+    // as open drain GPIO, clock SCL until the slave lets go of SDA (nine pulses cover a byte and
+    // its ACK), make a STOP, and give the pins back to the peripheral.  I2C must be disabled.
+    struct i2c_bus_recovery {
+        static void delay( uint32_t us ) {
+            const uint32_t t0 = dwt::cycles(), n = us * ( __system_clock / 1000000 );
+            while ( dwt::cycles() - t0 < n )
+                ;
+        }
+
+        bool operator()( volatile I2C& i2c ) {
+            // REMAP=0 { SCL, SDA }, see main.cpp
+            const GPIOB_PIN scl = bus_index( &i2c ) ? PB10 : PB6;
+            const GPIOB_PIN sda = bus_index( &i2c ) ? PB11 : PB7;
+            auto gpio = reinterpret_cast< volatile GPIO * >( GPIOB_BASE );
+
+            ++__recoveries[ bus_index( &i2c ) ].attempts;
+
+            gpio->BSRR = ( 1 << scl ) | ( 1 << sda );  // released
+            gpio_mode()( scl, GPIO_CNF_OUTPUT_ODRAIN, GPIO_MODE_OUTPUT_2M );
+            gpio_mode()( sda, GPIO_CNF_OUTPUT_ODRAIN, GPIO_MODE_OUTPUT_2M );
+            delay( 5 );
+
+            for ( int i = 0; i < 9 && ( gpio->IDR & ( 1 << sda ) ) == 0; ++i ) {
+                gpio->BRR = 1 << scl;
+                delay( 5 );
+                gpio->BSRR = 1 << scl;
+                delay( 5 );
+            }
+            // STOP: SDA low to high while SCL is high
+            gpio->BRR = 1 << scl;
+            delay( 5 );
+            gpio->BRR = 1 << sda;
+            delay( 5 );
+            gpio->BSRR = 1 << scl;
+            delay( 5 );
+            gpio->BSRR = 1 << sda;
+            delay( 5 );
+
+            const bool released = ( gpio->IDR & ( ( 1 << scl ) | ( 1 << sda ) ) ) == uint32_t( ( 1 << scl ) | ( 1 << sda ) );
+            if ( ! released )
+                ++__recoveries[ bus_index( &i2c ) ].failures;
+
+            gpio_mode()( scl, GPIO_CNF_ALT_OUTPUT_ODRAIN, GPIO_MODE_OUTPUT_2M );
+            gpio_mode()( sda, GPIO_CNF_ALT_OUTPUT_ODRAIN, GPIO_MODE_OUTPUT_2M );
+            return released;
+        }
+    };
 
     struct i2c_status {
         volatile I2C& _;
@@ -108,29 +125,34 @@ namespace stm32f103 {
         }
     };
 
+    // 'speed' 0 keeps the clock configuration in place (error recovery)
     struct i2c_reset {
-        bool operator()( volatile I2C& i2c, uint8_t own_addr = 0 ) {
+        bool operator()( volatile I2C& i2c, uint8_t own_addr = 0, uint32_t speed = 0 ) {
             if ( own_addr == 0 )
                 own_addr = i2c.OAR1 >> 1;
+            const uint32_t ccr = i2c.CCR, trise = i2c.TRISE;
 
             bitset::reset( i2c.CR1, PE );
+            if ( i2c.SR2 & BUSY )  // BUSY follows the lines even with PE=0
+                i2c_bus_recovery()( i2c );
             bitset::set( i2c.CR1, SWRST );
-            while ( i2c.SR1 && i2c.SR2 )
-                ;
+            i2c_wait()( [&]{ return !( i2c.SR1 && i2c.SR2 ); } );
             bitset::reset( i2c.CR1, SWRST );
             bitset::reset( i2c.CR1, PE );
 
-            uint16_t freqrange = uint16_t( __pclk1 / 1000'000 /*'*/ ); // source clk in MHz
-            uint16_t cr2 = freqrange;
-            i2c.CR2 |= cr2;
-
             // p784,
-            i2c.TRISE = freqrange + 1;
+            auto timing = i2c_timing::make( __pclk1, speed ? speed : i2c_clock_speed );
+            i2c.CR2 |= timing.freq;  // source clk in MHz
             i2c.OAR1 = own_addr << 1;
             i2c.OAR2 = 0;
 
-            uint16_t ccr = __pclk1 / ( i2c_clock_speed * 2 );  // ratio make it 5us for 10us interval clock
-            i2c.CCR = ccr;  // Sm mode
+            if ( speed == 0 && ccr != 0 ) {
+                i2c.CCR = ccr;
+                i2c.TRISE = trise;
+            } else {
+                i2c.CCR = timing.ccr;
+                i2c.TRISE = timing.trise;
+            }
 
             return true;
         }
@@ -146,7 +168,7 @@ namespace stm32f103 {
 
         inline bool operator()() const {
             bitset::set( _.CR1, START );
-            return condition_wait()( [&]{ return _.SR1 & SB; } );
+            return i2c_wait()( [&]{ return _.SR1 & SB; } );
         }
     };
 
@@ -169,7 +191,7 @@ namespace stm32f103 {
             auto status = _.SR1 | ( _.SR2 << 16 ); // clear ADDR
             if ( success ) {
                 bitset::set( _.CR1, STOP );
-                condition_wait()( [&]{ return !bitset::test(_.SR2, BUSY); } );
+                i2c_wait()( [&]{ return !bitset::test(_.SR2, BUSY); } );
             }
 
             bitset::reset( _.CR2, LAST );
@@ -196,7 +218,7 @@ namespace stm32f103 {
         inline bool operator()( volatile I2C& _, uint8_t address ) {
 
             _.DR = ( address << 1 );
-            return condition_wait()( [&]{ return _.SR1 & ADDR; } );
+            return i2c_wait()( [&]{ return _.SR1 & ADDR; } );
         }
 
         void static clear( volatile I2C& _ ) {
@@ -206,7 +228,7 @@ namespace stm32f103 {
 
     template<> inline bool i2c_address<Receiver>::operator()( volatile I2C& _, uint8_t address ) {
         _.DR = (address << 1) | 1;
-        return condition_wait()( [&](){ return _.SR1 & ADDR; } );
+        return i2c_wait()( [&](){ return _.SR1 & ADDR; } );
     }
 
     template<> void i2c_address<Receiver>::clear( volatile I2C& _ ) {
@@ -227,9 +249,9 @@ namespace stm32f103 {
             if ( start() ) {
                 if ( i2c_address< Receiver >()( _, address ) ) {
                     i2c_address<Receiver>().clear( _ );
-                    condition_wait()( [&](){ return !_.SR1 & ADDR; } );
+                    i2c_wait()( [&](){ return !( _.SR1 & ADDR ); } );
                     while ( size >= 3 ) {
-                        if ( condition_wait()( [&](){ return _.SR1 & (RxNE|BTF); } ) ) {
+                        if ( i2c_wait()( [&](){ return _.SR1 & (RxNE|BTF); } ) ) {
                             if ( _.SR1 & RxNE ) {
                                 *data++ = _.DR;
                                 --size;
@@ -238,7 +260,7 @@ namespace stm32f103 {
                             return I2C_POLLING_MASTER_RECEIVER_RECV_TIMEOUT;
                         }
                     }
-                    if ( condition_wait()( [&](){ return _.SR1 & BTF; } ) ) {
+                    if ( i2c_wait()( [&](){ return _.SR1 & BTF; } ) ) {
                         bitset::reset( _.CR1, ACK );
                         bitset::set( _.CR1, STOP );
                         *data++ = _.DR;  // Data N-1
@@ -246,7 +268,7 @@ namespace stm32f103 {
                     } else {
                         return I2C_POLLING_MASTER_RECEIVER_RECV_TIMEOUT;
                     }
-                    if ( condition_wait()( [&](){ return _.SR1 & RxNE; } ) ) {
+                    if ( i2c_wait()( [&](){ return _.SR1 & RxNE; } ) ) {
                         *data++ = _.DR;
                         --size;
                         return I2C_RESULT_SUCCESS;
@@ -269,14 +291,14 @@ namespace stm32f103 {
                 bitset::set( _.CR1, POS );
                 i2c_address<Receiver>().clear( _ );
                 bitset::reset( _.CR1, ACK );
-                if ( condition_wait()( [&](){ return _.SR1 & BTF; } ) ) {
+                if ( i2c_wait()( [&](){ return _.SR1 & BTF; } ) ) {
                     bitset::set( _.CR1, STOP );
                     *data++ = _.DR;
                     --size;
-                    if ( condition_wait()( [&](){ return _.SR1 & (RxNE|BTF); } ) ) {
+                    if ( i2c_wait()( [&](){ return _.SR1 & (RxNE|BTF); } ) ) {
                         *data++ = _.DR;
                         --size;
-                        if ( condition_wait()( [&](){ return !bitset::test(_.SR2, BUSY); } ) ) {
+                        if ( i2c_wait()( [&](){ return !bitset::test(_.SR2, BUSY); } ) ) {
                             bitset::reset( _.CR1, POS );
                         }
                     }
@@ -294,7 +316,7 @@ namespace stm32f103 {
                 bitset::reset( _.CR1, ACK );           // ACK = 0
                 i2c_address<Receiver>().clear( _ );    // Clear ADDR
                 bitset::set( _.CR1, STOP );            // STOP = 1
-                if ( condition_wait()( [&](){ return _.SR1 & RxNE; } ) ) {  // Wait until RxNE = 1
+                if ( i2c_wait()( [&](){ return _.SR1 & RxNE; } ) ) {  // Wait until RxNE = 1
                     *data++ = _.DR;                    // Read the data
                     --size;
                 }
@@ -313,7 +335,26 @@ namespace stm32f103 {
 
         inline bool operator << ( uint8_t data ) {
             _.DR = data;
-            return condition_wait()( [&](){ return _.SR1 & TxE|BTF; } );
+            return i2c_wait()( [&](){ return _.SR1 & ( TxE | BTF ); } );
+        }
+    };
+
+    // write phase of a combined transfer: address, data and BTF, but no STOP, so that the read
+    // phase can follow with a repeated START while the bus is still ours
+    struct polling_master_writer {
+        volatile I2C& _;
+        polling_master_writer( volatile I2C& t ) : _( t ) {}
+
+        I2C_RESULT_CODE operator()( uint8_t address, const uint8_t * data, size_t size ) const {
+            if ( ! i2c_address< Transmitter >()( _, address ) )
+                return I2C_POLLING_MASTER_TRANSMITTER_ADDRESS_FAILED;
+            i2c_address< Transmitter >::clear( _ );
+            while ( size-- ) {
+                if ( ! i2c_wait()( [&]{ return _.SR1 & TxE; } ) )
+                    return I2C_POLLING_MASTER_TRANSMITTER_SEND_TIMEOUT;
+                _.DR = *data++;
+            }
+            return i2c_wait()( [&]{ return _.SR1 & BTF; } ) ? I2C_RESULT_SUCCESS : I2C_POLLING_MASTER_TRANSMITTER_SEND_TIMEOUT;
         }
     };
 
@@ -332,10 +373,8 @@ namespace stm32f103 {
                     return I2C_DEVICE_ERROR_CONDITION;
             }
 
-            if ( ! condition_wait()( [&](){ return !st.busy(); } ) ) {
-                if ( ( _.SR1 & error_condition ) && ( _.SR2 & (BUSY| MSL) ) )
-                    i2c_reset()( _, own_addr_ );  // Reset i2c chip
-            }
+            if ( ! i2c_wait()( [&](){ return !st.busy(); } ) )
+                i2c_reset()( _, own_addr_ );  // Reset i2c chip; recovers a bus held low
 
             return st.busy() ? I2C_BUS_BUSY : I2C_RESULT_SUCCESS;
         }
@@ -365,7 +404,7 @@ namespace stm32f103 {
                 if ( i2c_address< Transmitter >()( _, address ) ) {
                     i2c_address< Transmitter >().clear( _ );
 
-                    if ( condition_wait()( [&]{ return dma_channel.transfer_complete(); } ) )
+                    if ( i2c_wait()( [&]{ return dma_channel.transfer_complete(); } ) )
                         return I2C_RESULT_SUCCESS;
                     else
                         return I2C_DMA_MASTER_TRANSMITTER_SEND_TIMEOUT;
@@ -396,7 +435,7 @@ namespace stm32f103 {
             if ( start() ) { // generate start condition (master start)
                 if ( i2c_address< Receiver >()( _, address ) ) {
                     i2c_address< Receiver >::clear(_);
-                    if ( condition_wait()( [&](){ return dma_channel.transfer_complete(); } ) ) {
+                    if ( i2c_wait()( [&](){ return dma_channel.transfer_complete(); } ) ) {
                         return I2C_RESULT_SUCCESS;
                     } else
                         return I2C_DMA_MASTER_RECEIVER_RECV_TIMEOUT;
@@ -422,10 +461,111 @@ static dma_channel_t< DMA_I2C1_RX > * __dma_i2c1_rx;
 static dma_channel_t< DMA_I2C2_TX > * __dma_i2c2_tx;
 static dma_channel_t< DMA_I2C2_RX > * __dma_i2c2_rx;
 
+namespace {
+    // interrupt driven transactions, per bus; zero (.bss) is the idle state
+    struct i2c_engine {
+        i2c_master master;
+        ring_buffer< i2c_transaction *, 8 > queue;
+        std::atomic< uint32_t > completed;
+        std::atomic< uint32_t > failed;
+        uint32_t max_queued;
+        i2c_slave slave;
+    };
+
+    std::array< i2c_engine, 2 > __engines;
+
+    inline i2c_engine& engine( volatile I2C * i2c ) {
+        return __engines[ bus_index( i2c ) ];
+    }
+
+    // slave bulk reads borrow the bus Tx channel; TC hands bytes past the register file back to
+    // TxE.  The channel callback in place before the read is put back when the read ends.
+    std::array< void(*)( uint32_t ), 2 > __slave_dma_saved;
+
+    template< uint32_t bus, typename T >
+    void slave_dma_restore( T * channel ) {
+        channel->enable( false );
+        if ( auto saved = __slave_dma_saved[ bus ] ) {
+            channel->set_callback( saved );
+            __slave_dma_saved[ bus ] = nullptr;
+        }
+    }
+
+    template< uint32_t bus >
+    void slave_dma_complete( uint32_t flag ) {
+        if ( flag & 0x02 ) {  // TCIF
+            if ( bus )
+                slave_dma_restore< bus >( __dma_i2c2_tx );
+            else
+                slave_dma_restore< bus >( __dma_i2c1_tx );
+            __engines[ bus ].slave.dma_complete( *reinterpret_cast< volatile I2C * >( bus ? I2C2_BASE : I2C1_BASE ) );
+        }
+    }
+
+    template< uint32_t bus, typename T >
+    bool slave_dma_start( T * channel, const uint8_t * data, size_t size ) {
+        if ( channel == nullptr )
+            return false;
+        channel->enable( false );
+        if ( __slave_dma_saved[ bus ] == nullptr )
+            __slave_dma_saved[ bus ] = channel->callback();
+        channel->set_callback( slave_dma_complete< bus > );
+        channel->set_transfer_buffer( data, size );
+        channel->enable( true );
+        return true;
+    }
+
+    bool slave_dma_start1( const uint8_t * data, size_t size ) {
+        return slave_dma_start< 0 >( __dma_i2c1_tx, data, size );
+    }
+
+    bool slave_dma_start2( const uint8_t * data, size_t size ) {
+        return slave_dma_start< 1 >( __dma_i2c2_tx, data, size );
+    }
+
+    void slave_dma_stop1() {
+        if ( __dma_i2c1_tx )
+            slave_dma_restore< 0 >( __dma_i2c1_tx );
+    }
+
+    void slave_dma_stop2() {
+        if ( __dma_i2c2_tx )
+            slave_dma_restore< 1 >( __dma_i2c2_tx );
+    }
+}
+
+// Bus ownership for the polling and dma transfers.  An interrupt driven transaction may hold the
+// bus, and its interrupt cannot run while the caller is an interrupt handler itself, so give up
+// (I2C_BUS_BUSY) rather than spin forever.  The owner starts queued transactions on release.
+class i2c::scoped_lock {
+    i2c& _;
+public:
+    const bool owns;
+    scoped_lock( i2c& t ) : _( t )
+                          , owns( i2c_wait()( [&]{ return !t.lock_.test_and_set( std::memory_order_acquire ); } ) ) {
+    }
+    ~scoped_lock() {
+        if ( owns ) {
+            _.lock_.clear( std::memory_order_release );
+            _.dispatch();
+        }
+    }
+};
+
 i2c::i2c() : i2c_( 0 )
 {
 }
 
+namespace {
+    // a lease queued by attach() is taken up from the release that hands the channel over
+    template< I2C_BASE base, i2c::DMA_Direction dir >
+    void dma_granted( DMA_CHANNEL ) {
+        i2c_t< base >::instance()->attach( *dma_t< DMA1_BASE >::instance(), dir );
+    }
+}
+
+// The I2C channels are shared with USART1 (ch4, ch5) and USART2 (ch6, ch7); a channel held by
+// either is queued for, and attached from its release.  Leases are kept until detach().
 void
 i2c::attach( dma& dma, DMA_Direction dir )
 {
@@ -433,14 +573,14 @@ i2c::attach( dma& dma, DMA_Direction dir )
 
     if ( addr == I2C1_BASE ) {
         if ( dir == DMA_Rx || dir == DMA_Both ) {
-            if ( __dma_i2c1_rx = new (&__i2c1_rx_dma) dma_channel_t< DMA_I2C1_RX >( dma, 0, 0 ) ) {
+            if ( dma.acquire( DMA_I2C1_RX, dma_granted< I2C1_BASE, DMA_Rx > ) && ( __dma_i2c1_rx = new (&__i2c1_rx_dma) dma_channel_t< DMA_I2C1_RX >( dma, 0, 0 ) ) ) {
                 __dma_i2c1_rx->set_callback( +[]( uint32_t flag ){
                         // stream() << "\n\tI2C-1 Rx irq: " << flag << std::endl;
                     });
             }
         }
         if ( dir == DMA_Tx || dir == DMA_Both ) {
-            if ( __dma_i2c1_tx = new (&__i2c1_tx_dma) dma_channel_t< DMA_I2C1_TX >( dma, 0, 0 ) ) {
+            if ( dma.acquire( DMA_I2C1_TX, dma_granted< I2C1_BASE, DMA_Tx > ) && ( __dma_i2c1_tx = new (&__i2c1_tx_dma) dma_channel_t< DMA_I2C1_TX >( dma, 0, 0 ) ) ) {
                 __dma_i2c1_tx->set_callback( +[]( uint32_t flag ){
                         // stream() << "\n\tI2C-1 Tx irq: " << flag << std::endl;
                     });
@@ -448,14 +588,14 @@ i2c::attach( dma& dma, DMA_Direction dir )
         }
     } else if ( addr == I2C2_BASE ) {
         if ( dir == DMA_Rx || dir == DMA_Both ) {
-            if ( __dma_i2c2_rx = new (&__i2c2_rx_dma) dma_channel_t< DMA_I2C2_RX >( dma, 0, 0 ) ) {
+            if ( dma.acquire( DMA_I2C2_RX, dma_granted< I2C2_BASE, DMA_Rx > ) && ( __dma_i2c2_rx = new (&__i2c2_rx_dma) dma_channel_t< DMA_I2C2_RX >( dma, 0, 0 ) ) ) {
                 __dma_i2c2_rx->set_callback( +[]( uint32_t flag ){
                         // stream() << "\n\tI2C-2 Rx irq: " << flag << std::endl;
                     });
             }
         }
         if ( dir == DMA_Tx || dir == DMA_Both ) {
-            if ( __dma_i2c2_tx = new (&__i2c2_tx_dma) dma_channel_t< DMA_I2C2_TX >( dma, 0, 0 ) ) {
+            if ( dma.acquire( DMA_I2C2_TX, dma_granted< I2C2_BASE, DMA_Tx > ) && ( __dma_i2c2_tx = new (&__i2c2_tx_dma) dma_channel_t< DMA_I2C2_TX >( dma, 0, 0 ) ) ) {
                 __dma_i2c2_tx->set_callback( +[]( uint32_t flag ){
                         // stream() << "\n\tI2C-2 Tx irq: " << flag << std::endl;
                     });
@@ -464,11 +604,41 @@ i2c::attach( dma& dma, DMA_Direction dir )
     }
 }
 
+// releases the channels, or withdraws the requests still queued by attach()
+void
+i2c::detach( dma& dma, DMA_Direction dir )
+{
+    uint32_t addr = reinterpret_cast< uint32_t >(const_cast< I2C * >(i2c_));
+
+    if ( addr == I2C1_BASE ) {
+        if ( dir == DMA_Rx || dir == DMA_Both ) {
+            __dma_i2c1_rx = nullptr;
+            dma.release( DMA_I2C1_RX );
+        }
+        if ( dir == DMA_Tx || dir == DMA_Both ) {
+            __dma_i2c1_tx = nullptr;
+            __slave_dma_saved[ 0 ] = nullptr;
+            dma.release( DMA_I2C1_TX );
+        }
+    } else if ( addr == I2C2_BASE ) {
+        if ( dir == DMA_Rx || dir == DMA_Both ) {
+            __dma_i2c2_rx = nullptr;
+            dma.release( DMA_I2C2_RX );
+        }
+        if ( dir == DMA_Tx || dir == DMA_Both ) {
+            __dma_i2c2_tx = nullptr;
+            __slave_dma_saved[ 1 ] = nullptr;
+            dma.release( DMA_I2C2_TX );
+        }
+    }
+}
+
 void
 i2c::init( stm32f103::I2C_BASE addr )
 {
     lock_.clear();
     own_addr_ = ( addr == I2C1_BASE ) ? 0x03 : 0x04;
+    speed_ = i2c_clock_speed;
 
     if ( auto I2C = reinterpret_cast< volatile stm32f103::I2C * >( addr ) ) {
         i2c_ = I2C;
@@ -501,10 +671,88 @@ i2c::listen( uint8_t addr )
     return true;
 }
 
+bool
+i2c::listen( uint8_t addr, uint8_t * registers, size_t size, size_t writable, size_t dma_threshold )
+{
+    if ( registers == nullptr || size == 0 )
+        return false;
+    auto& slave = engine( i2c_ ).slave;
+    bitset::reset( i2c_->CR2, ITEVTEN | ITERREN );
+    slave.configure( registers, size, writable );
+    if ( bus_index( i2c_ ) == 0 )
+        slave.set_dma( dma_threshold, slave_dma_start1, slave_dma_stop1 );
+    else
+        slave.set_dma( dma_threshold, slave_dma_start2, slave_dma_stop2 );
+    bitset::set( i2c_->CR1, PE );
+    return listen( addr );
+}
+
+stream&
+i2c::print_slave( stream&& o ) const
+{
+    const auto& slave = engine( i2c_ ).slave;
+    if ( ! slave.configured() )
+        return o << "i2c slave: not configured" << std::endl;
+    const auto& st = slave.stats();
+    o << "i2c slave: addr " << own_addr_ << "\tpointer " << slave.pointer() << "\tstate " << int( slave.state() ) << std::endl
+      << "\twrites " << st.writes << " (" << st.bytes_written << " bytes)"
+      << "\treads " << st.reads << " (" << st.bytes_read << " bytes by irq, " << st.dma_reads << " by dma)"
+      << "\terrors " << st.errors << std::endl;
+    return o;
+}
+
 void
 i2c::reset()
 {
+    i2c_reset()( *i2c_, own_addr_, speed_ );
+}
+
+bool
+i2c::set_speed( uint32_t speed )
+{
+    if ( ! i2c_timing::make( __pclk1, speed ).valid() )
+        return false;
+    scoped_lock lock( *this );
+    if ( ! lock.owns ) {
+        result_code_ = I2C_BUS_BUSY;
+        return false;
+    }
+    speed_ = speed;
+    i2c_reset()( *i2c_, own_addr_, speed_ );
+    return true;
+}
+
+uint32_t
+i2c::speed() const
+{
+    return speed_;
+}
+
+bool
+i2c::recover()
+{
+    scoped_lock lock( *this );
+    if ( ! lock.owns ) {
+        result_code_ = I2C_BUS_BUSY;
+        return false;
+    }
+    bitset::reset( i2c_->CR1, PE );
+    const bool released = i2c_bus_recovery()( *i2c_ );
     i2c_reset()( *i2c_, own_addr_ );
+    return released;
+}
+
+stream&
+i2c::print_statistics( stream&& o ) const
+{
+    const auto& r = __recoveries[ bus_index( i2c_ ) ];
+    const uint32_t us = __system_clock / 1000000;
+    o << "i2c bus recovery: " << r.attempts.load() << " (failed " << r.failures.load() << ")" << std::endl;
+    o << "bus waits:         " << __bus_waits.waits.load() << "\ttimeouts " << __bus_waits.timeouts.load()
+      << "\tworst " << __bus_waits.worst.load() / us << "us" << std::endl;
+    o << "transaction waits: " << __transaction_waits.waits.load() << "\ttimeouts " << __transaction_waits.timeouts.load()
+      << "\tworst " << __transaction_waits.worst.load() / us << "us" << std::endl;
+    return o;
 }
 
 bool
@@ -563,6 +811,16 @@ i2c::print_result( stream&& o ) const
         o << "i2c dma master transmitter address failed"; break;
     case I2C_DMA_MASTER_TRANSMITTER_SEND_TIMEOUT:
         o << "i2c dma master transmitter send timeout"; break;
+    case I2C_TRANSACTION_PENDING:
+        o << "i2c transaction pending"; break;
+    case I2C_IRQ_MASTER_ADDRESS_NACK:
+        o << "i2c irq master address nack"; break;
+    case I2C_IRQ_MASTER_DATA_NACK:
+        o << "i2c irq master data nack"; break;
+    case I2C_IRQ_MASTER_BUS_ERROR:
+        o << "i2c irq master bus error"; break;
+    case I2C_IRQ_MASTER_ABORTED:
+        o << "i2c irq master aborted"; break;
     default:
         o << "error code: " << code << "\t";
         break;
@@ -595,12 +853,16 @@ i2c::print_status( stream&& o ) const
 bool
 i2c::read( uint8_t address, uint8_t * data, size_t size )
 {
-    scoped_spinlock<> lock( lock_ );
+    scoped_lock lock( *this );
+    if ( ! lock.owns ) {
+        result_code_ = I2C_BUS_BUSY;
+        return false;
+    }
 
     if ( ( result_code_ = i2c_ready_wait( *i2c_, own_addr_ )() ) != I2C_RESULT_SUCCESS )
         return false;
 
-    if ( size > 3 )
+    if ( size >= 3 )
         result_code_ = polling_master_receiver<3>( *i2c_ )( address, data, size );
     if ( size == 2 )
         result_code_ = polling_master_receiver<2>( *i2c_ )( address, data, size );
@@ -612,7 +874,11 @@ i2c::read( uint8_t address, uint8_t * data, size_t size )
 bool
 i2c::write( uint8_t address, const uint8_t * data, size_t size )
 {
-    scoped_spinlock<> lock( lock_ );
+    scoped_lock lock( *this );
+    if ( ! lock.owns ) {
+        result_code_ = I2C_BUS_BUSY;
+        return false;
+    }
 
     bitset::set( i2c_->CR1, ACK | PE );
 
@@ -648,7 +914,11 @@ i2c::write( uint8_t address, const uint8_t * data, size_t size )
 bool
 i2c::dma_transfer( uint8_t address, const uint8_t * data, size_t size )
 {
-    scoped_spinlock<> lock( lock_ );
+    scoped_lock lock( *this );
+    if ( ! lock.owns ) {
+        result_code_ = I2C_BUS_BUSY;
+        return false;
+    }
 
     const auto base_addr = reinterpret_cast< uint32_t >( const_cast< I2C * >(i2c_) );
     if ( base_addr == I2C1_BASE && __dma_i2c1_tx == nullptr ) {
@@ -681,7 +951,11 @@ i2c::dma_transfer( uint8_t address, const uint8_t * data, size_t size )
 bool
 i2c::dma_receive( uint8_t address, uint8_t * data, size_t size )
 {
-    scoped_spinlock<> lock( lock_ );
+    scoped_lock lock( *this );
+    if ( ! lock.owns ) {
+        result_code_ = I2C_BUS_BUSY;
+        return false;
+    }
 
     const auto base_addr = reinterpret_cast< uint32_t >( const_cast< I2C * >(i2c_) );
 
@@ -712,14 +986,157 @@ i2c::dma_receive( uint8_t address, uint8_t * data, size_t size )
     return false;
 }
 
+// write 'txlen' bytes, repeated START, read 'rxlen' bytes; a single STOP at the end.  The write
+// phase (usually a register pointer) is polled; the read phase goes by DMA if the bus has an Rx
+// channel and more than one byte is wanted.
+bool
+i2c::transfer( uint8_t address, const uint8_t * tx, size_t txlen, uint8_t * rx, size_t rxlen )
+{
+    if ( rxlen == 0 )
+        return write( address, tx, txlen );
+    if ( txlen == 0 )
+        return read( address, rx, rxlen );
+
+    scoped_lock lock( *this );
+    if ( ! lock.owns ) {
+        result_code_ = I2C_BUS_BUSY;
+        return false;
+    }
+
+    bitset::set( i2c_->CR1, ACK | PE );
+
+    if ( ( result_code_ = i2c_ready_wait( *i2c_, own_addr_ )() ) != I2C_RESULT_SUCCESS )
+        return false;
+
+    {
+        scoped_i2c_start start( *i2c_ );
+        if ( ! start() ) {
+            result_code_ = I2C_POLLING_MASTER_TRANSMITTER_START_FAILED;
+            return false;
+        }
+        if ( ( result_code_ = polling_master_writer( *i2c_ )( address, tx, txlen ) ) != I2C_RESULT_SUCCESS )
+            return false;
+        start.success = false;  // no STOP; the read phase ends the transaction
+    }
+
+    const auto base_addr = reinterpret_cast< uint32_t >( const_cast< I2C * >(i2c_) );
+    if ( rxlen > 1 && base_addr == I2C1_BASE && __dma_i2c1_rx )
+        result_code_ = dma_master_receiver( *i2c_ )( *__dma_i2c1_rx, address, rx, rxlen );
+    else if ( rxlen > 1 && base_addr == I2C2_BASE && __dma_i2c2_rx )
+        result_code_ = dma_master_receiver( *i2c_ )( *__dma_i2c2_rx, address, rx, rxlen );
+    else if ( rxlen > 2 )
+        result_code_ = polling_master_receiver<3>( *i2c_ )( address, rx, rxlen );
+    else if ( rxlen == 2 )
+        result_code_ = polling_master_receiver<2>( *i2c_ )( address, rx, rxlen );
+    else
+        result_code_ = polling_master_receiver<1>( *i2c_ )( address, rx, rxlen );
+
+    return result_code_ == I2C_RESULT_SUCCESS;
+}
+
+bool
+i2c::submit( i2c_transaction& t )
+{
+    auto& e = engine( i2c_ );
+    t.result = I2C_TRANSACTION_PENDING;
+    if ( ! e.queue.push( &t ) ) {
+        t.result = I2C_BUS_BUSY;
+        return false;
+    }
+    if ( e.queue.size() > e.max_queued )
+        e.max_queued = e.queue.size();
+    dispatch();
+    return true;
+}
+
+bool
+i2c::wait( const i2c_transaction& t )
+{
+    // the event irq wakes WFE
+    while ( ! deadline_wait( 100000, &__transaction_waits, true )( [&]{ return t.done(); } ) )
+        abort();  // the transaction on the bus is stuck; the queue moves on to the next one
+    return t.result.load() == I2C_RESULT_SUCCESS;
+}
+
+void
+i2c::abort()
+{
+    const bool i2c2 = reinterpret_cast< uint32_t >( const_cast< I2C * >( i2c_ ) ) == I2C2_BASE;
+    disable_interrupt( i2c2 ? I2C2_EV_IRQn : I2C1_EV_IRQn );
+    disable_interrupt( i2c2 ? I2C2_ER_IRQn : I2C1_ER_IRQn );
+    auto t = engine( i2c_ ).master.abort( *i2c_ );
+    enable_interrupt( i2c2 ? I2C2_EV_IRQn : I2C1_EV_IRQn );
+    enable_interrupt( i2c2 ? I2C2_ER_IRQn : I2C1_ER_IRQn );
+    complete( t );
+}
+
+// starts the next queued transaction unless the bus is owned; runs again whenever the owner lets go
+void
+i2c::dispatch()
+{
+    auto& e = engine( i2c_ );
+    while ( ! e.queue.empty() ) {
+        if ( lock_.test_and_set( std::memory_order_acquire ) )
+            return;
+        i2c_transaction * t;
+        if ( e.queue.pop( t ) ) {
+            i2c_wait()( [&]{ return ( i2c_->CR1 & STOP ) == 0; } ); // previous STOP still on the bus
+            e.master.start( *i2c_, t );
+            return;
+        }
+        lock_.clear( std::memory_order_release );
+    }
+}
+
+void
+i2c::complete( i2c_transaction * t )
+{
+    if ( t == nullptr )
+        return;
+    auto& e = engine( i2c_ );
+    if ( t->result.load() == I2C_RESULT_SUCCESS )
+        ++e.completed;
+    else
+        ++e.failed;
+    auto completion = t->completion;
+    lock_.clear( std::memory_order_release );
+    if ( completion )
+        completion( *t );
+    dispatch();
+}
+
+stream&
+i2c::print_queue( stream&& o ) const
+{
+    const auto& e = engine( i2c_ );
+    o << "i2c queue: " << int( e.queue.size() ) << " pending (max " << int( e.max_queued ) << ")"
+      << "\tcompleted " << int( e.completed.load() ) << "\tfailed " << int( e.failed.load() )
+      << "\t" << ( e.master.busy() ? "busy" : "idle" ) << std::endl;
+    return o;
+}
+
 void
 i2c::handle_event_interrupt()
 {
+    auto& e = engine( i2c_ );
+    if ( e.master.busy() )
+        complete( e.master.event( *i2c_ ) );
+    else if ( e.slave.configured() )
+        e.slave.event( *i2c_ );
 }
 
 void
 i2c::handle_error_interrupt()
 {
+    auto& e = engine( i2c_ );
+    if ( e.master.busy() ) {
+        complete( e.master.error( *i2c_ ) );
+        return;
+    }
+    if ( e.slave.configured() ) {
+        e.slave.error( *i2c_ );
+        return;
+    }
     // stream() << "ERROR irq: " << status32_to_string( i2c_status( *i2c_ )() ) << std::endl;
     constexpr uint32_t error_condition = SMB_ALART | TIME_OUT | PEC_ERR | OVR | AF | ARLO | BERR;
     i2c_->SR1 &= ~error_condition;
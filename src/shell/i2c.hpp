@@ -8,6 +8,7 @@
 
 #include <array>
 #include <atomic>
+#include <cstddef>
 #include <cstdint>
 
 class stream;
@@ -48,6 +49,28 @@ namespace stm32f103 {
         , I2C_POLLING_MASTER_TRANSMITTER_ADDRESS_FAILED
         , I2C_POLLING_MASTER_TRANSMITTER_SEND_TIMEOUT
         , I2C_DEVICE_ERROR_CONDITION
+        , I2C_TRANSACTION_PENDING
+        , I2C_IRQ_MASTER_ADDRESS_NACK
+        , I2C_IRQ_MASTER_DATA_NACK
+        , I2C_IRQ_MASTER_BUS_ERROR
+        , I2C_IRQ_MASTER_ABORTED
+    };
+
+    // One interrupt driven master transaction (i2c::submit): 'tx_size' bytes written, then
+    // 'rx_size' bytes read after a repeated START; either phase may be empty.  The descriptor and
+    // its buffers belong to the bus until 'result' leaves I2C_TRANSACTION_PENDING; 'completion'
+    // is called from the I2C interrupt right after that.
+    struct i2c_transaction {
+        uint8_t address;
+        const uint8_t * tx;
+        size_t tx_size;
+        uint8_t * rx;
+        size_t rx_size;
+        void (*completion)( i2c_transaction& );
+        void * context;
+        std::atomic< I2C_RESULT_CODE > result;
+
+        inline bool done() const { return result.load() != I2C_TRANSACTION_PENDING; }
     };
 
     // I^2C 26.5, p773 RM0008
@@ -61,9 +84,14 @@ namespace stm32f103 {
         std::atomic_flag lock_;
         uint8_t own_addr_;
         I2C_RESULT_CODE result_code_;
+        uint32_t speed_;
 
         i2c( const i2c& ) = delete;
         i2c& operator = ( const i2c& ) = delete;
+
+        class scoped_lock;
+        void dispatch();
+        void complete( i2c_transaction * );
         
     public:
         i2c();
@@ -74,10 +102,25 @@ namespace stm32f103 {
         void init( I2C_BASE );
 
         void attach( dma&, DMA_Direction );
+        void detach( dma&, DMA_Direction = DMA_Both );
 
         void reset();
 
+        // SCL frequency up to 400kHz (Fm); false if PCLK1 cannot make it, or the bus is busy
+        bool set_speed( uint32_t speed );
+        uint32_t speed() const;
+
+        // clocks a stuck slave off SDA (nine SCL pulses and a STOP) and resets the peripheral
+        bool recover();
+        // recovery counts of this bus; wait counts and worst case of both buses
+        stream& print_statistics( stream&& ) const;
+
         bool listen( uint8_t own_addr );
+        // slave serving a register file from interrupts (pointer byte, then auto-increment);
+        // the first 'writable' registers accept writes, reads of 'dma_threshold' bytes or more
+        // go by DMA if a Tx channel is attached (0: never)
+        bool listen( uint8_t own_addr, uint8_t * registers, size_t size, size_t writable, size_t dma_threshold = 0 );
+        stream& print_slave( stream&& ) const;
         
         inline operator bool () const { return i2c_; };
 
@@ -88,6 +131,17 @@ namespace stm32f103 {
 
         bool dma_transfer( uint8_t address, const uint8_t *, size_t );
         bool dma_receive( uint8_t address, uint8_t * data, size_t );
+        // write then read with a repeated START in between (register read)
+        bool transfer( uint8_t address, const uint8_t * tx, size_t txlen, uint8_t * rx, size_t rxlen );
+
+        // non-blocking; false if the queue is full.  Transactions run back to back from the
+        // event interrupt, in between the polling and dma transfers above.
+        bool submit( i2c_transaction& );
+        // thread mode only; a transaction that holds the bus for 100ms is aborted
+        bool wait( const i2c_transaction& );
+        void abort();
+        stream& print_queue( stream&& ) const;
+
         uint32_t status() const;
         bool start();
         bool stop();
@@ -0,0 +1,72 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include <cstdint>
+
+// bits in the control and status registers
+namespace stm32f103 {
+
+    enum I2C_CR1_MASK {
+        SWRST          = 1 << 15  // Software reset (0 := not under reset, 0 := under reset state
+        , RES0         = 1 << 14  //
+        , ALERT        = 1 << 13  //
+        , PEC          = 1 << 12  //
+        , POS          = 1 << 11  // Acknowledge/PEC Position (for data reception)
+        , ACK          = 1 << 10  //
+        , STOP         = 1 <<  9  //
+        , START        = 1 <<  8  //
+        , NOSTRETCH    = 1 <<  7  //
+        , ENGC         = 1 <<  6  //
+        , ENPEC        = 1 <<  5  //
+        , ENARP        = 1 <<  4  //
+        , SMBTYPE      = 1 <<  3  //
+        , RES1         = 1 <<  2  //
+        , SMBUS        = 1 <<  1  //
+        , PE           = 1 <<  0  // Peripheral enable
+    };
+
+    enum I2C_CR2_MASK {
+        LAST          = 1 << 12
+        , DMAEN       = 1 << 11    // DMA requests enable
+        , ITBUFFN     = 1 << 10    // Buffer interrupt enable
+        , ITEVTEN     = 1 <<  9    // Event interrupt enable
+        , ITERREN     = 1 <<  8    // Error interrupt enable
+        , FREQ        = 0x3f       // Peirpheral clock frequence ( 0x02(2MHz) .. 0x32(50MHz) )
+    };
+
+   // p782
+    enum I2C_STATUS {
+        // SR2, p782
+        ST_PEC          = 0xff << 8  // Packet error checking rigister
+        , DUALF         = 1 << 7     // Dual flag (slave mode)
+        , SMBHOST       = 1 << 6     // SMBus host header (slave mode)
+        , SMBDEFAULT    = 1 << 5     // SMB deault, SMBus device default address (slave mode)
+        , GENCALL       = 1 << 4     // General call address (slave mode)
+        , TRA           = 1 << 2     // Transmitter/receiver (0: data bytes received, 1: data bytes transmitted)
+        , BUSY          = 1 << 1     // Bus busy
+        , MSL           = 1          // Master/slave
+        // SR1, p778
+        , SMB_ALART     = 1 << 15    // SMBus alert
+        , TIME_OUT      = 1 << 14    // Timeout or Tlow error
+        , PEC_ERR       = 1 << 12    // PEC Error in reception
+        , OVR           = 1 << 11    // Overrun/Underrun
+        , AF            = 1 << 10    // Acknowledge failure
+        , ARLO          = 1 << 9     // arbitration lost
+        , BERR          = 1 << 8     // Bus error
+        , TxE           = 1 << 7     // Data register empty (transmitter)
+        , RxNE          = 1 << 6     // Date register not empty (receiver)
+        , STOPF         = 1 << 4     // Stop detection (slave)
+        , ADD10         = 1 << 3     // 10-bit header sent
+        , BTF           = 1 << 2     // Byte transfer finished
+        , ADDR          = 1 << 1     // Address sent (master), matched(slave)
+        , SB            = 1          // Start bit (master mode); 1: start condition generated
+    };
+
+    constexpr uint32_t error_condition = SMB_ALART | TIME_OUT | PEC_ERR | OVR | AF | ARLO | BERR;
+
+}
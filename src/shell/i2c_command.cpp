@@ -6,13 +6,17 @@
 
 #include "i2c.hpp"
 #include "dma.hpp"
+#include "dwt.hpp"
 #include "i2c_string.hpp"
+#include "i2c_timing.hpp"
 #include "gpio_mode.hpp"
 #include "stream.hpp"
 #include "stm32f103.hpp"
 #include "utility.hpp"
 #include <algorithm>
 
+extern uint32_t __system_clock, __pclk1;
+
 void i2c_command( size_t argc, const char ** argv );
 
 static void
@@ -60,6 +64,29 @@ i2cdetect( size_t argc, const char ** argv )
     i2c_probe( id );
 }
 
+namespace {
+    // The I2C channels are shared with USART1 and USART2; hold them only while a command runs,
+    // unless the slave keeps its Tx channel for bulk reads.
+    class scoped_dma_lease {
+        stm32f103::i2c& i2c_;
+        bool attached_;
+    public:
+        scoped_dma_lease( stm32f103::i2c& t ) : i2c_( t ), attached_( t.has_dma( stm32f103::i2c::DMA_None ) ) {
+            if ( attached_ )
+                i2c_.attach( *stm32f103::dma_t< stm32f103::DMA1_BASE >::instance(), stm32f103::i2c::DMA_Both );
+        }
+        ~scoped_dma_lease() {
+            if ( attached_ )
+                i2c_.detach( *stm32f103::dma_t< stm32f103::DMA1_BASE >::instance() );
+        }
+        void keep() {  // Tx only
+            if ( attached_ )
+                i2c_.detach( *stm32f103::dma_t< stm32f103::DMA1_BASE >::instance(), stm32f103::i2c::DMA_Rx );
+            attached_ = false;
+        }
+    };
+}
+
 void
 i2c_command( size_t argc, const char ** argv )
 {
@@ -71,8 +98,7 @@ i2c_command( size_t argc, const char ** argv )
 
     using namespace stm32f103;
 
-    if ( !i2cx.has_dma( i2c::DMA_Both ) )
-        i2cx.attach( *dma_t< DMA1_BASE >::instance(), i2c::DMA_Both );
+    scoped_dma_lease lease( i2cx );
 
     static uint32_t replicates;
     static uint8_t chipaddr;
@@ -120,8 +146,15 @@ i2c_command( size_t argc, const char ** argv )
             "i2c <hex value> [w|w2|w3|w4]   // write <hex value> as byte|2,3 or 4 bytes words\n"
             "i2c r[2|3|4]   // read n-word data from i2c device\n"
             "i2c --read <numbuer>   // read number-byte adrray data i2c device\n"
+            "i2c <hex reg> irq <number>   // write <reg>, repeated START, read number-byte; interrupt driven\n"
+            "i2c queue   // interrupt driven transaction counts\n"
+            "i2c <hex reg> xfer <number>   // register read: write + read vs. repeated START, timed\n"
             "i2c probe\n"
+            "i2c2 slave [<addr> [dma <bytes>]]   // serve a 256 byte register file; status without <addr>\n"
             "i2c reset\n"
+            "i2c recover   // nine SCL pulses and a STOP; frees SDA held low by a slave\n"
+            "i2c stats   // bus recoveries, wait timeouts and worst case\n"
+            "i2c speed [100000|400000]   // SCL frequency, Hz\n"
             "i2c status\n"
                  << std::endl;
         i2c_string::print_registers( stream(), i2cx.base_addr() );
@@ -133,6 +166,86 @@ i2c_command( size_t argc, const char ** argv )
             i2cx.print_status( stream() );
         } else if ( strcmp( argv[0], "reset" ) == 0 ) {
             i2cx.reset();
+        } else if ( strcmp( argv[0], "slave" ) == 0 ) {
+            // demo register file: 0x00..0x0f writable by the master, 0x10..0xff a read only pattern
+            static std::array< uint8_t, 256 > registers;
+            if ( argc > 1 && std::isdigit( *argv[1] ) ) {
+                --argc; ++argv;
+                uint8_t own_addr = strtox( argv[0] );
+                size_t dma_threshold = 0;
+                if ( argc > 2 && strcmp( argv[1], "dma" ) == 0 && std::isdigit( *argv[2] ) ) {
+                    argc -= 2; argv += 2;
+                    dma_threshold = strtod( argv[0] );
+                }
+                for ( size_t i = 16; i < registers.size(); ++i )
+                    registers[ i ] = uint8_t( i );
+                if ( ! i2cx.listen( own_addr, registers.data(), registers.size(), 16, dma_threshold ) )
+                    stream() << "i2c slave: listen failed" << std::endl;
+                else if ( dma_threshold && i2cx.has_dma( i2c::DMA_Tx ) )
+                    lease.keep();
+                else if ( !dma_threshold )
+                    i2cx.detach( *dma_t< DMA1_BASE >::instance() ); // a lease kept by an earlier 'slave .. dma'
+            }
+            i2cx.print_slave( stream() );
+        } else if ( strcmp( argv[0], "recover" ) == 0 ) {
+            stream() << "i2c recover: " << ( i2cx.recover() ? "bus released" : "SDA or SCL still low" ) << std::endl;
+        } else if ( strcmp( argv[0], "stats" ) == 0 ) {
+            i2cx.print_statistics( stream() );
+        } else if ( strcmp( argv[0], "speed" ) == 0 ) {
+            if ( argc > 1 && std::isdigit( *argv[1] ) ) {
+                --argc; ++argv;
+                uint32_t speed = strtod( argv[0] );
+                if ( speed > i2c_fast_mode )
+                    stream() << "i2c speed: " << speed << " -- Fm+ is not supported by the STM32F1 I2C; 400kHz max" << std::endl;
+                else if ( ! i2cx.set_speed( speed ) )
+                    stream() << "i2c speed: " << speed << " -- not available with PCLK1 " << __pclk1 << "Hz" << std::endl;
+            }
+            auto timing = i2c_timing::make( __pclk1, i2cx.speed() );
+            stream() << "i2c speed: " << i2cx.speed() << "Hz, SCL " << timing.speed << "Hz\t"
+                     << ( timing.fast() ? ( timing.ccr & CCR_DUTY ? "Fm 16/9" : "Fm 2" ) : "Sm" )
+                     << "\tCCR " << int( timing.ccr & CCR_CCR ) << "\tTRISE " << int( timing.trise ) << std::endl;
+        } else if ( strcmp( argv[0], "queue" ) == 0 ) {
+            i2cx.print_queue( stream() );
+        } else if ( strcmp( argv[0], "irq" ) == 0 ) {
+            size_t read_counts = 1;
+            if ( argc > 1 && std::isdigit( *argv[1] ) ) {
+                --argc; ++argv;
+                read_counts = strtod( argv[0] );
+            }
+            read_counts = read_counts == 0 ? 1 : (read_counts < rxdata.size() ? read_counts : rxdata.size() );
+            rxdata = { 0 };
+            txdata[ 0 ] = uint8_t( txd );
+            i2c_transaction t = { chipaddr, txdata.data(), 1, rxdata.data(), read_counts, nullptr, nullptr };
+            if ( i2cx.submit( t ) && i2cx.wait( t ) ) {
+                rx_print( stream(__FILE__,__LINE__), read_counts, 0 );
+            } else {
+                stream(__FILE__,__LINE__) << "i2c -- irq transaction failed. addr=" << chipaddr << " code=" << int( t.result.load() ) << std::endl;
+            }
+        } else if ( strcmp( argv[0], "xfer" ) == 0 ) {
+            size_t read_counts = 1;
+            if ( argc > 1 && std::isdigit( *argv[1] ) ) {
+                --argc; ++argv;
+                read_counts = strtod( argv[0] );
+            }
+            read_counts = read_counts == 0 ? 1 : (read_counts < rxdata.size() ? read_counts : rxdata.size() );
+            const uint8_t reg = uint8_t( txd );
+            const uint32_t us = __system_clock / 1000000;
+            // both forms move pointer + 2 address bytes + data; the repeated START saves a STOP, the
+            // bus free time after it, and a second bus acquisition
+            auto t0 = dwt::cycles();
+            bool ok = ( i2cx.has_dma( i2c::DMA_Tx ) ? i2cx.dma_transfer( chipaddr, &reg, 1 ) : i2cx.write( chipaddr, &reg, 1 ) )
+                && ( i2cx.has_dma( i2c::DMA_Rx ) && read_counts > 1 ? i2cx.dma_receive( chipaddr, rxdata.data(), read_counts )
+                     : i2cx.read( chipaddr, rxdata.data(), read_counts ) );
+            auto t1 = dwt::cycles();
+            stream() << "write+read: " << int( read_counts + 3 ) << " bytes, 2 START 2 STOP\t"
+                     << int( ( t1 - t0 ) / us ) << "us" << ( ok ? "" : "\tfailed" ) << std::endl;
+            t0 = dwt::cycles();
+            ok = i2cx.transfer( chipaddr, &reg, 1, rxdata.data(), read_counts );
+            t1 = dwt::cycles();
+            stream() << "transfer:   " << int( read_counts + 3 ) << " bytes, START Sr STOP\t"
+                     << int( ( t1 - t0 ) / us ) << "us" << ( ok ? "" : "\tfailed" ) << std::endl;
+            if ( ok )
+                rx_print( stream(__FILE__,__LINE__), read_counts, 0 );
         } else if ( strcmp( argv[0], "probe" ) == 0 ) {
             i2c_probe( id );
         } else if ( strcmp( argv[0], "--slave" ) == 0 ) {
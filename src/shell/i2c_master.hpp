@@ -0,0 +1,186 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include "i2c.hpp"
+#include "i2c_bits.hpp"
+#include <cstddef>
+#include <cstdint>
+
+namespace stm32f103 {
+
+    // Interrupt driven master state machine, RM0008 26.3.3 and AN2824.
+    //
+    //   write_start -SB-> address(W) -ADDR-> write_data -TxE..BTF-> STOP, or repeated START
+    //   read_start  -SB-> address(R) -ADDR-> read_data  -RxNE..BTF-> STOP
+    //
+    // start() generates the START; then the I2Cx_EV handler calls event() and I2Cx_ER calls
+    // error().  Both return the transaction once it is over (result set, engine idle again).
+    // ITBUFEN is on only while bytes are moved one TxE/RxNE at a time; the last three bytes of a
+    // read are taken on BTF, so that ACK and STOP are programmed while SCL is stretched.
+    // Zero is the idle state.
+
+    class i2c_master {
+    public:
+        enum state_type : uint32_t { idle, write_start, write_data, read_start, read_data };
+
+    private:
+        i2c_transaction * current_;
+        size_t count_;            // bytes moved in the current phase
+        state_type state_;
+        uint32_t cr2_;            // interrupt enables to restore when done (slave mode keeps ITEVTEN)
+
+        i2c_transaction * finish( volatile I2C& _, I2C_RESULT_CODE code ) {
+            auto t = current_;
+            _.CR2 = ( _.CR2 & ~( ITBUFFN | ITEVTEN | ITERREN ) ) | cr2_;
+            _.CR1 = ( _.CR1 & ~POS ) | ACK;
+            current_ = nullptr;
+            state_ = idle;
+            t->result = code;
+            return t;
+        }
+
+        i2c_transaction * addressed( volatile I2C& _ ) {
+            auto t = current_;
+            if ( state_ == write_start ) {
+                (void)_.SR2;                         // SR1 then SR2 read clears ADDR
+                if ( t->tx_size == 0 ) {             // address only (probe)
+                    _.CR1 |= STOP;
+                    return finish( _, I2C_RESULT_SUCCESS );
+                }
+                state_ = write_data;
+                _.CR2 |= ITBUFFN;
+                return nullptr;
+            }
+            state_ = read_data;
+            _.CR2 &= ~ITBUFFN;                       // a write phase ended on TxE|BTF may leave it on
+            if ( t->rx_size == 1 ) {
+                _.CR1 &= ~ACK;
+                (void)_.SR2;
+                _.CR1 |= STOP;
+                _.CR2 |= ITBUFFN;
+            } else if ( t->rx_size == 2 ) {          // N = 2 and N = 3 are paced by BTF alone
+                _.CR1 = ( _.CR1 & ~ACK ) | POS;      // NACK goes to the byte in the shift register
+                (void)_.SR2;
+            } else {
+                (void)_.SR2;
+                if ( t->rx_size > 3 )
+                    _.CR2 |= ITBUFFN;
+            }
+            return nullptr;
+        }
+
+        i2c_transaction * receive( volatile I2C& _, uint32_t sr1 ) {
+            auto t = current_;
+            const size_t remaining = t->rx_size - count_;
+            if ( remaining == 1 ) {                  // single byte; NACK and STOP were set at ADDR
+                if ( sr1 & RxNE ) {
+                    t->rx[ count_++ ] = _.DR;
+                    return finish( _, I2C_RESULT_SUCCESS );
+                }
+            } else if ( remaining == 2 ) {           // N-1 in DR, N in the shift register
+                if ( sr1 & BTF ) {
+                    _.CR1 |= STOP;
+                    t->rx[ count_++ ] = _.DR;
+                    t->rx[ count_++ ] = _.DR;
+                    return finish( _, I2C_RESULT_SUCCESS );
+                }
+            } else if ( remaining == 3 ) {           // N-2 in DR; wait for N-1 behind it
+                if ( sr1 & BTF ) {
+                    _.CR1 &= ~ACK;
+                    t->rx[ count_++ ] = _.DR;
+                }
+            } else if ( sr1 & RxNE ) {
+                t->rx[ count_++ ] = _.DR;
+                if ( t->rx_size - count_ == 3 )
+                    _.CR2 &= ~ITBUFFN;
+            }
+            return nullptr;
+        }
+
+    public:
+        inline bool busy() const { return current_ != nullptr; }
+        inline state_type state() const { return state_; }
+        inline const i2c_transaction * current() const { return current_; }
+
+        void start( volatile I2C& _, i2c_transaction * t ) {
+            current_ = t;
+            count_ = 0;
+            state_ = t->tx_size || t->rx_size == 0 ? write_start : read_start;
+            cr2_ = _.CR2 & ( ITBUFFN | ITEVTEN | ITERREN );
+            _.SR1 &= ~error_condition;
+            _.CR1 = ( _.CR1 & ~POS ) | PE | ACK;
+            _.CR2 = ( _.CR2 & ~ITBUFFN ) | ITEVTEN | ITERREN;
+            _.CR1 |= START;
+        }
+
+        i2c_transaction * event( volatile I2C& _ ) {
+            auto t = current_;
+            if ( t == nullptr )
+                return nullptr;
+            const uint32_t sr1 = _.SR1;
+            switch ( state_ ) {
+            case write_start:
+            case read_start:
+                if ( sr1 & SB ) {
+                    _.DR = ( t->address << 1 ) | ( state_ == read_start ? 1 : 0 ); // clears SB
+                } else if ( sr1 & ADDR ) {
+                    return addressed( _ );
+                }
+                break;  // BTF of a write phase stays set until the repeated START is out
+            case write_data:
+                if ( ( sr1 & TxE ) && count_ < t->tx_size ) {
+                    _.DR = t->tx[ count_++ ];
+                } else if ( sr1 & BTF ) {
+                    if ( t->rx_size ) {
+                        count_ = 0;
+                        state_ = read_start;
+                        _.CR2 &= ~ITBUFFN;
+                        _.CR1 |= START;
+                    } else {
+                        _.CR1 |= STOP;
+                        return finish( _, I2C_RESULT_SUCCESS );
+                    }
+                } else if ( sr1 & TxE ) {
+                    _.CR2 &= ~ITBUFFN;               // last byte in the shift register; wait for BTF
+                }
+                break;
+            case read_data:
+                return receive( _, sr1 );
+            case idle:
+                break;
+            }
+            return nullptr;
+        }
+
+        i2c_transaction * error( volatile I2C& _ ) {
+            const uint32_t sr1 = _.SR1;
+            _.SR1 &= ~error_condition;
+            if ( current_ == nullptr )
+                return nullptr;
+            if ( sr1 & AF ) {
+                _.CR1 |= STOP;
+                return finish( _, state_ == write_start || state_ == read_start ? I2C_IRQ_MASTER_ADDRESS_NACK : I2C_IRQ_MASTER_DATA_NACK );
+            }
+            if ( sr1 & ( ARLO | BERR ) ) {
+                if ( _.SR2 & MSL )                   // after ARLO the interface is a slave already
+                    _.CR1 |= STOP;
+                return finish( _, I2C_IRQ_MASTER_BUS_ERROR );
+            }
+            return nullptr;
+        }
+
+        // the bus interrupts must be masked by the caller
+        i2c_transaction * abort( volatile I2C& _ ) {
+            if ( current_ == nullptr )
+                return nullptr;
+            _.CR1 |= STOP;
+            return finish( _, I2C_IRQ_MASTER_ABORTED );
+        }
+    };
+
+}
@@ -0,0 +1,180 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include "i2c.hpp"
+#include "i2c_bits.hpp"
+#include <cstddef>
+#include <cstdint>
+
+namespace stm32f103 {
+
+    // Interrupt driven slave serving a register file, as an EEPROM or a sensor does:
+    //
+    //   write: S addr+W ptr [data...] P       ptr := first byte, data go to ptr, ptr+1, ...
+    //   read:  S addr+R data... NACK P        from ptr, auto-increment; 0xff past the end
+    //
+    // Every read starts at the last pointer written (a Linux master writes it first, with a
+    // repeated START before the read).  Registers [ 0, writable ) accept data; writes elsewhere
+    // are acknowledged and dropped.  ITBUFEN is on from ADDR to the end of each transaction; a
+    // read of at least 'dma_threshold' bytes is handed to the Tx DMA channel through 'dma_start'
+    // instead (DMAEN, no TxE interrupts) and taken back with 'dma_stop' on the master's NACK,
+    // or by dma_complete() when the channel runs out of registers first.
+    // The I2Cx_EV handler calls event(), I2Cx_ER calls error(), unless the master engine has the
+    // bus; the blocking master transfers must not be used on a listening bus.  Zero is the
+    // unconfigured state.
+
+    class i2c_slave {
+    public:
+        enum state_type : uint32_t { idle, receiving, transmitting, transmitting_dma };
+
+        struct statistics {
+            uint32_t writes;          // transactions
+            uint32_t reads;
+            uint32_t dma_reads;
+            uint32_t bytes_written;   // data bytes received from the master, pointer excluded
+            uint32_t bytes_read;      // bytes handed to DR by the interrupt (DMA reads excluded)
+            uint32_t errors;          // BERR, ARLO, OVR
+        };
+
+    private:
+        uint8_t * registers_;
+        size_t size_;
+        size_t writable_;
+        size_t dma_threshold_;        // 0: no DMA
+        bool (*dma_start_)( const uint8_t *, size_t );
+        void (*dma_stop_)();
+        void (*on_write_)( uint8_t pointer, size_t count );
+
+        state_type state_;
+        uint8_t pointer_;             // last pointer byte written
+        size_t index_;                // register for the next byte of this transaction
+        size_t count_;                // data bytes of this transaction
+        statistics stats_;
+
+        void end_write() {
+            if ( state_ == receiving && count_ && on_write_ )
+                on_write_( pointer_, count_ );
+            state_ = idle;
+        }
+
+        void begin( volatile I2C& _, bool transmit ) {
+            end_write();  // a repeated START ends a write without STOPF
+            index_ = pointer_;
+            count_ = 0;
+            if ( ! transmit ) {
+                state_ = receiving;
+                index_ = size_t( -1 );  // next byte is the pointer
+                ++stats_.writes;
+                _.CR2 |= ITBUFFN;
+                return;
+            }
+            ++stats_.reads;
+            if ( dma_threshold_ && dma_start_ && pointer_ < size_ && size_ - pointer_ >= dma_threshold_ ) {
+                if ( dma_start_( registers_ + pointer_, size_ - pointer_ ) ) {
+                    _.CR2 = ( _.CR2 & ~ITBUFFN ) | DMAEN;
+                    state_ = transmitting_dma;
+                    ++stats_.dma_reads;
+                    return;
+                }
+            }
+            state_ = transmitting;
+            _.CR2 |= ITBUFFN;
+        }
+
+        void finish( volatile I2C& _ ) {
+            if ( state_ == transmitting_dma ) {
+                _.CR2 &= ~DMAEN;
+                if ( dma_stop_ )
+                    dma_stop_();
+            }
+            end_write();
+            _.CR2 &= ~ITBUFFN;
+        }
+
+    public:
+        void configure( uint8_t * registers, size_t size, size_t writable ) {
+            registers_ = registers;
+            size_ = size;
+            writable_ = writable < size ? writable : size;
+            pointer_ = 0;
+            state_ = idle;
+            stats_ = statistics();
+        }
+
+        void set_dma( size_t threshold, bool (*start)( const uint8_t *, size_t ), void (*stop)() ) {
+            dma_threshold_ = threshold;
+            dma_start_ = start;
+            dma_stop_ = stop;
+        }
+
+        // called at the end of a write transaction that carried data; in interrupt context
+        void set_write_callback( void (*callback)( uint8_t pointer, size_t count ) ) {
+            on_write_ = callback;
+        }
+
+        inline bool configured() const { return registers_ != nullptr; }
+        inline state_type state() const { return state_; }
+        inline uint8_t pointer() const { return pointer_; }
+        inline const statistics& stats() const { return stats_; }
+
+        // the DMA channel reached the end of the file; whatever the master still reads is 0xff
+        void dma_complete( volatile I2C& _ ) {
+            if ( state_ != transmitting_dma )
+                return;
+            _.CR2 &= ~DMAEN;
+            state_ = transmitting;
+            index_ = size_;
+            _.CR2 |= ITBUFFN;
+        }
+
+        void event( volatile I2C& _ ) {
+            const uint32_t sr1 = _.SR1;
+            if ( sr1 & ADDR ) {
+                const uint32_t sr2 = _.SR2;  // SR1 then SR2 read clears ADDR
+                begin( _, sr2 & TRA );
+                return;
+            }
+            if ( ( sr1 & RxNE ) && state_ == receiving ) {
+                const uint8_t data = _.DR;
+                if ( index_ == size_t( -1 ) ) {
+                    pointer_ = data;
+                    index_ = data;
+                } else {
+                    if ( index_ < writable_ )
+                        registers_[ index_ ] = data;
+                    ++index_;
+                    ++count_;
+                    ++stats_.bytes_written;
+                }
+            }
+            if ( sr1 & STOPF ) {
+                _.CR1 |= PE;  // SR1 read then CR1 write clears STOPF
+                finish( _ );
+                return;
+            }
+            if ( ( sr1 & TxE ) && state_ == transmitting ) {
+                _.DR = index_ < size_ ? registers_[ index_ ] : 0xff;
+                ++index_;
+                ++stats_.bytes_read;
+            }
+        }
+
+        void error( volatile I2C& _ ) {
+            const uint32_t sr1 = _.SR1;
+            _.SR1 &= ~error_condition;
+            if ( sr1 & ( BERR | ARLO | OVR ) )
+                ++stats_.errors;
+            if ( sr1 & ( AF | BERR | ARLO ) ) {  // AF: the master's NACK that ends a read
+                if ( state_ == transmitting && ( sr1 & AF ) && stats_.bytes_read )
+                    --stats_.bytes_read;         // the byte preloaded into DR is never sent
+                finish( _ );
+            }
+        }
+    };
+
+}
@@ -160,7 +160,7 @@ i2c_string::OAR2( stream& o, uint16_t reg, volatile I2C * )
 stream&
 i2c_string::CCR( stream& o, uint16_t reg, volatile I2C * )
 {
-    o << "CCR  : {" << int( reg & 0x7ff ) << "}\t";
+    o << "CCR  : {" << ( reg & 0x8000 ? ( reg & 0x4000 ? "Fm 16/9," : "Fm 2," ) : "Sm," ) << int( reg & 0xfff ) << "}\t";
     return o;
 }
 
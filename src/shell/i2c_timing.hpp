@@ -0,0 +1,72 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include <cstdint>
+
+namespace stm32f103 {
+
+    // CCR register, p784 RM0008
+    enum I2C_CCR_MASK {
+        CCR_FS          = 1 << 15    // 1: Fm mode
+        , CCR_DUTY      = 1 << 14    // Fm duty cycle, 0: Tlow/Thigh = 2, 1: Tlow/Thigh = 16/9
+        , CCR_CCR       = 0x0fff     // clock control
+    };
+
+    constexpr uint32_t i2c_standard_mode = 100'000; //'
+    constexpr uint32_t i2c_fast_mode     = 400'000; //'
+
+    // CR2 FREQ, CCR and TRISE for an SCL frequency at or below 'speed' from PCLK1.
+    //   Sm:          Thigh = Tlow = CCR * Tpclk1, CCR >= 4, rise time <= 1000ns
+    //   Fm, DUTY 0:  Thigh = CCR * Tpclk1, Tlow = 2 * Thigh
+    //   Fm, DUTY 1:  Thigh = 9 * CCR * Tpclk1, Tlow = 16 * CCR * Tpclk1, rise time <= 300ns
+    // Fm takes whichever duty lands closer to 'speed' (16:9 for PCLK1 a multiple of 10MHz).
+    // Fm+ (1MHz) is not implemented by the F1 I2C peripheral; anything over 400kHz is invalid.
+    struct i2c_timing {
+        uint32_t freq;    // CR2 FREQ, PCLK1 in MHz
+        uint32_t ccr;     // CCR register, F/S | DUTY | CCR
+        uint32_t trise;   // TRISE register
+        uint32_t speed;   // resulting SCL frequency, ignoring rise time
+
+        constexpr bool valid() const { return ccr != 0; }
+        constexpr bool fast() const { return ccr & CCR_FS; }
+
+        static constexpr i2c_timing make( uint32_t pclk1, uint32_t speed ) {
+            const uint32_t mhz = pclk1 / 1000'000; //'
+            if ( speed == 0 || speed > i2c_fast_mode || mhz < 2 || mhz > 50 )
+                return i2c_timing{ 0, 0, 0, 0 };
+
+            if ( speed <= i2c_standard_mode ) {
+                uint32_t ccr = ( pclk1 + 2 * speed - 1 ) / ( 2 * speed );
+                ccr = ccr < 4 ? 4 : ccr;
+                if ( ccr > CCR_CCR )
+                    return i2c_timing{ 0, 0, 0, 0 };
+                return i2c_timing{ mhz, ccr, mhz + 1, pclk1 / ( 2 * ccr ) };
+            }
+
+            if ( mhz < 4 )  // Fm needs PCLK1 >= 4MHz
+                return i2c_timing{ 0, 0, 0, 0 };
+            uint32_t ccr3 = ( pclk1 + 3 * speed - 1 ) / ( 3 * speed );
+            uint32_t ccr25 = ( pclk1 + 25 * speed - 1 ) / ( 25 * speed );
+            ccr3 = ccr3 < 1 ? 1 : ccr3;
+            ccr25 = ccr25 < 1 ? 1 : ccr25;
+            const uint32_t speed3 = pclk1 / ( 3 * ccr3 );
+            const uint32_t speed25 = pclk1 / ( 25 * ccr25 );
+            const uint32_t trise = mhz * 300 / 1000 + 1;
+            if ( speed25 > speed3 )
+                return i2c_timing{ mhz, CCR_FS | CCR_DUTY | ccr25, trise, speed25 };
+            return i2c_timing{ mhz, CCR_FS | ccr3, trise, speed3 };
+        }
+    };
+
+    static_assert( i2c_timing::make( 36000000, 100000 ).ccr == 180, "Sm 36MHz" );
+    static_assert( i2c_timing::make( 36000000, 100000 ).trise == 37, "Sm 36MHz" );
+    static_assert( i2c_timing::make( 36000000, 400000 ).ccr == ( CCR_FS | 30 ), "Fm 36MHz" );
+    static_assert( i2c_timing::make( 36000000, 400000 ).trise == 11, "Fm 36MHz" );
+    static_assert( i2c_timing::make( 10000000, 400000 ).ccr == ( CCR_FS | CCR_DUTY | 1 ), "Fm 10MHz" );
+    static_assert( ! i2c_timing::make( 36000000, 1000000 ).valid(), "no Fm+ on F1" );
+}
@@ -11,6 +11,7 @@
 #include "command_processor.hpp"
 #include "system_clock.hpp"
 #include "dma.hpp"
+#include "dwt.hpp"
 #include "gpio.hpp"
 #include "gpio_mode.hpp"
 #include "i2c.hpp"
@@ -77,6 +78,8 @@ extern "C" {
     void __spi1_handler( void );
     void __spi2_handler( void );
     void __usart1_handler( void );
+    void __usart2_handler( void );
+    void __usart3_handler( void );
     void __systick_handler( void );
     void __rcc_handler( void );
 
@@ -161,6 +164,8 @@ main()
         __pclk2 = __system_clock;
         __pclk1 = __system_clock / 2;
 
+        stm32f103::dwt::enable();  // cycle counter for benchmarks
+
         // ADC prescaler
         RCC->CFGR &= ~( 0b11 << 14 );
         RCC->CFGR |= ( 0b10 << 14 );  // set prescaler to 6
@@ -181,12 +186,16 @@ main()
         RCC->APB2ENR |= 0x0010;     // IOPC EN := GPIO C enable
 
         RCC->APB2ENR |= (01 << 9);    // ADC1
+        RCC->APB2ENR |= (01 << 10);   // ADC2 (dual mode slave, adc_pair)
+        RCC->APB2ENR |= (01 << 11);   // TIM1 ADC1 injected channel trigger (TRGO)
 
         RCC->APB2ENR |= (01 << 12);   // SPI1 enable;
 
         RCC->APB1ENR |= 1 << 14;      // SPI2 (based on PCLK1, not equal to SPI1)
 
         RCC->APB2ENR |= (01 << 14);   // UART1 enable;
+        RCC->APB1ENR |= (01 << 17);   // USART2 enable (PCLK1)
+        RCC->APB1ENR |= (01 << 18);   // USART3 enable (PCLK1)
 
         // 7.3.8 p114 (APB1 peripheral clock enable register)
         RCC->APB1ENR |= (1 << 25); // CAN clock enable
@@ -199,6 +208,8 @@ main()
         RCC->APB1ENR |= 0x01;  // TIM2 General purpose timer (uing in bmp280)
         // TIM3
         RCC->APB1ENR |= 0x02;  // TIM3 General purpose timer (uing in bmp280)
+        // TIM4
+        RCC->APB1ENR |= 0x04;  // TIM4 ADC1 scan trigger (CC4)
         //RCC->APB1ENR |= 0x3e;  // TIM3..TIM7 General purpose timer (calibration trial)
     }
 
@@ -276,16 +287,27 @@ main()
     {
         int x = 0;
 
-        std::array< char, 128 > cbuf;
-        typedef tokenizer< 32 > tokenizer_type;
+        std::array< char, 512 > cbuf;
+        constexpr size_t line_size = 128;
+
+        auto& console = *stm32f103::uart_t< stm32f103::USART1_BASE >::instance();
 
-        tokenizer_type::argv_type argv;
+        // a pasted script arrives as one burst; more input within ~2ms of a line belongs to it
+        auto more_input = [&]{
+            const uint32_t t0 = stm32f103::dwt::cycles();
+            while ( console.rx_pending() == 0 ) {
+                if ( stm32f103::dwt::cycles() - t0 > __system_clock / 500 )
+                    return false;
+            }
+            return true;
+        };
 
         while ( true ) {
             stream() << "stm32f103 > ";
-            auto length = stm32f103::uart::gets( cbuf.data(), cbuf.size() );
-            auto argc = tokenizer_type()( cbuf.data(), argv );
-            command_processor()( argc, argv.data() );
+            size_t length = console.gets( cbuf.data(), line_size );
+            while ( length + line_size < cbuf.size() && more_input() )
+                length += console.gets( cbuf.data() + length, line_size );
+            command_processor().execute( cbuf.data() );
         }
     }
 
@@ -333,18 +355,21 @@ systick_handler()
 void __hard_fault( void )
 {
     serial_puts( "\nHard fault\n" );
+    stm32f103::uart_t< stm32f103::USART1_BASE >::instance()->flush();
     while( true );
 }
 
 void __bus_fault( void )
 {
     serial_puts( "\nBus fault\n" );
+    stm32f103::uart_t< stm32f103::USART1_BASE >::instance()->flush();
     while( true );    
 }
 
 void __usage_fault( void )
 {
     serial_puts( "\nUsage fault\n" );
+    stm32f103::uart_t< stm32f103::USART1_BASE >::instance()->flush();
     while( true );
 }
 
@@ -396,6 +421,18 @@ __usart1_handler(void)
     stm32f103::uart_t< stm32f103::USART1_BASE >::instance()->handle_interrupt();
 }
 
+void
+__usart2_handler(void)
+{
+    stm32f103::uart_t< stm32f103::USART2_BASE >::instance()->handle_interrupt();
+}
+
+void
+__usart3_handler(void)
+{
+    stm32f103::uart_t< stm32f103::USART3_BASE >::instance()->handle_interrupt();
+}
+
 void
 __systick_handler( void )
 {
@@ -3,6 +3,7 @@
  * Author: Toshinobu Hondo, Ph.D., 
  */
 
+#include "dma_memcpy.hpp"
 #include <cstddef>
 
 #ifdef __cplusplus
@@ -17,8 +18,5 @@ extern "C" {
 void *
 memset( void * dest, int value, size_t num )
 {
-    char * p = reinterpret_cast< char * >( dest );
-    while ( num-- )
-        *p++ = value;
-    return dest;
+    return stm32f103::cpu_memset( dest, value, num );
 }
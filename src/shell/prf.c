@@ -137,6 +137,21 @@ snprintf(char * buf, unsigned int size, const char *fmt, ...)
         return rv;
 }
 
+/* buffer formatting with the same engine as printf; the bench command compares
+ * it against the compile time format (format.hpp)
+ */
+int
+prf_snprintf(char * buf, unsigned int size, const char *fmt, ...)
+{
+        va_list args;
+        int rv;
+
+        va_start(args, fmt);
+        rv = vsnprintf(buf,size,fmt,args);
+        va_end(args);
+        return rv;
+}
+
 #ifdef notdef
 static int
 sprintf(char *buf, const char *fmt, ...)
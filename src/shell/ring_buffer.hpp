@@ -0,0 +1,166 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace stm32f103 {
+
+    enum overflow_policy : uint32_t {
+        overflow_block          // wait (servicing the consumer by polling) until room is available
+        , overflow_drop_newest  // discard the byte being written
+        , overflow_drop_oldest  // discard the oldest byte in the buffer
+    };
+
+    // Lock-free ring buffer for a single core.
+    //
+    // Producers may be thread mode code and interrupt handlers at any priority.  A slot is
+    // reserved by CAS on reserve_, written, and then published to the consumer by the
+    // outermost (lowest priority) producer in progress.  Interrupts nest strictly, so a
+    // preempting producer always completes before the one it preempted resumes; nesting_
+    // tells whether anyone below us still owns an unwritten slot.
+    // The consumer side is a CAS on tail_, which also lets a producer drop the oldest entry.
+
+    template< typename T, size_t N >
+    class ring_buffer {
+        static_assert( ( N & ( N - 1 ) ) == 0, "ring_buffer size must be power of 2" );
+
+        std::array< T, N > buffer_;
+        std::atomic< uint32_t > reserve_;  // slots handed out to producers
+        std::atomic< uint32_t > head_;     // slots visible to the consumer
+        std::atomic< uint32_t > tail_;     // slots consumed
+        std::atomic< uint32_t > nesting_;  // producers in progress
+
+        inline void publish() {
+            auto reserved = reserve_.load();
+            auto head = head_.load();
+            while ( int32_t( reserved - head ) > 0 && !head_.compare_exchange_weak( head, reserved ) )
+                ;
+        }
+
+    public:
+        ring_buffer() {
+            clear();
+        }
+
+        inline void clear() {
+            reserve_ = 0;
+            head_ = 0;
+            tail_ = 0;
+            nesting_ = 0;
+        }
+
+        static constexpr size_t capacity() { return N; }
+
+        inline size_t size() const { return head_.load() - tail_.load(); }
+
+        inline bool empty() const { return head_.load() == tail_.load(); }
+
+        // a producer is in progress; asked by a producer whose push failed, it is one that the
+        // caller preempted, holding reserved slots that only it can publish
+        inline bool producing() const { return nesting_.load() != 0; }
+
+        // returns false when the buffer is full; nothing is written in that case
+        bool push( T c ) {
+            nesting_.fetch_add( 1 );
+            auto slot = reserve_.load();
+            do {
+                if ( slot - tail_.load() >= N ) {
+                    if ( nesting_.fetch_sub( 1 ) == 1 )
+                        publish();
+                    return false;
+                }
+            } while ( !reserve_.compare_exchange_weak( slot, slot + 1 ) );
+
+            buffer_[ slot % N ] = c;
+
+            if ( nesting_.fetch_sub( 1 ) == 1 )
+                publish();
+            return true;
+        }
+
+        // all or nothing; the n slots become visible to the consumer together
+        bool push( const T * data, size_t n ) {
+            nesting_.fetch_add( 1 );
+            auto slot = reserve_.load();
+            do {
+                if ( slot - tail_.load() + n > N ) {
+                    if ( nesting_.fetch_sub( 1 ) == 1 )
+                        publish();
+                    return false;
+                }
+            } while ( !reserve_.compare_exchange_weak( slot, slot + n ) );
+
+            for ( size_t i = 0; i < n; ++i )
+                buffer_[ ( slot + i ) % N ] = data[ i ];
+
+            if ( nesting_.fetch_sub( 1 ) == 1 )
+                publish();
+            return true;
+        }
+
+        bool pop( T& c ) {
+            auto tail = tail_.load();
+            do {
+                if ( tail == head_.load() )
+                    return false;
+                c = buffer_[ tail % N ];
+            } while ( !tail_.compare_exchange_weak( tail, tail + 1 ) );
+            return true;
+        }
+
+        inline bool drop_oldest() {
+            T c;
+            return pop( c );
+        }
+    };
+
+    // Wait-free single producer (ISR) / single consumer (thread) ring buffer.
+    // Each index is written by one side only, so push and pop are a load, a store and
+    // a release; no CAS loop.
+
+    template< typename T, size_t N >
+    class spsc_ring_buffer {
+        static_assert( ( N & ( N - 1 ) ) == 0, "spsc_ring_buffer size must be power of 2" );
+
+        std::array< T, N > buffer_;
+        std::atomic< uint32_t > head_;  // written by producer
+        std::atomic< uint32_t > tail_;  // written by consumer
+
+    public:
+        spsc_ring_buffer() : head_( 0 ), tail_( 0 ) {
+        }
+
+        static constexpr size_t capacity() { return N; }
+
+        inline size_t size() const { return head_.load( std::memory_order_acquire ) - tail_.load( std::memory_order_acquire ); }
+
+        inline bool empty() const { return size() == 0; }
+
+        inline bool push( T c ) {
+            auto head = head_.load( std::memory_order_relaxed );
+            if ( head - tail_.load( std::memory_order_acquire ) >= N )
+                return false;
+            buffer_[ head % N ] = c;
+            head_.store( head + 1, std::memory_order_release );
+            return true;
+        }
+
+        inline bool pop( T& c ) {
+            auto tail = tail_.load( std::memory_order_relaxed );
+            if ( tail == head_.load( std::memory_order_acquire ) )
+                return false;
+            c = buffer_[ tail % N ];
+            tail_.store( tail + 1, std::memory_order_release );
+            return true;
+        }
+    };
+
+}
@@ -1,5 +1,6 @@
 // Copyright (C) 2018 MS-Cheminformatics LLC
 
+#include "dlog.hpp"
 #include "dma.hpp"
 #include "dma_channel.hpp"
 #include "gpio.hpp"
@@ -209,9 +210,8 @@ spi::handle_interrupt()
             rxd_ = spi_->DATA | 0x80000000;
             (*this) = true;        // ~SS = 'H'
             // spi_->CR1 |= BIDIOE;   // switch to write-only mode
-            scoped_spinlock<> lock( lock_ );
             if ( spi_ == reinterpret_cast< volatile stm32f103::SPI * >( SPI2_BASE ) )
-                stream() << "SPI2 got : " << ( rxd_.load() & 0xffff ) << std::endl;
+                DLOG( "SPI2 got : %u\n", uint32_t( rxd_.load() & 0xffff ) );
         }
 
         if ( spi_->SR & 02 ) { // Tx empty
@@ -226,27 +226,17 @@ spi::handle_interrupt()
         }
 
         if ( auto flags = ( spi_->SR & 0x7c ) ) { // ignore BSY, RX not empty, TX empty
-            scoped_spinlock<> lock( lock_ );
-
-            stream() << "SPI IRQ: [" << flags << " CR1=" << spi_->CR1 << "]";
-            if ( flags & 0x80 )
-                stream() << ("BSY,");
-            if ( flags & 0x40 )
-                stream() << ("OVR,");
-            if ( flags & 0x20 )
-                stream() << ("MODF,");
-            if ( flags & 0x10 )
-                stream() << ("CRCERR,");
-            if ( flags & 0x08 )
-                stream() << ("UDR,");
-            if ( flags & 04 )
-                stream() << ("CHSIDE,");
-            stream() << std::endl;
+            DLOG( "SPI IRQ: [%x CR1=%x]%s%s%s%s%s\n", uint32_t( flags ), uint32_t( spi_->CR1 )
+                  , ( flags & 0x40 ) ? "OVR," : ""
+                  , ( flags & 0x20 ) ? "MODF," : ""
+                  , ( flags & 0x10 ) ? "CRCERR," : ""
+                  , ( flags & 0x08 ) ? "UDR," : ""
+                  , ( flags & 0x04 ) ? "CHSIDE," : "" );
         }
 
         if ( spi_->SR & (1 << 5 ) ) { // MODF (mode falt)
             spi_->CR1 = spi_->CR1;
-            stream() << "SPI MODF: [" << spi_->SR << " CR1=" << spi_->CR1 << "]" << std::endl;
+            DLOG( "SPI MODF: [%x CR1=%x]\n", uint32_t( spi_->SR ), uint32_t( spi_->CR1 ) );
         }
     }
 }
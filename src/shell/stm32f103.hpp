@@ -37,6 +37,8 @@ namespace stm32f103 {  // as known as Blue Pill
         , ADC2_BASE	      = 0x40012800
         , SYSTICK_BASE	  = 0xe000e010
         , SCB_BASE        = 0xe000ed00  // PM0056 p148 4.4.15
+        , DWT_BASE        = 0xe0001000  // Data watchpoint and trace unit, ARMv7-M ARM C1.8
+        , COREDEBUG_BASE  = 0xe000edf0  // Debug halting control and status (DEMCR at 0x0c)
         , NVIC_BASE       = 0xe000e100
     };
 
@@ -112,7 +114,7 @@ namespace stm32f103 {  // as known as Blue Pill
         , TIM7_BASE   = 0x40001400 //- 0x4000 17FF TIM7 timer
         , TIM12_BASE  = 0x40001800 //- 0x4000 1BFF TIM12 timer
         , TIM13_BASE  = 0x40001C00 //- 0x4000 1FFF TIM13 timer
-        // 0x4001 2C00 - 0x4001 2FFF TIM1 timer Section 14.4.21 on page 362
+        , TIM1_BASE   = 0x40012C00 //- 0x4001 2FFF TIM1 timer Section 14.4.21 on page 362
         // 0x4001 3400 - 0x4001 37FF TIM8 timer Section 14.4.21 on page 362
         // 0x4001 5000 - 0x4001 53FF TIM10 timer Section 16.5.11 on page 467
         // 0x4001 5400 - 0x4001 57FF TIM11 timer Section 16.5.11 on page 467
@@ -319,6 +321,25 @@ namespace stm32f103 {  // as known as Blue Pill
         uint32_t BFAR;
     } SCB_type;
 
+    // ARMv7-M ARM C1.8.6, DWT register map
+    typedef struct DWT {
+        uint32_t CTRL;     /* Address offset: 0x00, bit0 CYCCNTENA */
+        uint32_t CYCCNT;   /* Address offset: 0x04 */
+        uint32_t CPICNT;   /* Address offset: 0x08 */
+        uint32_t EXCCNT;   /* Address offset: 0x0C */
+        uint32_t SLEEPCNT; /* Address offset: 0x10 */
+        uint32_t LSUCNT;   /* Address offset: 0x14 */
+        uint32_t FOLDCNT;  /* Address offset: 0x18 */
+        uint32_t PCSR;     /* Address offset: 0x1C */
+    } DWT_type;
+
+    typedef struct CoreDebug {
+        uint32_t DHCSR;    /* Address offset: 0x00 */
+        uint32_t DCRSR;    /* Address offset: 0x04 */
+        uint32_t DCRDR;    /* Address offset: 0x08 */
+        uint32_t DEMCR;    /* Address offset: 0x0C, bit24 TRCENA */
+    } CoreDebug_type;
+
     /*
      * STM32F107 Interrupt Number Definition
      */
@@ -6,6 +6,7 @@
 
 #include "stream.hpp"
 #include "stm32f103.hpp"
+#include "to_chars.hpp"
 #include "uart.hpp"
 #include <atomic>
 #include <cmath>
@@ -15,48 +16,59 @@
 using namespace stm32f103;
 
 class stream_t {
-    constexpr const static char * __chars__ = "0123456789abcdef";
+    const uint8_t base_;
+    const uint8_t width_;
+    const char fill_;
 public:
+    stream_t( uint8_t base, uint8_t width, char fill ) : base_( base ), width_( width ), fill_( fill ) {
+    }
+
     template<typename T>
     void operator()( uart& o_, T d ) const {
-        if ( std::is_signed< T >::value ) {
+        char buf[ 24 ];
+        char * p = buf;
+        if ( base_ == stream::hex ) {
+            typedef typename std::make_unsigned< T >::type unsigned_type;
+            p = u64tox( unsigned_type( d ), p );
+        } else if ( std::is_signed< T >::value ) {
             // signed int -- output in decimal numbers
-            char buf[ 22 ]; // 64bit signed max = 20 chars + sign and '\0'
-            char * p = &buf[21];
-            *p-- = '\0';
-            
-            if ( d < 0 ) {
-                o_.putc( '-' );
-                d = -d;
-            }
-            do  {
-                *p-- = __chars__[ d % 10 ];
-                d /= 10;
-            } while ( d );
-            o_ << ++p;            
-
+            p = sizeof( T ) > 4 ? i64toa( d, p ) : i32toa( int32_t( d ), p );
+        } else if ( base_ == stream::dec ) {
+            p = sizeof( T ) > 4 ? u64toa( d, p ) : u32toa( uint32_t( d ), p );
         } else {
             // unsigned values always output in hex
-            for ( size_t i = 0; i < sizeof(T) * 2; ++i )
-                o_.putc( __chars__[ ( d >> (( sizeof(T) * 2 - 1 - i )*4) ) & 0x0f ] );
+            p = u64tox( d, p, sizeof( T ) * 2 );
         }
+        for ( size_t n = p - buf; n < width_; ++n )
+            o_.putc( fill_ );
+        for ( const char * q = buf; q < p; ++q )
+            o_.putc( *q );
     }
 };
 
-template<> void stream_t::operator()( uart& o, double d ) const {
-    o << "stream_t::operator()(uart&, double) " << std::endl;
-}
 
 
 stream::stream() : uart_( *stm32f103::uart_t< stm32f103::USART1_BASE >::instance() )
+                 , base_( automatic )
+                 , width_( 0 )
+                 , precision_( 6 )
+                 , fill_( ' ' )
 {
 }
 
 stream::stream( uart& t ) : uart_( t )
+                          , base_( automatic )
+                          , width_( 0 )
+                          , precision_( 6 )
+                          , fill_( ' ' )
 {
 }
 
 stream::stream( const char * file, const int line, const char * function ) : uart_( *uart_t< USART1_BASE >::instance() )
+                                                                           , base_( automatic )
+                                                                           , width_( 0 )
+                                                                           , precision_( 6 )
+                                                                           , fill_( ' ' )
 {
     (*this) << file << " " << line << ": ";
     if ( function )
@@ -87,85 +99,152 @@ stream::operator << ( const char * s )
 stream&
 stream::operator << ( const int8_t d )
 {
-    stream_t()( uart_, d );
+    stream_t( base_, width_, fill_ )( uart_, d );
+    width_ = 0;
     return *this;
 }
 
 stream&
 stream::operator << ( const uint8_t d )
 {
-    stream_t()( uart_, d );
+    stream_t( base_, width_, fill_ )( uart_, d );
+    width_ = 0;
     return *this;
 }
 
 stream&
 stream::operator << ( const int16_t d )
 {
-    stream_t()( uart_, d );
+    stream_t( base_, width_, fill_ )( uart_, d );
+    width_ = 0;
     return *this;
 }
 
 stream&
 stream::operator << ( const uint16_t d )
 {
-    stream_t()( uart_, d );
+    stream_t( base_, width_, fill_ )( uart_, d );
+    width_ = 0;
     return *this;    
 }
 
 stream&
 stream::operator << ( const int32_t d )
 {
-    stream_t()( uart_, d );
+    stream_t( base_, width_, fill_ )( uart_, d );
+    width_ = 0;
     return *this;        
 }
 
 stream&
 stream::operator << ( const uint32_t d )
 {
-    stream_t()( uart_, d );
+    stream_t( base_, width_, fill_ )( uart_, d );
+    width_ = 0;
     return *this;            
 }
 
-// require lldivm
 stream&
 stream::operator << ( const int64_t d )
 {
-    stream_t()( uart_, uint64_t( d ) );
+    stream_t( base_, width_, fill_ )( uart_, d );
+    width_ = 0;
     return *this;
 }
 
 stream&
 stream::operator << ( const uint64_t d )
 {
-    stream_t()( uart_, d );
+    stream_t( base_, width_, fill_ )( uart_, d );
+    width_ = 0;
     return *this;
 }
 
 stream&
 stream::operator << ( const double d )
 {
-    stream_t()( uart_, d );
+    char buf[ 48 ];
+    put_padded( buf, dtoa( d, buf, precision_ ) );
+    return *this;
+}
+
+stream&
+stream::put_fixed( int64_t raw, unsigned q )
+{
+    char buf[ 48 ];
+    put_padded( buf, qtoa( raw, q, buf, precision_ ) );
+    return *this;
+}
+
+stream&
+stream::write( const char * s, size_t size )
+{
+    while ( size-- ) {
+        if ( *s == '\n' )
+            uart_.putc( '\r' );
+        uart_.putc( *s++ );
+    }
     return *this;
 }
 
+void
+stream::put_padded( const char * first, const char * last )
+{
+    for ( size_t n = last - first; n < width_; ++n )
+        uart_.putc( fill_ );
+    width_ = 0;
+    while ( first < last )
+        uart_.putc( *first++ );
+}
+
 #if __GNUC__ >= 7
 stream&
 stream::operator << ( const int d )
 {
-    stream_t()( uart_, static_cast< const int32_t > (d) );
+    stream_t( base_, width_, fill_ )( uart_, static_cast< const int32_t > (d) );
+    width_ = 0;
     return *this;
 }
 
 stream&
 stream::operator << ( const size_t d )
 {
-    stream_t()( uart_, static_cast< const uint32_t > (d) );
+    stream_t( base_, width_, fill_ )( uart_, static_cast< const uint32_t > (d) );
+    width_ = 0;
     return *this;
 }
 #endif
 
+stream&
+stream::operator << ( const basefield base )
+{
+    base_ = base;
+    return *this;
+}
+
+stream&
+stream::operator << ( const setw w )
+{
+    width_ = w.width;
+    return *this;
+}
+
+stream&
+stream::operator << ( const setprecision p )
+{
+    precision_ = p.precision;
+    return *this;
+}
+
+stream&
+stream::operator << ( const setfill f )
+{
+    fill_ = f.fill;
+    return *this;
+}
+
 void
 stream::flush()
 {
-    // nothing to do
+    uart_.flush();
 }
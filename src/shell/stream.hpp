@@ -10,6 +10,7 @@
 #include <cstddef>
 
 class stream;
+template< unsigned Q, typename T > class fixed;
 
 namespace std {
     constexpr const char * endl = "\n";
@@ -22,13 +23,28 @@ namespace stm32f103 {
 
 class stream {
     stm32f103::uart& uart_;
+    uint8_t base_;
+    uint8_t width_;
+    uint8_t precision_;
+    char fill_;
+    void put_padded( const char * first, const char * last );
+    stream& put_fixed( int64_t raw, unsigned q );
 public:
+    // integer format manipulators; stream() << stream::dec << value << stream::setw( 8 ) << value
+    // 'automatic' (default) := signed in decimal, unsigned in full width hex
+    enum basefield : uint8_t { automatic, dec, hex };
+    struct setw { uint8_t width; constexpr setw( size_t w ) : width( uint8_t( w ) ) {} }; // next value only
+    struct setfill { char fill; constexpr setfill( char c ) : fill( c ) {} };
+    struct setprecision { uint8_t precision; constexpr setprecision( size_t n ) : precision( uint8_t( n ) ) {} }; // default 6
+
     stream( stm32f103::uart& );
     stream();
     stream( const char * file, const int line, const char * function = 0 );
 
     void flush();
 
+    stream& write( const char * s, size_t size );  // '\n' is sent as "\r\n" as operator << ( const char * ) does
+
     stream& operator << ( const bool );
     stream& operator << ( const char );
     stream& operator << ( const char * );
@@ -41,6 +57,14 @@ public:
     stream& operator << ( const int64_t );
     stream& operator << ( const uint64_t );
     stream& operator << ( const double );    
+    stream& operator << ( const basefield );
+    stream& operator << ( const setw );
+    stream& operator << ( const setfill );
+    stream& operator << ( const setprecision );
+
+    template< unsigned Q, typename T > stream& operator << ( const fixed< Q, T >& t ) {
+        return put_fixed( t.raw(), Q );
+    }
 #if __GNUC__ >= 7
     stream& operator << ( const int );    
     stream& operator << ( const size_t );
@@ -0,0 +1,115 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#include "telemetry.hpp"
+#include "../common/cobs.hpp"
+#include "background.hpp"
+#include "dwt.hpp"
+#include "ring_buffer.hpp"
+#include "stm32f103.hpp"
+#include "system_clock.hpp"
+#include "uart.hpp"
+#include <atomic>
+#include <cstring>
+
+extern uint32_t __system_clock;
+
+namespace {
+    // all zero is a valid empty state, as in dlog.cpp
+    stm32f103::ring_buffer< uint32_t, 256 > __telemetry_ring;
+    std::atomic< uint32_t > __frames;
+    std::atomic< uint32_t > __dropped;
+    std::atomic< bool > __enabled;
+    uint8_t __sequence;
+
+    constexpr size_t max_words = ( telemetry_record::max_record_size + 3 ) / 4;
+    constexpr size_t max_frame = telemetry_record::max_frame_size;
+    constexpr size_t frames_per_poll = 4;
+}
+
+using namespace stm32f103;
+
+bool
+telemetry::post( uint8_t type, const void * data, size_t size )
+{
+    if ( ! __enabled || size > telemetry_record::max_record_size )
+        return false;
+
+    // header word := size [15:8] | type [7:0], followed by the record padded to words
+    uint32_t record[ 1 + max_words ] = { 0 };
+    record[ 0 ] = ( size << 8 ) | type;
+    std::memcpy( record + 1, data, size );
+
+    if ( __telemetry_ring.push( record, 1 + ( size + 3 ) / 4 ) )
+        return true;
+    ++__dropped;
+    return false;
+}
+
+void
+telemetry::enable( bool enable )
+{
+    __enabled = enable;
+    if ( enable ) {
+        background::add( drain );
+        auto seconds = std::chrono::duration_cast< std::chrono::seconds >( system_clock::now() - system_clock::zero ).count();
+        post( telemetry_record::time, telemetry_record::time_record{ dwt::cycles(), __system_clock, uint32_t( seconds ) } );
+    } else {
+        background::remove( drain );
+        uint32_t w;
+        while ( __telemetry_ring.pop( w ) ) // discard, consumer side only; producers may be active
+            ;
+    }
+}
+
+bool
+telemetry::enabled()
+{
+    return __enabled.load();
+}
+
+uint32_t
+telemetry::frames()
+{
+    return __frames.load();
+}
+
+uint32_t
+telemetry::dropped()
+{
+    return __dropped.load();
+}
+
+void
+telemetry::drain()
+{
+    auto& console = *uart_t< USART1_BASE >::instance();
+
+    for ( size_t n = 0; n < frames_per_poll; ++n ) {
+        // a frame is written as a whole; do not stall the shell waiting for room
+        if ( console.tx_pending() + max_frame > 256 )
+            return;
+
+        uint32_t header;
+        if ( ! __telemetry_ring.pop( header ) )
+            return;
+
+        uint8_t record[ telemetry_record::max_record_size ];
+        const size_t size = ( header >> 8 ) & 0xff;
+        for ( size_t i = 0; i < ( size + 3 ) / 4; ++i ) {
+            uint32_t w = 0;
+            __telemetry_ring.pop( w ); // published as a whole together with the header
+            for ( size_t k = 0; k < 4 && i * 4 + k < size; ++k )
+                record[ i * 4 + k ] = ( w >> ( k * 8 ) ) & 0xff;
+        }
+
+        uint8_t frame[ max_frame ];
+        const size_t length = telemetry_record::frame( header & 0xff, __sequence++, record, size, frame );
+        for ( size_t i = 0; i < length; ++i )
+            console.putc( frame[ i ] );
+        ++__frames;
+    }
+}
@@ -0,0 +1,38 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include "../common/telemetry_record.hpp"
+#include <cstddef>
+#include <cstdint>
+
+// Binary telemetry frames multiplexed with the shell on the console (USART1)
+//
+// A producer (thread mode or any interrupt priority) posts a typed record into a lock-free RAM
+// ring; a background task frames it (telemetry_record.hpp) and writes it to the console, so a
+// frame is never interleaved with other thread mode output.  While telemetry is off, producers
+// keep printing text.  The host side is in src/telemetry.
+
+namespace stm32f103 {
+
+    class telemetry {
+    public:
+        template< typename T >
+        static inline bool post( telemetry_record::type type, const T& record ) {
+            static_assert( sizeof( T ) <= telemetry_record::max_record_size, "telemetry record too large" );
+            return post( type, &record, sizeof( record ) );
+        }
+        static bool post( uint8_t type, const void * data, size_t size );
+
+        static void enable( bool );   // also sends a time record
+        static bool enabled();
+        static uint32_t frames();
+        static uint32_t dropped();
+        static void drain();          // background task
+    };
+
+}
@@ -0,0 +1,32 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#include "telemetry.hpp"
+#include "stream.hpp"
+#include "utility.hpp"
+
+void
+telemetry_command( size_t argc, const char ** argv )
+{
+    using namespace stm32f103;
+
+    if ( argc == 1 )
+        stream() << "telemetry: " << ( telemetry::enabled() ? "on" : "off" )
+                 << "\tframes: " << int( telemetry::frames() )
+                 << "\tdropped: " << int( telemetry::dropped() )
+                 << std::endl;
+
+    while ( --argc ) {
+        ++argv;
+        if ( strcmp( argv[0], "on" ) == 0 ) {
+            telemetry::enable( true );
+        } else if ( strcmp( argv[0], "off" ) == 0 ) {
+            telemetry::enable( false );
+        } else {
+            stream() << "telemetry [on|off]  // binary frames for adc, candump and bmp280 samples (host: src/telemetry)" << std::endl;
+        }
+    }
+}
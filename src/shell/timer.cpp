@@ -21,6 +21,9 @@ extern "C" {
 }
 
 extern std::atomic< uint32_t > atomic_jiffies;          //  100us  (4.97 days)
+extern uint32_t __system_clock;
+extern uint32_t __pclk1;
+extern uint32_t __pclk2;
 
 namespace stm32f103 {
 
@@ -48,6 +51,7 @@ namespace stm32f103 {
         uint32_t CNT;
         uint32_t PSC;
         uint32_t ARR;
+        uint32_t RCR;   // TIM1/TIM8 repetition counter, reserved on TIM2..5
         uint32_t CCR1;
         uint32_t CCR2;
         uint32_t CCR3;
@@ -57,7 +61,7 @@ namespace stm32f103 {
     };
     static constexpr const char * register_names [] = {
         "CR1", "CR2", "SMCR", "DIER", "SR", "EGR", "CCMR1", "CCMR2", "CCER", "CNT", "PSC"
-        , "ARR", "CCR1", "CCR2", "CCR3", "CCR4", "DCR", "DMAR"
+        , "ARR", "RCR", "CCR1", "CCR2", "CCR3", "CCR4", "DCR", "DMAR"
     };
 
     template< TIM_BASE base > inline void timer_irq_clear() {
@@ -118,6 +122,13 @@ timer::init( TIM_BASE base )
                 stream() << "Clock for TIM3 is disabled" << std::endl;
         }
         break;
+    case TIM1_BASE:
+        // trigger source only (adc injected channel), no interrupt
+        if ( auto RCC = reinterpret_cast< volatile stm32f103::RCC * >( stm32f103::RCC_BASE ) ) {
+            if ( ( RCC->APB2ENR & ( 1 << 11 ) ) == 0 )  // TIM1
+                stream() << "Clock for TIM1 is disabled" << std::endl;
+        }
+        break;
     case TIM5_BASE:
     case TIM6_BASE:
     case TIM7_BASE:
@@ -170,6 +181,71 @@ timer::set_interval( TIM_BASE base, size_t arr )
     p->CR1 |= 1;      // enable
 }
 
+// timers run at twice their APB clock unless the APB prescaler is 1 (RM0008, Figure 8); TIM1 is on APB2
+uint32_t
+timer::clock( TIM_BASE base )
+{
+    if ( base == TIM1_BASE )
+        return __pclk2 == __system_clock ? __pclk2 : __pclk2 * 2;
+    return __pclk1 == __system_clock ? __pclk1 : __pclk1 * 2;
+}
+
+uint32_t
+timer::counter( TIM_BASE base )
+{
+    return reinterpret_cast< volatile TIM * >( base )->CNT;
+}
+
+uint32_t
+timer::prescaler( TIM_BASE base )
+{
+    return reinterpret_cast< volatile TIM * >( base )->PSC + 1;
+}
+
+uint32_t
+timer::set_trigger( TIM_BASE base, uint32_t rate, uint32_t channel )
+{
+    auto p = reinterpret_cast< volatile TIM * >( base );
+
+    uint32_t ticks = rate ? ( clock( base ) + rate / 2 ) / rate : 0;
+    if ( ticks < 2 )
+        ticks = 2;
+    const uint32_t psc = ( ticks - 1 ) / 65536;
+    const uint32_t arr = ( ticks + psc / 2 ) / ( psc + 1 ) - 1;
+
+    p->CR1 = 0;
+    p->DIER = 0;      // trigger only, no interrupt
+    p->SMCR = 0;
+    p->CCER = 0;
+    p->CCMR1 = 0;
+    p->CCMR2 = 0;
+
+    p->PSC = psc;
+    p->ARR = arr;
+    p->CNT = 0;
+
+    if ( channel == 0 ) {
+        p->CR2 = 2 << 4;  // MMS = 010, update event as TRGO
+    } else if ( channel <= 4 ) {
+        p->CR2 = 0;
+        const uint32_t pwm1 = ( 6 << 4 ) | ( 1 << 3 ); // OCxM = 110 (PWM mode 1), OCxPE
+        const uint32_t ccr = ( arr + 1 ) / 2;
+        switch ( channel ) {
+        case 1: p->CCMR1 = pwm1;      p->CCR1 = ccr; break;
+        case 2: p->CCMR1 = pwm1 << 8; p->CCR2 = ccr; break;
+        case 3: p->CCMR2 = pwm1;      p->CCR3 = ccr; break;
+        case 4: p->CCMR2 = pwm1 << 8; p->CCR4 = ccr; break;
+        }
+        p->CCER = 1 << ( ( channel - 1 ) * 4 );  // CCxE, rising edge at CNT == CCRx
+    }
+
+    p->EGR = 1;       // UG, load PSC/ARR
+    p->SR = 0;
+    p->CR1 = ARPE | CEN;
+
+    return ( psc + 1 ) * ( arr + 1 );
+}
+
 void
 timer::print_registers( TIM_BASE base )
 {
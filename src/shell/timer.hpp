@@ -25,6 +25,10 @@ namespace stm32f103 {
         static void init( TIM_BASE );
         static void enable( TIM_BASE, bool );
         static void set_interval( TIM_BASE, size_t ); // 1Hz default
+        static uint32_t set_trigger( TIM_BASE, uint32_t rate, uint32_t channel );
+        static uint32_t clock( TIM_BASE );
+        static uint32_t counter( TIM_BASE );
+        static uint32_t prescaler( TIM_BASE );
         static void print_registers( TIM_BASE );
     };
 
@@ -48,6 +52,15 @@ namespace stm32f103 {
 
         inline void set_interval( size_t arr ) const { timer::set_interval( base, arr ); };
 
+        // Free running trigger source at 'rate' Hz without interrupt: channel 0 drives TRGO on
+        // update, 1..4 a PWM edge on CCx.  Returns the timer clocks per period actually set.
+        inline uint32_t set_trigger( uint32_t rate, uint32_t channel ) const { return timer::set_trigger( base, rate, channel ); }
+
+        static uint32_t clock() { return timer::clock( base ); }  // counter input clock (Hz)
+
+        static uint32_t counter() { return timer::counter( base ); }      // CNT
+        static uint32_t prescaler() { return timer::prescaler( base ); }  // clocks per count, PSC + 1
+
         void set_callback( void (*cb)() ) { // required ctor
             scoped_spinlock<> guard( guard_ );
             callback_ = cb;
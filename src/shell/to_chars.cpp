@@ -0,0 +1,293 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#include "to_chars.hpp"
+#include <cstring>
+
+namespace {
+
+    constexpr const char __digits2 [] =
+        "00010203040506070809"
+        "10111213141516171819"
+        "20212223242526272829"
+        "30313233343536373839"
+        "40414243444546474849"
+        "50515253545556575859"
+        "60616263646566676869"
+        "70717273747576777879"
+        "80818283848586878889"
+        "90919293949596979899";
+
+    constexpr const char * __xdigits = "0123456789abcdef";
+
+    constexpr int max_precision = 17;
+
+    inline void put2( char * p, uint32_t d ) {
+        p[ 0 ] = __digits2[ d * 2 ];
+        p[ 1 ] = __digits2[ d * 2 + 1 ];
+    }
+
+    // exactly 9 digits, zero padded
+    inline char * put9( uint32_t v, char * p ) {
+        uint32_t hi = v / 10000;     // < 100000
+        uint32_t lo = v - hi * 10000;
+        uint32_t h2 = hi / 100;      // < 1000
+        p[ 0 ] = char( '0' + h2 / 100 );
+        put2( p + 1, h2 % 100 );
+        put2( p + 3, hi % 100 );
+        put2( p + 5, lo / 100 );
+        put2( p + 7, lo % 100 );
+        return p + 9;
+    }
+
+}
+
+char *
+u32toa( uint32_t v, char * p )
+{
+    char buf[ 10 ];
+    char * q = buf + sizeof( buf );
+
+    while ( v >= 100 ) {
+        uint32_t r = v % 100;
+        v /= 100;
+        q -= 2;
+        put2( q, r );
+    }
+    if ( v >= 10 ) {
+        q -= 2;
+        put2( q, v );
+    } else {
+        *--q = char( '0' + v );
+    }
+
+    while ( q < buf + sizeof( buf ) )
+        *p++ = *q++;
+    return p;
+}
+
+char *
+i32toa( int32_t v, char * p )
+{
+    if ( v < 0 ) {
+        *p++ = '-';
+        return u32toa( 0 - uint32_t( v ), p );
+    }
+    return u32toa( uint32_t( v ), p );
+}
+
+// 10^9 = 2^9 * 5^9; shift out the power of two, then long divide the remaining 55 bits by
+// 5^9 (21 bits) eleven bits at a time, so that each step fits a 32-bit UDIV.
+uint64_t
+div1e9( uint64_t v, uint32_t& rem )
+{
+    constexpr uint32_t d = 1953125; // 5^9
+    const uint64_t n = v >> 9;
+
+    uint64_t q = 0;
+    uint32_t r = 0;
+    for ( int shift = 44; shift >= 0; shift -= 11 ) {
+        uint32_t x = ( r << 11 ) | uint32_t( ( n >> shift ) & 0x7ff );
+        q = ( q << 11 ) | ( x / d );
+        r = x % d;
+    }
+    rem = ( r << 9 ) | uint32_t( v & 0x1ff );
+    return q;
+}
+
+char *
+u64toa( uint64_t v, char * p )
+{
+    if ( ( v >> 32 ) == 0 )
+        return u32toa( uint32_t( v ), p );
+
+    uint32_t lo, mid;
+    uint64_t hi = div1e9( v, lo );
+    if ( ( hi >> 32 ) == 0 ) {
+        p = u32toa( uint32_t( hi ), p );
+    } else {
+        hi = div1e9( hi, mid );  // hi <= 18
+        p = u32toa( uint32_t( hi ), p );
+        p = put9( mid, p );
+    }
+    return put9( lo, p );
+}
+
+char *
+i64toa( int64_t v, char * p )
+{
+    if ( v < 0 ) {
+        *p++ = '-';
+        return u64toa( 0 - uint64_t( v ), p );
+    }
+    return u64toa( uint64_t( v ), p );
+}
+
+char *
+u32tox( uint32_t v, char * p, size_t digits )
+{
+    if ( digits == 0 ) {
+        digits = 1;
+        while ( digits < 8 && ( v >> ( digits * 4 ) ) )
+            ++digits;
+    }
+    for ( size_t i = digits; i > 0; --i )
+        *p++ = __xdigits[ ( v >> ( ( i - 1 ) * 4 ) ) & 0x0f ];
+    return p;
+}
+
+char *
+u64tox( uint64_t v, char * p, size_t digits )
+{
+    if ( digits == 0 && ( v >> 32 ) == 0 )
+        return u32tox( uint32_t( v ), p );
+    if ( digits == 0 )
+        return u32tox( uint32_t( v ), u32tox( uint32_t( v >> 32 ), p ), 8 );
+    if ( digits <= 8 )
+        return u32tox( uint32_t( v ), p, digits );
+    return u32tox( uint32_t( v ), u32tox( uint32_t( v >> 32 ), p, digits - 8 ), 8 );
+}
+
+namespace {
+
+    // integer part, '.', and 'precision' digits of a 0.128 binary fraction hi:lo; 'sticky' tells
+    // that non-zero bits were shifted out below it (only for |v| < 2^-64, far below the 17th digit)
+    char * fraction_toa( uint64_t ip, uint64_t hi, uint64_t lo, bool sticky, int precision, char * p )
+    {
+        uint32_t frac[ 4 ] = { uint32_t( lo ), uint32_t( lo >> 32 ), uint32_t( hi ), uint32_t( hi >> 32 ) };
+        const int low = lo ? 0 : 2;  // the lower words stay zero when they start so
+
+        char digits[ max_precision ];
+        for ( int i = 0; i < precision; ++i ) {
+            // frac * 10, the digit is what carries out of the 128 bits
+            uint32_t carry = 0;
+            for ( int j = low; j < 4; ++j ) {
+                uint64_t t = uint64_t( frac[ j ] ) * 10 + carry;
+                frac[ j ] = uint32_t( t );
+                carry = uint32_t( t >> 32 );
+            }
+            digits[ i ] = char( carry );
+        }
+
+        constexpr uint32_t half = 1U << 31;
+        const bool below = sticky || frac[ 0 ] || frac[ 1 ] || frac[ 2 ];
+        bool odd = precision ? ( digits[ precision - 1 ] & 1 ) : ( ip & 1 );
+        if ( frac[ 3 ] > half || ( frac[ 3 ] == half && ( below || odd ) ) ) {
+            int i = precision - 1;
+            while ( i >= 0 && digits[ i ] == 9 )
+                digits[ i-- ] = 0;
+            if ( i >= 0 )
+                ++digits[ i ];
+            else
+                ++ip;
+        }
+
+        p = u64toa( ip, p );
+        if ( precision > 0 ) {
+            *p++ = '.';
+            for ( int i = 0; i < precision; ++i )
+                *p++ = char( '0' + digits[ i ] );
+        }
+        return p;
+    }
+
+    char * scientific_toa( double v, char * p, int precision )
+    {
+        int e10 = 0;
+        while ( v >= 1.0e16 ) {
+            v *= 1.0e-16;
+            e10 += 16;
+        }
+        while ( v >= 10.0 ) {
+            v *= 0.1;
+            ++e10;
+        }
+        char buf[ 24 ];
+        char * q = dtoa( v, buf, precision );
+        if ( buf[ 0 ] == '1' && buf[ 1 ] == '0' ) { // rounded up to 10.000
+            q = dtoa( v * 0.1, buf, precision );
+            ++e10;
+        }
+        for ( const char * s = buf; s < q; ++s )
+            *p++ = *s;
+        *p++ = 'e';
+        *p++ = '+';
+        if ( e10 < 100 ) {
+            put2( p, e10 );
+            return p + 2;
+        }
+        return u32toa( e10, p );
+    }
+}
+
+char *
+dtoa( double v, char * p, int precision )
+{
+    if ( precision < 0 )
+        precision = 0;
+    if ( precision > max_precision )
+        precision = max_precision;
+
+    uint64_t bits;
+    std::memcpy( &bits, &v, sizeof( bits ) );
+
+    const int biased = int( bits >> 52 ) & 0x7ff;
+    uint64_t m = bits & ( ( 1ULL << 52 ) - 1 );
+
+    if ( bits >> 63 )
+        *p++ = '-';
+
+    if ( biased == 0x7ff ) {
+        std::memcpy( p, m ? "nan" : "inf", 3 );
+        return p + 3;
+    }
+
+    int e;
+    if ( biased == 0 ) {
+        e = -1074;             // subnormal
+    } else {
+        m |= 1ULL << 52;
+        e = biased - 1075;     // v = m * 2^e
+    }
+
+    if ( e >= 0 ) {
+        if ( e <= 11 )
+            return fraction_toa( m << e, 0, 0, false, precision, p );
+        return scientific_toa( bits >> 63 ? -v : v, p, precision );
+    }
+
+    // v * 10^17 < 2^57 * 2^(53 - s); for s > 128 no bit can reach the 17th digit, nor a tie
+    const int s = -e;          // number of fraction bits in m
+    if ( s <= 52 )
+        return fraction_toa( m >> s, m << ( 64 - s ), 0, false, precision, p );
+    if ( s <= 64 )
+        return fraction_toa( 0, m << ( 64 - s ), 0, false, precision, p );
+    if ( s < 128 )
+        return fraction_toa( 0, m >> ( s - 64 ), m << ( 128 - s ), false, precision, p );
+    if ( s == 128 )
+        return fraction_toa( 0, 0, m, false, precision, p );
+    if ( s - 128 < 64 )
+        return fraction_toa( 0, 0, m >> ( s - 128 ), ( m & ( ( 1ULL << ( s - 128 ) ) - 1 ) ) != 0, precision, p );
+    return fraction_toa( 0, 0, 0, m != 0, precision, p );
+}
+
+char *
+qtoa( int64_t raw, unsigned q, char * p, int precision )
+{
+    if ( precision < 0 )
+        precision = 0;
+    if ( precision > max_precision )
+        precision = max_precision;
+
+    uint64_t u = uint64_t( raw );
+    if ( raw < 0 ) {
+        *p++ = '-';
+        u = 0 - u;
+    }
+    if ( q == 0 )
+        return fraction_toa( u, 0, 0, false, precision, p );
+    return fraction_toa( u >> q, u << ( 64 - q ), 0, false, precision, p );
+}
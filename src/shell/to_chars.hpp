@@ -0,0 +1,37 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// Integer to text conversions for the console; each writes at p (no terminating '\0')
+// and returns the position just past the last character written.
+// Decimal conversions emit two digits per step from a lookup table; 64-bit values are
+// split into 9-digit groups with 32-bit division only, so no libgcc __aeabi_uldivmod.
+
+char * u32toa( uint32_t, char * p );
+char * i32toa( int32_t, char * p );
+char * u64toa( uint64_t, char * p );
+char * i64toa( int64_t, char * p );
+
+// lower case hex; 'digits' == 0 emits the minimum number of digits
+char * u32tox( uint32_t, char * p, size_t digits = 0 );
+char * u64tox( uint64_t, char * p, size_t digits = 0 );
+
+// v / 10^9 and v % 10^9 using 32-bit division
+uint64_t div1e9( uint64_t v, uint32_t& rem );
+
+// Fixed precision decimal ("%.*f"), precision 0..17, digits exact and rounded half to even
+// like printf for |v| < 2^64.  The fraction is expanded from a 0.128 binary fixed point by
+// multiplying by ten, so no floating point division is involved; 128 bits hold every bit of
+// a double that can reach the 17th digit.  Larger values are printed in scientific notation
+// scaled by multiplication (not correctly rounded).
+char * dtoa( double v, char * p, int precision = 6 );
+
+// signed fixed point value raw * 2^-q (q < 64)
+char * qtoa( int64_t raw, unsigned q, char * p, int precision = 6 );
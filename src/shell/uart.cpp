@@ -52,9 +52,11 @@ using namespace stm32f103;
 
 uart::uart() : usart_( 0 )
              , baud_( 115200 )
-             , spinlock_( ATOMIC_FLAG_INIT )
+             , tx_policy_( overflow_block )
+             , tx_dropped_( 0 )
+             , tx_blocked_( 0 )
+             , dma_tx_( nullptr )
 {
-    spinlock_.clear();
 }
 
 bool
@@ -4,6 +4,7 @@
 // Contact: toshi.hondo@qtplatz.com
 //
 
+#include "uart_channel.hpp"
 #include <atomic>
 #include <cstdint>
 #include <cstddef>
@@ -12,11 +13,14 @@ namespace stm32f103 {
 
     enum USART_BASE : uint32_t;
     struct USART;
+    class dma;
+    class uart_dma_transmitter;
+    struct scoped_interrupt_mask;
 
     class uart {
-        volatile USART * usart_;
+        uart_channel< USART, scoped_interrupt_mask > channel_;
         uint32_t baud_;
-        std::atomic_flag spinlock_;
+        uart_dma_transmitter * dma_tx_;
 
         uart( const uart& ) = delete;
         uart& operator = ( const uart& ) = delete;
@@ -34,11 +38,39 @@ namespace stm32f103 {
 
         void putc( int );
 
+        // wait until all queued bytes are shifted out; usable with interrupts masked (fault handlers),
+        // except for the bytes of a putc that the caller preempted, which go out after it resumes
+        void flush();
+
+        void set_overflow_policy( overflow_policy );
+        inline overflow_policy tx_overflow_policy() const { return channel_.tx_overflow_policy(); }
+        inline uint32_t tx_dropped() const { return channel_.tx_dropped(); }
+        inline uint32_t tx_blocked() const { return channel_.tx_blocked(); }
+        size_t tx_pending() const;
+
+        // switch the transmitter to double buffered DMA (DMA1 ch4, ch7, ch2 for USART1, 2, 3); bulk output then costs
+        // one buffer append per byte instead of one interrupt per byte
+        bool attach( dma& );
+        void detach();
+        inline bool has_dma() const { return dma_tx_ != nullptr; }
+        uint32_t dma_transfers() const;
+
+        // non-blocking read of received bytes; returns the number of bytes stored
+        size_t read( uint8_t * p, size_t size );
+        inline size_t rx_pending() const { return channel_.rx_pending(); }
+        inline uint32_t rx_overrun() const { return channel_.rx_overrun(); }
+        inline uint32_t rx_framing() const { return channel_.rx_framing(); }
+        inline uint32_t rx_parity() const { return channel_.rx_parity(); }
+        inline uint32_t rx_noise() const { return channel_.rx_noise(); }
+        inline uint32_t rx_dropped() const { return channel_.rx_dropped(); }
+        void clear_errors();
+
         void handle_interrupt();
+        void handle_dma_interrupt( uint32_t flag );
 
         // printf & console interface
-        static int getc( bool echo = true );
-        static size_t gets( char * p, size_t size );
+        int getc( bool echo = true );
+        size_t gets( char * p, size_t size );
     private:
         bool init( USART_BASE addr );
         template< USART_BASE > friend struct uart_t;
@@ -0,0 +1,212 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include "bitset.hpp"
+#include "ring_buffer.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace stm32f103 {
+
+    // bits in the control and status registers
+    namespace uart_bits {
+
+        enum UART_CR1_MASK {
+            Reserved = 0xfffc0000
+            , UE     = 0x2000  // uart enable
+            , M      = 0x1000  // Word length 0 := 1-start bit, 8 bits, n stop bit, 1 := 1 start bit, 9 data bits, n stop bit
+            , WAKE   = 0x0800  // 0: idle line, 1: address mark
+            , PCE    = 0x0400  // Parity control enable ( 0: disabled, 1:enabled )
+            , PS     = 0x0200  // Parity 0: even, 1: odd
+            , PEIE   = 0x0100  // PE interrupt enable
+            , TXEIE  = 0x0080  // TXE interrupt enable
+            , TCIE   = 0x0040  // Transmission complete interrupt enable
+            , RXNEIE = 0x0020  // RXNE interrupt enable
+            , IDLEIE = 0x0010  // IDLE interrupt enable
+            , TE     = 0x0008  // Transmitter enable
+            , RE     = 0x0004  // Receiver enable
+            , RWU    = 0x0002  // Receiver wakeup
+            , SBK    = 0x0001  // Send brak
+        };
+
+        enum UART_STATUS {
+            ST_PE      =	0x0001
+            , ST_FE    =	0x0002
+            , ST_NE	   =	0x0004
+            , ST_OVER  =	0x0008
+            , ST_IDLE  =	0x0010
+            , ST_RXNE  =	0x0020		// Receiver not empty
+            , ST_TC	   =	0x0040		// Transmission complete
+            , ST_TXE   =	0x0080		// Transmitter empty
+            , ST_BREAK =	0x0100
+            , ST_CTS   =	0x0200
+        };
+    }
+
+    // Interrupt driven transmit and receive of a USART over the rings; the part of uart that
+    // does not depend on the device, so that the host test (uart/loopback.cpp) runs it on a
+    // model of the registers.
+    //
+    // USART_type is the register block (SR, DR, CR1); interrupt_mask a scoped PRIMASK
+    // critical section; T the byte type of the transmit ring, which the host test replaces
+    // to preempt a producer between its slot reservation and publication.
+
+    template< typename USART_type, typename interrupt_mask, typename T = uint8_t >
+    class uart_channel {
+    public:
+        static constexpr size_t buffer_size = 256;
+
+    private:
+        volatile USART_type * usart_;
+        overflow_policy tx_policy_;
+        std::atomic< uint32_t > tx_dropped_;
+        std::atomic< uint32_t > tx_blocked_;
+        ring_buffer< T, buffer_size > txbuf_;
+        spsc_ring_buffer< uint8_t, buffer_size > rxbuf_;
+        std::atomic< uint32_t > rx_overrun_;  // SR.ORE; a byte was lost in the shift register
+        std::atomic< uint32_t > rx_framing_;  // SR.FE; byte discarded
+        std::atomic< uint32_t > rx_parity_;   // SR.PE; byte discarded
+        std::atomic< uint32_t > rx_noise_;    // SR.NE; byte kept
+        std::atomic< uint32_t > rx_dropped_;  // rxbuf_ full
+
+        uart_channel( const uart_channel& ) = delete;
+        uart_channel& operator = ( const uart_channel& ) = delete;
+
+    public:
+        uart_channel( volatile USART_type * usart = nullptr ) : usart_( usart )
+                                                              , tx_policy_( overflow_block )
+                                                              , tx_dropped_( 0 )
+                                                              , tx_blocked_( 0 )
+                                                              , rx_overrun_( 0 )
+                                                              , rx_framing_( 0 )
+                                                              , rx_parity_( 0 )
+                                                              , rx_noise_( 0 )
+                                                              , rx_dropped_( 0 ) {
+        }
+
+        inline volatile USART_type * usart() const { return usart_; }
+
+        inline void set_overflow_policy( overflow_policy policy ) { tx_policy_ = policy; }
+        inline overflow_policy tx_overflow_policy() const { return tx_policy_; }
+
+        // a byte the DMA transmitter could not take, under tx_policy_
+        inline void count_dropped() { ++tx_dropped_; }
+        inline void count_blocked() { ++tx_blocked_; }
+
+        inline uint32_t tx_dropped() const { return tx_dropped_.load(); }
+        inline uint32_t tx_blocked() const { return tx_blocked_.load(); }
+        inline size_t tx_pending() const { return txbuf_.size(); }
+
+        inline size_t rx_pending() const { return rxbuf_.size(); }
+        inline uint32_t rx_overrun() const { return rx_overrun_.load(); }
+        inline uint32_t rx_framing() const { return rx_framing_.load(); }
+        inline uint32_t rx_parity() const { return rx_parity_.load(); }
+        inline uint32_t rx_noise() const { return rx_noise_.load(); }
+        inline uint32_t rx_dropped() const { return rx_dropped_.load(); }
+
+        void clear_errors() {
+            rx_overrun_ = 0;
+            rx_framing_ = 0;
+            rx_parity_ = 0;
+            rx_noise_ = 0;
+            rx_dropped_ = 0;
+        }
+
+        // move one queued byte to DR if the transmitter is empty; the mask covers only 'TXE
+        // test, pop, DR write' so that the interrupt handler and a producer draining by polling
+        // cannot reorder bytes
+        bool transmit_one() {
+            interrupt_mask mask;
+
+            T c;
+            if ( ( usart_->SR & uart_bits::ST_TXE ) && txbuf_.pop( c ) ) {
+                usart_->DR = uint8_t( c );
+                return true;
+            }
+            return false;
+        }
+
+        void putc( int c ) {
+            bool blocked( false );
+
+            while ( ! txbuf_.push( T( c ) ) ) {
+                if ( tx_policy_ == overflow_drop_newest ) {
+                    ++tx_dropped_;
+                    return;
+                } else if ( tx_policy_ == overflow_drop_oldest ) {
+                    ++tx_dropped_;
+                    if ( ! txbuf_.drop_oldest() )
+                        return; // every slot is held by preempted producers; give up this byte instead
+                } else {
+                    // overflow_block; drain by polling since the USART interrupt may be masked
+                    // by the priority we are running at (putc called from an ISR)
+                    if ( ! blocked ) {
+                        blocked = true;
+                        ++tx_blocked_;
+                    }
+                    if ( ! transmit_one() && txbuf_.empty() && txbuf_.producing() ) {
+                        // every slot is held by producers we preempted, and they can publish
+                        // only after we return; waiting would never end
+                        ++tx_dropped_;
+                        return;
+                    }
+                }
+            }
+            bitset::set( usart_->CR1, uart_bits::TXEIE );
+        }
+
+        // Bytes reserved by a producer that the caller preempted are not published until that
+        // producer resumes; they are left to the interrupt, which its putc enables.
+        void flush() {
+            while ( ! txbuf_.empty() )
+                transmit_one();
+            while ( ! ( usart_->SR & uart_bits::ST_TC ) )
+                ;
+        }
+
+        // non-blocking read of received bytes; returns the number of bytes stored
+        size_t read( uint8_t * p, size_t size ) {
+            size_t count( 0 );
+            while ( count < size && rxbuf_.pop( p[ count ] ) )
+                ++count;
+            return count;
+        }
+
+        inline bool getc( uint8_t& c ) { return rxbuf_.pop( c ); }
+
+        void handle_interrupt() {
+            uint32_t status = usart_->SR;
+
+            if ( status & ( uart_bits::ST_RXNE | uart_bits::ST_OVER ) ) {
+                // SR read followed by DR read clears PE, FE, NE and ORE (RM0008 27.6.1)
+                uint8_t c = usart_->DR & 0xff;
+                if ( status & uart_bits::ST_OVER )
+                    ++rx_overrun_;
+                if ( status & uart_bits::ST_NE )
+                    ++rx_noise_;
+                if ( status & uart_bits::ST_FE ) {
+                    ++rx_framing_;
+                } else if ( status & uart_bits::ST_PE ) {
+                    ++rx_parity_;
+                } else if ( ! rxbuf_.push( c ) ) {
+                    ++rx_dropped_;
+                }
+            }
+
+            if ( ( status & uart_bits::ST_TXE ) && ( usart_->CR1 & uart_bits::TXEIE ) ) {
+                if ( ! transmit_one() ) {
+                    bitset::reset( usart_->CR1, uart_bits::TXEIE );
+                    if ( ! txbuf_.empty() ) // a producer preempted us between pop and TXEIE clear
+                        bitset::set( usart_->CR1, uart_bits::TXEIE );
+                }
+            }
+        }
+    };
+
+}
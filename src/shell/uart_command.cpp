@@ -0,0 +1,196 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#include "dma.hpp"
+#include "dwt.hpp"
+#include "stm32f103.hpp"
+#include "stream.hpp"
+#include "uart.hpp"
+#include "utility.hpp"
+
+extern uint32_t __system_clock;
+extern uint32_t __pclk1;
+
+namespace {
+    constexpr const char * __policy_names [] = { "block", "drop", "drop-oldest" };
+
+    void
+    print_status( stm32f103::uart& port )
+    {
+        stream() << "tx policy: " << __policy_names[ port.tx_overflow_policy() ]
+                 << "\tpending: " << int( port.tx_pending() )
+                 << "\tdropped: " << int( port.tx_dropped() )
+                 << "\tblocked: " << int( port.tx_blocked() )
+                 << std::endl;
+        stream() << "tx mode: " << ( port.has_dma() ? "dma" : "irq" )
+                 << "\tdma transfers: " << int( port.dma_transfers() )
+                 << std::endl;
+        stream() << "rx pending: " << int( port.rx_pending() )
+                 << "\toverrun: " << int( port.rx_overrun() )
+                 << "\tframing: " << int( port.rx_framing() )
+                 << "\tparity: " << int( port.rx_parity() )
+                 << "\tnoise: " << int( port.rx_noise() )
+                 << "\tdropped: " << int( port.rx_dropped() )
+                 << std::endl;
+    }
+
+    bool
+    open( stm32f103::uart& port, size_t number, uint32_t baud )
+    {
+        using namespace stm32f103;
+        // USART2: PA2/PA3 (shared with ADC inputs), USART3: PB10/PB11 (shared with I2C2)
+        if ( number == 2 )
+            return port.enable( PA2, PA3, uart::parity_none, 8, baud, __pclk1 );
+        else if ( number == 3 )
+            return port.enable( PB10, PB11, uart::parity_none, 8, baud, __pclk1 );
+        return false;
+    }
+
+    void
+    print_received( stm32f103::uart& port )
+    {
+        uint8_t data[ 32 ];
+        while ( size_t size = port.read( data, sizeof( data ) ) ) {
+            for ( size_t i = 0; i < size; ++i ) {
+                char s[] = { char( ( data[ i ] >= ' ' && data[ i ] < 0x7f ) || data[ i ] == '\n' ? data[ i ] : '.' ), 0 };
+                stream() << s;
+            }
+        }
+        stream() << std::endl;
+    }
+
+    // Writes 'size' bytes in chunks that fit the tx buffer and waits for each chunk to drain.
+    // CPU cost := cycles spent in putc + cycles stolen by interrupts while waiting; the latter
+    // is measured as the shortfall of an idle loop calibrated with the transmitter quiet.
+    void
+    bench( stm32f103::uart& port, size_t size )
+    {
+        using stm32f103::dwt;
+
+        static const char pattern[] = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ.\n";
+        constexpr size_t chunk = 128;
+
+        port.flush();
+
+        constexpr uint32_t cal_spins = 256;
+        auto t = dwt::cycles();
+        for ( uint32_t i = 0; i < cal_spins; ++i ) {
+            if ( port.tx_pending() )
+                break;
+        }
+        const uint32_t cal_cycles = dwt::cycles() - t;
+
+        uint32_t enqueue( 0 ), stolen( 0 );
+        const auto t0 = dwt::cycles();
+        for ( size_t i = 0; i < size; ) {
+            t = dwt::cycles();
+            for ( size_t k = 0; k < chunk && i < size; ++k, ++i )
+                port.putc( pattern[ i % ( sizeof( pattern ) - 1 ) ] );
+            enqueue += dwt::cycles() - t;
+
+            uint32_t spins( 0 );
+            t = dwt::cycles();
+            while ( port.tx_pending() )
+                ++spins;
+            uint32_t wait = dwt::cycles() - t;
+            uint32_t idle = spins * cal_cycles / cal_spins;
+            if ( wait > idle )
+                stolen += wait - idle;
+        }
+        port.flush();
+        const uint32_t elapsed = dwt::cycles() - t0;
+
+        const uint32_t ms = elapsed / ( __system_clock / 1000 );
+        const uint32_t cpu = enqueue + stolen;
+        const uint32_t per_kb = ( cpu / size ) * 1024 + ( ( cpu % size ) * 1024 ) / size;
+
+        stream() << "\nuart bench (" << ( port.has_dma() ? "dma" : "irq" ) << "): "
+                 << int( size ) << " bytes in " << int( ms ) << "ms, "
+                 << int( ms ? size * 1000 / ms : 0 ) << " bytes/s, "
+                 << int( per_kb ) << " cycles/KB (putc " << int( enqueue ) << ", irq " << int( stolen ) << ")"
+                 << std::endl;
+    }
+}
+
+void
+uart_command( size_t argc, const char ** argv )
+{
+    using namespace stm32f103;
+
+    size_t number = 1;
+    if ( argc > 1 && ( argv[1][0] == '1' || argv[1][0] == '2' || argv[1][0] == '3' ) && argv[1][1] == '\0' ) {
+        number = argv[1][0] - '0';
+        --argc; ++argv;
+    }
+
+    auto& port = number == 3 ? *uart_t< USART3_BASE >::instance()
+        : number == 2 ? *uart_t< USART2_BASE >::instance() : *uart_t< USART1_BASE >::instance();
+
+    if ( argc == 1 )
+        print_status( port );
+
+    while ( --argc ) {
+        ++argv;
+        if ( strcmp( argv[0], "help" ) == 0 ) {
+            stream() << "uart [1|2|3] <command>              // port number, default is 1 (console)\n"
+                "uart [status]\n"
+                "uart 2|3 open [baud]                // configure USART2 (PA2/PA3) or USART3 (PB10/PB11)\n"
+                "uart 2|3 send text...               // transmit text followed by CR LF\n"
+                "uart 2|3 recv                       // print received bytes\n"
+                "uart clear                          // reset rx error counters\n"
+                "uart policy block|drop|drop-oldest  // tx buffer overflow policy\n"
+                "uart dma on|off                     // double buffered DMA transmitter\n"
+                "uart bench [bytes]                  // tx throughput and cpu cycles per KB\n"
+                     << std::endl;
+        } else if ( strcmp( argv[0], "status" ) == 0 ) {
+            print_status( port );
+        } else if ( strcmp( argv[0], "clear" ) == 0 ) {
+            port.clear_errors();
+            print_status( port );
+        } else if ( strcmp( argv[0], "policy" ) == 0 && argc > 1 ) {
+            --argc; ++argv;
+            for ( size_t i = 0; i < countof( __policy_names ); ++i ) {
+                if ( strcmp( argv[0], __policy_names[ i ] ) == 0 )
+                    port.set_overflow_policy( overflow_policy( i ) );
+            }
+            print_status( port );
+        } else if ( strcmp( argv[0], "dma" ) == 0 && argc > 1 ) {
+            --argc; ++argv;
+            if ( strcmp( argv[0], "on" ) == 0 && ! port.attach( *dma_t< DMA1_BASE >::instance() ) )
+                stream() << "dma channel is in use; see 'dma status'" << std::endl;
+            else if ( strcmp( argv[0], "off" ) == 0 )
+                port.detach();
+            print_status( port );
+        } else if ( strcmp( argv[0], "open" ) == 0 && number != 1 ) {
+            uint32_t baud = 115200;
+            if ( argc > 1 && ( '0' <= argv[1][0] && argv[1][0] <= '9' ) ) {
+                --argc; ++argv;
+                baud = strtod( argv[0] );
+            }
+            if ( ! open( port, number, baud ) )
+                stream() << "uart" << int( number ) << " open failed" << std::endl;
+        } else if ( strcmp( argv[0], "send" ) == 0 && number != 1 ) {
+            while ( --argc ) {
+                ++argv;
+                port << argv[0];
+                if ( argc > 1 )
+                    port.putc( ' ' );
+            }
+            port << "\n";
+            break;
+        } else if ( strcmp( argv[0], "recv" ) == 0 ) {
+            print_received( port );
+        } else if ( strcmp( argv[0], "bench" ) == 0 ) {
+            size_t size = 4096;
+            if ( argc > 1 && ( '0' <= argv[1][0] && argv[1][0] <= '9' ) ) {
+                --argc; ++argv;
+                size = strtod( argv[0] );
+            }
+            if ( size > 0 && size <= 65536 )
+                bench( port, size );
+        }
+    }
+}
@@ -0,0 +1,134 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#include "uart_dma.hpp"
+#include "dma.hpp"
+#include "dma_channel.hpp"
+
+using namespace stm32f103;
+
+uart_dma_transmitter::uart_dma_transmitter( dma& dma, DMA_CHANNEL request ) : dma_( dma )
+                                                                            , request_( request )
+                                                                            , channel_( dma_channel_number( request ) )
+                                                                            , fill_( 0 )
+                                                                            , nesting_( 0 )
+                                                                            , sending_( 0 )
+                                                                            , transfers_( 0 )
+                                                                            , errors_( 0 )
+{
+    count_[ 0 ] = 0;
+    count_[ 1 ] = 0;
+}
+
+bool
+uart_dma_transmitter::push( uint8_t c )
+{
+    nesting_.fetch_add( 1 );
+
+    bool result( false );
+    for ( ;; ) {
+        auto fill = fill_.load();
+        auto count = count_[ fill ].load();
+        if ( count & sealed )
+            continue;  // kick() swapped buffers under us; fill_ has already moved
+        if ( count >= buffer_size )
+            break;
+        if ( count_[ fill ].compare_exchange_weak( count, count + 1 ) ) {
+            buffer_[ fill ][ count ] = c;
+            result = true;
+            break;
+        }
+    }
+
+    if ( nesting_.fetch_sub( 1 ) == 1 )
+        kick();
+
+    return result;
+}
+
+void
+uart_dma_transmitter::kick()
+{
+    if ( nesting_.load() != 0 )
+        return; // a preempted producer owns an unwritten byte; it kicks when done
+
+    uint32_t idle( 0 );
+    if ( ! sending_.compare_exchange_strong( idle, claimed ) )
+        return;
+
+    auto fill = fill_.load();
+    if ( count_[ fill ].load() == 0 ) {
+        sending_ = 0;
+        return;
+    }
+
+    // Switch producers to the other buffer first, then seal; a producer that still holds the
+    // old index either completed its CAS before the seal (and has written by now) or fails on it.
+    fill_ = fill ^ 1;
+    auto count = count_[ fill ].fetch_or( sealed );
+
+    sending_ = fill + 1;
+    dma_.enable( channel_, false );
+    dma_.set_transfer_buffer( channel_, buffer_[ fill ].data(), count );
+    dma_.enable( channel_, true );
+}
+
+void
+uart_dma_transmitter::complete( bool error )
+{
+    auto sending = sending_.load();
+    if ( sending == 0 || sending == claimed )
+        return;
+
+    if ( ! error && dma_.dmaChannel( channel_ ).CNDTR != 0 )
+        return;
+
+    if ( ! sending_.compare_exchange_strong( sending, claimed ) )
+        return; // completed by someone else (irq vs. poll)
+
+    dma_.enable( channel_, false );
+    count_[ sending - 1 ] = 0;
+    ++transfers_;
+    sending_ = 0;
+
+    kick();
+}
+
+void
+uart_dma_transmitter::poll()
+{
+    complete( false );
+    kick();
+}
+
+void
+uart_dma_transmitter::handle_interrupt( uint32_t flag )
+{
+    if ( flag & 0x08 ) { // TEIF; the buffer is lost, drop it so that the pipeline keeps going
+        ++errors_;
+        complete( true );
+    } else {
+        complete( false );
+    }
+}
+
+void
+uart_dma_transmitter::stop()
+{
+    dma_.release( request_ );
+}
+
+bool
+uart_dma_transmitter::idle() const
+{
+    return sending_.load() == 0 && count_[ 0 ].load() == 0 && count_[ 1 ].load() == 0;
+}
+
+size_t
+uart_dma_transmitter::pending() const
+{
+    return ( count_[ 0 ].load() & ~sealed ) + ( count_[ 1 ].load() & ~sealed );
+}
@@ -0,0 +1,62 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace stm32f103 {
+
+    class dma;
+    enum DMA_CHANNEL : uint32_t;
+
+    // Double buffered DMA transmitter for a USART.
+    //
+    // Producers append to the 'fill' buffer while DMA drains the other one; on transfer
+    // complete the buffers swap.  A byte is reserved by CAS on the fill buffer's count, and
+    // a buffer is handed to DMA only when no producer is in progress (nesting_ == 0), so
+    // a reserved but not yet written byte is never transmitted.  Whoever finds the channel
+    // idle at that moment (the outermost producer or the DMA completion) starts the transfer.
+
+    class uart_dma_transmitter {
+    public:
+        static constexpr size_t buffer_size = 256;
+
+        uart_dma_transmitter( dma&, DMA_CHANNEL request ); // request must be leased (dma::try_acquire)
+
+        bool push( uint8_t );  // false if the fill buffer is full
+        void kick();           // start a transfer if the channel is idle and data is pending
+        void poll();           // complete a finished transfer without waiting for the DMA irq
+        void handle_interrupt( uint32_t flag );
+        void stop();           // disable the channel and release its lease
+
+        bool idle() const;
+        inline uint32_t transfers() const { return transfers_.load(); }
+        inline uint32_t errors() const { return errors_.load(); }
+        size_t pending() const;
+
+    private:
+        static constexpr uint32_t sealed = 0x80000000; // count_ flag; buffer owned by DMA
+        static constexpr uint32_t claimed = 3;         // sending_ value while kick() prepares a transfer
+
+        dma& dma_;
+        DMA_CHANNEL request_;
+        uint32_t channel_;
+        std::array< std::array< uint8_t, buffer_size >, 2 > buffer_;
+        std::array< std::atomic< uint32_t >, 2 > count_;
+        std::atomic< uint32_t > fill_;      // index of buffer accepting bytes
+        std::atomic< uint32_t > nesting_;   // producers in progress
+        std::atomic< uint32_t > sending_;   // 0: idle, 1|2: buffer index + 1 under transfer
+        std::atomic< uint32_t > transfers_;
+        std::atomic< uint32_t > errors_;
+
+        void complete( bool error );
+    };
+
+}
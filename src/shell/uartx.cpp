@@ -1,9 +1,13 @@
 // Copyright (C) 2018-2020 MS-Cheminformatics LLC
 
+#include "background.hpp"
+#include "bitset.hpp"
+#include "dma.hpp"
+#include "dma_channel.hpp"
 #include "gpio_mode.hpp"
 #include "stm32f103.hpp"
 #include "uart.hpp"
-#include "spinlock.hpp"
+#include "uart_dma.hpp"
 #include <array>
 #include <atomic>
 #include <mutex>
@@ -15,79 +19,25 @@ extern "C" {
     void enable_interrupt( stm32f103::IRQn_type IRQn );
 }
 
-namespace {
-    enum UART_CR1_MASK {
-        Reserved = 0xfffc0000
-        , UE     = 0x2000  // uart enable
-        , M      = 0x1000  // Word length 0 := 1-start bit, 8 bits, n stop bit, 1 := 1 start bit, 9 data bits, n stop bit
-        , WAKE   = 0x0800  // 0: idle line, 1: address mark
-        , PCE    = 0x0400  // Parity control enable ( 0: disabled, 1:enabled )
-        , PS     = 0x0200  // Parity 0: even, 1: odd
-        , PEIE   = 0x0100  // PE interrupt enable
-        , TXEIE  = 0x0080  // TXE interrupt enable
-        , TCIE   = 0x0040  // Transmission complete interrupt enable
-        , RXNEIE = 0x0020  // RXNE interrupt enable
-        , IDLEIE = 0x0010  // IDLE interrupt enable
-        , TE     = 0x0008  // Transmitter enable
-        , RE     = 0x0004  // Receiver enable
-        , RWU    = 0x0002  // Receiver wakeup
-        , SBK    = 0x0001  // Send brak
-    };
-
-    enum UART_STATUS {
-        ST_PE      =	0x0001
-        , ST_FE    =	0x0002
-        , ST_NE	   =	0x0004
-        , ST_OVER  =	0x0008
-        , ST_IDLE  =	0x0010
-        , ST_RXNE  =	0x0020		// Receiver not empty
-        , ST_TC	   =	0x0040		// Transmission complete
-        , ST_TXE   =	0x0080		// Transmitter empty
-        , ST_BREAK =	0x0100
-        , ST_CTS   =	0x0200
-    };
-}
+namespace stm32f103 {
 
-namespace {
-
-    template< typename T, size_t size = 128 >
-    class recv_buffer {
-        std::array< T, size > buffer_;
-        std::atomic< size_t > wc_, rc_;
-    public:
-        recv_buffer() : wc_( 0 )
-                      , rc_( 0 ) {
+    // PRIMASK based critical section of uart_channel::transmit_one
+    struct scoped_interrupt_mask {
+        uint32_t primask;
+        scoped_interrupt_mask() {
+            __asm volatile ( "mrs %0, primask\n\tcpsid i" : "=r" ( primask ) :: "memory" );
         }
-                        
-        inline std::optional< T > deque() {
-            auto wc = wc_.load( std::memory_order_acquire );
-            if ( rc_ < wc )
-                return buffer_.at( rc_++ % size );
-            return std::nullopt;
-        }
-
-        inline bool enque( T c ) {         // IRQ service call
-            auto rc = rc_.load( std::memory_order_acquire );
-            if ( ( wc_ - rc ) > size )
-                return false;
-            buffer_.at( wc_++ % size ) = c;
-            return true;
+        ~scoped_interrupt_mask() {
+            __asm volatile ( "msr primask, %0" :: "r" ( primask ) : "memory" );
         }
     };
+}
 
-    constexpr size_t recv_bufsize = 128;
-
-    recv_buffer< uint8_t, recv_bufsize > * __recv_bufp;
-    recv_buffer< uint8_t, recv_bufsize > __recv_buffer;
+namespace {
 
-    struct output_usart {
-        volatile stm32f103::USART& usart_;
-        output_usart( volatile stm32f103::USART& t ) : usart_( t ) {}
-        inline void operator << ( int c ) const {
-            while ( ! (usart_.SR & ST_TXE) )
-                ;
-            usart_.DR = c;
-        }
+    enum UART_CR3_MASK {
+        DMAT     = 0x0080  // DMA enable transmitter
+        , DMAR   = 0x0040  // DMA enable receiver
     };
 
     //---------------------------------------------------
@@ -95,20 +45,43 @@ namespace {
 }
 
 using namespace stm32f103;
+using namespace stm32f103::uart_bits;
+
+namespace {
 
-uart::uart() : usart_( 0 )
+    template< USART_BASE base, DMA_CHANNEL channel >
+    uart_dma_transmitter * attach_dma_transmitter( dma& dma )
+    {
+        static uint8_t __storage[ sizeof( uart_dma_transmitter ) ] __attribute__( ( aligned( 4 ) ) );
+
+        if ( ! dma.try_acquire( channel ) ) // the channel is shared with another peripheral
+            return nullptr;
+
+        constexpr auto number = dma_channel_number( channel );
+        dma.init_channel( DMA_CHANNEL( number )
+                          , peripheral_address< channel >::value
+                          , nullptr
+                          , 0
+                          , peripheral_address< channel >::dma_ccr );
+        dma.set_callback( number, +[]( uint32_t flag ){
+                uart_t< base >::instance()->handle_dma_interrupt( flag );
+            });
+        return new ( &__storage ) uart_dma_transmitter( dma, channel );
+    }
+
+}
+
+uart::uart() : channel_( nullptr )
              , baud_( 115200 )
-             , spinlock_( {0} )
+             , dma_tx_( nullptr )
 {
-    __recv_bufp = new (&__recv_buffer) recv_buffer< uint8_t, recv_bufsize >();
-    spinlock_.clear();
 }
 
 bool
 uart::init( stm32f103::USART_BASE addr )
 {
     new (this) stm32f103::uart();    
-    usart_ = reinterpret_cast< stm32f103::USART * >( addr );
+    new (&channel_) uart_channel< USART, scoped_interrupt_mask >( reinterpret_cast< stm32f103::USART * >( addr ) );
     return true;
 }
 
@@ -116,25 +89,27 @@ bool
 uart::config( parity parity, int nbits, uint32_t baud, uint32_t pclk )
 {
     baud_ = baud; // 115200
-    if ( usart_ ) {
+    if ( auto usart = channel_.usart() ) {
         uint32_t flag( UE | TE | RE ); // uart enable, transmitter enable, receiver enable
         if ( parity != parity_none )
             flag |= ( PCE | ( parity << 8 ) ) & 0x0600;  // parity enable, [even|odd] parity
 
-        if ( reinterpret_cast< uint32_t >( usart_ ) == stm32f103::USART1_BASE )        
-            flag |= RXNEIE; // rx interrupt enable
+        flag |= RXNEIE; // rx interrupt enable
 
-        usart_->CR1  = flag;
-        usart_->CR2  = 0;  // 1 stop bit
-        usart_->CR3  = 0;  // CTS/RTS...
-        usart_->GTPR = 0;
+        usart->CR1  = flag;
+        usart->CR2  = 0;  // 1 stop bit
+        usart->CR3  = 0;  // CTS/RTS...
+        usart->GTPR = 0;
         // baud = pclk / (16 * USARTDIV)
         // pclk / baud / 16 = USARTDIV
         // brr = (pclk / 16 / baud (in real)) * 16
-        usart_->BRR  = pclk / baud;  // 72000000 / 115200 (mantissa + 4bit fraction)
+        // USART1 is on PCLK2, USART2/3 are on PCLK1; 921600 baud is 39 (+0.16%) on 36MHz PCLK1
+        usart->BRR  = ( pclk + baud / 2 ) / baud;  // 72000000 / 115200 (mantissa + 4bit fraction), rounded
 
-        if ( reinterpret_cast< uint32_t >( usart_ ) == stm32f103::USART1_BASE ) {
-            enable_interrupt( stm32f103::USART1_IRQn );
+        switch ( reinterpret_cast< uint32_t >( usart ) ) {
+        case stm32f103::USART1_BASE: enable_interrupt( stm32f103::USART1_IRQn ); break;
+        case stm32f103::USART2_BASE: enable_interrupt( stm32f103::USART2_IRQn ); break;
+        case stm32f103::USART3_BASE: enable_interrupt( stm32f103::USART3_IRQn ); break;
         }
 
         return true;
@@ -166,14 +141,10 @@ template<> bool uart::enable( GPIOB_PIN tx, GPIOB_PIN rx, parity parity, int nbi
 uart&
 uart::operator << ( const char * s )
 {
-    output_usart out( *usart_ );
-
-    scoped_spinlock< std::atomic_flag > lock( spinlock_ );
-
     while ( s && *s ) {
         if ( *s == '\n' )
-            out << '\r';
-        out << int(*s++);
+            putc( '\r' );
+        putc( *s++ );
     }
     return *this;
 }
@@ -181,44 +152,145 @@ uart::operator << ( const char * s )
 void
 uart::putc( int c )
 {
-    scoped_spinlock< std::atomic_flag > lock( spinlock_ );    
-    output_usart( *usart_ ) << c;
+    bool blocked( false );
+
+    if ( auto tx = dma_tx_ ) {
+        // the buffer under transfer belongs to DMA, so drop-oldest degrades to drop-newest
+        while ( ! tx->push( c ) ) {
+            if ( channel_.tx_overflow_policy() != overflow_block ) {
+                channel_.count_dropped();
+                return;
+            }
+            if ( ! blocked ) {
+                blocked = true;
+                channel_.count_blocked();
+            }
+            tx->poll(); // DMA irq may be masked by our priority
+        }
+        return;
+    }
+
+    channel_.putc( c );
+}
+
+void
+uart::flush()
+{
+    if ( auto tx = dma_tx_ ) {
+        while ( ! tx->idle() )
+            tx->poll();
+    }
+    channel_.flush();
+}
+
+size_t
+uart::tx_pending() const
+{
+    return dma_tx_ ? dma_tx_->pending() : channel_.tx_pending();
+}
+
+uint32_t
+uart::dma_transfers() const
+{
+    return dma_tx_ ? dma_tx_->transfers() : 0;
+}
+
+bool
+uart::attach( dma& dma )
+{
+    if ( dma_tx_ )
+        return true;
+
+    flush();
+
+    switch ( reinterpret_cast< uint32_t >( channel_.usart() ) ) {
+    case USART1_BASE: dma_tx_ = attach_dma_transmitter< USART1_BASE, DMA_USART1_TX >( dma ); break;
+    case USART2_BASE: dma_tx_ = attach_dma_transmitter< USART2_BASE, DMA_USART2_TX >( dma ); break;
+    case USART3_BASE: dma_tx_ = attach_dma_transmitter< USART3_BASE, DMA_USART3_TX >( dma ); break;
+    default:
+        return false;
+    }
+    if ( dma_tx_ == nullptr )
+        return false;
+    bitset::set( channel_.usart()->CR3, DMAT );
+    return true;
+}
+
+void
+uart::detach()
+{
+    if ( auto tx = dma_tx_ ) {
+        flush();
+        dma_tx_ = nullptr;
+        bitset::reset( channel_.usart()->CR3, DMAT );
+        tx->stop();
+    }
+}
+
+void
+uart::handle_dma_interrupt( uint32_t flag )
+{
+    if ( dma_tx_ )
+        dma_tx_->handle_interrupt( flag );
+}
+
+void
+uart::set_overflow_policy( overflow_policy policy )
+{
+    channel_.set_overflow_policy( policy );
+}
+
+int
+uart::getc( bool echo )
+{
+    uint8_t c;
+    while ( ! channel_.getc( c ) )
+        background::poll();
+    if ( echo )
+        putc( c );
+    return c;
 }
 
-// static
 size_t
 uart::gets( char * s, size_t size )
 {
-    auto& uart0 = *uart_t< USART1_BASE >::instance();
-    
     char * p = s;
     while ( size > 0 ) {
-        if ( auto data = __recv_bufp->deque() ) {
-            auto c = *data & 0x7f; // uart0.getc() & 0x7f;
-            uart0.putc( c );
+        auto c = getc( false ) & 0x7f;
+        putc( c );
 
-            if ( c == '\r' ) {
-                *p++ = '\n';
-                break;
-            } else if ( c == '\b' || c == 0x7f || c == 0x15 ) {
-                if ( p > s ) {
-                    --p;
-                    ++size;
-                }
-            } else if ( c >= ' ' && c < 0x7f ) {
-                *p++ = c;
-                if ( --size == 1 )
-                    break;
+        if ( c == '\r' ) {
+            *p++ = '\n';
+            break;
+        } else if ( c == '\b' || c == 0x7f || c == 0x15 ) {
+            if ( p > s ) {
+                --p;
+                ++size;
             }
+        } else if ( c >= ' ' && c < 0x7f ) {
+            *p++ = c;
+            if ( --size == 1 )
+                break;
         }
     }
     *p = '\0';
     return size_t( p - s );
 }
 
+size_t
+uart::read( uint8_t * p, size_t size )
+{
+    return channel_.read( p, size );
+}
+
 void
-uart::handle_interrupt()
+uart::clear_errors()
 {
-    __recv_bufp->enque( usart_->DR & 0xff );
+    channel_.clear_errors();
 }
 
+void
+uart::handle_interrupt()
+{
+    channel_.handle_interrupt();
+}
@@ -0,0 +1,293 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+
+// Fuzz and throughput test of the telemetry framing (common/cobs.hpp, telemetry_record::frame)
+// and the host deframer (receiver.cpp)
+//
+//   make && ./framing [-v]
+//
+// COBS: random payloads of 0 to 1100 bytes round trip through encode and decode, among them
+// empty and all-zero payloads and runs of 253 to 256 and 508 to 510 non-zero bytes around the
+// 254 byte block; the encoded data must hold no zero and fit max_encoded_size.
+//
+// Stream: frames of random records go through the receiver interleaved with console text and
+// dlog records, first undamaged (frames, text and sequence must all come through), then with
+// damage to one frame in four: a bit flip, a frame cut short without its closing delimiter, a
+// frame cut short with it, or a missing closing delimiter.  Every undamaged frame must still
+// be delivered intact and in order, the damaged ones must be rejected and counted as errors
+// (CRC-16 lets about 1 in 65536 damaged frames through, which is reported, and must stay
+// rare), and the sequence gaps must equal the frames lost.  Damage may take undamaged frames
+// with it: without its closing delimiter a frame either swallows the text that follows, or is
+// delivered by the next frame's opening zero and that frame is taken for text, where a 0xa5
+// starts a dlog record; but the receiver must be back in step within a bounded number of bytes,
+// and of a frame without its delimiter and the next one, at least one must arrive.
+//
+// Throughput: MB/s of record bytes for framing and for deframing ADC size records.
+
+#include "receiver.hpp"
+#include "cobs.hpp"
+#include "dlog_record.hpp"
+#include "telemetry_record.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+    int failures = 0;
+
+    void check( bool ok, const char * what ) {
+        if ( !ok && failures++ < 20 )
+            std::printf( "FAIL %s\n", what );
+    }
+
+    long
+    round_trip( std::mt19937& rng )
+    {
+        long count = 0;
+        auto run = [&]( const std::vector< uint8_t >& data ) {
+            std::vector< uint8_t > encoded( cobs::max_encoded_size( data.size() ) + 1, 0xcc );
+            const size_t size = cobs::encode( data.data(), data.size(), encoded.data() );
+            check( size <= cobs::max_encoded_size( data.size() ) && encoded[ cobs::max_encoded_size( data.size() ) ] == 0xcc
+                   , "encoded size" );
+            bool zero = false;
+            for ( size_t i = 0; i < size; ++i )
+                zero = zero || encoded[ i ] == 0;
+            check( !zero, "zero in the encoded data" );
+            std::vector< uint8_t > decoded( size + 1 );
+            const size_t n = cobs::decode( encoded.data(), size, decoded.data() );
+            check( n == data.size() && std::equal( data.begin(), data.end(), decoded.begin() ), "round trip" );
+            ++count;
+        };
+
+        run( {} );
+        for ( size_t n: { 1, 2, 253, 254, 255, 256, 508, 509, 510, 1100 } ) {
+            run( std::vector< uint8_t >( n, 0 ) );
+            run( std::vector< uint8_t >( n, 0x5a ) );
+            std::vector< uint8_t > d( n, 0xff );
+            d[ 0 ] = 0;
+            run( d );
+            d[ 0 ] = 1;
+            d[ n - 1 ] = 0;
+            run( d );
+        }
+        for ( int i = 0; i < 100000; ++i ) {
+            std::vector< uint8_t > d( rng() % 1101 );
+            const uint32_t zeros = rng() % 4;       // none, rare, frequent, mostly
+            for ( auto& c: d ) {
+                const uint32_t r = rng() % 1000;
+                const bool zero = zeros == 1 ? r < 2 : zeros == 2 ? r < 200 : zeros == 3 ? r < 900 : false;
+                c = zero ? 0 : uint8_t( 1 + rng() % 255 );
+            }
+            run( d );
+        }
+        return count;
+    }
+
+    struct sent_frame {
+        uint8_t type;
+        uint8_t sequence;
+        std::vector< uint8_t > record;
+        bool damaged;
+        bool delimiter;         // lost its closing delimiter
+        bool delivered;
+        size_t offset;          // in the stream
+    };
+
+    enum damage { none, bit_flip, truncated, truncated_closed, no_delimiter };
+
+    // Undamaged frames may only be lost this close, in bytes, after the start of a damaged one:
+    // the damaged frame, the next frame taken for text, and what a 0xa5 in it takes for a dlog
+    // record
+    constexpr size_t resync = 2 * telemetry_record::max_frame_size + 1 + 4 * ( 2 + dlog_record::max_words );
+
+    struct stream_result {
+        long frames = 0, damaged = 0, passed = 0;
+    };
+
+    void
+    stream( std::mt19937& rng, bool damage_frames, stream_result& result, bool verbose )
+    {
+        telemetry::receiver rx;
+        std::vector< sent_frame > sent;
+        std::string text, received_text;
+        std::vector< uint8_t > bytes;
+        size_t next = 0;            // first sent frame not yet matched
+        long foreign = 0;
+
+        rx.on_text = [&]( char c ){ received_text += c; };
+        rx.on_frame = [&]( const telemetry::frame& f ) {
+            // frames in order, with gaps; a damaged one that got through matches none
+            size_t i = next;
+            while ( i < sent.size() && !( sent[ i ].type == f.type && sent[ i ].sequence == f.sequence && sent[ i ].record == f.record ) )
+                ++i;
+            if ( i < sent.size() && !sent[ i ].damaged ) {
+                sent[ i ].delivered = true;
+                next = i + 1;
+            } else {
+                ++foreign;
+            }
+        };
+
+        uint8_t sequence = 0;
+        bool previous = false;      // the last frame was damaged
+        for ( int i = 0; i < 20000; ++i ) {
+            if ( rng() % 4 == 0 ) {                 // a line of text
+                std::string line = "> adc " + std::to_string( rng() % 100000 ) + "\r\n";
+                text += line;
+                bytes.insert( bytes.end(), line.begin(), line.end() );
+            }
+            if ( rng() % 8 == 0 ) {                 // a dlog record
+                const uint32_t words = rng() % 4;
+                const uint32_t header = dlog_record::header( rng(), words );
+                bytes.push_back( dlog_record::sync );
+                for ( uint32_t k = 0; k < 4 * ( 2 + words ); ++k )
+                    bytes.push_back( k < 4 ? uint8_t( header >> ( 8 * k ) ) : uint8_t( rng() % 3 ? rng() : 0 ) );
+            }
+
+            sent_frame f{ uint8_t( 1 + rng() % 4 ), sequence++, std::vector< uint8_t >( 4 + rng() % 61 ), false, false, false, bytes.size() };
+            for ( auto& c: f.record )
+                c = rng() % 3 ? uint8_t( rng() ) : 0;
+            std::memcpy( f.record.data(), &i, sizeof i );   // unique
+            uint8_t frame[ telemetry_record::max_frame_size ];
+            size_t size = telemetry_record::frame( f.type, f.sequence, f.record.data(), f.record.size(), frame );
+
+            const auto d = damage_frames && !previous && rng() % 4 == 0 ? damage( 1 + rng() % 4 ) : none;
+            switch ( d ) {
+            case none:
+                break;
+            case bit_flip:
+                frame[ 1 + rng() % ( size - 2 ) ] ^= uint8_t( 1 << rng() % 8 );
+                break;
+            case truncated:                         // the next frame's opening zero ends it
+                size = 2 + rng() % ( size - 3 );
+                break;
+            case truncated_closed: {
+                const size_t keep = 2 + rng() % ( size - 3 );
+                frame[ keep ] = 0;
+                size = keep + 1;
+                break;
+            }
+            case no_delimiter:
+                --size;
+                break;
+            }
+            f.damaged = d != none && d != no_delimiter;
+            f.delimiter = d == no_delimiter;
+            previous = d != none;
+            bytes.insert( bytes.end(), frame, frame + size );
+            sent.push_back( f );
+        }
+        bytes.push_back( '\n' );                    // past the last frame, back in text
+        text += '\n';
+
+        // in random pieces, as read() returns them
+        for ( size_t pos = 0; pos < bytes.size(); ) {
+            const size_t n = std::min( bytes.size() - pos, size_t( 1 + rng() % 300 ) );
+            rx.feed( bytes.data() + pos, n );
+            pos += n;
+        }
+
+        long damaged = 0, rejected = 0, lost = 0, passed = 0, gaps = 0, missing = 0, collateral = 0;
+        bool started = false;
+        size_t damage_offset = 0;
+        bool damage_seen = false;
+        for ( auto& f: sent ) {
+            damaged += f.damaged ? 1 : 0;
+            rejected += f.damaged && !f.delivered ? 1 : 0;
+            passed += f.damaged && f.delivered ? 1 : 0;
+            lost += f.delivered ? 0 : 1;
+            if ( !f.damaged && !f.delimiter && !f.delivered ) {
+                ++collateral;
+                check( damage_seen && f.offset < damage_offset + resync, "no resync after a damaged frame" );
+            }
+            if ( f.damaged || f.delimiter ) {
+                damage_offset = f.offset;
+                damage_seen = true;
+            }
+            if ( f.delivered ) {                    // the receiver sees a gap between two deliveries
+                gaps += started ? missing : 0;
+                started = true;
+                missing = 0;
+            } else {
+                ++missing;
+            }
+        }
+        passed += foreign;
+        for ( size_t i = 1; i + 1 < sent.size(); ++i )
+            if ( sent[ i ].delimiter && sent[ i - 1 ].delivered )      // the receiver in step
+                check( sent[ i ].delivered || sent[ i + 1 ].delivered, "both a frame without delimiter and the next lost" );
+        check( long( rx.frames() ) + lost == long( sent.size() ) + foreign, "frames() does not count the deliveries" );
+        check( foreign || long( rx.lost() ) == gaps, "sequence gaps are not the frames lost" );
+        check( long( rx.errors() ) >= rejected, "rejected frames not counted as errors" );
+        check( passed * 1000 <= damaged, "too many damaged frames passed the CRC" );
+        if ( !damage_frames )
+            check( received_text == text && rx.errors() == 0, "text around undamaged frames" );
+        if ( verbose || failures )
+            std::printf( "  %s: %zu frames, %ld damaged, %ld rejected (%zu errors), %ld passed the CRC, %ld more lost, %zu lost by sequence\n"
+                         , damage_frames ? "damaged" : "clean", sent.size(), damaged, rejected, rx.errors(), passed, collateral, rx.lost() );
+        result.frames += long( sent.size() );
+        result.damaged += damaged;
+        result.passed += passed;
+    }
+
+    void
+    throughput()
+    {
+        constexpr size_t count = 200000;
+        constexpr size_t size = sizeof( telemetry_record::adc_record );
+        std::vector< uint8_t > bytes;
+        bytes.reserve( count * telemetry_record::max_frame_size );
+        uint8_t record[ size ];
+        for ( size_t i = 0; i < size; ++i )
+            record[ i ] = uint8_t( i * 37 );        // some zeros, as real samples have
+
+        auto t0 = std::chrono::steady_clock::now();
+        uint8_t frame[ telemetry_record::max_frame_size ];
+        for ( size_t i = 0; i < count; ++i ) {
+            record[ 0 ] = uint8_t( i );
+            const size_t n = telemetry_record::frame( telemetry_record::adc_block, uint8_t( i ), record, size, frame );
+            bytes.insert( bytes.end(), frame, frame + n );
+        }
+        auto t1 = std::chrono::steady_clock::now();
+
+        telemetry::receiver rx;
+        size_t delivered = 0;
+        rx.on_frame = [&]( const telemetry::frame& ){ ++delivered; };
+        rx.feed( bytes.data(), bytes.size() );
+        auto t2 = std::chrono::steady_clock::now();
+
+        check( delivered == count && rx.errors() == 0, "throughput stream" );
+        const double mb = double( count * size ) / 1e6;
+        std::printf( "throughput, %zu byte records: frame %.1f MB/s, deframe %.1f MB/s (%.0f%% overhead on the wire)\n"
+                     , size, mb / std::chrono::duration< double >( t1 - t0 ).count()
+                     , mb / std::chrono::duration< double >( t2 - t1 ).count()
+                     , 100.0 * ( double( bytes.size() ) / double( count * size ) - 1 ) );
+    }
+}
+
+int
+main( int argc, char ** argv )
+{
+    const bool verbose = argc > 1 && std::strcmp( argv[ 1 ], "-v" ) == 0;
+    std::mt19937 rng( 9 );
+
+    const long payloads = round_trip( rng );
+    std::printf( "cobs: %ld payloads round trip\n", payloads );
+
+    stream_result r;
+    stream( rng, false, r, verbose );
+    for ( int i = 0; i < 10; ++i )
+        stream( rng, true, r, verbose );
+    std::printf( "receiver: %ld frames, %ld damaged, %ld of them passed the CRC\n", r.frames, r.damaged, r.passed );
+
+    throughput();
+
+    std::printf( "framing: %d failed\n", failures );
+    return failures ? 1 : 0;
+}
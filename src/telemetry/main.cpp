@@ -0,0 +1,159 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+
+// Telemetry receiver for the shell's 'telemetry on' (shell/telemetry.hpp)
+//
+//   stty -F /dev/ttyUSB0 115200 raw; ./telemetry -o run1 < /dev/ttyUSB0
+//
+// Writes run1-adc.csv, run1-can.csv and run1-sensor.csv; console text goes to stdout.
+// Time is in seconds since the time record sent by 'telemetry on'.
+
+#include "receiver.hpp"
+#include "telemetry_record.hpp"
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+
+namespace {
+
+    template< typename T >
+    bool
+    get( const telemetry::frame& f, T& t )
+    {
+        if ( f.record.size() != sizeof( T ) )
+            return false;
+        std::memcpy( &t, f.record.data(), sizeof( T ) );
+        return true;
+    }
+
+    class writer {
+        std::string prefix_;
+        std::ofstream adc_, can_, sensor_;
+        double clock_;
+        bool synced_;
+        uint32_t last_;
+        uint64_t elapsed_;   // cycles since the time record, unwrapped
+        uint32_t seconds_;
+    public:
+        writer( const std::string& prefix ) : prefix_( prefix ), clock_( 72.0e6 ), synced_( false ), last_( 0 ), elapsed_( 0 ), seconds_( 0 ) {}
+
+        double time( uint32_t cycles ) {
+            if ( ! synced_ ) {
+                synced_ = true;
+                last_ = cycles;
+            }
+            elapsed_ += uint32_t( cycles - last_ );
+            last_ = cycles;
+            return double( elapsed_ ) / clock_;
+        }
+
+        std::ofstream& open( std::ofstream& o, const char * name, const char * header ) {
+            if ( ! o.is_open() ) {
+                o.open( prefix_ + "-" + name + ".csv" );
+                o << header << std::endl;
+            }
+            return o;
+        }
+
+        void operator()( const telemetry::frame& f ) {
+            using namespace telemetry_record;
+            char buf[ 256 ];
+            switch ( f.type ) {
+            case telemetry_record::time: {
+                time_record r;
+                if ( get( f, r ) && r.clock ) {
+                    clock_ = r.clock;
+                    synced_ = true;
+                    last_ = r.cycles;
+                    elapsed_ = 0;
+                    seconds_ = r.seconds;
+                    std::cerr << "telemetry: clock " << r.clock << "Hz, epoch " << r.seconds << std::endl;
+                }
+                break;
+            }
+            case adc_block: {
+                adc_record r;
+                if ( get( f, r ) ) {
+                    auto& o = open( adc_, "adc", "time,seq,accumulation,ch0,ch1,ch2,ch3,ch4,ch5,ch6,ch7" );
+                    snprintf( buf, sizeof( buf ), "%.6f,%u,%u", time( r.cycles ), f.sequence, r.accumulation );
+                    o << buf;
+                    for ( size_t i = 0; i < r.count && i < 8; ++i )
+                        o << "," << r.data[ i ];
+                    o << "\n";
+                }
+                break;
+            }
+            case can_frame: {
+                can_record r;
+                if ( get( f, r ) ) {
+                    auto& o = open( can_, "can", "time,seq,id,ide,rtr,dlc,fmi,data" );
+                    snprintf( buf, sizeof( buf ), "%.6f,%u,0x%03x,%u,%u,%u,%u,", time( r.cycles ), f.sequence, r.id, r.ide, r.rtr, r.dlc, r.fmi );
+                    o << buf;
+                    for ( size_t i = 0; i < 8; ++i ) {
+                        snprintf( buf, sizeof( buf ), "%02x", r.data[ i ] );
+                        o << buf;
+                    }
+                    o << "\n";
+                }
+                break;
+            }
+            case sensor: {
+                sensor_record r;
+                if ( get( f, r ) ) {
+                    auto& o = open( sensor_, "sensor", "time,seq,pressure_pa,temperature_degc" );
+                    snprintf( buf, sizeof( buf ), "%.6f,%u,%u,%.2f\n", time( r.cycles ), f.sequence, r.pressure, r.temperature / 100.0 );
+                    o << buf;
+                }
+                break;
+            }
+            default:
+                std::cerr << "telemetry: unknown record type " << int( f.type ) << std::endl;
+                break;
+            }
+        }
+    };
+}
+
+int
+main( int argc, char ** argv )
+{
+    std::string prefix = "telemetry";
+    const char * input_file = nullptr;
+
+    for ( int i = 1; i < argc; ++i ) {
+        if ( std::strcmp( argv[ i ], "-o" ) == 0 && i + 1 < argc )
+            prefix = argv[ ++i ];
+        else if ( argv[ i ][ 0 ] == '-' ) {
+            std::cerr << "usage: " << argv[ 0 ] << " [-o prefix] [capture]" << std::endl;
+            return 1;
+        } else
+            input_file = argv[ i ];
+    }
+
+    int fd = input_file ? ::open( input_file, O_RDONLY ) : 0;
+    if ( fd < 0 ) {
+        std::cerr << input_file << ": cannot open" << std::endl;
+        return 1;
+    }
+
+    writer csv( prefix );
+    telemetry::receiver rx;
+    rx.on_frame = std::ref( csv );
+    rx.on_text = []( char c ){ if ( c != '\r' ) std::cout << c; };
+
+    uint8_t buf[ 256 ];
+    ssize_t size;
+    while ( ( size = ::read( fd, buf, sizeof( buf ) ) ) > 0 ) { // returns what a tty has, without waiting to fill buf
+        rx.feed( buf, size_t( size ) );
+        std::cout << std::flush;
+    }
+
+    std::cerr << "telemetry: " << rx.frames() << " frames, " << rx.lost() << " lost, " << rx.errors() << " errors" << std::endl;
+    return 0;
+}
@@ -0,0 +1,128 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+
+#include "receiver.hpp"
+#include "cobs.hpp"
+#include "dlog_record.hpp"
+#include "telemetry_record.hpp"
+
+namespace {
+    constexpr size_t max_payload = 2 + telemetry_record::max_record_size + 2;
+    constexpr size_t max_encoded = cobs::max_encoded_size( max_payload );
+}
+
+using namespace telemetry;
+
+receiver::receiver() : state_( text )
+                     , dlog_remaining_( 0 )
+                     , has_sequence_( false )
+                     , sequence_( 0 )
+                     , frames_( 0 )
+                     , errors_( 0 )
+                     , lost_( 0 )
+{
+}
+
+void
+receiver::feed( const uint8_t * data, size_t size )
+{
+    for ( size_t i = 0; i < size; ++i )
+        put( data[ i ] );
+}
+
+void
+receiver::put( uint8_t c )
+{
+    switch ( state_ ) {
+    case text:
+        if ( c == 0 ) {
+            state_ = framed;
+            buffer_.clear();
+        } else if ( c == dlog_record::sync ) {
+            state_ = dlog;
+            buffer_.clear();
+            dlog_remaining_ = 8;   // header and time stamp
+        } else if ( on_text ) {
+            on_text( char( c ) );
+        }
+        break;
+
+    case dlog:
+        buffer_.push_back( c );
+        if ( buffer_.size() == 4 ) {
+            uint32_t header = buffer_[ 0 ] | buffer_[ 1 ] << 8 | buffer_[ 2 ] << 16 | uint32_t( buffer_[ 3 ] ) << 24;
+            if ( dlog_record::words( header ) > dlog_record::max_words ) {
+                // not a record: 0xa5 in the body of a frame whose opening zero was lost
+                ++errors_;
+                state_ = text;
+                break;
+            }
+            dlog_remaining_ += 4 * dlog_record::words( header );
+        }
+        if ( buffer_.size() == dlog_remaining_ )
+            state_ = text;
+        break;
+
+    case framed:
+        if ( c != 0 ) {
+            buffer_.push_back( c );
+            if ( buffer_.size() > max_encoded ) {
+                ++errors_;
+                text_fallback();
+                state_ = text;
+            }
+        } else if ( ! buffer_.empty() ) {
+            if ( deliver() ) {
+                state_ = text;
+            } else {
+                // Either a damaged frame, or text between a lost delimiter and this one; in the
+                // latter case this zero opens the next frame.
+                ++errors_;
+                text_fallback();
+                buffer_.clear();
+            }
+        }
+        break;
+    }
+}
+
+bool
+receiver::deliver()
+{
+    std::vector< uint8_t > payload( buffer_.size() );
+    size_t size = cobs::decode( buffer_.data(), buffer_.size(), payload.data() );
+    if ( size < 4 )
+        return false;
+    const uint16_t crc = payload[ size - 2 ] | payload[ size - 1 ] << 8;
+    if ( cobs::crc16( payload.data(), size - 2 ) != crc )
+        return false;
+
+    frame f;
+    f.type = payload[ 0 ];
+    f.sequence = payload[ 1 ];
+    f.record.assign( payload.begin() + 2, payload.begin() + ( size - 2 ) );
+
+    if ( has_sequence_ )
+        lost_ += uint8_t( f.sequence - sequence_ - 1 );
+    has_sequence_ = true;
+    sequence_ = f.sequence;
+    ++frames_;
+
+    if ( on_frame )
+        on_frame( f );
+    return true;
+}
+
+void
+receiver::text_fallback()
+{
+    bool printable = true;
+    for ( auto c: buffer_ )
+        printable = printable && ( ( c >= ' ' && c < 0x7f ) || c == '\r' || c == '\n' || c == '\t' );
+    if ( printable && on_text ) {
+        for ( auto c: buffer_ )
+            on_text( char( c ) );
+    }
+}
@@ -0,0 +1,52 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace telemetry {
+
+    struct frame {
+        uint8_t type;
+        uint8_t sequence;
+        std::vector< uint8_t > record;
+    };
+
+    // Splits the console byte stream into text, dlog records and telemetry frames
+    // (telemetry_record.hpp).  dlog records are skipped; use src/dlog to decode them.
+    class receiver {
+    public:
+        receiver();
+
+        std::function< void( const frame& ) > on_frame;
+        std::function< void( char ) > on_text;
+
+        void feed( const uint8_t * data, size_t size );
+
+        size_t frames() const { return frames_; }
+        size_t errors() const { return errors_; }   // cobs or crc failure, oversized frame, bad dlog header
+        size_t lost() const { return lost_; }       // sequence gaps
+
+    private:
+        enum state { text, dlog, framed };
+        state state_;
+        std::vector< uint8_t > buffer_;
+        size_t dlog_remaining_;
+        bool has_sequence_;
+        uint8_t sequence_;
+        size_t frames_;
+        size_t errors_;
+        size_t lost_;
+
+        void put( uint8_t );
+        bool deliver();
+        void text_fallback();
+    };
+
+}
@@ -0,0 +1,410 @@
+// Copyright (C) 2018-2020 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+
+// Host loopback model of the USART driver at 921600 baud, full duplex
+//
+//   make && ./loopback [-v]
+//
+// The driver under test is uart_channel (shell/uart_channel.hpp), the putc, transmit_one,
+// flush and handle_interrupt that uart runs, here on a model of the register block: reading
+// DR takes RDR and clears RXNE and ORE, writing it fills TDR and clears TXE, and SR is made of
+// TXE, TC, RXNE and ORE.
+//
+// Loopback: TX is wired to RX on every port.  The model is clocked in CPU cycles (72MHz).
+// Each port has a TDR, a shift register, and an RDR that takes a byte when its stop bit is in.
+// If RXNE is still set at that moment, the byte is lost and ORE is set, as RM0008 27.3.3
+// describes.  One CPU serves all of the ports.  Higher priority interrupts mask it at random
+// for up to 'masked' cycles.  Thread mode drains the receive ring (checking the sequence) and
+// refills the transmit ring a byte at a time; when both are done it stalls for up to 'stall'
+// cycles.  A run passes when every byte comes back in order with no overrun and no drop, and
+// every line was kept busy.  Two runs go past what the 256 byte rings or one byte time can
+// hide, and they must report the loss instead of passing.
+//
+// Overflow: with the USART interrupt masked, putc writes more than the ring holds; each SR
+// read takes a few cycles of the line.  overflow_block must send every byte in order by
+// polling, overflow_drop_newest keep the first 256 and overflow_drop_oldest the last 256,
+// counting the rest as dropped.
+//
+// Nested producer: an interrupt preempts a putc between its slot reservation and publication,
+// and writes more than the ring holds, then flushes.  Nothing it writes can be sent until the
+// preempted putc publishes, so under every policy it must return, counting what did not fit
+// as dropped, and the preempted byte must go out first.
+
+#include "uart_channel.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace stm32f103;
+using namespace stm32f103::uart_bits;
+
+namespace {
+
+    constexpr uint32_t cpu_clock = 72000000;
+    constexpr uint32_t isr_cycles = 70;         // entry, SR/DR access, ring push and pop, exit
+    constexpr uint32_t byte_thread_cycles = 12; // per byte moved by the thread
+    constexpr uint32_t poll_cycles = 4;         // an SR read while putc or flush polls
+    constexpr uint64_t max_polls = 10000000;    // putc or flush that polls longer does not return
+
+    struct line;
+
+    struct status_register {
+        line * owner;
+        operator uint32_t () const volatile;
+    };
+
+    struct data_register {
+        line * owner;
+        operator uint32_t () const volatile;
+        void operator = ( uint32_t ) volatile;
+    };
+
+    struct USART {
+        status_register SR;
+        data_register DR;
+        uint32_t BRR;
+        uint32_t CR1;
+        uint32_t CR2;
+        uint32_t CR3;
+        uint32_t GTPR;
+    };
+
+    // one USART, its TX wired to its RX
+    struct line {
+        USART regs;
+        uint32_t byte_cycles;                   // 10 bits of BRR/PCLK
+
+        bool txe = true, rxne = false, ore = false;
+        uint8_t tdr = 0, rdr = 0, shift = 0;
+        uint64_t shift_end = 0;                 // 0: shift register idle
+        uint64_t now = 1;                       // for SR polling
+        bool polled = false;                    // SR reads take poll_cycles
+        uint64_t polls = 0;
+
+        std::vector< uint8_t > wire;            // every byte sent
+        uint64_t busy = 0, first_start = 0, last_end = 0;
+        uint32_t overrun = 0;                   // bytes lost to ORE
+
+        line( uint32_t pclk, uint32_t baud ) : regs{ { this }, { this }, 0, 0, 0, 0, 0 } {
+            const uint32_t brr = ( pclk + baud / 2 ) / baud;  // as uart::config
+            byte_cycles = 10 * brr * ( cpu_clock / pclk );
+        }
+        line( const line& ) = delete;
+
+        void clock( uint64_t t ) {
+            if ( shift_end == t ) {
+                wire.push_back( shift );
+                if ( rxne ) {
+                    ++overrun;                  // the new byte is lost, RDR keeps the old one
+                    ore = true;
+                } else {
+                    rdr = shift;
+                    rxne = true;
+                }
+                shift_end = 0;
+                last_end = t;
+            }
+            if ( shift_end == 0 && !txe ) {
+                shift = tdr;
+                txe = true;
+                shift_end = t + byte_cycles;
+                busy += byte_cycles;
+                if ( first_start == 0 )
+                    first_start = t;
+            }
+        }
+
+        void advance( uint64_t cycles ) {
+            for ( uint64_t end = now + cycles; now < end; )
+                clock( ++now );
+        }
+
+        uint32_t status() {
+            if ( polled ) {
+                if ( ++polls > max_polls ) {
+                    std::printf( "FAIL putc or flush does not return\n" );
+                    std::exit( 1 );
+                }
+                advance( poll_cycles );
+            }
+            return ( txe ? ST_TXE : 0 ) | ( txe && shift_end == 0 ? ST_TC : 0 ) | ( rxne ? ST_RXNE : 0 ) | ( ore ? ST_OVER : 0 );
+        }
+
+        uint8_t read() {                        // after the SR read of handle_interrupt
+            rxne = false;
+            ore = false;
+            return rdr;
+        }
+
+        void write( uint8_t c ) {
+            tdr = c;
+            txe = false;
+        }
+
+        bool interrupt_pending() const { return rxne || ( txe && ( regs.CR1 & TXEIE ) ); }
+    };
+
+    status_register::operator uint32_t () const volatile { return owner->status(); }
+    data_register::operator uint32_t () const volatile { return owner->read(); }
+    void data_register::operator = ( uint32_t c ) volatile { owner->write( uint8_t( c ) ); }
+
+    struct no_mask { no_mask() {} };            // one CPU, nothing preempts transmit_one here
+
+    struct port {
+        const char * name;
+        line l;
+        uart_channel< USART, no_mask > channel;
+
+        // thread side
+        uint8_t next_tx = 0, next_rx = 0;
+        uint64_t sent = 0, received = 0;
+        uint32_t sequence = 0;
+        size_t max_rx = 0;
+
+        port( const char * n, uint32_t pclk, uint32_t baud ) : name( n ), l( pclk, baud ), channel( &l.regs ) {
+        }
+
+        void interrupt() {
+            channel.handle_interrupt();
+            max_rx = std::max( max_rx, channel.rx_pending() );
+        }
+
+        // thread mode, one byte at a time: drain first, then refill; false if there is nothing to do
+        bool service( uint64_t total ) {
+            uint8_t c;
+            if ( channel.read( &c, 1 ) ) {
+                if ( c != next_rx )
+                    ++sequence;
+                next_rx = c + 1;
+                ++received;
+                return true;
+            }
+            if ( sent < total && channel.tx_pending() < channel.buffer_size ) {     // putc would not block
+                channel.putc( next_tx++ );
+                ++sent;
+                return true;
+            }
+            return false;
+        }
+    };
+
+    struct scenario {
+        const char * name;
+        int ports;              // USART1 (PCLK2 72MHz), USART2, USART3 (PCLK1 36MHz)
+        uint32_t masked;        // longest higher priority section, cycles
+        uint32_t stall;         // longest thread mode stall, cycles
+        bool expect_loss;
+    };
+
+    int
+    run( const scenario& sc, bool verbose )
+    {
+        port p1( "USART1", 72000000, 921600 ), p2( "USART2", 36000000, 921600 ), p3( "USART3", 36000000, 921600 );
+        port * ports[] = { &p2, &p3, &p1 };
+        const uint64_t total = 20000;   // bytes per port, each way
+        std::mt19937 rng( 11 );
+
+        uint64_t cpu_free = 0;          // ISR or masked section until then
+        uint64_t thread_resume = 0;
+        uint64_t next_mask = 1000;
+        uint64_t isr_busy = 0;
+        uint64_t now = 1;
+
+        auto done = [&]{
+            for ( int i = 0; i < sc.ports; ++i )
+                if ( ports[ i ]->received + ports[ i ]->channel.rx_dropped() + ports[ i ]->l.overrun < total )
+                    return false;
+            return true;
+        };
+
+        for ( ; !done() && now < 100 * total * 800; ++now ) {
+            for ( int i = 0; i < sc.ports; ++i )
+                ports[ i ]->l.clock( now );
+
+            if ( now < cpu_free )
+                continue;
+
+            if ( now >= next_mask && sc.masked ) {          // a higher priority interrupt
+                cpu_free = now + 1 + rng() % sc.masked;
+                next_mask = now + 2000 + rng() % 20000;
+                continue;
+            }
+
+            bool served = false;
+            for ( int i = 0; i < sc.ports && !served; ++i ) {
+                if ( ports[ i ]->l.interrupt_pending() ) {
+                    ports[ i ]->interrupt();
+                    cpu_free = now + isr_cycles;
+                    isr_busy += isr_cycles;
+                    served = true;
+                }
+            }
+            if ( served || now < thread_resume )
+                continue;
+
+            bool moved = false;
+            for ( int i = 0; i < sc.ports; ++i )
+                moved = ports[ i ]->service( total ) || moved;
+            if ( moved )
+                cpu_free = now + byte_thread_cycles;   // interrupts preempt in between bytes
+            else
+                thread_resume = now + ( sc.stall ? rng() % sc.stall : 0 );
+        }
+
+        int failures = 0;
+        bool lost = false;
+        for ( int i = 0; i < sc.ports; ++i ) {
+            auto& p = *ports[ i ];
+            const uint32_t dropped = p.channel.rx_dropped(), overrun = p.l.overrun;
+            const double utilization = double( p.l.busy ) / double( p.l.last_end - p.l.first_start );
+            const bool ok = p.received == total && overrun == 0 && dropped == 0 && p.sequence == 0 && utilization > 0.99;
+            lost = lost || overrun || dropped;
+            if ( !sc.expect_loss && !ok )
+                ++failures;
+            if ( overrun + dropped + p.received != total || ( p.sequence && !( overrun + dropped ) ) )
+                ++failures;                     // a loss that is not counted, or a corrupted byte
+            if ( ( overrun != 0 ) != ( p.channel.rx_overrun() != 0 ) )
+                ++failures;                     // ORE not seen by the driver
+            if ( verbose || ( !sc.expect_loss && !ok ) )
+                std::printf( "  %s: %llu byte cycles, received %llu/%llu, overrun %u (ORE %u), dropped %u, sequence %u, line %.1f%%, rx ring max %zu\n"
+                             , p.name, (unsigned long long)p.l.byte_cycles, (unsigned long long)p.received, (unsigned long long)total
+                             , overrun, p.channel.rx_overrun(), dropped, p.sequence, utilization * 100, p.max_rx );
+        }
+        if ( sc.expect_loss && !lost )
+            ++failures;
+        std::printf( "%-52s cpu in isr %4.1f%%: %s\n", sc.name, 100.0 * isr_busy / now, failures ? "FAIL" : "OK" );
+        return failures;
+    }
+
+    const char * policy_name( overflow_policy policy ) {
+        return policy == overflow_block ? "block" : policy == overflow_drop_newest ? "drop newest" : "drop oldest";
+    }
+
+    // the interrupt, unmasked again, sends what is left
+    template< typename channel_type >
+    void
+    drain( line& l, channel_type& channel )
+    {
+        for ( uint64_t n = 0; n < 100 * channel.buffer_size * l.byte_cycles; ++n ) {
+            l.clock( ++l.now );
+            if ( l.interrupt_pending() )
+                channel.handle_interrupt();
+        }
+    }
+
+    int
+    overflow( overflow_policy policy, bool verbose )
+    {
+        line l( 36000000, 921600 );
+        uart_channel< USART, no_mask > channel( &l.regs );
+        channel.set_overflow_policy( policy );
+        constexpr size_t count = 600, size = uart_channel< USART, no_mask >::buffer_size;
+
+        l.polled = true;                        // USART interrupt masked: putc can only poll
+        for ( size_t i = 0; i < count; ++i )
+            channel.putc( int( i ) );
+        l.polled = false;
+        drain( l, channel );
+        l.polled = true;
+        channel.flush();
+
+        std::vector< uint8_t > expect;
+        for ( size_t i = policy == overflow_drop_oldest ? count - size : 0; i < ( policy == overflow_drop_newest ? size : count ); ++i )
+            expect.push_back( uint8_t( i ) );
+        const uint32_t dropped = policy == overflow_block ? 0 : count - size;
+        const uint32_t blocked = policy == overflow_block ? count - size : 0;
+
+        const bool ok = l.wire == expect && channel.tx_dropped() == dropped && channel.tx_blocked() == blocked && channel.tx_pending() == 0;
+        if ( verbose || !ok )
+            std::printf( "  sent %zu of %zu, dropped %u, blocked %u, %llu polls\n"
+                         , l.wire.size(), count, channel.tx_dropped(), channel.tx_blocked(), (unsigned long long)l.polls );
+        std::printf( "%-52s %s\n", ( std::string( "overflow, " ) + policy_name( policy ) ).c_str(), ok ? "OK" : "FAIL" );
+        return ok ? 0 : 1;
+    }
+
+    // a byte of the transmit ring whose store into its slot lets an interrupt in
+    struct preemptible_byte {
+        uint8_t value;
+        static std::function< void() > preempt;
+
+        preemptible_byte( int c = 0 ) : value( uint8_t( c ) ) {}
+        preemptible_byte( const preemptible_byte& ) = default;
+        preemptible_byte& operator = ( const preemptible_byte& t ) {
+            value = t.value;
+            if ( auto isr = std::exchange( preempt, nullptr ) )
+                isr();
+            return *this;
+        }
+        operator uint8_t () const { return value; }
+    };
+    std::function< void() > preemptible_byte::preempt;
+
+    int
+    nested( overflow_policy policy, bool verbose )
+    {
+        line l( 36000000, 921600 );
+        uart_channel< USART, no_mask, preemptible_byte > channel( &l.regs );
+        channel.set_overflow_policy( policy );
+        constexpr size_t count = 300, size = uart_channel< USART, no_mask >::buffer_size;
+
+        bool returned = false;
+        preemptible_byte::preempt = [&]{
+            l.polled = true;                    // the USART interrupt is below us
+            for ( size_t i = 0; i < count; ++i )
+                channel.putc( int( i ) );
+            channel.flush();
+            l.polled = false;
+            returned = true;
+        };
+        channel.putc( 0xee );                   // thread mode
+        drain( l, channel );
+
+        std::vector< uint8_t > expect( 1, 0xee );
+        for ( size_t i = 0; i < size - 1; ++i ) // the slots the preempted putc did not hold
+            expect.push_back( uint8_t( i ) );
+        const uint32_t dropped = count - ( size - 1 );
+        const uint32_t blocked = policy == overflow_block ? dropped : 0;
+
+        const bool ok = returned && l.wire == expect && channel.tx_dropped() == dropped && channel.tx_blocked() == blocked;
+        if ( verbose || !ok )
+            std::printf( "  sent %zu, dropped %u, blocked %u, %llu polls\n"
+                         , l.wire.size(), channel.tx_dropped(), channel.tx_blocked(), (unsigned long long)l.polls );
+        std::printf( "%-52s %s\n", ( std::string( "preempted putc, " ) + policy_name( policy ) ).c_str(), ok ? "OK" : "FAIL" );
+        return ok ? 0 : 1;
+    }
+}
+
+int
+main( int argc, char ** argv )
+{
+    const bool verbose = argc > 1 && std::strcmp( argv[ 1 ], "-v" ) == 0;
+
+    // 921600 baud is 780 CPU cycles a byte; the rings hide 256 of them, 2.77ms
+    const scenario scenarios[] = {
+        { "USART2+3, 4us masked, 1ms thread stall",          2,  300,  72000, false }
+        , { "USART1+2+3, 4us masked, 1ms thread stall",      3,  300,  72000, false }
+        , { "USART1+2+3, 9us masked, 2.5ms thread stall",    3,  650, 180000, false }
+        , { "USART2+3, 4ms thread stall (ring overflow)",    2,  300, 288000, true }
+        , { "USART2+3, 12us masked (overrun)",               2,  900,  72000, true }
+    };
+
+    int failures = 0, runs = 0;
+    for ( const auto& sc: scenarios ) {
+        failures += run( sc, verbose ) ? 1 : 0;
+        ++runs;
+    }
+    for ( auto policy: { overflow_block, overflow_drop_newest, overflow_drop_oldest } ) {
+        failures += overflow( policy, verbose );
+        failures += nested( policy, verbose );
+        runs += 2;
+    }
+    std::printf( "uart loopback: %d runs, %d failed\n", runs, failures );
+    return failures ? 1 : 0;
+}